@@ -0,0 +1,144 @@
+#!/bin/bash
+#
+# Benchmark the throughput and CPU cost of pv's transfer paths, writing one
+# tab-separated line of results per combination of transfer method, input
+# type, and output type, after a header line.
+#
+# Run from the build directory with "make bench", or directly, with these
+# optional environment variables:
+#
+#   pv=PATH            the pv binary to test (default ./pv, or "pv")
+#   BENCH_SIZE=BYTES   amount of data per run, in bytes (default 268435456)
+#   BENCH_DIR=DIR      where to put the temporary files (default $TMPDIR)
+#   BENCH_SYSCALLS=0   don't count system calls even if strace is available
+#
+# The columns are:
+#
+#   method      splice, readwrite (-C), linemode (-l), sparse (-O), or
+#               directio (-K)
+#   input       file, or pipe (from "cat")
+#   output      null (/dev/null), pipe (to "cat"), or file
+#   bytes       bytes transferred
+#   seconds     elapsed time
+#   gb_per_s    throughput, in 10^9 bytes per second
+#   cpu_per_gb  CPU seconds (user + system) used per 10^9 bytes, by pv and
+#               by any "cat" at either end
+#   calls_per_gb  system calls made by pv per 10^9 bytes, measured in a
+#               separate run under strace, or "-" if not measured
+#   p50_us      median time taken by the passes of the main loop that
+#   p99_us      wrote data, and its 99th percentile, from "--stats"
+#
+# The timings are only comparable between runs on the same host.
+#
+
+pv=${pv:-./pv}
+test -x "${pv}" || pv="pv"
+
+benchSize=${BENCH_SIZE:-268435456}
+benchDir=${BENCH_DIR:-${TMPDIR:-/tmp}}
+
+test_input=$(mktemp "${benchDir}/pvbench1XXXXXX") || exit 1
+test_output=$(mktemp "${benchDir}/pvbench2XXXXXX") || exit 1
+stats_output=$(mktemp "${benchDir}/pvbench3XXXXXX") || exit 1
+strace_output=$(mktemp "${benchDir}/pvbench4XXXXXX") || exit 1
+
+trap 'rm -f "${test_input}" "${test_output}" "${stats_output}" "${strace_output}"' EXIT
+
+countSyscalls=false
+if test "${BENCH_SYSCALLS}" != "0" && command -v strace >/dev/null 2>&1; then
+	countSyscalls=true
+fi
+
+# Text data, so that line mode has lines to count and the sparse output
+# check has to look at every block.
+yes "The quick brown fox jumps over the lazy dog, again and again." \
+| head -c "${benchSize}" > "${test_input}"
+
+# Current time in seconds, with fractions where possible.
+now() {
+	if test -n "${EPOCHREALTIME}"; then
+		echo "${EPOCHREALTIME}"
+	else
+		date +%s.%N
+	fi
+}
+
+# Run pv with the given options, with the input and output types in
+# ${input} and ${output}.  With STRACE set, run it under "strace -c".
+run_pv() {
+	local tracer
+	tracer=""
+	test -n "${STRACE}" && tracer="strace -f -c -o ${strace_output}"
+	case "${input}-${output}" in
+	file-null)	${tracer} "${pv}" "$@" "${test_input}" > /dev/null ;;
+	file-pipe)	${tracer} "${pv}" "$@" "${test_input}" | cat > /dev/null ;;
+	file-file)	${tracer} "${pv}" "$@" "${test_input}" > "${test_output}" ;;
+	pipe-null)	cat "${test_input}" | ${tracer} "${pv}" "$@" > /dev/null ;;
+	pipe-pipe)	cat "${test_input}" | ${tracer} "${pv}" "$@" | cat > /dev/null ;;
+	pipe-file)	cat "${test_input}" | ${tracer} "${pv}" "$@" > "${test_output}" ;;
+	esac
+}
+
+printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" \
+  method input output bytes seconds gb_per_s cpu_per_gb calls_per_gb p50_us p99_us
+
+for method in splice readwrite linemode sparse directio; do
+	case "${method}" in
+	splice)		options="" ;;
+	readwrite)	options="-C" ;;
+	linemode)	options="-l" ;;
+	sparse)		options="-O" ;;
+	directio)	options="-K" ;;
+	esac
+	for input in file pipe; do
+		for output in null pipe file; do
+			# Sparse output and direct I/O only apply to files.
+			case "${method}-${output}" in
+			sparse-null|sparse-pipe|directio-null|directio-pipe) continue ;;
+			esac
+
+			rm -f "${test_output}"
+
+			# "times" reports the CPU used by this subshell's
+			# children, which for the pipe cases includes "cat".
+			startTime=$(now)
+			cpuTimes=$(
+			  run_pv -q -v ${options} 2>"${stats_output}" >/dev/null
+			  times
+			)
+			endTime=$(now)
+			cpuTimes="${cpuTimes##*$'\n'}"
+
+			calls="-"
+			if ${countSyscalls}; then
+				STRACE=1 run_pv -q ${options} 2>/dev/null
+				calls=$(awk '$NF=="total"{print $(NF-2)}' "${strace_output}")
+				test -n "${calls}" || calls="-"
+			fi
+
+			awk -v method="${method}" -v input="${input}" -v output="${output}" \
+			    -v bytes="${benchSize}" -v start="${startTime}" -v end="${endTime}" \
+			    -v cpu="${cpuTimes}" -v calls="${calls}" '
+			  function seconds(t,   parts) {
+				split(t, parts, /[ms]/)
+				return parts[1] * 60 + parts[2]
+			  }
+			  /^chunk time p50\/p99 = / {
+				split($5, p, "/")
+				p50 = p[1]
+				p99 = p[2]
+			  }
+			  END {
+				elapsed = end - start
+				split(cpu, c, " ")
+				cpusec = seconds(c[1]) + seconds(c[2])
+				gb = bytes / 1000000000
+				if (calls != "-") calls = sprintf("%.0f", calls / gb)
+				if (p50 == "") { p50 = "-"; p99 = "-" }
+				printf "%s\t%s\t%s\t%d\t%.3f\t%.3f\t%.3f\t%s\t%s\t%s\n", \
+				  method, input, output, bytes, elapsed, \
+				  (elapsed > 0 ? gb / elapsed : 0), cpusec / gb, calls, p50, p99
+			  }' "${stats_output}"
+		done
+	done
+done
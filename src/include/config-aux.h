@@ -52,6 +52,32 @@ typedef bool _Bool;
 # endif
 #endif
 
+/* Whether "--query" can read a memory-mapped status page. */
+#undef PV_STATUS_PAGE
+#if defined(PV_REMOTE_CONTROL) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#define PV_STATUS_PAGE 1
+#endif
+
+/* Whether "--watchfd" can use pidfd_open() to notice processes exiting. */
+#undef PV_WATCHFD_PIDFD
+#if HAVE_DECL_SYS_PIDFD_OPEN && defined(HAVE_SYS_SYSCALL_H) && defined(HAVE_POLL) && defined(HAVE_POLL_H)
+#define PV_WATCHFD_PIDFD 1
+#endif
+
+/*
+ * Whether "--size @DIR" can add up the sizes of the files in a directory
+ * tree - with several threads, walking it in the background, or with
+ * nftw().
+ */
+#undef PV_DIRSIZE
+#undef PV_DIRSIZE_THREADED
+#if defined(HAVE_THREADS) && defined(HAVE_FDOPENDIR) && defined(HAVE_FSTATAT) && defined(HAVE_OPENAT)
+#define PV_DIRSIZE_THREADED 1
+#define PV_DIRSIZE 1
+#elif defined(HAVE_NFTW)
+#define PV_DIRSIZE 1
+#endif
+
 #ifndef SPLINT
 /* Remove __attribute__(()) if not using GCC. */
 #ifndef __GNUC__
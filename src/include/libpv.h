@@ -0,0 +1,179 @@
+/*
+ * libpv - the pv transfer engine, for use inside other programs.
+ *
+ * This lets a program copy data between two file descriptors, or write out
+ * a buffer it already holds, with the same rate limiting and progress
+ * measurement that pv provides, without running pv as a separate process
+ * and passing the data through an extra pipe.  Instead of a display on a
+ * terminal, progress is reported by calling a function given by the
+ * caller.
+ *
+ * Usage:
+ *
+ *   handle = libpv_new("myprogram");
+ *   libpv_set_rate_limit(handle, 1048576);
+ *   libpv_set_progress(handle, my_progress_function, my_data);
+ *   status = libpv_transfer_fd(handle, input_fd, output_fd);
+ *   libpv_free(handle);
+ *
+ * Notes:
+ *
+ *  - No signal handlers are installed, and no signals are used, so a
+ *    program writing to a pipe or socket should ignore SIGPIPE, as it
+ *    would for its own writes; a closed output then ends the transfer
+ *    normally instead of killing the program.
+ *  - The descriptors passed in are duplicated, so they stay open, and
+ *    their owner is responsible for closing them afterwards.
+ *  - Errors are reported on standard error, prefixed with the name given
+ *    to the last call to libpv_new(), as well as being flagged in the
+ *    return value.
+ *  - A handle can be used for any number of transfers, one at a time.
+ *    Separate handles may be used at the same time by different threads.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#ifndef _LIBPV_H
+#define _LIBPV_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bits of the value returned by the transfer functions, which is 0 on
+ * success; these are the same as the bits of pv's exit status.
+ */
+#define LIBPV_ERROR_ACCESS	2	/* the input could not be read */
+#define LIBPV_ERROR_OUROBOROS	4	/* the input is the same as the output */
+#define LIBPV_ERROR_TRANSITION	8	/* the descriptor could not be set up */
+#define LIBPV_ERROR_TRANSFER	16	/* a read or write failed */
+#define LIBPV_ERROR_STOPPED	32	/* stopped early by libpv_stop() */
+#define LIBPV_ERROR_MEMORY	64	/* memory allocation failed */
+
+/*
+ * Opaque handle, holding the settings for transfers.
+ */
+struct libpv_s;
+typedef struct libpv_s *libpv_t;
+
+/*
+ * Progress of a transfer, as passed to the progress function.  Amounts
+ * are in bytes, or in lines with libpv_set_line_mode(), and rates are in
+ * the same units per second.  Amounts are "long long" rather than off_t
+ * so that they don't depend on how the caller was built.
+ *
+ * New members will only ever be added to the end.
+ */
+struct libpv_progress_s {
+	double elapsed_seconds;		/* time since the transfer started */
+	long long transferred;		/* amount that has reached the output */
+	long long size;			/* expected total, or 0 if not known */
+	double transfer_rate;		/* rate over the last interval */
+	double average_rate;		/* rate averaged over recent intervals */
+	double rate_min;		/* slowest rate measured so far */
+	double rate_max;		/* fastest rate measured so far */
+	double percentage;		/* percentage complete, or -1 if size is 0 */
+	long eta_seconds;		/* estimated seconds left, or -1 if unknown */
+	unsigned long stalls;		/* number of intervals with nothing moving */
+	bool final;			/* set for the last call, at the end */
+};
+
+/*
+ * Function called every update interval during a transfer, and once more
+ * with "final" set when the transfer completes - but not if it was stopped
+ * by libpv_stop() or ended by an error.  It is called on the thread that is doing
+ * the transfer, which waits for it to return, so it should be quick; it
+ * may call libpv_stop() on the handle.
+ */
+typedef void (*libpv_progress_fn_t)(const struct libpv_progress_s *progress, void *userdata);
+
+/*
+ * Return a new handle, with "name" as the prefix for error messages (or
+ * "libpv" if it is NULL), or NULL if memory allocation failed.
+ */
+extern libpv_t libpv_new(const char *name);
+
+/*
+ * Free a handle.  It must not be in the middle of a transfer.
+ */
+extern void libpv_free(libpv_t handle);
+
+/*
+ * Limit the transfer rate to "rate" bytes (or lines) per second, or with
+ * 0, remove the limit.  This may be called from the progress function to
+ * change the limit during a transfer.
+ */
+extern void libpv_set_rate_limit(libpv_t handle, long long rate);
+
+/*
+ * Set the total amount expected, for the percentage and ETA.  If it is 0,
+ * which is the default, the size of the input is used where it can be
+ * found.
+ */
+extern void libpv_set_size(libpv_t handle, long long size);
+
+/*
+ * Stop the transfer once "size" bytes (or lines) have been written, if
+ * "stop" is true; the size must have been given with libpv_set_size().
+ */
+extern void libpv_set_stop_at_size(libpv_t handle, bool stop);
+
+/*
+ * Set the number of seconds between calls to the progress function; the
+ * default is 1, and it can be from 0.1 to 600.
+ */
+extern void libpv_set_interval(libpv_t handle, double seconds);
+
+/*
+ * Count lines instead of bytes, if "line_mode" is true.
+ */
+extern void libpv_set_line_mode(libpv_t handle, bool line_mode);
+
+/*
+ * Set the size of the transfer buffer in bytes, or 0 for the default.
+ */
+extern void libpv_set_buffer_size(libpv_t handle, size_t size);
+
+/*
+ * Set the function to call with the progress of each transfer, or NULL
+ * for none, and the pointer to pass to it.
+ */
+extern void libpv_set_progress(libpv_t handle, libpv_progress_fn_t fn, void *userdata);
+
+/*
+ * Copy everything from "input_fd" to "output_fd", returning 0 on success,
+ * or a combination of the LIBPV_ERROR_* bits.
+ */
+extern int libpv_transfer_fd(libpv_t handle, int input_fd, int output_fd);
+
+/*
+ * Write the "length" bytes at "buffer" to "output_fd", straight from the
+ * buffer without copying it, returning 0 on success, or a combination of
+ * the LIBPV_ERROR_* bits.  The buffer must not be changed until this
+ * returns.  The size defaults to "length".
+ */
+extern int libpv_transfer_buffer(libpv_t handle, const void *buffer, size_t length, int output_fd);
+
+/*
+ * Ask a transfer in progress to stop as soon as possible, in which case
+ * it returns with LIBPV_ERROR_STOPPED.  This may be called from the
+ * progress function, or from another thread.
+ */
+extern void libpv_stop(libpv_t handle);
+
+/*
+ * Return the version of pv that the library comes from, such as "1.11.0".
+ */
+extern const char *libpv_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* !_LIBPV_H */
@@ -56,6 +56,7 @@ typedef /*@null@*/ const char * argv_string;
 struct opts_s {
 	double interval;               /* interval between updates */
 	double delay_start;            /* delay before first display */
+	double metrics_interval;       /* interval between metrics records */
 	/*@keep@*/ const char *program_name; /* name the program is running as */
 	/*@keep@*/ /*@null@*/ char *output; /* fd to write output to */
 	/*@keep@*/ /*@null@*/ char *name;    /* display name, if any */
@@ -64,11 +65,16 @@ struct opts_s {
 	/*@keep@*/ /*@null@*/ char *format;  /* output format, if any */
 	/*@keep@*/ /*@null@*/ char *format1; /* first format, if two were given */
 	/*@keep@*/ /*@null@*/ char *pidfile; /* PID file, if any */
+	/*@keep@*/ /*@null@*/ char *rate_group; /* rate limit group, if any */
+	/*@keep@*/ /*@null@*/ char *metrics; /* metrics destination, if any */
 	/*@keep@*/ /*@null@*/ char *store_and_forward_file; /* store and forward file, if any */
+	/*@keep@*/ /*@null@*/ char *error_map; /* bad block map file, if any */
+	/*@keep@*/ /*@null@*/ char *size_directory; /* directory to total for "--size @DIR" */
 	/*@keep@*/ /*@null@*/ char *extra_display; /* extra display specifier, if any */
 	/*@keep@*/ /*@null@*/ pid_t *watchfd_pid;  /* array of processes to watch fds of */
 	/*@keep@*/ /*@null@*/ int *watchfd_fd;  /* array of fds to watch in each one (0=all) */
 	/*@keep@*/ /*@null@*/ argv_string *argv;   /* array of non-option arguments */
+	/*@keep@*/ /*@null@*/ argv_string *tee_outputs; /* array of extra outputs */
 	size_t lastwritten;            /* show N bytes last written */
 	off_t rate_limit;              /* rate limit, in bytes per second */
 	size_t buffer_size;            /* buffer size, in bytes (0=default) */
@@ -80,10 +86,16 @@ struct opts_s {
 	unsigned int average_rate_window; /* time window in seconds for average rate calculations */
 	unsigned int width;            /* screen width */
 	unsigned int height;           /* screen height */
+	unsigned int io_depth;         /* io_uring reads/writes in flight (0=default) */
+	unsigned int parallel;         /* --parallel copy threads (0=off) */
+	int numa_node;                 /* --numa-node for buffers (-1=local) */
 	unsigned int argc;             /* number of non-option arguments */
 	unsigned int argv_length;      /* allocated array size */
 	unsigned int watchfd_count;	       /* number of watchfd items */
 	unsigned int watchfd_length;	       /* allocated array size */
+	unsigned int tee_count;	       /* number of extra outputs */
+	unsigned int tee_length;	       /* allocated array size */
+	unsigned int hash_algorithms;  /* PV_HASH_* digests to work out */
 	pvaction_t action;	       /* the program action to perform */
 	pvside_t side;		       /* which side of the monitored command to monitor */
 	bool progress;                 /* progress bar flag */
@@ -98,6 +110,7 @@ struct opts_s {
 	bool bufpercent;               /* transfer buffer percentage flag */
 	bool force;                    /* force-if-not-terminal flag */
 	bool cursor;                   /* whether to use cursor positioning */
+	bool cursor_batch;             /* whether one instance draws all lines */
 	bool numeric;                  /* numeric output only */
 	bool wait;                     /* wait for transfer before display */
 	bool rate_gauge;               /* if size unknown, show rate vs max rate */
@@ -105,11 +118,20 @@ struct opts_s {
 	bool null_terminated_lines;    /* lines are null-terminated */
 	bool no_display;               /* do nothing other than pipe data */
 	bool no_splice;                /* flag set if never to use splice */
+	bool io_uring;                 /* set to use the io_uring engine */
+	bool threaded;                 /* set to read and write in separate threads */
+	bool huge_pages;               /* set to back buffers with huge pages */
+	bool lock_memory;              /* set to lock buffers into memory */
+	bool zero_copy;                /* set to use zero-copy sends to TCP sockets */
+	bool auto_buffer;              /* set to tune the buffer size while running */
 	bool stop_at_size;             /* set if we stop at "size" bytes */
 	bool sync_after_write;         /* set if we sync after every write */
 	bool direct_io;                /* set if O_DIRECT is to be used */
 	bool sparse_output;            /* set if we leave holes in the output */
 	bool discard_input;            /* set to write nothing to output */
+	bool tee_drop;                 /* set to drop extra outputs that fall behind */
+	bool overlap;                  /* set to forward while still storing (-U) */
+	bool merge;                    /* set to read all input files at once */
 	bool show_stats;	       /* set to write statistics at the end */
 	bool width_set_manually;       /* width was set manually, not detected */
 	bool height_set_manually;      /* height was set manually, not detected */
@@ -27,13 +27,59 @@ extern "C" {
 #define RATE_BURST_WINDOW	5	 	 /* rate burst window (multiples of rate) */
 #define REMOTE_INTERVAL		100000000	 /* nsec between checks for -R and -Q */
 #define MONITOR_EXCHANGE_INTERVAL 100000000	 /* nsec between "-M both" data exchanges */
+#define LOOP_WAIT_MAX		1000000		 /* max usec the main loop waits with nothing due */
+#define LOOP_WAIT_MIN		1000		 /* min usec the main loop waits for a timer */
+#define LOOP_UPDATE_SLACK_MAX	90000		 /* max usec a display update may be late by */
 #define BUFFER_SIZE		(size_t) 409600	 /* default transfer buffer size */
 #define BUFFER_SIZE_MAX		(size_t) 524288	 /* max auto transfer buffer size */
 #define MAX_READ_AT_ONCE	(size_t) 524288	 /* max to read() in one go */
 #define MAX_WRITE_AT_ONCE	(size_t) 524288	 /* max to write() in one go */
 #define TRANSFER_READ_TIMEOUT	0.09L		 /* seconds to time reads out at */
 #define TRANSFER_WRITE_TIMEOUT	0.9L		 /* seconds to time writes out at */
-#define MAX_LINE_POSITIONS	100000		 /* number of lines to remember positions of */
+#define PV_LINE_POSITIONS_MIN	(size_t) 1024	 /* line positions to make room for at first */
+#define PV_LINE_POSITIONS_WINDOW (size_t) 65536	 /* output pipe capacity, if it can't be found */
+#define PV_URING_MAX_DEPTH	32		 /* max io_uring reads, or writes, in flight */
+#define PV_URING_DEFAULT_DEPTH	4		 /* io_uring reads/writes in flight by default */
+#define PV_URING_QUEUE_DEPTH	64		 /* io_uring submission queue size */
+#define PV_URING_SLOT_SIZE	(size_t) 131072	 /* max bytes per io_uring read or write */
+#define PV_PIPELINE_SLOTS	8		 /* number of slots in the threaded pipeline ring */
+#define PV_PARALLEL_MAX_THREADS	64		 /* max --parallel copy threads */
+#define PV_PARALLEL_CHUNK_MIN	(size_t) 1048576 /* min bytes per --parallel copy chunk */
+#define PV_HUGE_PAGE_DEFAULT	(size_t) 2097152 /* huge page size, if it can't be found */
+#define PV_NUMA_MAX_NODE	1023		 /* highest --numa-node accepted */
+#define PV_ZEROCOPY_MIN_SEND	(size_t) 65536	 /* min bytes to send with MSG_ZEROCOPY */
+#define PV_ZEROCOPY_COPIED_LIMIT 64		 /* copied zero-copy sends before giving up */
+#define PV_LINECOUNT_THREADS	4		 /* max background line counting threads */
+#define PV_LINECOUNT_CHUNK	(size_t) 1048576 /* bytes per background line count read */
+#define PV_DIRSIZE_THREADS	8		 /* threads walking the tree for "--size @DIR" */
+#define PV_DIRSIZE_START_WAIT	100000000LL	 /* nsec to wait for it before starting in the background */
+#define PV_PREFETCH_BYTES	(off_t) 4194304	 /* bytes of the next input file to read ahead */
+#define PV_SPARSE_BLOCK_DEFAULT	(size_t) 4096	 /* sparse output block size if unknown */
+#define PV_SPARSE_BLOCK_MAX	(size_t) 1048576 /* max sparse output block size */
+#define PV_SPARSE_SKIP_MAX	(off_t) 1073741824 /* max input hole to skip in one go */
+#define PV_TEE_TAIL		(size_t) 2048	 /* bytes of each tee() copy looked at if not line mode */
+#define PV_FANOUT_MAX		16		 /* max number of --tee outputs */
+#define PV_FANOUT_BACKLOG_MIN	(size_t) 1048576 /* min bytes held back for a slow --tee output */
+#define PV_MERGE_MAX		16		 /* max number of input files with --merge */
+#define PV_HASH_MAX		3		 /* number of --hash digest algorithms */
+#define PV_HASH_RING_SIZE	(size_t) 4194304 /* bytes of written data queued for hashing */
+#define PV_HASH_CHUNK		(size_t) 262144	 /* max bytes hashed before freeing ring space */
+#define PV_DIGEST_HEX_MAX	65		 /* longest digest in hex, plus terminator */
+#define PV_SPOOL_CHUNK		(size_t) 1048576 /* max bytes forwarded from the spool at once */
+#define PV_RESCUE_BLOCK_FIRST	(size_t) 65536	 /* --error-map first pass block size */
+#define PV_RESCUE_BLOCK_MIN	(size_t) 512	 /* --error-map smallest block size */
+#define PV_RESCUE_SAVE_INTERVAL	5000000000LL	 /* nanoseconds between --error-map saves */
+#define PV_AUTOTUNE_WINDOW	500000000	 /* nsec between --auto-buffer adjustments */
+#define PV_AUTOTUNE_BUFFER_MAX	(size_t) 16777216 /* max --auto-buffer transfer buffer size */
+#define PV_CHUNK_TIME_BUCKETS	40		 /* log2 histogram buckets for --stats chunk times */
+#define PV_RATE_SUBBUCKET_BITS	3		 /* each power of 2 of rate histogram split 2^N ways */
+#define PV_RATE_BUCKETS		(1 + (48 << PV_RATE_SUBBUCKET_BITS)) /* rate histogram buckets, 0 to 2^48/s */
+#define PV_IO_SIZE_BUCKETS	32		 /* log2 histogram buckets for read and write sizes */
+#define PV_BOTTLENECK_WINDOW	1.0		 /* seconds over which %{bottleneck} is measured */
+#define PV_BOTTLENECK_THRESHOLD	0.1		 /* min fraction of time waiting to be a bottleneck */
+#define PV_METRICS_RECORD_MAX	1024		 /* max size of one --metrics record */
+#define PV_METRICS_FINAL_WAIT	1000000000LL	 /* nanoseconds to wait to send the final --metrics record */
+#define PV_STATUSPAGE_MAGIC	0x70767370	 /* "pvsp", start of a --query status page */
 
 #define MAXIMISE_BUFFER_FILL	1
 
@@ -44,11 +90,35 @@ extern "C" {
 #define PV_FORMAT_ARRAY_MAX		100
 #define PV_SIZEOF_FORMAT_SEGMENTS_BUF	4096
 #define PV_SIZEOF_CRS_LOCK_FILE		1024
+#define PV_SIZEOF_CRS_SLOT_LINE		2048	/* max bytes of one --cursor-batch line */
+#define PV_CRS_SLOTS_MAX		64	/* max instances drawn by a --cursor-batch owner */
+#define PV_SIZEOF_STATUSPAGE_FILE	4096
 
-#define PV_SIZEOF_FILE_FDINFO		4096
-#define PV_SIZEOF_FILE_FD		4096
-#define PV_SIZEOF_FILE_FDPATH		4096
+#define PV_SIZEOF_FILE_FD		64	/* "/proc/PID/fdinfo/FD" paths */
+#define PV_SIZEOF_FILE_FDPATH		4096	/* buffer for readlink() of those */
 #define PV_SIZEOF_DISPLAY_NAME		512
+#define PV_SIZEOF_FDINFO_CONTENT	512	/* how much of an fdinfo file to read */
+
+/*
+ * How often to check with stat() and lstat() whether a watched fd has
+ * changed, in seconds, when its fdinfo shows its inode so that each read of
+ * its position can detect most changes by itself.
+ */
+#define PV_WATCHFD_STAT_INTERVAL	5
+
+/*
+ * At most 1/PV_WATCHFD_FDINFO_SHARE of the descriptor limit is used to hold
+ * /proc/PID/fdinfo/FD files open with --watchfd; beyond that, and if the
+ * limit is reached anyway, each fdinfo file is opened just for one read.
+ */
+#define PV_WATCHFD_FDINFO_SHARE		2
+
+/*
+ * How often to rescan the fds of a whole process being watched with
+ * --watchfd, in seconds, when the fd count shown by stat() on /proc/PID/fd
+ * hasn't changed and none of its watched fds have closed.
+ */
+#define PV_WATCHPID_RESCAN_INTERVAL	5
 
 #define PV_BARSTYLE_MAX			4	/* number of different styles allowed in a format */
 #define PV_BARSTYLE_SIZEOF_STRING	10	/* max length of a bar constituent component in bytes */
@@ -58,6 +128,104 @@ extern "C" {
 #define PV_DISPLAY_PROCESSTITLE		2
 
 
+#ifdef HAVE_IO_URING
+/*
+ * Opaque io_uring instance, managed by the functions in uring.c.
+ */
+struct pvuring_s;
+typedef struct pvuring_s *pvuring_t;
+#endif				/* HAVE_IO_URING */
+
+#ifdef HAVE_THREADS
+/*
+ * Opaque threaded reader/writer pipeline, managed by pipeline.c.
+ */
+struct pvpipeline_s;
+typedef struct pvpipeline_s *pvpipeline_t;
+
+/*
+ * Opaque parallel chunked copy, managed by parallel.c.
+ */
+struct pvparallel_s;
+typedef struct pvparallel_s *pvparallel_t;
+
+/*
+ * Opaque background line counter, managed by linecount.c.
+ */
+struct pvlinecount_s;
+typedef struct pvlinecount_s *pvlinecount_t;
+#endif				/* HAVE_THREADS */
+
+/*
+ * Opaque directory tree walk for "--size @DIR", managed by dirsize.c.
+ */
+struct pvdirsize_s;
+typedef struct pvdirsize_s *pvdirsize_t;
+
+/*
+ * Opaque open-ahead of the next input file, managed by file.c.
+ */
+struct pvprefetch_s;
+typedef struct pvprefetch_s *pvprefetch_t;
+
+/*
+ * Opaque set of running --hash digests, managed by hash.c.
+ */
+struct pvhash_s;
+typedef struct pvhash_s *pvhash_t;
+
+/*
+ * Opaque forwarding state for --overlap, managed by spool.c.
+ */
+struct pvspool_s;
+typedef struct pvspool_s *pvspool_t;
+
+/*
+ * Opaque bad block map for --error-map, managed by rescue.c.
+ */
+struct pvrescue_s;
+typedef struct pvrescue_s *pvrescue_t;
+
+/*
+ * How a buffer from pv_buffer_alloc() was allocated (see memory.c), so
+ * that pv_buffer_free() can undo it, and --stats can report it.
+ */
+struct pvbuffermem_s {
+	size_t size;			/* bytes allocated, in whole pages */
+	size_t page_size;		/* size of the pages it was sized in */
+	int node;			/* NUMA node it is bound to, or -1 */
+	bool mapped;			/* set if from mmap(), not posix_memalign() */
+	bool hugetlb;			/* set if from the reserved huge page pool */
+	bool thp;			/* set if advised to use transparent huge pages */
+	bool locked;			/* set if locked into memory with mlock() */
+};
+
+/*
+ * Running state of one --hash digest (see digest.c).  The block
+ * algorithms keep any partial block in "block" until the rest of it is
+ * added.
+ */
+struct pvdigest_s {
+	union {
+		uint32_t crc32c;
+		uint64_t xxh64[4];
+		uint32_t sha256[8];
+	} value;
+	unsigned char block[64];		/* partial block not yet added */
+	uint64_t total;				/* bytes added so far */
+	size_t block_bytes;			/* bytes held in "block" */
+	unsigned int algorithm;			/* PV_HASH_* value */
+};
+
+/*
+ * Extra output given with --tee, and input read at the same time as the
+ * others with --merge, defined in full further down.
+ */
+struct pvfanoutput_s;
+typedef /*@null@*/ struct pvfanoutput_s *pvfanoutput_t;
+struct pvmergeinput_s;
+typedef /*@null@*/ struct pvmergeinput_s *pvmergeinput_t;
+
 /*
  * Structure for data shared between multiple "pv -c" instances.
  */
@@ -66,6 +234,55 @@ struct pvipccursorstate_s {
 	bool tty_tostop_added;	/* whether any instance had to set TOSTOP on the terminal */
 };
 
+/*
+ * Structure for data shared between "pv --cursor-batch" instances, one of
+ * which - the owner - draws the lines that all of them publish in their
+ * slots.  Each slot's "sequence" is odd while its line is being changed.
+ */
+struct pvipccursorbatch_s {
+	struct pvipccursorstate_s common;	/* must be first - see cursor->shared */
+	pid_t owner;			/* process drawing all the lines, 0 if none */
+	unsigned int slots_used;	/* number of instances that have attached */
+	struct pvipccursorslot_s {
+		uint32_t sequence;	/* incremented before and after each change */
+		pid_t pid;		/* process publishing in this slot */
+		uint32_t length;	/* bytes of "line" in use */
+		bool finished;		/* set once the process has finished */
+		char line[PV_SIZEOF_CRS_SLOT_LINE];	/* latest display line */
+	} slot[PV_CRS_SLOTS_MAX];
+};
+
+/*
+ * Structure for data shared between the members of a rate limit group.
+ */
+struct pvipcrategroup_s {
+	long double tokens;		/* amount that may be sent */
+	struct timespec last_refill;	/* when tokens were last added */
+	struct timespec tick_start;	/* start of current draw counting interval */
+	off_t rate_limit;		/* group rate limit, per second */
+	unsigned long generation;	/* incremented when rate_limit changes */
+	unsigned int draws_this_tick;	/* members drawing in this interval */
+	unsigned int draws_last_tick;	/* members drawing in the last interval */
+	bool initialised;		/* set once the first member has set up */
+};
+
+/*
+ * Structure of the status page that a transferring "pv" keeps up to date in
+ * a memory-mapped file, so that "pv --query" can read it without sending a
+ * signal.  The writer makes "sequence" odd while it changes the fields
+ * after it, and even again afterwards; a reader copies the fields and
+ * retries if "sequence" was odd or changed in the meantime.
+ */
+struct pvstatuspage_s {
+	uint32_t magic;			/* PV_STATUSPAGE_MAGIC */
+	uint32_t struct_size;		/* sizeof(struct pvstatuspage_s) */
+	uint32_t sequence;		/* odd while being updated */
+	pid_t pid;			/* process ID of the writer */
+	long double elapsed_seconds;	/* from state.transfer */
+	off_t transferred;		/* from state.transfer */
+	off_t size;			/* from state.control */
+};
+
 /*
  * Types of transfer count - bytes, decimal bytes or lines.
  */
@@ -138,6 +355,11 @@ typedef uint16_t pvdisplay_width_t;
 struct pvwatchfd_s;
 typedef /*@null@*/ struct pvwatchfd_s *pvwatchfd_t;
 
+/*
+ * Parameters passed to formatter functions, defined in full further down.
+ */
+struct pvformatter_args_s;
+
 /* String pointer, that is the only pointer to this resource, that can be null. */
 typedef /*@only@*/ /*@null@*/ char * nullable_string_t;
 
@@ -165,6 +387,14 @@ struct pvstate_s {
 	struct pvinputfiles_s {
 		/*@only@*/ /*@null@*/ nullable_string_t *filename; /* input filenames */
 		unsigned int file_count;	 /* number of input files */
+		int input_fd;			 /* descriptor read for "-", or -1 for stdin */
+		/*@dependent@*/ /*@null@*/ const char *buffer; /* libpv input buffer, instead of files */
+		size_t buffer_length;		 /* size of the libpv input buffer */
+		/*@null@*/ /*@only@*/ pvprefetch_t prefetch; /* next input file, opened ahead */
+#ifdef HAVE_THREADS
+		/*@null@*/ /*@only@*/ pvlinecount_t linecount; /* line count running in the background */
+#endif				/* HAVE_THREADS */
+		/*@null@*/ /*@only@*/ pvdirsize_t dirsize; /* "--size @DIR" walk running in the background */
 	} files;
 
 	/*********************************
@@ -177,6 +407,11 @@ struct pvstate_s {
 			int fd;			 /* watched fd, or -1 for all */
 			pvwatchfd_t info_array;	 /* watch information for each fd */
 			int array_length;	 /* length of watch info array */
+			struct timespec next_scan;	/* when to rescan the PID's fds anyway */
+			off_t fd_count;		 /* PID's fd count at last scan, or 0 */
+			int pidfd;		 /* pidfd_open() descriptor of the PID */
+			bool pidfd_open;	 /* true if pidfd is open */
+			bool rescan;		 /* true to rescan on the next update */
 			bool finished;		 /* "PID:FD": fd closed; or PID gone */
 		} *watching;
 		unsigned int count;	/* number of items in these arrays */
@@ -196,15 +431,21 @@ struct pvstate_s {
 		/*@only@*/ /*@null@*/ char *extra_format_string; /* extra format string alone */
 		/*@null@*/ char *output_name;    /* name of the output, for diagnostics */
 		/*@null@*/ char *default_bar_style; /* which bar style to use by default */
+		/*@only@*/ /*@null@*/ char *rate_group;	 /* name of rate limit group to join */
+		/*@only@*/ /*@null@*/ char *metrics_dest;	 /* where to write --metrics records */
+		double metrics_interval;         /* interval between --metrics records */
 		off_t error_skip_block;          /* skip block size, 0 for adaptive */
 		off_t rate_limit;                /* rate limit, in bytes per second */
 		size_t target_buffer_size;       /* buffer size (0=default) */
 		off_t size;                      /* total size of data */
 		unsigned int skip_errors;        /* skip read errors counter */
+		unsigned int hash_algorithms;    /* PV_HASH_* digests to work out */
 		int output_fd;                   /* fd to write output to */
 		pid_t othermonitor_pid;		 /* pid of the other monitor, in "-M both" mode */
 		int othermonitor_read_fd;	 /* fd to read transfer counts from other monitor */
 		int othermonitor_write_fd;	 /* fd to write transfer counts to other monitor */
+		/*@null@*/ /*@dependent@*/ volatile off_t *othermonitor_own_count; /* shared count to store ours in */
+		/*@null@*/ /*@dependent@*/ const volatile off_t *othermonitor_other_count; /* other monitor's shared count */
 		unsigned int average_rate_window; /* time window in seconds for average rate calculations */
 		unsigned int history_interval;	 /* seconds between each average rate calc history entry */
 		pvdisplay_width_t width;         /* screen width */
@@ -213,6 +454,8 @@ struct pvstate_s {
 		pvformatoptions_s format_option; /* old-style format options (used by -R) */
 		bool force;                      /* display even if not on terminal */
 		bool cursor;                     /* use cursor positioning */
+		bool cursor_batch;               /* let one instance draw all lines */
+		bool merge_inputs;               /* read all input files at once */
 		bool numeric;                    /* numeric output only */
 		bool wait;                       /* wait for data before display */
 		bool rate_gauge;                 /* if size unknown, show rate vs max rate */
@@ -223,12 +466,25 @@ struct pvstate_s {
 		bool no_display;                 /* do nothing other than pipe data */
 		bool no_splice;                  /* never use splice() */
 		bool stop_at_size;               /* set if we stop at "size" bytes */
+		bool size_estimated;             /* set while "size" is only an estimate */
 		bool sync_after_write;           /* set if we sync after every write */
 		bool direct_io;                  /* set if O_DIRECT is to be used */
 		bool direct_io_changed;          /* set when direct_io is changed */
 		bool sparse_output;		 /* set if we leave holes in the output */
 		bool discard_input;              /* write nothing to stdout */
 		bool show_stats;		 /* show statistics on exit */
+		bool io_uring;			 /* use the io_uring transfer engine */
+		unsigned int io_depth;		 /* io_uring reads/writes in flight, 0=default */
+		bool threaded;			 /* use separate reader and writer threads */
+		unsigned int parallel;		 /* --parallel copy threads, 0=off */
+		int numa_node;			 /* --numa-node for buffers, -1=local */
+		bool huge_pages;		 /* back buffers with huge pages */
+		bool lock_memory;		 /* lock buffers into memory */
+		bool zero_copy;			 /* use MSG_ZEROCOPY for TCP outputs */
+		bool embedded;			 /* running inside another program (libpv) */
+		/*@null@*/ pvprogress_fn_t progress_fn; /* called at each update, or NULL */
+		/*@dependent@*/ /*@null@*/ void *progress_userdata; /* passed to progress_fn */
+		bool auto_buffer;		 /* tune the buffer size while running */
 		bool width_set_manually;	 /* width was set manually, not detected */
 		bool height_set_manually;	 /* height was set manually, not detected */
 	} control;
@@ -284,6 +540,8 @@ struct pvstate_s {
 			/*@dependent@*/ /*@null@*/ const char *string_parameter; /* parameter after colon in %{x:} */
 			pvdisplay_bytecount_t string_parameter_bytes;	/* number of bytes in string_parameter */
 			pvdisplay_component_t type;	/* component type, -1 for static string */
+			/*@null@*/ pvdisplay_bytecount_t (*function)(struct pvformatter_args_s *);	/* formatter */
+			bool fixed_width;		/* whether it is formatted in the first pass */
 			int8_t parameter;		/* component parameter, such as bar style index */
 			pvdisplay_width_t chosen_size;	/* "n" from %<n>A, or 0 */
 			pvdisplay_bytecount_t offset;	/* start offset of this segment in the build buffer */
@@ -302,6 +560,8 @@ struct pvstate_s {
 		char next_line[PV_SIZEOF_PREVLINE_BUFFER];
 
 		/*@only@*/ /*@null@*/ char *display_buffer;	/* buffer for display string */
+		/*@only@*/ /*@null@*/ char *shown_buffer;	/* copy of what the terminal line shows */
+		/*@only@*/ /*@null@*/ char *update_buffer;	/* changes to send to the terminal */
 		off_t initial_offset;			 /* offset when first opened (when watching fds) */
 		size_t next_line_len;				 /* length of currently receiving line so far */
 
@@ -315,6 +575,11 @@ struct pvstate_s {
 		pvdisplay_bytecount_t display_string_bytes;	/* byte length of string in display buffer */
 		pvdisplay_width_t display_string_width;		/* displayed width of string in display buffer */
 		pvdisplay_bytecount_t lastwritten_bytes;	 /* largest number of last-written bytes to show */
+		pvdisplay_bytecount_t shown_buffer_size;	 /* size allocated to shown_buffer and update_buffer */
+		pvdisplay_bytecount_t shown_bytes;		 /* byte length of string in shown_buffer */
+		unsigned long shown_interruptions;		 /* pv_error() count when shown_buffer was written */
+		bool shown_valid;		 /* set if shown_buffer matches the terminal */
+		bool shown_on_tty;		 /* set if stderr is a terminal, when shown_buffer was allocated */
 
 		bool showing_timer;		 /* set if showing timer */
 		bool showing_bytes;		 /* set if showing byte/line count */
@@ -322,6 +587,22 @@ struct pvstate_s {
 		bool showing_rate;		 /* set if showing transfer rate */
 		bool showing_last_written;	 /* set if displaying the last few bytes written */
 		bool showing_previous_line;	 /* set if displaying the previously output line */
+		bool showing_bottleneck;	 /* set if showing time spent waiting */
+
+		/*
+		 * The fractions of time spent waiting for the input and
+		 * for the output, for %{bottleneck}, %{wait-in}, and
+		 * %{wait-out}, over the last PV_BOTTLENECK_WINDOW seconds;
+		 * the window started at bottleneck_window_start seconds,
+		 * when the wait totals were bottleneck_wait_in_start and
+		 * bottleneck_wait_out_start.
+		 */
+		long double bottleneck_window_start;
+		long double bottleneck_wait_in_start;
+		long double bottleneck_wait_out_start;
+		long double bottleneck_wait_in_fraction;
+		long double bottleneck_wait_out_fraction;
+		bool bottleneck_measured;	 /* set once a window has completed */
 
 		bool format_uses_colour;	 /* set if the format string uses colours */
 		bool colour_permitted;		 /* whether colour is permitted for this display */
@@ -352,9 +633,19 @@ struct pvstate_s {
 		long double ratesquared_sum;	 /* sum of the squares of each transfer rate */
 		unsigned long measurements_taken; /* how many times the rate was measured */
 
+		/*
+		 * Each measured rate is also counted in a histogram, for
+		 * percentiles (see calc.c); bucket 0 counts measurements
+		 * where nothing was transferred, and stall_count counts how
+		 * many separate times that happened.
+		 */
+		uint32_t rate_histogram[PV_RATE_BUCKETS];
+		unsigned long stall_count;	 /* number of runs of zero-rate measurements */
+		bool stalled;			 /* set if the last measured rate was zero */
+
 		/* Keep track of progress over last intervals to compute current average rate. */
 		/*@null@*/ struct {	 /* state at previous intervals (circular buffer) */
-			long double elapsed_sec;	/* time since start of transfer */
+			long long elapsed_ns;		/* time since start of transfer, 0 if unused */
 			off_t transferred;		/* amount transferred by that time */
 		} *history;
 		size_t history_len;		 /* total size of history array */
@@ -373,7 +664,13 @@ struct pvstate_s {
 		char lock_file[PV_SIZEOF_CRS_LOCK_FILE];
 #ifdef HAVE_IPC
 		/*@keep@*/ /*@null@*/ struct pvipccursorstate_s *shared; /* data shared between instances */
+		/*@dependent@*/ /*@null@*/ struct pvipccursorbatch_s *batch; /* same, with --cursor-batch */
+		/*@only@*/ /*@null@*/ char *paint_buffer; /* lines drawn by a --cursor-batch owner */
+		size_t paint_buffer_size;	 /* size of paint_buffer */
+		uint32_t painted_sequence[PV_CRS_SLOTS_MAX]; /* slot sequences last drawn */
 		int shmid;		 /* ID of our shared memory segment */
+		int slot;		 /* our --cursor-batch slot, -1 if none */
+		int painted_top;	 /* y_topmost last drawn at, 0 to redraw all */
 		int pvcount;		 /* number of `pv' processes in total */
 		int pvmax;		 /* highest number of `pv's seen */
 		int y_lastread;		 /* last value of _y_top seen */
@@ -388,6 +685,137 @@ struct pvstate_s {
 		bool disable;		 /* set if cursor positioning can't be used */
 	} cursor;
 
+	/**************************
+	 * Rate limit group state *
+	 **************************/
+	struct pvrategroupstate_s {
+		char lock_file[PV_SIZEOF_CRS_LOCK_FILE];
+#ifdef HAVE_IPC
+		/*@keep@*/ /*@null@*/ struct pvipcrategroup_s *shared; /* data shared between members */
+		int shmid;		 /* ID of the group's shared memory segment */
+#endif				/* HAVE_IPC */
+		int lock_fd;		 /* fd of group lock file, -1 if none open */
+		off_t limit_seen;	 /* rate limit when last checked against the group */
+		unsigned long generation_seen; /* group limit generation last seen */
+		bool joined;		 /* set once the group has been joined */
+	} rategroup;
+
+	/***************************************
+	 * Status page for --query (remote.c) *
+	 ***************************************/
+	struct pvstatuspagestate_s {
+		char filename[PV_SIZEOF_STATUSPAGE_FILE];	/* path of the mapped file */
+		/*@null@*/ /*@dependent@*/ volatile struct pvstatuspage_s *page; /* mapped page, or NULL */
+		int fd;			 /* fd of the file, read-locked while open, or -1 */
+	} statuspage;
+
+	/******************************
+	 * Metrics stream (--metrics) *
+	 ******************************/
+	/*
+	 * Records are written to "fd" every control.metrics_interval
+	 * seconds, independently of the display.  If "fd" is a socket, it
+	 * is non-blocking, so that a slow reader can't hold up the
+	 * transfer; the unwritten part of a record is kept in "pending"
+	 * and sent before anything else, and records that fall due while
+	 * part of one is still pending are dropped (see metrics.c) - except
+	 * for the final record, for which the destination is given up to
+	 * PV_METRICS_FINAL_WAIT to take what is pending and the record.
+	 */
+	struct pvmetricsstate_s {
+		char pending[PV_METRICS_RECORD_MAX];	/* unsent part of the last record */
+		struct timespec next_record;	 /* when the next record is due */
+		long double prev_elapsed;	 /* elapsed seconds at the last record */
+		off_t prev_transferred;		 /* amount transferred at the last record */
+		size_t pending_bytes;		 /* bytes in "pending" */
+		unsigned long records;		 /* number of records written */
+		unsigned long dropped;		 /* number of records dropped */
+		int fd;				 /* fd to write records to, -1 if none */
+		bool close_fd;			 /* set if "fd" was opened by us */
+		bool final_written;		 /* set once the final record is written */
+	} metrics;
+
+	/*****************************
+	 * Extra outputs from --tee *
+	 *****************************/
+	/*
+	 * Everything written to the main output is also written to each
+	 * of these.  Those that can't take it straight away keep it in a
+	 * backlog of their own (see fanout.c), so that the main output and
+	 * the other outputs aren't held up until the backlog gets too
+	 * big.
+	 */
+	struct pvfanoutstate_s {
+		/*@only@*/ /*@null@*/ pvfanoutput_t output;	/* array of outputs */
+		unsigned int count;		 /* number of outputs */
+		bool drop_slow;			 /* drop outputs that can't keep up */
+	} fanout;
+
+	/********************************
+	 * Inputs read at once, --merge *
+	 ********************************/
+	/*
+	 * All of the input files are open at once, and whichever have
+	 * data are read from in turn (see merge.c).  In line mode, each
+	 * input's partial last line is held back in "carry" until the rest
+	 * of it arrives, so that lines from different inputs don't get
+	 * mixed up.
+	 */
+	struct pvmergestate_s {
+		/*@only@*/ /*@null@*/ pvmergeinput_t input;	/* array of inputs */
+		unsigned int count;		 /* number of inputs */
+		unsigned int next;		 /* input to read from first next time */
+	} merge;
+
+	/**********************
+	 * Digests for --hash *
+	 **********************/
+	/*
+	 * What is written is hashed as it goes (see hash.c); once the
+	 * transfer ends, "finished" is set, and "hex" holds each digest in
+	 * the order of the PV_HASH_* values, with "text" holding all of
+	 * them separated by spaces, for %{digest}.
+	 */
+	struct pvhashstate_s {
+		/*@only@*/ /*@null@*/ pvhash_t engine;	/* running digests */
+		char hex[PV_HASH_MAX][PV_DIGEST_HEX_MAX];
+		char text[PV_HASH_MAX * PV_DIGEST_HEX_MAX];
+		bool finished;			 /* set once the digests are final */
+	} hash;
+
+	/******************************************************
+	 * Forwarding from the spool, for --store-and-forward *
+	 ******************************************************/
+	/*
+	 * With --overlap, the main output is the store-and-forward file,
+	 * and what lands in it is copied on to the real output while the
+	 * input is still being stored (see spool.c); "line" shows how far
+	 * that has got.
+	 */
+	struct pvspoolstate_s {
+		/*@only@*/ /*@null@*/ pvspool_t engine;	/* forwarding state */
+		/*@only@*/ /*@null@*/ char *output;	/* real output, NULL for stdout */
+		/*@only@*/ /*@null@*/ struct pvsubline_s *line;	/* progress line, and name */
+		int fd;				 /* spool, open for reading, -1 if none */
+	} spool;
+
+	/*********************************************
+	 * Multi-pass error skipping, for --error-map *
+	 *********************************************/
+	struct pvrescuestate_s {
+		/*@only@*/ /*@null@*/ char *filename;	/* map file, NULL if not used */
+		/*@dependent@*/ /*@null@*/ pvrescue_t map;	/* map, while pv_rescue_loop() runs */
+	} rescue;
+
+	/****************************************************************
+	 * Progress lines below the main one (--tee, --merge, --overlap) *
+	 ****************************************************************/
+	struct pvsublinesstate_s {
+		/*@only@*/ /*@null@*/ char *format_string;	/* format for the lines */
+		unsigned int lines_shown;	 /* number of lines on the terminal */
+		unsigned int width_shown;	 /* display width the lines were parsed for */
+	} sublines;
+
 	/*******************
 	 * Transfer state  *
 	 *******************/
@@ -409,14 +837,17 @@ struct pvstate_s {
 	struct pvtransferstate_s {
 		long double elapsed_seconds;	 /* how long we have been transferring data for */
 		/*@only@*/ /*@null@*/ char *transfer_buffer;	 /* data transfer buffer */
+		struct pvbuffermem_s buffer_mem; /* how transfer_buffer was allocated */
+		/*@dependent@*/ /*@null@*/ const char *digest;	 /* --hash digests, once known */
 		size_t buffer_size;		 /* size of buffer */
 		size_t read_position;		 /* amount of data in buffer */
 		size_t write_position;		 /* buffered data written */
 
 		ssize_t to_write;		 /* max to write this time around */
 		ssize_t written;		 /* bytes sent to stdout this time */
+		long wait_usec;			 /* max to wait for input or output, 0=default */
 
-		size_t written_but_not_consumed; /* bytes in the output pipe, unread */
+		size_t written_but_not_consumed; /* bytes in the output pipe or socket, unread */
 
 		off_t total_bytes_read;		 /* total bytes read */
 		off_t total_written;		 /* total bytes or lines written */
@@ -425,10 +856,11 @@ struct pvstate_s {
 		off_t otherside_transferred;	 /* amount transferred by the other side ("-M both") */
 
 		/* Keep track of line positions to backtrack written_but_not_consumed. */
-		/*@only@*/ /*@null@*/ off_t *line_positions; /* line separator write positions (circular buffer) */
+		/*@only@*/ /*@null@*/ uint32_t *line_positions; /* low 32 bits of separator positions (circular buffer) */
 		size_t line_positions_capacity;	 /* total size of line position array */
 		size_t line_positions_length;	 /* number of positions stored in array */
 		size_t line_positions_head;	 /* index to use for next position */
+		size_t line_positions_window;	 /* bytes of output to cover, 0 if not tracking */
 		off_t last_output_position;	 /* write position last sent to output */
 
 		/*
@@ -449,6 +881,29 @@ struct pvstate_s {
 		off_t read_errors_in_a_row;
 		int last_read_skip_fd;
 		/* read_error_warning_shown is defined below. */
+
+		/*
+		 * With O_DIRECT on a regular file or block device output,
+		 * writes must be a whole number of direct_block bytes at an
+		 * offset that is a multiple of it; direct_checked_fd is the
+		 * output this was worked out for (direct_block is 0 if the
+		 * output is not using O_DIRECT).  Anything that doesn't fit,
+		 * such as the tail end of the data, is written through the
+		 * page cache using direct_tail_fd, a second descriptor for
+		 * the same output without O_DIRECT - or, if that could not
+		 * be opened (direct_tail_failed), by briefly clearing
+		 * O_DIRECT on the output itself.
+		 *
+		 * Likewise direct_input_block is the block size for O_DIRECT
+		 * reads from direct_input_fd, which the read position is
+		 * kept in line with when the buffer is compacted.
+		 */
+		size_t direct_block;
+		size_t direct_input_block;
+		int direct_checked_fd;
+		int direct_input_fd;
+		int direct_tail_fd;
+		bool direct_tail_failed;
 #ifdef HAVE_SPLICE
 		/*
 		 * These variables are used to keep track of whether
@@ -459,8 +914,197 @@ struct pvstate_s {
 		 * time within pv_transfer().
 		 */
 		int splice_failed_fd;
+		/*
+		 * Similarly, copy_file_range() and sendfile() are tried
+		 * first when the input is a regular file and the output is
+		 * a regular file or a socket respectively - which of these
+		 * applies (offload_file_to_*) is worked out once per input
+		 * (offload_checked_fd), and each is disabled for the input
+		 * if it fails.  Using any of them sets splice_used.
+		 */
+		int copy_range_failed_fd;
+		int sendfile_failed_fd;
+		int offload_checked_fd;
+		bool offload_file_to_file;
+		bool offload_file_to_socket;
 		bool splice_used;
+#ifdef HAVE_TEE
+		/*
+		 * When line mode, the previous line, or the last bytes
+		 * written need to see the data, and the input is a pipe,
+		 * it is copied with tee() into a private pipe (tee_pipe)
+		 * while the original is spliced to the output, and the
+		 * copy is taken back out for the statistics - discarding
+		 * what isn't needed into tee_discard_fd (/dev/null).
+		 * "tee_pending" is the number of copied bytes not yet
+		 * spliced to the output, "tee_unconsumed" is the number
+		 * spliced whose copy hasn't been taken back out yet, and
+		 * tee_failed_fd is the input that tee() last failed on.
+		 */
+		int tee_pipe[2];
+		int tee_discard_fd;
+		int tee_failed_fd;
+		size_t tee_pending;
+		size_t tee_unconsumed;
+#endif				/* HAVE_TEE */
 #endif
+#ifdef HAVE_IO_URING
+		/*
+		 * When the io_uring engine is in use, "uring" is the ring,
+		 * and the uring_read_* arrays describe the reads that are
+		 * in flight into consecutive parts of the transfer buffer;
+		 * they are committed to read_position in order as they
+		 * complete.  The uring_write_* arrays do the same for the
+		 * writes in flight from consecutive parts of the buffer
+		 * starting at write_position, which are passed on to
+		 * pv__transfer_write_result() in order.
+		 *
+		 * uring_read_fd is the input the read bookkeeping refers
+		 * to, and uring_read_offset is where the next read starts
+		 * if that input is seekable (uring_read_seekable), in which
+		 * case the reads are issued at explicit offsets so that
+		 * they can run in parallel.  The same goes for the output
+		 * (uring_write_fd, uring_write_offset, and
+		 * uring_write_seekable), so that several writes can be in
+		 * flight at once to a regular file or block device.
+		 *
+		 * If the engine could not be started, or a read failed,
+		 * uring_failed is set, and once nothing is in flight the
+		 * normal select() and read()/write() path takes over - which
+		 * also means read errors are handled (and skipped) there.
+		 */
+		/*@null@*/ /*@only@*/ pvuring_t uring;
+		size_t uring_read_length[PV_URING_MAX_DEPTH];
+		long uring_read_result[PV_URING_MAX_DEPTH];
+		bool uring_read_done[PV_URING_MAX_DEPTH];
+		off_t uring_read_offset;
+		size_t uring_write_length[PV_URING_MAX_DEPTH];
+		long uring_write_result[PV_URING_MAX_DEPTH];
+		bool uring_write_done[PV_URING_MAX_DEPTH];
+		off_t uring_write_offset;
+		unsigned int uring_reads_queued;
+		unsigned int uring_reads_committed;
+		unsigned int uring_writes_queued;
+		unsigned int uring_writes_committed;
+		int uring_read_fd;
+		int uring_write_fd;
+		bool uring_read_seekable;
+		bool uring_read_stopped;	/* short read seen - discard the rest */
+		bool uring_read_eof;		/* end of input seen by a read */
+		bool uring_write_seekable;
+		bool uring_write_stopped;	/* short write seen - discard the rest */
+		bool uring_failed;
+#endif				/* HAVE_IO_URING */
+#ifdef HAVE_THREADS
+		/*
+		 * The threaded pipeline, if in use, owns the transfer
+		 * buffer while its threads are running.  If the threads
+		 * can't be started, pipeline_failed is set and the normal
+		 * path is used.
+		 */
+		/*@null@*/ /*@only@*/ pvpipeline_t pipeline;
+		bool pipeline_failed;
+		/*
+		 * With --parallel, parallel_fd is the input that
+		 * parallel_usable was last worked out for; it is cleared
+		 * once the copy of that input has finished, and if the
+		 * threads can't be started, parallel_failed is set.
+		 */
+		/*@null@*/ /*@only@*/ pvparallel_t parallel;
+		int parallel_fd;
+		bool parallel_usable;
+		bool parallel_failed;
+#endif				/* HAVE_THREADS */
+		/*
+		 * In sparse output mode, the output is written or skipped
+		 * in runs of whole output blocks of sparse_block_size bytes
+		 * (0 until worked out).  Where the input is a regular file
+		 * that supports SEEK_DATA and SEEK_HOLE (sparse_input_holes),
+		 * its holes are skipped without being read; sparse_input_fd
+		 * is the input this refers to, and sparse_data_end is where
+		 * the data region being read from it ends.
+		 */
+		size_t sparse_block_size;
+		off_t sparse_data_end;
+		int sparse_input_fd;
+		bool sparse_input_holes;
+		/*
+		 * With --auto-buffer, the amounts read and written and the
+		 * time spent waiting for each side are measured over a
+		 * window starting at autotune_window_start, and at the end
+		 * of each window control.target_buffer_size may be grown
+		 * or shrunk (see autotune.c).  The capacities of the input
+		 * and output pipes, if they are pipes, are raised to match
+		 * where allowed, and recorded for --stats.
+		 */
+		struct timespec autotune_window_start;
+		long double autotune_input_wait;	/* seconds spent waiting for input */
+		long double autotune_output_wait;	/* seconds spent waiting for output */
+		off_t autotune_read_bytes;
+		unsigned long autotune_reads;
+		size_t autotune_initial_size;	/* buffer size before any tuning */
+		size_t autotune_largest_size;	/* largest buffer size used */
+		unsigned int autotune_changes;	/* number of adjustments made */
+		int autotune_input_fd;		/* input whose pipe was last tuned */
+		int input_pipe_size;		/* tuned pipe capacities (0=not a pipe) */
+		int output_pipe_size;
+		bool autotune_output_checked;	/* set once the output pipe is tuned */
+		/*
+		 * Where epoll is available, the input and output are waited
+		 * for with a single epoll instance (epoll_fd), which is kept
+		 * for the whole transfer instead of being rebuilt for every
+		 * wait (see event.c).  Element 0 of epoll_watch_fd,
+		 * epoll_watch_events, and epoll_unpollable is the input,
+		 * and 1 is the output; epoll_watch_events is what the
+		 * descriptor is registered for (0 while it isn't being
+		 * waited for), and epoll_unpollable is set if it can't be
+		 * polled (such as a regular file), so is always ready.  If
+		 * epoll can't be used, epoll_failed is set and select() or
+		 * poll() are used instead.
+		 */
+		int epoll_fd;
+		int epoll_watch_fd[2];
+		unsigned int epoll_watch_events[2];
+		bool epoll_unpollable[2];
+		bool epoll_failed;
+		bool output_block_checked;	/* set once output_may_block is known */
+		bool output_may_block;		/* set if a write can wait for a reader */
+		/*
+		 * With --stats, the time taken by each call of pv_transfer()
+		 * that moved some data is counted in chunk_time_histogram,
+		 * where bucket N holds the calls that took from 2^N up to
+		 * 2^(N+1) nanoseconds.
+		 */
+		unsigned long chunk_time_histogram[PV_CHUNK_TIME_BUCKETS];
+		unsigned long chunk_count;	/* number of calls counted */
+		/*
+		 * With --stats, or when the display shows %{bottleneck},
+		 * %{wait-in}, or %{wait-out}, the time spent waiting for
+		 * the input to have data and for the output to accept it
+		 * is totalled, where waiting for the output includes the
+		 * time spent in write(); and the sizes of reads and writes
+		 * are counted in log2 histograms, where bucket N holds the
+		 * calls that moved from 2^N up to 2^(N+1) bytes (see
+		 * bottleneck.c).
+		 */
+		long double wait_input_seconds;
+		long double wait_output_seconds;
+		unsigned long read_size_histogram[PV_IO_SIZE_BUCKETS];
+		unsigned long write_size_histogram[PV_IO_SIZE_BUCKETS];
+		long double instrumented_since;	/* elapsed_seconds when measuring started */
+		bool instrumented;		/* set if the above are being measured */
+		bool buffer_pinned;		/* set while asynchronous I/O uses the buffer */
+		bool buffer_borrowed;		/* set if the buffer is the libpv input buffer */
+		/*
+		 * With --zero-copy, the count of MSG_ZEROCOPY sends made to
+		 * zerocopy_fd, and of those the kernel has said it is
+		 * finished with, and has had to copy anyway (see socket.c).
+		 */
+		int zerocopy_fd;		/* output checked for zero-copy, -1 if none */
+		bool zerocopy_usable;		/* set if zerocopy_fd takes MSG_ZEROCOPY */
+		unsigned long zerocopy_sent;
+		unsigned long zerocopy_completed;
+		unsigned long zerocopy_copied;
 		bool read_error_warning_shown;
 		bool output_not_seekable;	/* set if lseek() fails on output */
 	} transfer;
@@ -475,39 +1119,103 @@ typedef struct pvdisplay_s *pvdisplay_t;
 typedef struct pvdisplay_segment_s *pvdisplay_segment_t;
 typedef struct pvtransfercalc_s *pvtransfercalc_t;
 typedef struct pvcursorstate_s *pvcursorstate_t;
+typedef struct pvrategroupstate_s *pvrategroupstate_t;
+typedef struct pvstatuspagestate_s *pvstatuspagestate_t;
 typedef struct pvtransferstate_s *pvtransferstate_t;
 
 /*
- * Structure defining the current state of a single watched file descriptor.
- * The full definition needs to go here as it refers to sub-structures of
- * the main state, defined above.
+ * Display state of a watched file descriptor, only allocated for those
+ * that can be displayed.  The full definition needs to go here as it
+ * refers to sub-structures of the main state, defined above.
  */
-struct pvwatchfd_s {
+struct pvwatchfddisplay_s {
 	struct pvtransientflags_s flags;	/* transient flags */
 	struct pvtransferstate_s transfer;	/* transfer state */
 	struct pvtransfercalc_s calc;	 /* calculated transfer state */
 	struct pvdisplay_s display;	 /* display data */
-#ifdef __APPLE__
-#else
-	char file_fdinfo[PV_SIZEOF_FILE_FDINFO]; /* path to /proc fdinfo file */
-	char file_fd[PV_SIZEOF_FILE_FD];	 /* path to /proc fd symlink  */
-#endif
-	char file_fdpath[PV_SIZEOF_FILE_FDPATH]; /* path to file that was opened */
 	/*@keep@ */ char display_name[PV_SIZEOF_DISPLAY_NAME]; /* name to show on progress bar */
-	struct stat sb_fd;		 /* stat of fd symlink */
-	struct stat sb_fd_link;		 /* lstat of fd symlink */
+};
+
+/*
+ * Structure defining the current state of a single watched file
+ * descriptor.  These are kept in an array, one per fd, so they only hold
+ * what is looked at on every update; the display state, and the path of
+ * the file, are allocated separately, and only the stat() fields that are
+ * compared later are kept.
+ */
+struct pvwatchfd_s {
+#ifndef __APPLE__
+	struct timespec next_stat_check; /* when to next stat() the fd symlink */
+	unsigned long long fdinfo_ino;	 /* inode shown in fdinfo */
+	unsigned long fdinfo_mnt_id;	 /* mount ID shown in fdinfo */
+	unsigned int fdinfo_accmode;	 /* access mode from fdinfo flags */
+	int fdinfo_fd;			 /* fd open on /proc/PID/fdinfo/FD */
+	bool fdinfo_open;		 /* true if fdinfo_fd is open */
+	bool fdinfo_has_ino;		 /* true if fdinfo shows the inode */
+	bool fdinfo_recorded;		 /* true once the fdinfo_* fields are set */
+#endif
+	/*@only@*/ /*@null@*/ char *file_fdpath; /* path to file that was opened */
+	/*@only@*/ /*@null@*/ struct pvwatchfddisplay_s *shown; /* display state, if displayable */
 	off_t size;			 /* size of whole file, 0 if unknown */
 	off_t position;			 /* position last seen at */
 	struct timespec start_time;	 /* time we started watching the fd */
 	struct timespec end_time;	 /* time the fd was marked as closed */
 	struct timespec total_stoppage_time;	 /* total time spent stopped */
+	dev_t fd_dev;			 /* device of the file, from stat() */
+	ino_t fd_ino;			 /* inode of the file, from stat() */
+	mode_t fd_link_mode;		 /* mode of the fd symlink, from lstat() */
 	pid_t watch_pid;		 /* PID the fd belongs to */
 	int watch_fd;			 /* fd to watch */
+	int shown_row;			 /* display line it was last shown on */
 	bool closed;			 /* true once the fd is closed */
-	bool displayable;		 /* false if not displayable */
+	bool displayable;		 /* false if not displayable (no "shown") */
 	bool unused;			 /* true if free for re-use */
 };
 
+/*
+ * Structure for a progress line shown below the main one, for a --tee
+ * output or a --merge input.
+ */
+struct pvsubline_s {
+	struct pvtransientflags_s flags;	/* transient flags */
+	struct pvtransferstate_s transfer;	/* transfer state */
+	struct pvtransfercalc_s calc;	 /* calculated transfer state */
+	struct pvdisplay_s display;	 /* display data */
+	/*@only@*/ /*@null@*/ char *name;	 /* name to show */
+	off_t size;			 /* expected total, 0 if unknown */
+	off_t transferred;		 /* bytes, or lines in line mode, so far */
+};
+
+/*
+ * Structure for an extra output given with --tee.  The backlog is the
+ * data written to the main output that this one hasn't taken yet, held
+ * between "pending_start" and "pending_end" in "pending".
+ */
+struct pvfanoutput_s {
+	struct pvsubline_s line;	 /* progress line, and name */
+	/*@only@*/ /*@null@*/ char *pending; /* backlog buffer */
+	size_t pending_size;		 /* size of the backlog buffer */
+	size_t pending_start;		 /* offset of the first unwritten byte */
+	size_t pending_end;		 /* offset after the last unwritten byte */
+	int fd;				 /* fd of the output, -1 if not open */
+	bool finished;			 /* set once closed, or failed to open */
+};
+
+/*
+ * Structure for an input file read with --merge.  In line mode, "carry"
+ * holds the start of a line whose end hasn't been read yet.
+ */
+struct pvmergeinput_s {
+	struct pvsubline_s line;	 /* progress line, and name */
+	/*@only@*/ /*@null@*/ char *carry; /* partial line held back */
+	size_t carry_size;		 /* size of the carry buffer */
+	size_t carry_bytes;		 /* bytes held in the carry buffer */
+	unsigned int file_idx;		 /* index into the list of input files */
+	int fd;				 /* fd of the input, -1 if not open */
+	bool ready;			 /* set when found to have data waiting */
+	bool finished;			 /* set at end of file, or on error */
+};
+
 /*
  * Read-only counterparts to the above structure pointers, to be used in
  * function declarations where the function definitely shouldn't be altering
@@ -558,11 +1266,13 @@ void pv_error(char *, ...);
 
 int pv_main_loop(pvstate_t);
 void pv_calculate_transfer_rate(pvtransfercalc_t, readonly_pvtransferstate_t, readonly_pvcontrol_t, readonly_pvdisplay_t, bool);
+long double pv_calculate_rate_percentile(readonly_pvtransfercalc_t, long double);
 
 long pv_bound_long(long, long, long);
 long pv_seconds_remaining(const off_t, const off_t, const long double);
 void pv_si_prefix(long double *, char *, const long double, pvtransfercount_t);
 void pv_describe_amount(char *, size_t, char *, long double, char *, char *, pvtransfercount_t);
+void pv_describe_duration(char *, size_t, long);
 
 int8_t pv_display_barstyle_index(pvformatter_args_t, const char *);
 
@@ -609,6 +1319,10 @@ pvdisplay_bytecount_t pv_formatter_last_written(pvformatter_args_t);
 pvdisplay_bytecount_t pv_formatter_previous_line(pvformatter_args_t);
 pvdisplay_bytecount_t pv_formatter_name(pvformatter_args_t);
 pvdisplay_bytecount_t pv_formatter_sgr(pvformatter_args_t);
+pvdisplay_bytecount_t pv_formatter_bottleneck(pvformatter_args_t);
+pvdisplay_bytecount_t pv_formatter_wait_in(pvformatter_args_t);
+pvdisplay_bytecount_t pv_formatter_wait_out(pvformatter_args_t);
+pvdisplay_bytecount_t pv_formatter_digest(pvformatter_args_t);
 
 bool pv_format (pvprogramstatus_t, readonly_pvcontrol_t,
 		readonly_pvtransferstate_t, readonly_pvtransfercalc_t,
@@ -616,9 +1330,60 @@ bool pv_format (pvprogramstatus_t, readonly_pvcontrol_t,
 void pv_display (pvprogramstatus_t, readonly_pvcontrol_t, pvtransientflags_t,
 		 readonly_pvtransferstate_t, pvtransfercalc_t,
 		 pvcursorstate_t, pvdisplay_t, /*@null@ */ pvdisplay_t, bool);
+void pv_display_invalidate(pvdisplay_t);
 
 ssize_t pv_transfer(pvstate_t, int, bool *, bool *, off_t, long *);
+long pv_transfer_wait_usec(pvstate_t);
+size_t pv_transfer_lines_not_consumed(pvstate_t, size_t);
 int pv_next_file(pvstate_t, unsigned int, int);
+void pv_file_prefetch_cancel(pvstate_t);
+
+void pv_fanout_open(pvstate_t);
+void pv_fanout_queue(pvstate_t, const char *, size_t);
+bool pv_fanout_hold(pvstate_t, bool, long);
+bool pv_fanout_pending(pvstate_t);
+void pv_fanout_close(pvstate_t);
+void pv_fanout_free(pvstate_t);
+
+int pv_merge_open(pvstate_t);
+int pv_merge_wait(pvstate_t, /*@null@ */ bool *, int, /*@null@ */ bool *, long);
+ssize_t pv_merge_read(pvstate_t, char *, size_t);
+void pv_merge_close(pvstate_t);
+void pv_merge_free(pvstate_t);
+
+void pv_digest_init(struct pvdigest_s *, unsigned int);
+void pv_digest_update(struct pvdigest_s *, const unsigned char *, size_t);
+void pv_digest_hex(struct pvdigest_s *, char *, size_t);
+/*@observer@*/ const char *pv_digest_name(unsigned int);
+size_t pv_digest_text_length(unsigned int);
+
+void pv_hash_feed(pvstate_t, const char *, size_t);
+void pv_hash_finish(pvstate_t);
+void pv_hash_report(pvstate_t);
+void pv_hash_free(pvstate_t);
+
+/*@null@*/ /*@only@*/ char *pv_buffer_alloc(size_t, size_t, bool, bool, int, struct pvbuffermem_s *);
+void pv_buffer_free(/*@only@*/ char *, struct pvbuffermem_s *);
+
+bool pv_socket_is_tcp(int);
+size_t pv_socket_send_buffer(int);
+ssize_t pv_socket_unsent(int);
+bool pv_zerocopy_pending(pvtransferstate_t);
+bool pv_zerocopy_usable(pvstate_t, int, size_t);
+void pv_zerocopy_reap(pvtransferstate_t, long);
+ssize_t pv_zerocopy_send(pvstate_t, const char *, size_t);
+void pv_zerocopy_finish(pvtransferstate_t);
+
+void pv_spool_open(pvstate_t);
+bool pv_spool_hold(pvstate_t, bool, long);
+bool pv_spool_pending(pvstate_t);
+void pv_spool_close(pvstate_t);
+void pv_spool_free(pvstate_t);
+
+off_t pv_rescue_read_limit(pvstate_t, int, size_t *);
+void pv_rescue_read_done(pvstate_t, ssize_t);
+off_t pv_rescue_skip_amount(pvstate_t, off_t, size_t);
+void pv_rescue_read_failed(pvstate_t, off_t, off_t);
 /*@keep@*/ const char *pv_current_file_name(pvstate_t);
 
 unsigned int pv_update_calc_average_rate_window(pvtransfercalc_t, unsigned int);
@@ -627,12 +1392,57 @@ void pv_reset_transfer(pvtransferstate_t);
 void pv_reset_flags(pvtransientflags_t);
 void pv_reset_display(pvdisplay_t);
 void pv_reset_watchfd(pvwatchfd_t);
+void pv_reset_subline(pvstate_t, struct pvsubline_s *);
 void pv_freecontents_display(pvdisplay_t);
 void pv_freecontents_transfer(pvtransferstate_t);
 void pv_freecontents_calc(pvtransfercalc_t);
+void pv_freecontents_subline(struct pvsubline_s *);
 void pv_freecontents_watchfd(pvwatchfd_t);
 void pv_freecontents_watchfd_items(struct pvwatcheditem_s *, unsigned int);
 
+#ifdef HAVE_IO_URING
+/*@null@*/ /*@only@*/ pvuring_t pv_uring_alloc(unsigned int);
+void pv_uring_free(/*@only@*/ pvuring_t);
+bool pv_uring_queue_rw(pvuring_t, bool, int, void *, size_t, off_t, unsigned long);
+int pv_uring_submit_and_wait(pvuring_t, long);
+bool pv_uring_next_completion(pvuring_t, unsigned long *, long *);
+#endif				/* HAVE_IO_URING */
+
+#ifdef HAVE_THREADS
+ssize_t pv_pipeline_transfer(pvstate_t, int, bool *, bool *, off_t, long *);
+size_t pv_pipeline_buffered(/*@null@*/ pvpipeline_t, size_t *);
+void pv_pipeline_free(/*@only@*/ pvpipeline_t);
+ssize_t pv_parallel_transfer(pvstate_t, int, bool *, bool *, off_t);
+void pv_parallel_free(/*@only@*/ pvparallel_t);
+/*@null@*/ /*@only@*/ pvlinecount_t pv_linecount_start(const int *, unsigned int, off_t, char);
+void pv_linecount_update(pvstate_t, bool);
+void pv_linecount_free(/*@only@*/ pvlinecount_t);
+#endif				/* HAVE_THREADS */
+
+void pv_dirsize_update(pvstate_t, bool);
+void pv_dirsize_free(/*@only@*/ pvdirsize_t);
+
+void pv_autotune_update(pvstate_t, int);
+void pv_autotune_note_read(pvstate_t, ssize_t);
+void pv_autotune_note_wait(pvstate_t, bool, bool, long double);
+
+void pv_metrics_open(pvstate_t);
+void pv_metrics_update(pvstate_t, const struct timespec *, bool);
+void pv_metrics_close(pvstate_t);
+
+void pv_bottleneck_note_wait(pvstate_t, bool, bool, long double);
+void pv_bottleneck_note_read(pvstate_t, ssize_t);
+void pv_bottleneck_note_write(pvstate_t, ssize_t);
+void pv_bottleneck_describe_sizes(char *, size_t, const unsigned long *);
+
+void pv_rategroup_join(pvstate_t);
+long double pv_rategroup_draw(pvstate_t, long double);
+void pv_rategroup_leave(pvstate_t);
+
+int pv_event_wait(pvstate_t, int, /*@null@ */ bool *, int, /*@null@ */ bool *, long);
+void pv_event_forget_input(pvstate_t);
+void pv_event_close(pvstate_t);
+
 void pv_write_retry(int, const char *, size_t);
 void pv_tty_write(readonly_pvtransientflags_t, const char *, size_t);
 
@@ -648,12 +1458,19 @@ void pv_sig_checkbg(void);
 void pv_sig_nopause(void);
 
 bool pv_remote_check(pvstate_t);
+void pv_remote_statuspage_open(pvstate_t);
+void pv_remote_statuspage_update(pvstate_t);
+void pv_remote_statuspage_close(pvstate_t);
 
 int pv_watchfd_info(pvstate_t, pvwatchfd_t, bool);
 bool pv_watchfd_changed(pvwatchfd_t);
 off_t pv_watchfd_position(pvwatchfd_t);
 int pv_watchpid_scanfds(pvstate_t, pid_t, int, int *, pvwatchfd_t *);
 void pv_watchpid_setname(pvstate_t, pvwatchfd_t);
+void pv_watchpid_track(struct pvwatcheditem_s *);
+bool pv_watchpid_exited(struct pvwatcheditem_s *);
+bool pv_watchpid_rescan_due(struct pvwatcheditem_s *, const struct timespec *);
+void pv_watchpid_untrack(struct pvwatcheditem_s *);
 
 #ifdef __cplusplus
 }
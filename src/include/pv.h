@@ -37,12 +37,26 @@ extern "C" {
 #define PV_ERROREXIT_SIGNAL        32
 #define PV_ERROREXIT_MEMORY        64
 
+/*
+ * Digest algorithms for pv_state_hash_set(), which may be combined.
+ */
+#define PV_HASH_CRC32C	1
+#define PV_HASH_XXH64	2
+#define PV_HASH_SHA256	4
+
 /*
  * Opaque structure for PV internal state.
  */
 struct pvstate_s;
 typedef struct pvstate_s *pvstate_t;
 
+/*
+ * Function called by the main loop at each update when set with
+ * pv_state_progress_set(), with true as the second argument for the last
+ * update at the end of the transfer.
+ */
+typedef void (*pvprogress_fn_t)(pvstate_t, bool, /*@null@*/ void *);
+
 /*
  * Valid number types for pv_getnum_check().
  */
@@ -123,6 +137,16 @@ extern size_t pv_strlcat(char *, const char *, size_t);
  */
 /*@null@ */ /*@temp@ */ extern void *pv_memrchr(const void *, int, size_t);
 
+/*
+ * Return the number of times a character appears in the buffer.
+ */
+extern size_t pv_memcount(const void *, int, size_t);
+
+/*
+ * Return true if every byte in the buffer is zero.
+ */
+extern bool pv_is_zero(const void *, size_t);
+
 /*
  * Return the displayed width of a string.
  */
@@ -217,6 +241,9 @@ void pv_state_append_to_default_format(pvstate_t, /*@null@ */ const char *);
  */
 extern void pv_state_force_set(pvstate_t, bool);
 extern void pv_state_cursor_set(pvstate_t, bool);
+extern void pv_state_cursor_batch_set(pvstate_t, bool);
+extern void pv_state_merge_inputs_set(pvstate_t, bool);
+extern void pv_state_hash_set(pvstate_t, unsigned int);
 extern void pv_state_show_stats_set(pvstate_t, bool);
 extern void pv_state_numeric_set(pvstate_t, bool);
 extern void pv_state_wait_set(pvstate_t, bool);
@@ -234,8 +261,24 @@ extern void pv_state_sync_after_write_set(pvstate_t, bool);
 extern void pv_state_direct_io_set(pvstate_t, bool);
 extern void pv_state_sparse_output_set(pvstate_t, bool);
 extern void pv_state_rate_limit_set(pvstate_t, off_t);
+extern void pv_state_error_map_set(pvstate_t, /*@null@*/ const char *);
+extern void pv_state_rate_group_set(pvstate_t, /*@null@*/ const char *);
+extern void pv_state_metrics_set(pvstate_t, /*@null@*/ const char *, double);
 extern void pv_state_target_buffer_size_set(pvstate_t, size_t);
 extern void pv_state_no_splice_set(pvstate_t, bool);
+extern void pv_state_io_uring_set(pvstate_t, bool);
+extern void pv_state_io_depth_set(pvstate_t, unsigned int);
+extern void pv_state_threaded_set(pvstate_t, bool);
+extern void pv_state_parallel_set(pvstate_t, unsigned int);
+extern void pv_state_huge_pages_set(pvstate_t, bool);
+extern void pv_state_lock_memory_set(pvstate_t, bool);
+extern void pv_state_numa_node_set(pvstate_t, int);
+extern void pv_state_zero_copy_set(pvstate_t, bool);
+extern void pv_state_embedded_set(pvstate_t, bool);
+extern void pv_state_progress_set(pvstate_t, /*@null@*/ pvprogress_fn_t, /*@null@*/ void *);
+extern void pv_state_input_fd_set(pvstate_t, int);
+extern void pv_state_input_buffer_set(pvstate_t, /*@null@*/ const char *, size_t);
+extern void pv_state_auto_buffer_set(pvstate_t, bool);
 extern void pv_state_discard_input_set(pvstate_t, bool);
 extern void pv_state_size_set(pvstate_t, off_t);
 extern void pv_state_interval_set(pvstate_t, double);
@@ -249,10 +292,13 @@ extern void pv_state_output_set(pvstate_t, int, const char *);
 extern void pv_state_average_rate_window_set(pvstate_t, unsigned int);
 extern void pv_state_set_terminal_supports_utf8(pvstate_t, bool);
 extern void pv_state_othermonitor_set(pvstate_t, pid_t, int, int);
+extern void pv_state_othermonitor_counts_set(pvstate_t, /*@null@*/ volatile off_t *, /*@null@*/ const volatile off_t *);
 extern void pv_state_cancel_output_if_empty_format_string(pvstate_t);
 
 extern void pv_state_inputfiles(pvstate_t, unsigned int, const char **);
 extern void pv_state_watchfds(pvstate_t, unsigned int, const pid_t *, const int *);
+extern void pv_state_tee_outputs(pvstate_t, unsigned int, const char **, bool);
+extern void pv_state_spool_set(pvstate_t, int, /*@null@*/ const char *, /*@null@*/ const char *);
 
 /*
  * Work out whether we are in the foreground.
@@ -269,6 +315,12 @@ extern void pv_screensize(unsigned int *width, unsigned int *height);
  */
 extern off_t pv_calc_total_size(pvstate_t);
 
+/*
+ * Set the total size from the files under a directory, in the background
+ * if the final argument is true and it can't be done straight away.
+ */
+extern off_t pv_state_size_directory(pvstate_t, const char *, bool);
+
 /*
  * Set up signal handlers ready for running the main loop.
  */
@@ -299,6 +351,13 @@ extern FILE *pv_open_controlfile(char *, size_t, pid_t, int, bool);
  */
 extern int pv_main_loop(pvstate_t);
 
+/*
+ * Run the main loop as many times as needed to read as much as possible
+ * of a damaged input, keeping a map of which parts have been read, for
+ * --error-map; without a map, same as pv_main_loop().
+ */
+extern int pv_rescue_loop(pvstate_t);
+
 /*
  * Watch the selected file descriptors of the selected processes.
  */
@@ -0,0 +1,304 @@
+/*
+ * The libpv interface to the transfer engine; see src/include/libpv.h.
+ *
+ * Each handle holds a PV internal state that is set up as pv's main()
+ * would set it up with no display, except that no signal handlers are
+ * installed, and that the main loop is told that it is embedded so that
+ * it doesn't rely on them.  Progress is passed to the caller through a
+ * progress function called by the main loop at each display update.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+#include "libpv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+
+struct libpv_s {
+	/*@only@ */ pvstate_t state;	/* PV internal state, reused for each transfer */
+	off_t size;			/* size given by libpv_set_size() */
+	size_t buffer_size;		/* size given by libpv_set_buffer_size() */
+	bool stop_at_size;		/* set by libpv_set_stop_at_size() */
+	bool line_mode;			/* set by libpv_set_line_mode() */
+	/*@null@ */ libpv_progress_fn_t progress_fn; /* caller's progress function */
+	/*@dependent@ */ /*@null@ */ void *progress_userdata; /* passed to progress_fn */
+};
+
+
+/*
+ * Pass the progress of the transfer on to the caller's progress function;
+ * called by the main loop at each update, with "userdata" as the handle.
+ */
+static void libpv__progress( /*@dependent@ */ pvstate_t state, bool final, /*@null@ */ void *userdata)
+{
+	struct libpv_progress_s progress;
+	libpv_t handle;
+
+	handle = (libpv_t) userdata;
+	if ((NULL == handle) || (NULL == handle->progress_fn))
+		return;
+
+	memset(&progress, 0, sizeof(progress));
+
+	progress.elapsed_seconds = (double) (state->transfer.elapsed_seconds);
+	progress.transferred = (long long) (state->transfer.transferred);
+	progress.size = (long long) (state->control.size);
+	progress.transfer_rate = (double) (state->calc.transfer_rate);
+	progress.average_rate = (double) (state->calc.average_rate);
+	progress.rate_min = (double) (state->calc.rate_min);
+	progress.rate_max = (double) (state->calc.rate_max);
+	progress.percentage = -1.0;
+	progress.eta_seconds = -1;
+	if (state->control.size > 0) {
+		progress.percentage = state->calc.percentage;
+		if (progress.percentage > 100.0)
+			progress.percentage = 100.0;
+		if (final) {
+			progress.eta_seconds = 0;
+		} else if (state->transfer.transferred > 0) {
+			progress.eta_seconds =
+			    pv_seconds_remaining(state->transfer.transferred, state->control.size,
+						 state->calc.average_rate);
+			if (progress.eta_seconds < 0)
+				progress.eta_seconds = 0;
+		}
+	}
+	progress.stalls = state->calc.stall_count;
+	progress.final = final;
+
+	handle->progress_fn(&progress, handle->progress_userdata);
+}
+
+
+/*
+ * Return a new handle, or NULL on memory allocation failure.
+ */
+/*@null@ */
+/*@only@ */
+libpv_t libpv_new( /*@null@ */ const char *name)
+{
+	libpv_t handle;
+
+	handle = calloc(1, sizeof(*handle));
+	if (NULL == handle)
+		return NULL;
+
+	handle->state = pv_state_alloc();
+	if (NULL == handle->state) {
+		free(handle);
+		return NULL;
+	}
+
+	/*@-keeptrans@ */
+	pv_set_error_prefix(NULL == name ? "libpv" : name);
+	/*@+keeptrans@ */
+	/* splint - the prefix is copied, not kept. */
+
+	pv_state_embedded_set(handle->state, true);
+	pv_state_no_display_set(handle->state, true);
+	pv_state_interval_set(handle->state, 1.0);
+	pv_state_average_rate_window_set(handle->state, 30);
+	pv_state_progress_set(handle->state, libpv__progress, handle);
+
+	return handle;
+}
+
+
+/*
+ * Free a handle.
+ */
+void libpv_free( /*@only@ */ /*@null@ */ libpv_t handle)
+{
+	if (NULL == handle)
+		return;
+	pv_state_free(handle->state);
+	free(handle);
+}
+
+
+/*
+ * Set the rate limit; this takes effect immediately, even mid-transfer.
+ */
+void libpv_set_rate_limit(libpv_t handle, long long rate)
+{
+	pv_state_rate_limit_set(handle->state, rate > 0 ? (off_t) rate : 0);
+}
+
+
+/*
+ * Set the expected total size.
+ */
+void libpv_set_size(libpv_t handle, long long size)
+{
+	handle->size = size > 0 ? (off_t) size : 0;
+}
+
+
+/*
+ * Set whether to stop at the expected total size.
+ */
+void libpv_set_stop_at_size(libpv_t handle, bool stop)
+{
+	handle->stop_at_size = stop;
+}
+
+
+/*
+ * Set the interval between progress updates.
+ */
+void libpv_set_interval(libpv_t handle, double seconds)
+{
+	if (seconds < 0.1)
+		seconds = 0.1;
+	if (seconds > 600)
+		seconds = 600;
+	pv_state_interval_set(handle->state, seconds);
+}
+
+
+/*
+ * Set whether to count lines instead of bytes.
+ */
+void libpv_set_line_mode(libpv_t handle, bool line_mode)
+{
+	handle->line_mode = line_mode;
+}
+
+
+/*
+ * Set the transfer buffer size.
+ */
+void libpv_set_buffer_size(libpv_t handle, size_t size)
+{
+	handle->buffer_size = size;
+}
+
+
+/*
+ * Set the progress function.
+ */
+void libpv_set_progress(libpv_t handle, /*@null@ */ libpv_progress_fn_t fn, /*@null@ */ void *userdata)
+{
+	handle->progress_fn = fn;
+	handle->progress_userdata = userdata;
+}
+
+
+/*
+ * Run a transfer from "input_fd", or if "buffer" is not NULL, from the
+ * "length" bytes at "buffer", to "output_fd", returning the exit status
+ * bitmask.
+ */
+static int libpv__transfer(libpv_t handle, int input_fd, /*@null@ */ const char *buffer, size_t length,
+			   int output_fd)
+{
+	pvstate_t state;
+	const char *stdin_name[] = { "-" };
+	int own_input_fd, own_output_fd;
+	off_t size;
+	int retcode;
+
+	state = handle->state;
+
+	pv_state_reset(state);
+	state->status.exit_status = 0;
+
+	own_input_fd = -1;
+	if (NULL == buffer) {
+		own_input_fd = dup(input_fd);
+		if (own_input_fd < 0) {
+			pv_error("%s: %s", _("failed to duplicate file descriptor"), strerror(errno));
+			return PV_ERROREXIT_ACCESS;
+		}
+	}
+	own_output_fd = dup(output_fd);
+	if (own_output_fd < 0) {
+		pv_error("%s: %s", _("failed to duplicate file descriptor"), strerror(errno));
+		if (own_input_fd >= 0)
+			(void) close(own_input_fd);
+		return PV_ERROREXIT_TRANSITION;
+	}
+
+	/* The main loop closes the input, and the state closes the output. */
+	pv_state_output_set(state, own_output_fd, "(output)");
+	pv_state_input_fd_set(state, own_input_fd);
+	pv_state_input_buffer_set(state, buffer, length);
+	if (NULL == buffer) {
+		pv_state_inputfiles(state, 1, stdin_name);
+	} else {
+		pv_state_inputfiles(state, 0, stdin_name);
+	}
+
+	/* The main loop may have changed the buffer size last time. */
+	pv_state_target_buffer_size_set(state, handle->buffer_size);
+	pv_state_linemode_set(state, handle->line_mode);
+	pv_state_stop_at_size_set(state, handle->stop_at_size);
+
+	size = handle->size;
+	if ((0 == size) && (NULL != buffer) && (!handle->line_mode))
+		size = (off_t) length;
+	if ((0 == size) && (NULL == buffer))
+		size = pv_calc_total_size(state);
+	pv_state_size_set(state, size);
+
+	retcode = pv_main_loop(state);
+
+	/* Let go of the caller's buffer and descriptors. */
+	pv_state_input_buffer_set(state, NULL, 0);
+	pv_state_input_fd_set(state, -1);
+	pv_state_output_set(state, -1, "(none)");
+
+	return retcode | state->status.exit_status;
+}
+
+
+/*
+ * Copy from one file descriptor to another.
+ */
+int libpv_transfer_fd(libpv_t handle, int input_fd, int output_fd)
+{
+	return libpv__transfer(handle, input_fd, NULL, 0, output_fd);
+}
+
+
+/*
+ * Write out a buffer.
+ */
+int libpv_transfer_buffer(libpv_t handle, const void *buffer, size_t length, int output_fd)
+{
+	static const char empty[1] = { '\0' };
+
+	/* An empty transfer still needs a buffer, to not read any files. */
+	if ((NULL == buffer) || (0 == length))
+		return libpv__transfer(handle, -1, empty, 0, output_fd);
+
+	return libpv__transfer(handle, -1, (const char *) buffer, length, output_fd);
+}
+
+
+/*
+ * Make the main loop stop at the next pass.
+ */
+void libpv_stop(libpv_t handle)
+{
+	handle->state->flags.trigger_exit = 1;
+}
+
+
+/*
+ * Return the package version.
+ */
+const char *libpv_version(void)
+{
+	return PACKAGE_VERSION;
+}
@@ -268,7 +268,8 @@ static void display_word_wrap(const char *string, size_t display_width, size_t f
  * translatable, as they must remain consistent across all locales.
  *
  * The list is terminated with a NULL opt_short value - to leave a gap, set
- * opt_short to an empty string instead.
+ * opt_short to an empty string instead.  An empty opt_short with an
+ * opt_long describes an option that only has a long form.
  */
 struct option_definition_s {
 	/*@null@ */ const char *opt_short;
@@ -381,31 +382,103 @@ void display_help(void)
 		{ "-v", "--stats", NULL,
 		 N_("output transfer statistics at the end"),
 		 { 0, 0, 0, 0} },
+#ifdef HAVE_GETOPT_LONG
+		{ "", "--hash", N_("ALGO,..."),
+		 N_("output digests of the data at the end (crc32c, xxh64, sha256)"),
+		 { 0, 0, 0, 0} },
+		{ "", "--metrics", N_("DEST"),
+		 N_("write JSON transfer metrics to DEST (a file, socket, or fd:N)"),
+		 { 0, 0, 0, 0} },
+		{ "", "--metrics-interval", N_("SEC"),
+		 N_("write a metrics record every SEC seconds (default 0.1)"),
+		 { 0, 0, 0, 0} },
+#endif
 		{ "-f", "--force", NULL,
 		 N_("output even if standard error is not a terminal"),
 		 { 0, 0, 0, 0} },
 		{ "-c", "--cursor", NULL,
 		 N_("use cursor positioning escape sequences"),
 		 { 0, 0, 0, 0} },
+#ifdef HAVE_GETOPT_LONG
+		{ "", "--cursor-batch", NULL,
+		 N_("like -c, but with one pv drawing every pv's line"),
+		 { 0, 0, 0, 0} },
+#endif
 		{ "", NULL, NULL, NULL, { 0, 0, 0, 0} },
 		{ "-o", "--output", N_("FILE"),
 		 N_("write output to FILE instead of stdout"),
 		 { 0, 0, 0, 0} },
+#ifdef HAVE_GETOPT_LONG
+		{ "", "--tee", N_("FILE"),
+		 N_("also write output to FILE, showing its progress"),
+		 { 0, 0, 0, 0} },
+		{ "", "--tee-drop", NULL,
+		 N_("stop writing to a --tee FILE that falls behind"),
+		 { 0, 0, 0, 0} },
+		{ "", "--merge", NULL,
+		 N_("read all FILEs at once, interleaving them"),
+		 { 0, 0, 0, 0} },
+#endif
 		{ "-L", "--rate-limit", N_("RATE"),
 		 N_("limit transfer to RATE bytes per second"),
 		 { 0, 0, 0, 0} },
+#ifdef HAVE_GETOPT_LONG
+		{ "", "--rate-group", N_("NAME"),
+		 N_("share the rate limit with other pv processes in group NAME"),
+		 { 0, 0, 0, 0} },
+#endif
 		{ "-B", "--buffer-size", N_("BYTES"),
 		 N_("use a buffer size of BYTES"),
 		 { 0, 0, 0, 0} },
+#ifdef HAVE_GETOPT_LONG
+		{ "", "--auto-buffer", NULL,
+		 N_("adjust the buffer size to suit the transfer"),
+		 { 0, 0, 0, 0} },
+#endif
 		{ "-C", "--no-splice", NULL,
 		 N_("never use splice(), always use read/write"),
 		 { 0, 0, 0, 0} },
+#ifdef HAVE_GETOPT_LONG
+#ifdef HAVE_IO_URING
+		{ "", "--io-uring", NULL,
+		 N_("transfer using io_uring, if available"),
+		 { 0, 0, 0, 0} },
+		{ "", "--io-depth", N_("NUM"),
+		 N_("with io_uring, keep up to NUM reads and writes in flight"),
+		 { 0, 0, 0, 0} },
+#endif				/* HAVE_IO_URING */
+#ifdef HAVE_THREADS
+		{ "", "--threaded", NULL,
+		 N_("read and write in separate threads"),
+		 { 0, 0, 0, 0} },
+		{ "", "--parallel", N_("NUM"),
+		 N_("copy files and block devices with NUM threads at once"),
+		 { 0, 0, 0, 0} },
+#endif				/* HAVE_THREADS */
+		{ "", "--huge-pages", NULL,
+		 N_("back the transfer buffer with huge pages"),
+		 { 0, 0, 0, 0} },
+		{ "", "--numa-node", N_("NUM"),
+		 N_("keep the transfer buffer on NUMA node NUM"),
+		 { 0, 0, 0, 0} },
+		{ "", "--lock-memory", NULL,
+		 N_("lock the transfer buffer into memory"),
+		 { 0, 0, 0, 0} },
+		{ "", "--zero-copy", NULL,
+		 N_("send to TCP sockets without copying the data"),
+		 { 0, 0, 0, 0} },
+#endif
 		{ "-E", "--skip-errors", NULL,
 		 N_("skip read errors in input"),
 		 { 0, 0, 0, 0} },
 		{ "-Z", "--error-skip-block", N_("BYTES"),
 		 N_("skip errors in BYTES blocks at a time"),
 		 { 0, 0, 0, 0} },
+#ifdef HAVE_GETOPT_LONG
+		{ "", "--error-map", N_("FILE"),
+		 N_("retry skipped errors, keeping a resumable map in FILE"),
+		 { 0, 0, 0, 0} },
+#endif
 		{ "-S", "--stop-at-size", NULL,
 		 N_("stop after --size bytes have been transferred"),
 		 { 0, 0, 0, 0} },
@@ -424,6 +497,11 @@ void display_help(void)
 		{ "-U", "--store-and-forward", N_("FILE"),
 		 N_("write all input to FILE before writing to output"),
 		 { 0, 0, 0, 0} },
+#ifdef HAVE_GETOPT_LONG
+		{ "", "--overlap", NULL,
+		 N_("with -U, write to output while still writing to FILE"),
+		 { 0, 0, 0, 0} },
+#endif
 		{ "", NULL, NULL, NULL, { 0, 0, 0, 0} },
 		{ "-d", "--watchfd", N_("PID[:FD]|=NAME|@LISTFILE"),
 		 N_("watch file FD opened by process PID"),
@@ -546,8 +624,12 @@ void display_help(void)
 		 * "  <short>, <long> <arg>  <description>"
 		 *
 		 * If getopt_long() is unavailable then ", <long>" is
-		 * omitted.
+		 * omitted.  Options with no short form are padded as if
+		 * they had a two character one, so the long options line
+		 * up.
 		 */
+		if ((0 == definition->width.opt_short) && (definition->width.opt_long > 0))
+			definition->width.opt_short = 2;
 		option_width += 2 + definition->width.opt_short;	/* "  short" */
 #ifdef HAVE_GETOPT_LONG
 		option_width += 2 + definition->width.opt_long;	/* ", <long>" */
@@ -589,12 +671,12 @@ void display_help(void)
 		option_width = 0;
 
 		if (definition->width.opt_short > 0 && NULL != definition->opt_short) {
-			printf("  %s", definition->opt_short);
+			printf("  %*s", (int) (definition->width.opt_short), definition->opt_short);
 			option_width += 2 + definition->width.opt_short;
 		}
 #ifdef HAVE_GETOPT_LONG
 		if (definition->width.opt_long > 0 && NULL != definition->opt_long) {
-			printf(", %s", definition->opt_long);
+			printf("%s%s", '\0' == definition->opt_short[0] ? "  " : ", ", definition->opt_long);
 			option_width += 2 + definition->width.opt_long;
 		}
 #endif
@@ -20,6 +20,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#endif
 #ifdef HAVE_LANGINFO_H
 #include <langinfo.h>
 #endif
@@ -124,7 +127,7 @@ static int pv__write_pidfile(opts_t opts)
  */
 static int pv__set_output(pvstate_t state, opts_t opts, /*@null@ */ const char *output_file)
 {
-	int output_fd;
+	int output_fd, open_flags;
 
 	if ((NULL == state) || (NULL == opts))
 		return 0;
@@ -135,8 +138,16 @@ static int pv__set_output(pvstate_t state, opts_t opts, /*@null@ */ const char *
 		return 0;
 	}
 
+	/*
+	 * With --error-map, a partly recovered output is kept, so that
+	 * it can be resumed; rescue.c empties it if starting afresh.
+	 */
+	open_flags = O_WRONLY | O_CREAT;
+	if (NULL == opts->error_map)
+		open_flags |= O_TRUNC;
+
 	debug("%s: %s", "setting output", output_file);
-	output_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+	output_fd = open(output_file, open_flags, 0600);	/* flawfinder: ignore */
 	/*
 	 * flawfinder rationale: the output filename has been explicitly
 	 * provided, and in many cases the operator will want to write to
@@ -153,11 +164,162 @@ static int pv__set_output(pvstate_t state, opts_t opts, /*@null@ */ const char *
 }
 
 
+/*
+ * Create a temporary file for store-and-forward mode, in $TMPDIR, $TMP,
+ * or /tmp, putting its name in "buf", and return its file descriptor, or
+ * -1 after reporting the error.
+ */
+static int pv__store_and_forward_tempfile(opts_t opts, char *buf, size_t bufsize)
+{
+	char *tmpdir;
+	int tmp_fd;
+
+	tmpdir = (char *) getenv("TMPDIR");	/* flawfinder: ignore */
+	if ((NULL == tmpdir) || ('\0' == tmpdir[0]))
+		tmpdir = (char *) getenv("TMP");	/* flawfinder: ignore */
+	if ((NULL == tmpdir) || ('\0' == tmpdir[0]))
+		tmpdir = "/tmp";
+
+	/*
+	 * flawfinder rationale: null and zero-size values of $TMPDIR and
+	 * $TMP are rejected, and the destination buffer is bounded.
+	 */
+
+	(void) pv_snprintf(buf, bufsize, "%s/pv.XXXXXX", tmpdir);
+	/*@-unrecog@ *//* splint doesn't know mkstemp(). */
+	tmp_fd = mkstemp(buf);		 /* flawfinder: ignore */
+	/*@+unrecog@ */
+	if (tmp_fd < 0)
+		fprintf(stderr, "%s: %s: %s\n", opts->program_name, buf, strerror(errno));
+
+	return tmp_fd;
+}
+
+
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYSCONF) && defined(_SC_AVPHYS_PAGES) && defined(_SC_PAGESIZE)
+/*
+ * Return a memfd to hold the input in store-and-forward mode, if the
+ * amount of input is known and is no more than half of the memory that is
+ * currently free, so that holding it doesn't push everything else out to
+ * swap.  Returns -1 if a memfd isn't suitable, or can't be created.
+ */
+static int pv__store_and_forward_memfd(opts_t opts)
+{
+	long page_size, free_pages;
+	int memfd;
+
+	if ((opts->size < 1) || opts->linemode)
+		return -1;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	free_pages = sysconf(_SC_AVPHYS_PAGES);
+	if ((page_size < 1) || (free_pages < 1))
+		return -1;
+
+	if ((unsigned long long) (opts->size) > ((unsigned long long) page_size * (unsigned long long) free_pages) / 2) {
+		debug("%s: %lld", "input too big to store in memory", (long long) (opts->size));
+		return -1;
+	}
+
+	memfd = memfd_create("pv-store-and-forward", MFD_CLOEXEC);
+	if (memfd < 0)
+		debug("%s: %s", "memfd_create", strerror(errno));
+
+	return memfd;
+}
+#endif				/* HAVE_MEMFD_CREATE && HAVE_SYSCONF && _SC_AVPHYS_PAGES && _SC_PAGESIZE */
+
+
+/*
+ * Overlapped store-and-forward mode, for --overlap: run the main loop
+ * once, with the output forced to the store-and-forward file, while
+ * everything that lands in that file is forwarded to the real output as
+ * soon as it has been written (see src/pv/spool.c).
+ *
+ * If the file was "-", the input is held in a memfd if it is known to fit
+ * in memory, or a temporary file otherwise, which is removed straight
+ * away since it is only used through its file descriptors.  Returns
+ * nonzero on error.
+ */
+static int pv__store_and_forward_overlapped(pvstate_t state, opts_t opts, pvformatoptions_s format_options)
+{
+	char tmp_filename[4096];	 /* flawfinder: ignore */
+	const char *spool_name;
+	int spool_fd, reader_fd;
+
+	/* flawfinder: zeroed with memset and bounded by pv_snprintf. */
+
+	memset(tmp_filename, 0, sizeof(tmp_filename));
+
+	/*
+	 * Work out the input size, as in a normal transfer, since it is
+	 * also the size of what is to be forwarded.
+	 */
+	if (opts->size < 1) {
+		opts->size = pv_calc_total_size(state);
+		debug("%s: %llu", "no size given - calculated", opts->size);
+		pv_state_size_set(state, opts->size);
+		if (opts->size > 0) {
+			format_options.eta = opts->eta;
+			format_options.fineta = opts->fineta;
+		}
+	}
+
+	spool_fd = -1;
+	spool_name = opts->store_and_forward_file;
+
+	if (0 == strcmp(opts->store_and_forward_file, "-")) {
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYSCONF) && defined(_SC_AVPHYS_PAGES) && defined(_SC_PAGESIZE)
+		spool_fd = pv__store_and_forward_memfd(opts);
+		spool_name = "(memory)";
+#endif
+		if (spool_fd < 0) {
+			spool_fd = pv__store_and_forward_tempfile(opts, tmp_filename, sizeof(tmp_filename));
+			if (spool_fd < 0)
+				return PV_ERROREXIT_SAF;
+			(void) remove(tmp_filename);
+			spool_name = tmp_filename;
+		}
+	} else {
+		spool_fd = open(opts->store_and_forward_file, O_RDWR | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+		/* flawfinder rationale: see pv__set_output(). */
+		if (spool_fd < 0) {
+			fprintf(stderr, "%s: %s: %s\n", opts->program_name, opts->store_and_forward_file,
+				strerror(errno));
+			return PV_ERROREXIT_SAF;
+		}
+	}
+
+	/* The forwarding reads from its own descriptor for the file. */
+	reader_fd = dup(spool_fd);
+	if (reader_fd < 0) {
+		fprintf(stderr, "%s: %s: %s\n", opts->program_name, spool_name, strerror(errno));
+		(void) close(spool_fd);
+		return PV_ERROREXIT_SAF;
+	}
+	(void) fcntl(reader_fd, F_SETFD, FD_CLOEXEC);
+
+	debug("%s: %s", "storing in, and forwarding from", spool_name);
+	pv_state_output_set(state, spool_fd, spool_name);
+	pv_state_spool_set(state, reader_fd, opts->output, opts->name);
+
+	/* Set the displayed name to "(input)" and trigger a format reparse. */
+	/*@-mustfreefresh@ */
+	pv_state_name_set(state, _("(input)"));
+	pv_state_set_format_options(state, format_options);
+	/*@+mustfreefresh@ *//* see below about gettext _() calls. */
+
+	return pv_main_loop(state);
+}
+
+
 /*
  * Store-and-forward mode: run the main loop once with the output forced to
  * the store-and-forward file (creating and removing a temporary file if "-"
  * was specified); then run the main loop again with the input file list
- * forced to be just the store-and-forward file.  Returns nonzero on error.
+ * forced to be just the store-and-forward file, or with --overlap, do both
+ * at once with pv__store_and_forward_overlapped().  Returns nonzero on
+ * error.
  */
 static int pv__store_and_forward(pvstate_t state, opts_t opts, pvformatoptions_s format_options)
 {
@@ -171,6 +333,9 @@ static int pv__store_and_forward(pvstate_t state, opts_t opts, pvformatoptions_s
 	if ((NULL == state) || (NULL == opts) || (NULL == opts->store_and_forward_file))
 		return 0;
 
+	if (opts->overlap)
+		return pv__store_and_forward_overlapped(state, opts, format_options);
+
 	memset(tmp_filename, 0, sizeof(tmp_filename));
 
 	use_temporary_file = false;
@@ -181,31 +346,13 @@ static int pv__store_and_forward(pvstate_t state, opts_t opts, pvformatoptions_s
 	 * Create a temporary file if the specified file was "-".
 	 */
 	if (use_temporary_file) {
-		char *tmpdir;
 		int tmp_fd;
 
-		tmpdir = (char *) getenv("TMPDIR");	/* flawfinder: ignore */
-		if ((NULL == tmpdir) || ('\0' == tmpdir[0]))
-			tmpdir = (char *) getenv("TMP");	/* flawfinder: ignore */
-		if ((NULL == tmpdir) || ('\0' == tmpdir[0]))
-			tmpdir = "/tmp";
-
-		/*
-		 * flawfinder rationale: null and zero-size values of $TMPDIR and
-		 * $TMP are rejected, and the destination buffer is bounded.
-		 */
-
-		(void) pv_snprintf(tmp_filename, sizeof(tmp_filename), "%s/pv.XXXXXX", tmpdir);
-		/*@-unrecog@ *//* splint doesn't know mkstemp(). */
-		tmp_fd = mkstemp(tmp_filename);	/* flawfinder: ignore */
-		/*@+unrecog@ */
-		if (tmp_fd < 0) {
-			fprintf(stderr, "%s: %s: %s\n", opts->program_name, tmp_filename, strerror(errno));
+		tmp_fd = pv__store_and_forward_tempfile(opts, tmp_filename, sizeof(tmp_filename));
+		if (tmp_fd < 0)
 			return PV_ERROREXIT_SAF;
-		}
 		(void) close(tmp_fd);
 	}
-
 	/*
 	 * Real store-and-forward file: either the one we were given, or the
 	 * temporary file we created if we were given "-".
@@ -276,15 +423,17 @@ static int pv__store_and_forward(pvstate_t state, opts_t opts, pvformatoptions_s
  * If both sides are active, "othermonitor_pid" is the PID of the monitor on
  * the other side, "othermonitor_read_fd" is for reading transfer progress
  * from the other monitor, and "othermonitor_write_fd" is for writing
- * transfer progress to the other monitor.
+ * transfer progress to the other monitor - unless "monitor_counts" is not
+ * NULL, in which case it points to the two sides' shared counters, and the
+ * file descriptors are -1.
  *
  * Returns the appropriate exit status.
  *
  * As a side effect, "command_fd" is closed.
  */
 static int pv__run_monitor(const char *program_name, pvstate_t state, pvside_t side, int command_fd,
-			   pid_t othermonitor_pid, int othermonitor_read_fd, int othermonitor_write_fd, off_t size,
-			   pvformatoptions_s format_options)
+			   pid_t othermonitor_pid, int othermonitor_read_fd, int othermonitor_write_fd,
+			   /*@null@ */ volatile off_t *monitor_counts, off_t size, pvformatoptions_s format_options)
 {
 	const char *dummy_argv[1];	 /* flawfinder: ignore */
 
@@ -319,6 +468,13 @@ static int pv__run_monitor(const char *program_name, pvstate_t state, pvside_t s
 
 	/* Copy details of the other monitor into the main state. */
 	pv_state_othermonitor_set(state, othermonitor_pid, othermonitor_read_fd, othermonitor_write_fd);
+	if (NULL != monitor_counts) {
+		if (PV_SIDE_IN == side) {
+			pv_state_othermonitor_counts_set(state, &(monitor_counts[0]), &(monitor_counts[1]));
+		} else {
+			pv_state_othermonitor_counts_set(state, &(monitor_counts[1]), &(monitor_counts[0]));
+		}
+	}
 
 	/* Set the input files list to just "-". */
 	/*@-observertrans@ */
@@ -360,11 +516,12 @@ static int pv__run_monitor(const char *program_name, pvstate_t state, pvside_t s
  * Monitor mode: run a process and run the main transfer loop on its input,
  * output, or both.  Returns the appropriate exit status.
  *
- * When monitoring both sides, two pipes are set up between the monitor
- * processes for each side - in to out, and out to in - for them to exchange
- * information about the transfer, so both sides can see how many bytes the
- * other side has transferred.  This is what allows the in:out ratio to be
- * displayed.
+ * When monitoring both sides, the monitor processes for each side share a
+ * pair of counters in an anonymous shared memory mapping, so both sides can
+ * see how many bytes the other side has transferred at any time.  This is
+ * what allows the in:out ratio to be displayed.  Where such a mapping can't
+ * be made, two pipes are set up between them instead - in to out, and out
+ * to in - through which they exchange their counts every short while.
  */
 static int pv__monitor(pvstate_t state, opts_t opts, pvformatoptions_s format_options)
 {
@@ -372,6 +529,7 @@ static int pv__monitor(pvstate_t state, opts_t opts, pvformatoptions_s format_op
 	int pipefd_cmd_out[2];		 /* pipe from the command to the monitor */
 	int pipefd_in_to_out[2];	 /* from in monitor to out monitor */
 	int pipefd_out_to_in[2];	 /* from out monitor to in monitor */
+	/*@null@ */ volatile off_t *monitor_counts;	/* shared "in" and "out" counters */
 	int retcode, pid_status;
 	pid_t command_pid, in_monitor_pid, out_monitor_pid, waited_pid;
 
@@ -486,14 +644,29 @@ x = 1; \
 	close_if_open(pipefd_cmd_out[1]);
 
 	/*
-	 * If monitoring both input and output, create pipes for the two
-	 * monitors to talk to each other in both directions.
+	 * If monitoring both input and output, create the counters for the
+	 * two monitors to share, or if that's not possible, pipes for them
+	 * to talk to each other in both directions.
 	 */
+	monitor_counts = NULL;
 	pipefd_in_to_out[0] = -1;
 	pipefd_in_to_out[1] = -1;
 	pipefd_out_to_in[0] = -1;
 	pipefd_out_to_in[1] = -1;
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
 	if (PV_SIDE_BOTH == opts->side) {
+		void *mapped;
+		mapped = mmap(NULL, 2 * sizeof(off_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (MAP_FAILED == mapped) {
+			debug("%s: %s", "shared monitor counters unavailable", strerror(errno));
+		} else {
+			monitor_counts = (volatile off_t *) mapped;
+			monitor_counts[0] = 0;
+			monitor_counts[1] = 0;
+		}
+	}
+#endif
+	if ((PV_SIDE_BOTH == opts->side) && (NULL == monitor_counts)) {
 		if (0 != pipe(pipefd_in_to_out)) {
 			fprintf(stderr, "%s: %s\n", opts->program_name, strerror(errno));
 			close_if_open(pipefd_cmd_in[1]);
@@ -547,7 +720,8 @@ x = 1; \
 
 			retcode =
 			    pv__run_monitor(opts->program_name, state, PV_SIDE_OUT, pipefd_cmd_out[0], in_monitor_pid,
-					    pipefd_in_to_out[0], pipefd_out_to_in[1], opts->size, format_options);
+					    pipefd_in_to_out[0], pipefd_out_to_in[1], monitor_counts, opts->size,
+					    format_options);
 
 			/* Close the other ends of the intra-monitor pipes. */
 			close_if_open(pipefd_in_to_out[0]);
@@ -593,14 +767,14 @@ x = 1; \
 		close_if_open(pipefd_cmd_out[0]);
 		retcode =
 		    pv__run_monitor(opts->program_name, state, PV_SIDE_IN, pipefd_cmd_in[1], out_monitor_pid,
-				    pipefd_out_to_in[0], pipefd_in_to_out[1], opts->size, format_options);
+				    pipefd_out_to_in[0], pipefd_in_to_out[1], monitor_counts, opts->size, format_options);
 		break;
 	case PV_SIDE_OUT:
 		/* Close the write end of the "in" pipe. */
 		close_if_open(pipefd_cmd_in[1]);
 		retcode =
 		    pv__run_monitor(opts->program_name, state, PV_SIDE_OUT, pipefd_cmd_out[0], in_monitor_pid,
-				    pipefd_in_to_out[0], pipefd_out_to_in[1], opts->size, format_options);
+				    pipefd_in_to_out[0], pipefd_out_to_in[1], NULL, opts->size, format_options);
 		break;
 	}
 
@@ -638,6 +812,11 @@ x = 1; \
 		} while (-1 == waited_pid && EINTR == errno);
 	}
 
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+	if (NULL != monitor_counts)
+		(void) munmap((void *) monitor_counts, 2 * sizeof(off_t));
+#endif
+
 	return retcode;
 }
 
@@ -801,6 +980,10 @@ int main(int argc, char **argv)
 		opts->interval = 0.1;
 	if (opts->interval > 600)
 		opts->interval = 600;
+	if (opts->metrics_interval < 0.001)
+		opts->metrics_interval = 0.001;
+	if (opts->metrics_interval > 600)
+		opts->metrics_interval = 600;
 
 	/*
 	 * Set the output file, treating no output or "-" as stdout.  This
@@ -830,12 +1013,27 @@ int main(int argc, char **argv)
 	 */
 	pv_state_stop_at_size_set(state, opts->stop_at_size);
 
+	/*
+	 * Total up the directory given with "--size @DIR".  In a normal
+	 * transfer, this carries on in the background if it takes a while,
+	 * so the size is only an estimate to begin with.
+	 */
+	if (NULL != opts->size_directory) {
+		opts->size =
+		    pv_state_size_directory(state, opts->size_directory, PV_ACTION_TRANSFER == opts->action);
+		if (opts->size < 0) {
+			pv_state_free(state);
+			opts_free(opts);
+			return PV_ERROREXIT_ACCESS;
+		}
+	}
+
 	/* Total size calculation, in normal transfer mode. */
 	if (PV_ACTION_TRANSFER == opts->action) {
 		/*
 		 * If no size was given, try to calculate the total size.
 		 */
-		if (0 == opts->size) {
+		if ((0 == opts->size) && (NULL == opts->size_directory)) {
 			pv_state_linemode_set(state, opts->linemode);
 			pv_state_null_terminated_lines_set(state, opts->null_terminated_lines);
 			opts->size = pv_calc_total_size(state);
@@ -843,9 +1041,10 @@ int main(int argc, char **argv)
 		}
 
 		/*
-		 * If the size is unknown, ETA cannot be shown.
+		 * If the size is unknown, ETA cannot be shown - unless it is
+		 * still being totalled up from a directory.
 		 */
-		if (opts->size < 1) {
+		if ((opts->size < 1) && (NULL == opts->size_directory)) {
 			can_have_eta = false;
 			debug("%s", "size unknown - ETA disabled");
 		}
@@ -887,6 +1086,7 @@ int main(int argc, char **argv)
 	pv_state_no_display_set(state, opts->no_display);
 	pv_state_force_set(state, opts->force);
 	pv_state_cursor_set(state, opts->cursor);
+	pv_state_cursor_batch_set(state, opts->cursor_batch);
 	pv_state_show_stats_set(state, opts->show_stats);
 	pv_state_numeric_set(state, opts->numeric);
 	pv_state_wait_set(state, opts->wait);
@@ -902,14 +1102,29 @@ int main(int argc, char **argv)
 	pv_state_direct_io_set(state, opts->direct_io);
 	pv_state_discard_input_set(state, opts->discard_input);
 	pv_state_rate_limit_set(state, opts->rate_limit);
+	pv_state_rate_group_set(state, opts->rate_group);
+	pv_state_error_map_set(state, opts->error_map);
+	pv_state_metrics_set(state, opts->metrics, opts->metrics_interval);
 	pv_state_target_buffer_size_set(state, opts->buffer_size);
 	pv_state_no_splice_set(state, opts->no_splice);
+	pv_state_io_uring_set(state, opts->io_uring);
+	pv_state_io_depth_set(state, opts->io_depth);
+	pv_state_threaded_set(state, opts->threaded);
+	pv_state_parallel_set(state, opts->parallel);
+	pv_state_huge_pages_set(state, opts->huge_pages);
+	pv_state_lock_memory_set(state, opts->lock_memory);
+	pv_state_numa_node_set(state, opts->numa_node);
+	pv_state_zero_copy_set(state, opts->zero_copy);
+	pv_state_auto_buffer_set(state, opts->auto_buffer);
 	pv_state_size_set(state, opts->size);
 	pv_state_name_set(state, opts->name);
 	pv_state_default_bar_style_set(state, opts->default_bar_style);
 	pv_state_format_string_set(state, opts->format);
 	pv_state_extra_display_set(state, opts->extra_display);
 	pv_state_average_rate_window_set(state, opts->average_rate_window);
+	pv_state_tee_outputs(state, opts->tee_count, (const char **) (opts->tee_outputs), opts->tee_drop);
+	pv_state_merge_inputs_set(state, opts->merge);
+	pv_state_hash_set(state, opts->hash_algorithms);
 
 	format_options.progress = opts->progress;
 	format_options.timer = opts->timer;
@@ -933,7 +1148,7 @@ int main(int argc, char **argv)
 	case PV_ACTION_TRANSFER:
 		/* Normal "transfer data" mode. */
 		pv_state_cancel_output_if_empty_format_string(state);
-		retcode = pv_main_loop(state);
+		retcode = NULL != opts->error_map ? pv_rescue_loop(state) : pv_main_loop(state);
 		break;
 	case PV_ACTION_STORE_AND_FORWARD:
 		/* Store-and-forward transfer mode. */
@@ -32,9 +32,34 @@
 #ifdef HAVE_GETOPT_H
 #include <getopt.h>
 #endif
-#ifdef HAVE_FTW_H
-#include <ftw.h>
-#endif
+
+
+/*
+ * Values returned by getopt_long() for options that have no short form.
+ * They start above the range of any single character so that they cannot
+ * clash with a short option.
+ */
+enum {
+	PV_LONGOPT_IO_URING = 256,
+	PV_LONGOPT_THREADED,
+	PV_LONGOPT_PARALLEL,
+	PV_LONGOPT_AUTO_BUFFER,
+	PV_LONGOPT_RATE_GROUP,
+	PV_LONGOPT_METRICS,
+	PV_LONGOPT_METRICS_INTERVAL,
+	PV_LONGOPT_CURSOR_BATCH,
+	PV_LONGOPT_TEE,
+	PV_LONGOPT_TEE_DROP,
+	PV_LONGOPT_MERGE,
+	PV_LONGOPT_HASH,
+	PV_LONGOPT_OVERLAP,
+	PV_LONGOPT_IO_DEPTH,
+	PV_LONGOPT_ERROR_MAP,
+	PV_LONGOPT_HUGE_PAGES,
+	PV_LONGOPT_LOCK_MEMORY,
+	PV_LONGOPT_NUMA_NODE,
+	PV_LONGOPT_ZERO_COPY
+};
 
 
 void display_help(void);
@@ -72,12 +97,20 @@ void opts_free( /*@only@ */ opts_t opts)
 		free(opts->format1);
 	if (NULL != opts->pidfile)
 		free(opts->pidfile);
+	if (NULL != opts->rate_group)
+		free(opts->rate_group);
+	if (NULL != opts->metrics)
+		free(opts->metrics);
 	if (NULL != opts->output)
 		free(opts->output);
 	if (NULL != opts->default_bar_style)
 		free(opts->default_bar_style);
 	if (NULL != opts->store_and_forward_file)
 		free(opts->store_and_forward_file);
+	if (NULL != opts->error_map)
+		free(opts->error_map);
+	if (NULL != opts->size_directory)
+		free(opts->size_directory);
 	if (NULL != opts->extra_display)
 		free(opts->extra_display);
 	if (NULL != opts->watchfd_pid)
@@ -86,6 +119,8 @@ void opts_free( /*@only@ */ opts_t opts)
 		free(opts->watchfd_fd);
 	if (NULL != opts->argv)
 		free(opts->argv);
+	if (NULL != opts->tee_outputs)
+		free(opts->tee_outputs);
 	/*@+keeptrans@ */
 	free(opts);
 }
@@ -133,6 +168,76 @@ bool opts_add_file(opts_t opts, const char *filename)
 	return true;
 }
 
+/*
+ * Add an output to the list of extra outputs for --tee, returning false
+ * on error.  As with opts_add_file(), the name is not copied.
+ */
+static bool opts_add_tee(opts_t opts, const char *name)
+{
+	/*@-branchstate@ */
+	if ((opts->tee_count >= opts->tee_length) || (NULL == opts->tee_outputs)) {
+		opts->tee_length = opts->tee_count + 4;
+		/*@-keeptrans@ */
+		opts->tee_outputs = realloc(opts->tee_outputs, opts->tee_length * sizeof(char *));
+		/*@+keeptrans@ */
+		if (NULL == opts->tee_outputs) {
+			fprintf(stderr, "%s: %s\n", opts->program_name, strerror(errno));
+			opts->tee_length = 0;
+			opts->tee_count = 0;
+			return false;
+		}
+	}
+	/*@+branchstate@ */
+
+	/*
+	 * splint notes: "branchstate" and "keeptrans" were turned off
+	 * because of the same reason as for argv in opts_add_file().
+	 */
+
+	opts->tee_outputs[opts->tee_count++] = name;
+
+	return true;
+}
+
+/*
+ * Add the comma-separated digest algorithms in "spec" to the ones to work
+ * out with --hash, returning false, after reporting the error, if any of
+ * them is not recognised.
+ */
+static bool opts_parse_hash(opts_t opts, const char *spec)
+{
+	const char *start = spec;
+
+	while ('\0' != start[0]) {
+		const char *end;
+		size_t length;
+
+		end = strchr(start, ',');
+		length = (NULL == end) ? strlen(start) : (size_t) (end - start);	/* flawfinder: ignore */
+		/* flawfinder - optarg is null-terminated. */
+
+		if ((6 == length) && (0 == strncmp(start, "crc32c", length))) {
+			opts->hash_algorithms |= PV_HASH_CRC32C;
+		} else if ((5 == length) && (0 == strncmp(start, "xxh64", length))) {
+			opts->hash_algorithms |= PV_HASH_XXH64;
+		} else if ((6 == length) && (0 == strncmp(start, "sha256", length))) {
+			opts->hash_algorithms |= PV_HASH_SHA256;
+		} else if (length > 0) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: --hash: %.*s: %s\n", opts->program_name, (int) length, start,
+				_("unknown digest algorithm"));
+			return false;
+			/*@+mustfreefresh@ */
+		}
+
+		start += length;
+		if (',' == start[0])
+			start++;
+	}
+
+	return true;
+}
+
 /*
  * Add a process ID and file descriptor to the list of items to watch with
  * --watchfd, returning false on error.
@@ -476,27 +581,6 @@ static bool string_starts_with(const char *string, const char *match)
 }
 
 
-#ifdef HAVE_NFTW
-/*
- * Callback function for nftw() to add the size of the given file to the
- * total size so far.
- */
-static off_t dir_tree_file_size_so_far = 0;
-static int dir_tree_total_file_size( /*@unused@ */  __attribute__((unused))
-				    const char *fpath, const struct stat *sb, int typeflag,	/*@unused@ */
-				    __attribute__((unused))
-				    struct FTW *ftwbuf)
-{
-	if (typeflag != FTW_F)
-		return 0;
-	if (NULL == sb)
-		return 0;
-	dir_tree_file_size_so_far += (off_t) (sb->st_size);
-	return 0;
-}
-#endif				/* HAVE_NFTW */
-
-
 /*
  * Set opts->size from the size of the file whose name is size_file,
  * returning false (and reporting the error) if there is a problem.
@@ -504,8 +588,10 @@ static int dir_tree_total_file_size( /*@unused@ */  __attribute__((unused))
  * If size_file points to a block device, the size of the block device is
  * used.
  *
- * If size_file points to a directory, opts->size is set to the sum of the
- * sizes of all regular files under that directory, if nftw() is available.
+ * If size_file points to a directory, opts->size_directory is set to its
+ * name, so that the sizes of all the files under it can be added up by
+ * pv_state_size_directory() - in the background, once the transfer has
+ * started, where possible.
  */
 static bool opts_use_size_of_file(opts_t opts, const char *size_file)
 {
@@ -528,6 +614,11 @@ static bool opts_use_size_of_file(opts_t opts, const char *size_file)
 	stat_rc = 0;
 	memset(&sb, 0, sizeof(sb));
 
+	/* Forget any directory given by an earlier "--size @DIR". */
+	if (NULL != opts->size_directory)
+		free(opts->size_directory);
+	opts->size_directory = NULL;
+
 	stat_rc = stat(size_file, &sb);
 
 	if (0 != stat_rc) {
@@ -544,35 +635,18 @@ static bool opts_use_size_of_file(opts_t opts, const char *size_file)
 		return true;
 	}
 
-#ifdef HAVE_NFTW
+#ifdef PV_DIRSIZE
 	/* This was a directory - use the size of all files under it. */
 	if (S_ISDIR((mode_t) (sb.st_mode))) {
-		int maxfds, rc_nftw;
-
-		maxfds = -1;
-#ifdef _POSIX_OPEN_MAX
-		maxfds = _POSIX_OPEN_MAX;
-#endif
-		if (maxfds < 1) {
-			maxfds = (int) sysconf(_SC_OPEN_MAX);
-		}
-
-		dir_tree_file_size_so_far = 0;
-		rc_nftw = nftw(size_file, dir_tree_total_file_size, maxfds, 0
-#ifdef FTW_PHYS
-			       | FTW_PHYS
-#endif
-		    );
-
-		if (rc_nftw < 0) {
-			fprintf(stderr, "%s: %s: %s\n", opts->program_name, size_file, strerror(errno));
+		opts->size_directory = pv_strdup(size_file);
+		if (NULL == opts->size_directory) {
+			fprintf(stderr, "%s: %s\n", opts->program_name, strerror(errno));
 			return false;
 		}
-
-		opts->size = dir_tree_file_size_so_far;
+		opts->size = 0;
 		return true;
 	}
-#else				/* HAVE_NFTW */
+#else				/* PV_DIRSIZE */
 	/* This was a directory - report an error. */
 	if (S_ISDIR((mode_t) (sb.st_mode))) {
 		/*@-mustfreefresh@ *//* see above */
@@ -580,7 +654,7 @@ static bool opts_use_size_of_file(opts_t opts, const char *size_file)
 		return false;
 		/*@+mustfreefresh@ */
 	}
-#endif				/* !HAVE_NFTW */
+#endif				/* !PV_DIRSIZE */
 
 	/* This was not a block device - just use the size and return. */
 	if (!S_ISBLK((mode_t) (sb.st_mode))) {
@@ -708,6 +782,7 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		{ "numeric", 0, NULL, (int) 'n' },
 		{ "quiet", 0, NULL, (int) 'q' },
 		{ "cursor", 0, NULL, (int) 'c' },
+		{ "cursor-batch", 0, NULL, PV_LONGOPT_CURSOR_BATCH },
 		{ "wait", 0, NULL, (int) 'W' },
 		{ "delay-start", 1, NULL, (int) 'D' },
 		{ "size", 1, NULL, (int) 's' },
@@ -722,9 +797,20 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		{ "format", 1, NULL, (int) 'F' },
 		{ "extra-display", 1, NULL, (int) 'x' },
 		{ "stats", 0, NULL, (int) 'v' },
+		{ "metrics", 1, NULL, PV_LONGOPT_METRICS },
+		{ "metrics-interval", 1, NULL, PV_LONGOPT_METRICS_INTERVAL },
 		{ "rate-limit", 1, NULL, (int) 'L' },
+		{ "rate-group", 1, NULL, PV_LONGOPT_RATE_GROUP },
 		{ "buffer-size", 1, NULL, (int) 'B' },
+		{ "auto-buffer", 0, NULL, PV_LONGOPT_AUTO_BUFFER },
 		{ "no-splice", 0, NULL, (int) 'C' },
+		{ "io-uring", 0, NULL, PV_LONGOPT_IO_URING },
+		{ "threaded", 0, NULL, PV_LONGOPT_THREADED },
+		{ "parallel", 1, NULL, PV_LONGOPT_PARALLEL },
+		{ "huge-pages", 0, NULL, PV_LONGOPT_HUGE_PAGES },
+		{ "lock-memory", 0, NULL, PV_LONGOPT_LOCK_MEMORY },
+		{ "numa-node", 1, NULL, PV_LONGOPT_NUMA_NODE },
+		{ "zero-copy", 0, NULL, PV_LONGOPT_ZERO_COPY },
 		{ "skip-errors", 0, NULL, (int) 'E' },
 		{ "error-skip-block", 1, NULL, (int) 'Z' },
 		{ "stop-at-size", 0, NULL, (int) 'S' },
@@ -739,6 +825,13 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		{ "pidfile", 1, NULL, (int) 'P' },
 		{ "watchfd", 1, NULL, (int) 'd' },
 		{ "output", 1, NULL, (int) 'o' },
+		{ "tee", 1, NULL, PV_LONGOPT_TEE },
+		{ "tee-drop", 0, NULL, PV_LONGOPT_TEE_DROP },
+		{ "merge", 0, NULL, PV_LONGOPT_MERGE },
+		{ "hash", 1, NULL, PV_LONGOPT_HASH },
+		{ "overlap", 0, NULL, PV_LONGOPT_OVERLAP },
+		{ "io-depth", 1, NULL, PV_LONGOPT_IO_DEPTH },
+		{ "error-map", 1, NULL, PV_LONGOPT_ERROR_MAP },
 		{ "average-rate-window", 1, NULL, (int) 'm' },
 		{ "monitor", 1, NULL, (int) 'M' },
 #ifdef ENABLE_DEBUGGING
@@ -793,6 +886,8 @@ opts_t opts_parse(unsigned int argc, char **argv)
 	opts->action = PV_ACTION_TRANSFER;
 	opts->side = PV_SIDE_NONE;
 	opts->interval = 1;
+	opts->metrics_interval = 0.1;
+	opts->numa_node = -1;
 	opts->delay_start = 0;
 	opts->average_rate_window = 30;
 
@@ -864,6 +959,38 @@ opts_t opts_parse(unsigned int argc, char **argv)
 				/*@+mustfreefresh@ */
 			}
 			break;
+		case PV_LONGOPT_IO_DEPTH:
+			if ((!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER)) || (pv_getnum_count(optarg, false) < 1)
+			    || (pv_getnum_count(optarg, false) > 32)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: --io-depth: %s: %s\n", opts->program_name, optarg,
+					_("an integer from 1 to 32 is expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_NUMA_NODE:
+			if ((!pv_getnum_check(optarg, PV_NUMTYPE_BARE_INTEGER))
+			    || (pv_getnum_count(optarg, false) > 1023)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: --numa-node: %s: %s\n", opts->program_name, optarg,
+					_("an integer from 0 to 1023 is expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
+		case PV_LONGOPT_METRICS_INTERVAL:
+			if (!pv_getnum_check(optarg, PV_NUMTYPE_BARE_DOUBLE)) {
+				/*@-mustfreefresh@ *//* see above */
+				fprintf(stderr, "%s: --metrics-interval: %s: %s\n", opts->program_name, optarg,
+					_("numeric argument expected"));
+				opts_free(opts);
+				return NULL;
+				/*@+mustfreefresh@ */
+			}
+			break;
 		case 'd':
 			if ('@' == optarg[0]) {
 				/* "-d @FILE" syntax - check FILE exists. */
@@ -983,7 +1110,6 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		case 'A':
 			opts->lastwritten = (size_t) pv_getnum_count(optarg, opts->decimal_units);
 			numopts++;
-			opts->no_splice = true;
 			break;
 		case 'f':
 			opts->force = true;
@@ -991,6 +1117,19 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		case 'v':
 			opts->show_stats = true;
 			break;
+		case PV_LONGOPT_METRICS:
+			if (NULL != opts->metrics)
+				free(opts->metrics);
+			opts->metrics = pv_strdup(optarg);
+			if (NULL == opts->metrics) {
+				fprintf(stderr, "%s: --metrics: %s\n", opts->program_name, strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_METRICS_INTERVAL:
+			opts->metrics_interval = pv_getnum_interval(optarg);
+			break;
 		case 'n':
 			opts->numeric = true;
 			numopts++;
@@ -1002,6 +1141,10 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		case 'c':
 			opts->cursor = true;
 			break;
+		case PV_LONGOPT_CURSOR_BATCH:
+			opts->cursor = true;
+			opts->cursor_batch = true;
+			break;
 		case 'W':
 			opts->wait = true;
 			break;
@@ -1012,6 +1155,9 @@ opts_t opts_parse(unsigned int argc, char **argv)
 			if ('@' != *optarg) {
 				/* A number was passed, not "@<filename>". */
 				opts->size = pv_getnum_size(optarg, opts->decimal_units);
+				if (NULL != opts->size_directory)
+					free(opts->size_directory);
+				opts->size_directory = NULL;
 			} else {
 				/* Permit "@<filename>". */
 				const char *size_file = 1 + optarg;
@@ -1062,13 +1208,50 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		case 'L':
 			opts->rate_limit = pv_getnum_size(optarg, opts->decimal_units);
 			break;
+		case PV_LONGOPT_RATE_GROUP:
+			if (NULL != opts->rate_group)
+				free(opts->rate_group);
+			opts->rate_group = pv_strdup(optarg);
+			if (NULL == opts->rate_group) {
+				fprintf(stderr, "%s: --rate-group: %s\n", opts->program_name, strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			break;
 		case 'B':
 			opts->buffer_size = (size_t) pv_getnum_size(optarg, opts->decimal_units);
 			opts->no_splice = true;
 			break;
+		case PV_LONGOPT_AUTO_BUFFER:
+			opts->auto_buffer = true;
+			break;
 		case 'C':
 			opts->no_splice = true;
 			break;
+		case PV_LONGOPT_IO_URING:
+			opts->io_uring = true;
+			break;
+		case PV_LONGOPT_IO_DEPTH:
+			opts->io_depth = pv_getnum_count(optarg, false);
+			break;
+		case PV_LONGOPT_THREADED:
+			opts->threaded = true;
+			break;
+		case PV_LONGOPT_PARALLEL:
+			opts->parallel = pv_getnum_count(optarg, false);
+			break;
+		case PV_LONGOPT_HUGE_PAGES:
+			opts->huge_pages = true;
+			break;
+		case PV_LONGOPT_LOCK_MEMORY:
+			opts->lock_memory = true;
+			break;
+		case PV_LONGOPT_NUMA_NODE:
+			opts->numa_node = (int) pv_getnum_count(optarg, false);
+			break;
+		case PV_LONGOPT_ZERO_COPY:
+			opts->zero_copy = true;
+			break;
 		case 'E':
 			opts->skip_errors++;
 			break;
@@ -1149,6 +1332,38 @@ opts_t opts_parse(unsigned int argc, char **argv)
 				return NULL;
 			}
 			break;
+		case PV_LONGOPT_TEE:
+			if (!opts_add_tee(opts, optarg)) {
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_TEE_DROP:
+			opts->tee_drop = true;
+			break;
+		case PV_LONGOPT_MERGE:
+			opts->merge = true;
+			break;
+		case PV_LONGOPT_HASH:
+			if (!opts_parse_hash(opts, optarg)) {
+				opts_free(opts);
+				return NULL;
+			}
+			break;
+		case PV_LONGOPT_OVERLAP:
+			opts->overlap = true;
+			break;
+		case PV_LONGOPT_ERROR_MAP:
+			if (NULL != opts->error_map)
+				free(opts->error_map);
+			opts->error_map = pv_strdup(optarg);
+			if (NULL == opts->error_map) {
+				fprintf(stderr, "%s: --error-map: %s\n", opts->program_name, strerror(errno));
+				opts_free(opts);
+				return NULL;
+			}
+			opts->no_splice = true;
+			break;
 		case 'm':
 			opts->average_rate_window = pv_getnum_count(optarg, opts->decimal_units);
 			break;
@@ -1218,8 +1433,11 @@ opts_t opts_parse(unsigned int argc, char **argv)
 
 	if (PV_ACTION_WATCHFD == opts->action) {
 		if (opts->linemode || opts->null_terminated_lines || opts->stop_at_size
-		    || (opts->skip_errors > 0) || (opts->buffer_size > 0)
-		    || (opts->rate_limit > 0)) {
+		    || (opts->skip_errors > 0) || (opts->buffer_size > 0) || opts->auto_buffer
+		    || (opts->rate_limit > 0) || (NULL != opts->rate_group) || opts->io_uring || (opts->io_depth > 0)
+		    || opts->threaded || (opts->parallel > 0) || opts->huge_pages || opts->lock_memory
+		    || (opts->numa_node >= 0) || opts->zero_copy || (NULL != opts->metrics)
+		    || (NULL != opts->error_map)) {
 			/*@-mustfreefresh@ *//* see above */
 			fprintf(stderr, "%s: %s\n", opts->program_name,
 				_("cannot use line mode or transfer modifier options when watching file descriptors"));
@@ -1264,6 +1482,15 @@ opts_t opts_parse(unsigned int argc, char **argv)
 			/*@+mustfreefresh@ */
 		}
 
+		if (opts->tee_count > 0) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: --tee: %s\n", opts->program_name,
+				_("cannot transfer files when watching file descriptors"));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+
 		/* Accept additional watchfd arguments. */
 		while (optind < (int) argc) {
 			if (!opts_watchfd_parse(opts, argv[optind], NULL, 0)) {
@@ -1291,6 +1518,46 @@ opts_t opts_parse(unsigned int argc, char **argv)
 #endif
 	}
 
+	/* Only one alternative transfer engine can be chosen. */
+	if (opts->io_uring && opts->threaded) {
+		/*@-mustfreefresh@ *//* see above */
+		fprintf(stderr, "%s: %s\n", opts->program_name, _("cannot use --io-uring and --threaded together"));
+		opts_free(opts);
+		return NULL;
+		/*@+mustfreefresh@ */
+	}
+	if ((opts->parallel > 0) && (opts->io_uring || opts->threaded)) {
+		/*@-mustfreefresh@ *//* see above */
+		fprintf(stderr, "%s: %s\n", opts->program_name,
+			_("cannot use --parallel with --io-uring or --threaded"));
+		opts_free(opts);
+		return NULL;
+		/*@+mustfreefresh@ */
+	}
+
+	/*
+	 * A rate limit group needs a rate limit to start with, and its name
+	 * becomes part of a file name.
+	 */
+	if (NULL != opts->rate_group) {
+		if (('\0' == opts->rate_group[0]) || (NULL != strchr(opts->rate_group, '/'))) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: --rate-group: %s\n", opts->program_name,
+				_("the group name must not be empty or contain \"/\""));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+		if (0 == opts->rate_limit) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: --rate-group: %s\n", opts->program_name,
+				_("a rate limit must also be given with -L"));
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+	}
+
 	/* Don't allow -R and -Q together. */
 	if ((0 != opts->remote) && (0 != opts->query)) {
 		/*@-mustfreefresh@ *//* see above */
@@ -1312,8 +1579,8 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		opts->bytes = true;
 	}
 
-	/* If -Z was given but not -E, behave as if one -E was given too. */
-	if (opts->error_skip_block > 0 && 0 == opts->skip_errors)
+	/* If -Z or --error-map was given but not -E, behave as if one -E was given too. */
+	if ((opts->error_skip_block > 0 || NULL != opts->error_map) && 0 == opts->skip_errors)
 		opts->skip_errors = 1;
 
 	/*
@@ -1364,6 +1631,27 @@ opts_t opts_parse(unsigned int argc, char **argv)
 		/*@+mustfreefresh@ */
 	}
 
+	/*
+	 * The error map describes a single input, whose parts are written
+	 * to the same positions in the output.
+	 */
+	if ((NULL != opts->error_map) && (PV_ACTION_WATCHFD != opts->action)) {
+		/*@dependent@ */ const char *problem = NULL;
+		if ((PV_ACTION_TRANSFER != opts->action) || (0 != opts->remote) || (0 != opts->query))
+			problem = _("can only be used when transferring data");
+		else if (opts->linemode || opts->merge || (opts->tee_count > 0) || opts->discard_input)
+			problem = _("cannot be used with --line-mode, --merge, --tee, or --discard");
+		else if ((optind + 1 != (int) argc) || (0 == strcmp(argv[optind], "-")))
+			problem = _("exactly one input file must be given, which must not be \"-\"");
+		if (NULL != problem) {
+			/*@-mustfreefresh@ *//* see above */
+			fprintf(stderr, "%s: --error-map: %s\n", opts->program_name, problem);
+			opts_free(opts);
+			return NULL;
+			/*@+mustfreefresh@ */
+		}
+	}
+
 	/*
 	 * Store remaining command-line arguments.
 	 */
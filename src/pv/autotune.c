@@ -0,0 +1,198 @@
+/*
+ * Adjustment of the transfer buffer size and pipe capacities to suit the
+ * transfer while it is running, for --auto-buffer.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+
+/*
+ * If "fd" is a pipe, try to raise its capacity to "size" bytes, or as
+ * close to it as we are allowed (unprivileged processes are limited by
+ * /proc/sys/fs/pipe-max-size), and return its capacity; return 0 if it is
+ * not a pipe or its capacity can't be read.
+ *
+ * The capacity is never lowered, since that fails if the pipe holds more
+ * data than would fit.
+ */
+static int pv__autotune_pipe(int fd, size_t size)
+{
+#if defined(F_GETPIPE_SZ) && defined(F_SETPIPE_SZ)
+	struct stat sb;
+	int capacity;
+
+	if (fd < 0)
+		return 0;
+	memset(&sb, 0, sizeof(sb));
+	if ((0 != fstat(fd, &sb)) || (!S_ISFIFO(sb.st_mode)))
+		return 0;
+
+	capacity = fcntl(fd, F_GETPIPE_SZ);
+	if (capacity < 0)
+		return 0;
+
+	if (size > (size_t) (INT_MAX / 2))
+		size = (size_t) (INT_MAX / 2);
+
+	while (size > (size_t) capacity) {
+		int new_capacity;
+
+		new_capacity = fcntl(fd, F_SETPIPE_SZ, (int) size);
+		if (new_capacity >= 0) {
+			debug("%s %d: %s: %d -> %d", "fd", fd, "pipe capacity raised", capacity, new_capacity);
+			return new_capacity;
+		}
+		/* EPERM means over the limit, so try half the size. */
+		if (EPERM != errno)
+			break;
+		size /= 2;
+	}
+
+	return capacity;
+#else				/* !F_GETPIPE_SZ || !F_SETPIPE_SZ */
+	return 0;
+#endif				/* F_GETPIPE_SZ && F_SETPIPE_SZ */
+}
+
+
+/*
+ * Record a successful read (or splice) of "count" bytes.
+ */
+void pv_autotune_note_read(pvstate_t state, ssize_t count)
+{
+	if (count <= 0)
+		return;
+	state->transfer.autotune_reads++;
+	state->transfer.autotune_read_bytes += (off_t) count;
+}
+
+
+/*
+ * Record "seconds" spent waiting, during which the input was not ready
+ * if "input" is true, and the output was not ready (or the buffer was
+ * full, so there was no point reading) if "output" is true.
+ */
+void pv_autotune_note_wait(pvstate_t state, bool input, bool output, long double seconds)
+{
+	if (seconds <= 0.0)
+		return;
+	if (input)
+		state->transfer.autotune_input_wait += seconds;
+	if (output)
+		state->transfer.autotune_output_wait += seconds;
+}
+
+
+/*
+ * Raise the capacities of the input pipe "fd" and the output pipe, if
+ * they are pipes, to the target buffer size.
+ */
+static void pv__autotune_pipes(pvstate_t state, int fd, bool force)
+{
+	if (force || (fd != state->transfer.autotune_input_fd)) {
+		state->transfer.autotune_input_fd = fd;
+		state->transfer.input_pipe_size = pv__autotune_pipe(fd, state->control.target_buffer_size);
+	}
+	if (force || (!state->transfer.autotune_output_checked)) {
+		state->transfer.autotune_output_checked = true;
+		state->transfer.output_pipe_size =
+		    pv__autotune_pipe(state->control.output_fd, state->control.target_buffer_size);
+	}
+}
+
+
+/*
+ * Called at the start of each pv_transfer() if --auto-buffer is in use,
+ * with "fd" as the current input: at the end of each measurement window,
+ * decide whether the transfer buffer should be bigger or smaller, and
+ * set control.target_buffer_size accordingly; pv_transfer() does the
+ * actual reallocation.
+ *
+ * The buffer is doubled, up to PV_AUTOTUNE_BUFFER_MAX, if reads are
+ * typically filling at least half of it and the output is not what is
+ * holding the transfer up - in which case more data per system call
+ * helps.  It is halved, but never below the size it started at, if reads
+ * are typically less than an eighth of it, since the input is not
+ * supplying enough to make use of the space.
+ */
+void pv_autotune_update(pvstate_t state, int fd)
+{
+	struct timespec now, window_elapsed;
+	long double window_seconds;
+	size_t size, new_size;
+
+	if (!state->control.auto_buffer)
+		return;
+
+	pv_elapsedtime_read(&now);
+
+	if (0 == state->transfer.autotune_initial_size) {
+		state->transfer.autotune_initial_size = state->control.target_buffer_size;
+		state->transfer.autotune_largest_size = state->control.target_buffer_size;
+		pv_elapsedtime_copy(&(state->transfer.autotune_window_start), &now);
+	}
+
+	pv__autotune_pipes(state, fd, false);
+
+	pv_elapsedtime_subtract(&window_elapsed, &now, &(state->transfer.autotune_window_start));
+	if (pv_elapsedtime_seconds(&window_elapsed) < (long double) (PV_AUTOTUNE_WINDOW) / 1000000000.0L)
+		return;
+	window_seconds = pv_elapsedtime_seconds(&window_elapsed);
+
+	size = state->control.target_buffer_size;
+	new_size = size;
+
+	if (state->transfer.autotune_reads > 0) {
+		off_t average_read;
+
+		average_read = state->transfer.autotune_read_bytes / (off_t) (state->transfer.autotune_reads);
+
+		if ((average_read * 2 >= (off_t) size)
+		    && (state->transfer.autotune_output_wait * 2 < window_seconds)
+		    && (size < PV_AUTOTUNE_BUFFER_MAX)) {
+			new_size = size * 2;
+			if (new_size > PV_AUTOTUNE_BUFFER_MAX)
+				new_size = PV_AUTOTUNE_BUFFER_MAX;
+		} else if ((average_read * 8 < (off_t) size)
+			   && (size > state->transfer.autotune_initial_size)) {
+			new_size = size / 2;
+			if (new_size < state->transfer.autotune_initial_size)
+				new_size = state->transfer.autotune_initial_size;
+		}
+
+		debug("%s: %.3Lf %s, %lu %s, %lld %s, %.3Lf/%.3Lf %s, %ld -> %ld", "auto-buffer window",
+		      window_seconds, "sec", state->transfer.autotune_reads, "reads", (long long) average_read,
+		      "average", state->transfer.autotune_input_wait, state->transfer.autotune_output_wait,
+		      "sec waiting in/out", (long) size, (long) new_size);
+	}
+
+	if (new_size != size) {
+		state->control.target_buffer_size = new_size;
+		state->transfer.autotune_changes++;
+		if (new_size > state->transfer.autotune_largest_size)
+			state->transfer.autotune_largest_size = new_size;
+		if (new_size > size)
+			pv__autotune_pipes(state, fd, true);
+	}
+
+	pv_elapsedtime_copy(&(state->transfer.autotune_window_start), &now);
+	state->transfer.autotune_input_wait = 0.0;
+	state->transfer.autotune_output_wait = 0.0;
+	state->transfer.autotune_read_bytes = 0;
+	state->transfer.autotune_reads = 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Measurement of the time spent waiting for the input and the output, and
+ * of the sizes of reads and writes, to show which side is holding the
+ * transfer up.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Return the log2 histogram bucket for a transfer of "bytes" bytes.
+ */
+static unsigned int pv__bottleneck_bucket(ssize_t bytes)
+{
+	unsigned int bucket;
+	size_t remaining;
+
+	bucket = 0;
+	remaining = (size_t) bytes;
+	while ((remaining > 1) && (bucket < PV_IO_SIZE_BUCKETS - 1)) {
+		remaining >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+
+/*
+ * Add "seconds" to the time spent waiting for the input, if "input" is
+ * true, and for the output, if "output" is true.  If both are true then
+ * neither side was ready, and the time is counted against both.
+ */
+void pv_bottleneck_note_wait(pvstate_t state, bool input, bool output, long double seconds)
+{
+	if ((!state->transfer.instrumented) || (seconds <= 0.0))
+		return;
+	if (input)
+		state->transfer.wait_input_seconds += seconds;
+	if (output)
+		state->transfer.wait_output_seconds += seconds;
+}
+
+
+/*
+ * Count a read of "bytes" bytes in the read size histogram.
+ */
+void pv_bottleneck_note_read(pvstate_t state, ssize_t bytes)
+{
+	if ((!state->transfer.instrumented) || (bytes <= 0))
+		return;
+	state->transfer.read_size_histogram[pv__bottleneck_bucket(bytes)]++;
+}
+
+
+/*
+ * Count a write of "bytes" bytes in the write size histogram.
+ */
+void pv_bottleneck_note_write(pvstate_t state, ssize_t bytes)
+{
+	if ((!state->transfer.instrumented) || (bytes <= 0))
+		return;
+	state->transfer.write_size_histogram[pv__bottleneck_bucket(bytes)]++;
+}
+
+
+/*
+ * Write a description of the size histogram "histogram" into "buffer",
+ * which is "size" bytes long, as a list of "SIZE:COUNT" pairs for each
+ * non-empty bucket, where SIZE is the bottom of the bucket's range (so
+ * "64k:10" means 10 calls moved from 64KiB up to just under 128KiB).
+ */
+void pv_bottleneck_describe_sizes(char *buffer, size_t size, const unsigned long *histogram)
+{
+	size_t offset;
+	unsigned int bucket;
+
+	if (size < 1)
+		return;
+	buffer[0] = '\0';
+	offset = 0;
+
+	for (bucket = 0; bucket < PV_IO_SIZE_BUCKETS; bucket++) {
+		unsigned long amount;
+		char *suffix;
+		int written;
+
+		if (0 == histogram[bucket])
+			continue;
+
+		if (bucket >= 30) {
+			amount = 1UL << (bucket - 30);
+			suffix = "G";
+		} else if (bucket >= 20) {
+			amount = 1UL << (bucket - 20);
+			suffix = "M";
+		} else if (bucket >= 10) {
+			amount = 1UL << (bucket - 10);
+			suffix = "k";
+		} else {
+			amount = 1UL << bucket;
+			suffix = "";
+		}
+
+		written =
+		    pv_snprintf(buffer + offset, size - offset, "%s%lu%s:%lu", offset > 0 ? " " : "", amount, suffix,
+				histogram[bucket]);
+		if ((written < 0) || ((size_t) written >= size - offset)) {
+			/* Drop the pair that didn't fit. */
+			buffer[offset] = '\0';
+			break;
+		}
+		offset += (size_t) written;
+	}
+
+	if (0 == offset)
+		(void) pv_snprintf(buffer, size, "%s", "-");
+}
@@ -24,26 +24,32 @@ static void pv__update_average_rate_history(pvtransfercalc_t calc, readonly_pvtr
 {
 	size_t first = calc->history_first;
 	size_t last = calc->history_last;
-	long double last_elapsed;
+	long long now_ns, last_ns;
 
 	if (NULL == calc->history)
 		return;
 
-	last_elapsed = calc->history[last].elapsed_sec;
+	/*
+	 * The history is kept in whole nanoseconds, so the comparisons and
+	 * the subtraction below are integer operations.
+	 */
+	now_ns = (long long) (transfer->elapsed_seconds * 1000000000.0L);
+	if (now_ns < 1)
+		now_ns = 1;
+	last_ns = calc->history[last].elapsed_ns;
 
 	/*
 	 * Do nothing if this is not the first call but not enough time has
 	 * elapsed since the previous call yet.
 	 */
-	if ((last_elapsed > 0.0)
-	    && (transfer->elapsed_seconds < (last_elapsed + history_interval)))
+	if ((last_ns > 0) && (now_ns < (last_ns + 1000000000LL * (long long) history_interval)))
 		return;
 
 	/*
 	 * If this is not the first call, add a new entry to the ring
 	 * buffer.
 	 */
-	if (last_elapsed > 0.0) {
+	if (last_ns > 0) {
 		size_t len = calc->history_len;
 		last = (last + 1) % len;
 		calc->history_last = last;
@@ -53,19 +59,99 @@ static void pv__update_average_rate_history(pvtransfercalc_t calc, readonly_pvtr
 		}
 	}
 
-	calc->history[last].elapsed_sec = transfer->elapsed_seconds;
+	calc->history[last].elapsed_ns = now_ns;
 	calc->history[last].transferred = transfer->transferred;
 
 	if (first == last) {
 		calc->current_avg_rate = rate;
 	} else {
 		off_t bytes = (calc->history[last].transferred - calc->history[first].transferred);
-		long double sec = (calc->history[last].elapsed_sec - calc->history[first].elapsed_sec);
+		long long nsec = (calc->history[last].elapsed_ns - calc->history[first].elapsed_ns);
 		/* Safety check to avoid division by zero. */
-		if (sec < 0.000001 && sec > -0.000001)
-			sec = 0.000001;
-		calc->current_avg_rate = (long double) bytes / sec;
+		if (nsec < 1000)
+			nsec = 1000;
+		calc->current_avg_rate = (long double) bytes * 1000000000.0L / (long double) nsec;
+	}
+}
+
+
+/*
+ * Return the rate histogram bucket for a measured rate.
+ *
+ * Bucket 0 is for rates under 1 per second, which counts as having
+ * stalled.  After that, each power of 2 is split into 2^PV_RATE_SUBBUCKET_BITS
+ * buckets by the bits after the top one, like the mantissa of a floating
+ * point number, so the buckets are at most 12.5% wide whatever the rate;
+ * rates too big for the histogram go in the last bucket.
+ */
+static unsigned int pv__rate_bucket(long double rate)
+{
+	unsigned long long value;
+	unsigned int top_bit, sub_bucket, bucket;
+
+	if (rate < 1.0L)
+		return 0;
+	if (rate >= 281474976710656.0L)
+		return PV_RATE_BUCKETS - 1;
+
+	value = (unsigned long long) rate;
+	top_bit = 0;
+	while ((value >> top_bit) > 1)
+		top_bit++;
+
+	if (top_bit >= PV_RATE_SUBBUCKET_BITS) {
+		sub_bucket = (unsigned int) (value >> (top_bit - PV_RATE_SUBBUCKET_BITS));
+	} else {
+		sub_bucket = (unsigned int) (value << (PV_RATE_SUBBUCKET_BITS - top_bit));
 	}
+	sub_bucket &= (1U << PV_RATE_SUBBUCKET_BITS) - 1;
+
+	bucket = 1 + (top_bit << PV_RATE_SUBBUCKET_BITS) + sub_bucket;
+	if (bucket >= PV_RATE_BUCKETS)
+		bucket = PV_RATE_BUCKETS - 1;
+
+	return bucket;
+}
+
+
+/*
+ * Return the rate that the given fraction of the measured rates were at
+ * or below, as the middle of the histogram bucket it falls in, or 0 if
+ * nothing has been measured.
+ */
+long double pv_calculate_rate_percentile(readonly_pvtransfercalc_t calc, long double fraction)
+{
+	unsigned long long wanted, so_far;
+	unsigned int bucket, top_bit, sub_bucket;
+	long double lower, width;
+
+	if ((NULL == calc) || (calc->measurements_taken < 1))
+		return 0.0L;
+
+	wanted = (unsigned long long) (fraction * (long double) (calc->measurements_taken));
+	if (wanted < 1)
+		wanted = 1;
+
+	so_far = 0;
+	for (bucket = 0; bucket < PV_RATE_BUCKETS - 1; bucket++) {
+		so_far += calc->rate_histogram[bucket];
+		if (so_far >= wanted)
+			break;
+	}
+
+	if (0 == bucket)
+		return 0.0L;
+
+	top_bit = (bucket - 1) >> PV_RATE_SUBBUCKET_BITS;
+	sub_bucket = (bucket - 1) & ((1U << PV_RATE_SUBBUCKET_BITS) - 1);
+
+	lower = 1.0L;
+	while (top_bit-- > 0)
+		lower *= 2.0L;
+	width = lower / (long double) (1U << PV_RATE_SUBBUCKET_BITS);
+	lower += width * (long double) sub_bucket;
+
+	return lower + width / 2.0L;
 }
 
 
@@ -114,6 +200,7 @@ void pv_calculate_transfer_rate(pvtransfercalc_t calc, readonly_pvtransferstate_
 		calc->prev_trans += bytes_since_last;
 	} else {
 		long double measured_rate;
+		unsigned int bucket;
 
 		transfer_rate = ((long double) bytes_since_last + calc->prev_trans) / time_since_last;
 		measured_rate = transfer_rate;
@@ -130,6 +217,13 @@ void pv_calculate_transfer_rate(pvtransfercalc_t calc, readonly_pvtransferstate_
 		calc->rate_sum += measured_rate;
 		calc->ratesquared_sum += (measured_rate * measured_rate);
 		calc->measurements_taken++;
+
+		bucket = pv__rate_bucket(measured_rate);
+		if (calc->rate_histogram[bucket] < UINT32_MAX)
+			calc->rate_histogram[bucket]++;
+		if ((0 == bucket) && (!calc->stalled))
+			calc->stall_count++;
+		calc->stalled = (0 == bucket) ? true : false;
 	}
 	calc->prev_rate = transfer_rate;
 
@@ -10,6 +10,13 @@
  * terminal - so if terminal locking doesn't work, a separate lock file is
  * used, and cursor positioning is abandoned if that also fails.
  *
+ * With "--cursor-batch", a larger shared memory segment also holds a slot
+ * for each instance's display line.  Instances publish their lines in
+ * their slots without locking, and only one of them - the owner - writes
+ * to the terminal, drawing all of the lines that have changed in a single
+ * write() on each of its updates.  When the owner finishes, another
+ * instance takes over.
+ *
  * Copyright 2002-2008, 2010, 2012-2015, 2017, 2021, 2023-2026 Andrew Wood
  *
  * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
@@ -289,6 +296,8 @@ static int pv_crs_get_ypos(int terminalfd)
 
 
 #ifdef HAVE_IPC
+static void pv_crs_batch_join(pvcursorstate_t);
+
 /*
  * Initialise the IPC data, returning nonzero on error.
  *
@@ -305,13 +314,14 @@ static int pv_crs_get_ypos(int terminalfd)
 static int pv_crs_ipcinit(pvcursorstate_t cursor, readonly_pvcontrol_t control, char *ttyfile, int terminalfd)
 {
 	key_t key;
+	void *shared;
 
 	/*
 	 * Base the key for the shared memory segment on the current tty, to
 	 * avoid interfering in any way with instances of `pv' running on
 	 * another terminal.
 	 */
-	key = ftok(ttyfile, (int) 'p');
+	key = ftok(ttyfile, control->cursor_batch ? (int) 'P' : (int) 'p');
 	if (-1 == key) {
 		debug("%s: %s\n", "ftok failed", strerror(errno));
 		return 1;
@@ -323,7 +333,10 @@ static int pv_crs_ipcinit(pvcursorstate_t cursor, readonly_pvcontrol_t control,
 		return 1;
 	}
 
-	cursor->shmid = shmget(key, sizeof(struct pvipccursorstate_s), 0600 | IPC_CREAT);
+	cursor->shmid =
+	    shmget(key,
+		   control->cursor_batch ? sizeof(struct pvipccursorbatch_s) : sizeof(struct pvipccursorstate_s),
+		   0600 | IPC_CREAT);
 	if (cursor->shmid < 0) {
 		debug("%s: %s", "shmget failed", strerror(errno));
 		pv_crs_unlock(cursor, terminalfd);
@@ -332,8 +345,25 @@ static int pv_crs_ipcinit(pvcursorstate_t cursor, readonly_pvcontrol_t control,
 
 	/*@-nullpass@ */
 	/* splint doesn't know shmaddr can be NULL. */
-	cursor->shared = shmat(cursor->shmid, NULL, 0);
+	shared = shmat(cursor->shmid, NULL, 0);
 	/*@+nullpass@ */
+	if ((void *) -1 == shared) {
+		debug("%s: %s", "shmat failed", strerror(errno));
+		pv_crs_unlock(cursor, terminalfd);
+		return 1;
+	}
+
+	/*
+	 * The batch structure starts with the same shared state as the
+	 * plain one, so the rest of the code can use cursor->shared either
+	 * way.
+	 */
+	if (control->cursor_batch) {
+		cursor->batch = (struct pvipccursorbatch_s *) shared;
+		cursor->shared = &(cursor->batch->common);
+	} else {
+		cursor->shared = (struct pvipccursorstate_s *) shared;
+	}
 
 	pv_crs_ipccount(cursor);
 
@@ -344,6 +374,8 @@ static int pv_crs_ipcinit(pvcursorstate_t cursor, readonly_pvcontrol_t control,
 	 * the TOSTOP-added flag.
 	 */
 	if (cursor->pvcount < 2) {
+		if (NULL != cursor->batch)
+			memset(cursor->batch, 0, sizeof(*(cursor->batch)));
 		cursor->y_start = pv_crs_get_ypos(terminalfd);
 		cursor->shared->y_topmost = cursor->y_start;
 		cursor->shared->tty_tostop_added = false;
@@ -365,6 +397,9 @@ static int pv_crs_ipcinit(pvcursorstate_t cursor, readonly_pvcontrol_t control,
 		debug("%s: %d", "not the first to attach - got top y", cursor->y_start);
 	}
 
+	if (NULL != cursor->batch)
+		pv_crs_batch_join(cursor);
+
 	pv_crs_unlock(cursor, terminalfd);
 
 	return 0;
@@ -485,7 +520,7 @@ static void pv_crs_reinit(pvcursorstate_t cursor, readonly_pvcontrol_t control,
 	pv_crs_lock(cursor, control, STDERR_FILENO);
 
 	cursor->needreinit--;
-	if (cursor->y_offset < 1)
+	if ((cursor->y_offset < 1) || (NULL != cursor->batch))
 		cursor->needreinit = 0;
 
 	if (cursor->needreinit > 0) {
@@ -497,16 +532,343 @@ static void pv_crs_reinit(pvcursorstate_t cursor, readonly_pvcontrol_t control,
 
 	cursor->y_start = pv_crs_get_ypos(STDERR_FILENO);
 
-	if ((cursor->y_offset < 1) && (NULL != cursor->shared)) {
+	if (((cursor->y_offset < 1) || (NULL != cursor->batch)) && (NULL != cursor->shared)) {
 		cursor->shared->y_topmost = cursor->y_start;
 	}
 	cursor->y_lastread = cursor->y_start;
+	cursor->painted_top = 0;
 
 	pv_crs_unlock(cursor, STDERR_FILENO);
 }
 #endif
 
 
+#ifdef HAVE_IPC
+/*
+ * Take the next --cursor-batch slot, which also decides our row, and
+ * become the owner if there isn't one yet.  Instances beyond the number of
+ * slots get a row but no slot, and draw their own line as in plain cursor
+ * mode.
+ *
+ * Called with the terminal locked.
+ */
+static void pv_crs_batch_join(pvcursorstate_t cursor)
+{
+	struct pvipccursorbatch_s *batch;
+	pid_t no_owner;
+
+	batch = cursor->batch;
+	if (NULL == batch)
+		return;
+
+	cursor->y_offset = (int) (batch->slots_used);
+	__atomic_store_n(&(batch->slots_used), batch->slots_used + 1, __ATOMIC_RELEASE);
+
+	cursor->slot = -1;
+	cursor->painted_top = 0;
+	if (cursor->y_offset >= PV_CRS_SLOTS_MAX) {
+		debug("%s: %d", "no --cursor-batch slot left - drawing own line at offset", cursor->y_offset);
+		return;
+	}
+
+	cursor->slot = cursor->y_offset;
+	batch->slot[cursor->slot].pid = getpid();
+	batch->slot[cursor->slot].length = 0;
+	batch->slot[cursor->slot].finished = false;
+
+	no_owner = 0;
+	if (__atomic_compare_exchange_n
+	    (&(batch->owner), &no_owner, batch->slot[cursor->slot].pid, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		debug("%s", "became --cursor-batch owner");
+	}
+
+	debug("%s: %d", "--cursor-batch slot", cursor->slot);
+}
+
+
+/*
+ * Return true if process "pid" is known to have gone away.
+ */
+static bool pv_crs_batch_gone(pid_t pid)
+{
+	if (pid <= 0)
+		return true;
+	if ((kill(pid, 0) < 0) && (ESRCH == errno))
+		return true;
+	return false;
+}
+
+
+/*
+ * Return true if we are the --cursor-batch owner, taking over from the
+ * previous owner first if it has gone away or let go.
+ */
+static bool pv_crs_batch_claim(pvcursorstate_t cursor)
+{
+	struct pvipccursorbatch_s *batch;
+	pid_t owner, self;
+
+	batch = cursor->batch;
+	if ((NULL == batch) || (cursor->slot < 0))
+		return false;
+
+	self = batch->slot[cursor->slot].pid;
+	owner = __atomic_load_n(&(batch->owner), __ATOMIC_ACQUIRE);
+	if (owner == self)
+		return true;
+	if (!pv_crs_batch_gone(owner))
+		return false;
+
+	if (!__atomic_compare_exchange_n(&(batch->owner), &owner, self, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return false;
+
+	debug("%s: %d", "took over as --cursor-batch owner from", (int) owner);
+	cursor->painted_top = 0;
+	return true;
+}
+
+
+/*
+ * Copy the display line "output_line" of "length" bytes into our
+ * --cursor-batch slot, truncating it at a character boundary if it is too
+ * long.
+ */
+static void pv_crs_batch_publish(pvcursorstate_t cursor, const char *output_line, size_t length)
+{
+	struct pvipccursorslot_s *slot;
+	uint32_t sequence;
+
+	if ((NULL == cursor->batch) || (cursor->slot < 0))
+		return;
+
+	slot = &(cursor->batch->slot[cursor->slot]);
+
+	if (length > sizeof(slot->line)) {
+		length = sizeof(slot->line);
+		while ((length > 0) && (0x80 == (((unsigned char) output_line[length]) & 0xC0)))
+			length--;
+	}
+
+	sequence = slot->sequence;
+	__atomic_store_n(&(slot->sequence), sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(slot->line, output_line, length);
+	slot->length = (uint32_t) length;
+
+	__atomic_store_n(&(slot->sequence), sequence + 2, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * As the --cursor-batch owner, draw every slot's line that has changed
+ * since it was last drawn - or all of them, if the lines have moved -
+ * with a single write, scrolling the screen first if the lines would go
+ * past the bottom of it.
+ */
+static void pv_crs_batch_paint(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransientflags_t flags)
+{
+	struct pvipccursorbatch_s *batch;
+	unsigned int slots_used, slot_count, slot_idx;
+	char cup_cmd[32];		 /* flawfinder: ignore - bounded by pv_snprintf() */
+	size_t offset;
+	bool redraw_all;
+	int top;
+
+	batch = cursor->batch;
+	if (NULL == batch)
+		return;
+
+	if (NULL == cursor->paint_buffer) {
+		cursor->paint_buffer_size = PV_CRS_SLOTS_MAX * (PV_SIZEOF_CRS_SLOT_LINE + sizeof(cup_cmd)) + 1024;
+		cursor->paint_buffer = malloc(cursor->paint_buffer_size);
+		if (NULL == cursor->paint_buffer) {
+			debug("%s: %s", "paint buffer allocation failed", strerror(errno));
+			cursor->paint_buffer_size = 0;
+			return;
+		}
+	}
+
+	slots_used = __atomic_load_n(&(batch->slots_used), __ATOMIC_ACQUIRE);
+	if ((int) slots_used > cursor->pvmax)
+		cursor->pvmax = (int) slots_used;
+	slot_count = slots_used;
+	if (slot_count > PV_CRS_SLOTS_MAX)
+		slot_count = PV_CRS_SLOTS_MAX;
+
+	offset = 0;
+	top = batch->common.y_topmost;
+
+	/*
+	 * Scroll the screen if the lines would reach the bottom, as the
+	 * first instance does in plain cursor mode, and move them up.
+	 */
+	if ((top + cursor->pvmax) > (int) (control->height)) {
+		int offs;
+
+		offs = (top + cursor->pvmax) - (int) (control->height);
+		if (offs > PV_CRS_SLOTS_MAX)
+			offs = PV_CRS_SLOTS_MAX;
+
+		cup_cmd[0] = '\0';
+		(void) pv_snprintf(cup_cmd, sizeof(cup_cmd), "\033[%u;1H", control->height);
+		offset = strlen(cup_cmd);   /* flawfinder: ignore */
+		memcpy(cursor->paint_buffer, cup_cmd, offset);
+		for (; offs > 0; offs--) {
+			cursor->paint_buffer[offset++] = '\n';
+			top--;
+		}
+		if (top < 1)
+			top = 1;
+
+		batch->common.y_topmost = top;
+		debug("%s: %d", "scrolled screen - top is now", top);
+	}
+
+	cursor->y_start = top;
+	cursor->y_lastread = top;
+
+	redraw_all = (top != cursor->painted_top) ? true : false;
+	cursor->painted_top = top;
+
+	for (slot_idx = 0; slot_idx < slot_count; slot_idx++) {
+		struct pvipccursorslot_s *slot;
+		size_t slot_start, cup_cmd_length;
+		unsigned int attempt;
+		bool consistent;
+		int y;
+
+		slot = &(batch->slot[slot_idx]);
+
+		y = top + (int) slot_idx;
+		if ((y < 1) || (y > 999999))
+			y = 1;
+
+		cup_cmd[0] = '\0';
+		(void) pv_snprintf(cup_cmd, sizeof(cup_cmd), "\033[%d;1H", y);
+		cup_cmd_length = strlen(cup_cmd);	/* flawfinder: ignore */
+		/* flawfinder: always \0-terminated by pv_snprintf(). */
+
+		slot_start = offset;
+		consistent = false;
+
+		for (attempt = 0; attempt < 10 && !consistent; attempt++) {
+			uint32_t sequence_before, sequence_after;
+			size_t length;
+
+			sequence_before = __atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE);
+			if (0 != (sequence_before & 1))
+				continue;
+			if ((!redraw_all) && (sequence_before == cursor->painted_sequence[slot_idx]))
+				break;
+
+			length = (size_t) (slot->length);
+			if (length > sizeof(slot->line))
+				length = sizeof(slot->line);
+
+			offset = slot_start;
+			memcpy(cursor->paint_buffer + offset, cup_cmd, cup_cmd_length);
+			offset += cup_cmd_length;
+			memcpy(cursor->paint_buffer + offset, slot->line, length);
+			offset += length;
+
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			sequence_after = __atomic_load_n(&(slot->sequence), __ATOMIC_RELAXED);
+			if (sequence_before == sequence_after) {
+				consistent = true;
+				cursor->painted_sequence[slot_idx] = sequence_before;
+				if (0 == length)
+					offset = slot_start;
+			}
+		}
+
+		/* Leave this line as it is if it didn't settle. */
+		if (!consistent)
+			offset = slot_start;
+	}
+
+	if (offset > 0)
+		pv_tty_write(flags, cursor->paint_buffer, offset);
+}
+
+
+/*
+ * Update our --cursor-batch slot with "output_line", and if we are the
+ * owner, draw all of the lines that have changed.
+ */
+static void pv_crs_batch_update(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransientflags_t flags,
+				const char *output_line, size_t output_line_length)
+{
+	pv_crs_batch_publish(cursor, output_line, output_line_length);
+
+	if (!pv_crs_batch_claim(cursor)) {
+		/* Only the owner needs to know where the lines are. */
+		cursor->needreinit = 0;
+		return;
+	}
+
+	if (cursor->needreinit > 0)
+		pv_crs_reinit(cursor, control, flags);
+	if (cursor->needreinit > 0)
+		return;
+
+	pv_crs_batch_paint(cursor, control, flags);
+}
+
+
+/*
+ * Mark our --cursor-batch slot as finished, and if no other instance is
+ * drawing the lines, draw them one last time.  Returns true if all of the
+ * instances have now finished, so that the cursor should be moved past the
+ * lines, or false if that has been left to another instance.
+ *
+ * Called with the terminal locked, so that two instances finishing at once
+ * can't both leave it to the other.
+ */
+static bool pv_crs_batch_finish(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransientflags_t flags)
+{
+	struct pvipccursorbatch_s *batch;
+	unsigned int slots_used, slot_idx;
+	bool all_finished;
+
+	batch = cursor->batch;
+	if ((NULL == batch) || (cursor->slot < 0))
+		return true;
+
+	__atomic_store_n(&(batch->slot[cursor->slot].finished), true, __ATOMIC_RELEASE);
+
+	/* The owner is still running, and will draw our final line. */
+	if (!pv_crs_batch_claim(cursor))
+		return false;
+
+	pv_crs_batch_paint(cursor, control, flags);
+
+	slots_used = __atomic_load_n(&(batch->slots_used), __ATOMIC_ACQUIRE);
+	if (slots_used > PV_CRS_SLOTS_MAX)
+		slots_used = PV_CRS_SLOTS_MAX;
+
+	all_finished = true;
+	for (slot_idx = 0; slot_idx < slots_used; slot_idx++) {
+		if ((int) slot_idx == cursor->slot)
+			continue;
+		if (__atomic_load_n(&(batch->slot[slot_idx].finished), __ATOMIC_ACQUIRE))
+			continue;
+		if (pv_crs_batch_gone(batch->slot[slot_idx].pid))
+			continue;
+		all_finished = false;
+		break;
+	}
+
+	if (!all_finished) {
+		debug("%s", "handing over --cursor-batch drawing");
+		__atomic_store_n(&(batch->owner), 0, __ATOMIC_RELEASE);
+	}
+
+	return all_finished;
+}
+#endif				/* HAVE_IPC */
+
+
 /*
  * Output a single-line update (\0-terminated), using the ECMA-48 CSI "CUP"
  * sequence to move the cursor to the correct position to do so.
@@ -533,6 +895,11 @@ void pv_crs_update(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtrans
 	/* flawfinder - output_line is explictly expected to be \0-terminated. */
 
 #ifdef HAVE_IPC
+	if ((!cursor->noipc) && (NULL != cursor->batch) && (cursor->slot >= 0)) {
+		pv_crs_batch_update(cursor, control, flags, output_line, output_line_length);
+		return;
+	}
+
 	if (!cursor->noipc) {
 		if (cursor->needreinit > 0)
 			pv_crs_reinit(cursor, control, flags);
@@ -630,11 +997,27 @@ void pv_crs_fini(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransie
 {
 	char cup_cmd[32];		 /* flawfinder: ignore */
 	unsigned int y;
+	bool move_cursor;
 
 	/* flawfinder - "cup_cmd" is zeroed, and only written by pv_snprintf(). */
 
 	debug("%s", "fini");
 
+	pv_crs_lock(cursor, control, STDERR_FILENO);
+
+	move_cursor = cursor->disable ? false : true;
+
+#ifdef HAVE_IPC
+	/*
+	 * With --cursor-batch, only the last instance to finish moves the
+	 * cursor, after drawing the final lines.
+	 */
+	if ((!cursor->noipc) && (NULL != cursor->batch) && (cursor->slot >= 0) && (!cursor->disable)) {
+		if (!pv_crs_batch_finish(cursor, control, flags))
+			move_cursor = false;
+	}
+#endif				/* HAVE_IPC */
+
 	y = (unsigned int) (cursor->y_start);
 
 #ifdef HAVE_IPC
@@ -654,9 +1037,7 @@ void pv_crs_fini(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransie
 	memset(cup_cmd, 0, sizeof(cup_cmd));
 	(void) pv_snprintf(cup_cmd, sizeof(cup_cmd), "\033[%u;1H\n", y);
 
-	pv_crs_lock(cursor, control, STDERR_FILENO);
-
-	if (!cursor->disable) {
+	if (move_cursor) {
 		pv_tty_write(flags, cup_cmd, strlen(cup_cmd));	/* flawfinder: ignore */
 	}
 	/* flawfinder - pv_snprintf() always \0-terminates (see above). */
@@ -680,6 +1061,14 @@ void pv_crs_fini(pvcursorstate_t cursor, readonly_pvcontrol_t control, pvtransie
 		(void) shmdt(cursor->shared);
 	}
 	cursor->shared = NULL;
+	cursor->batch = NULL;
+	cursor->slot = -1;
+
+	if (NULL != cursor->paint_buffer) {
+		free(cursor->paint_buffer);
+		cursor->paint_buffer = NULL;
+		cursor->paint_buffer_size = 0;
+	}
 
 	/*
 	 * If this is the last instance detaching from the shared memory,
@@ -0,0 +1,576 @@
+/*
+ * Digest algorithms for --hash: CRC32C, XXH64, and SHA-256.  Where the
+ * processor has instructions for CRC32C or SHA-256, they are used instead
+ * of the portable code.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_X86_HASH_INSTRUCTIONS
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+
+/*
+ * Which instructions the processor has, and the CRC32C lookup tables,
+ * are worked out by the first call to pv_digest_init(), before any
+ * hashing thread is started.
+ */
+static bool pv__digest_ready = false;
+static bool pv__digest_have_crc32 = false;
+static bool pv__digest_have_sha = false;
+static uint32_t pv__crc32c_table[8][256];
+
+static const uint32_t pv__sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define PV_XXH64_PRIME1	0x9E3779B185EBCA87ULL
+#define PV_XXH64_PRIME2	0xC2B2AE3D27D4EB4FULL
+#define PV_XXH64_PRIME3	0x165667B19E3779F9ULL
+#define PV_XXH64_PRIME4	0x85EBCA77C2B2AE63ULL
+#define PV_XXH64_PRIME5	0x27D4EB2F165667C5ULL
+
+#define PV_ROTL64(x, n)	(((x) << (n)) | ((x) >> (64 - (n))))
+#define PV_ROTR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+
+/*
+ * Build the CRC32C tables for slicing by 8, and check which of the
+ * processor's instructions can be used.
+ */
+static void pv__digest_setup(void)
+{
+	uint32_t idx;
+	unsigned int slice;
+
+	if (pv__digest_ready)
+		return;
+	pv__digest_ready = true;
+
+	for (idx = 0; idx < 256; idx++) {
+		uint32_t crc = idx;
+		unsigned int bit;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ ((0 != (crc & 1)) ? 0x82F63B78 : 0);
+		pv__crc32c_table[0][idx] = crc;
+	}
+	for (idx = 0; idx < 256; idx++) {
+		for (slice = 1; slice < 8; slice++) {
+			uint32_t prev = pv__crc32c_table[slice - 1][idx];
+			pv__crc32c_table[slice][idx] = (prev >> 8) ^ pv__crc32c_table[0][prev & 0xff];
+		}
+	}
+
+#ifdef HAVE_X86_HASH_INSTRUCTIONS
+	{
+		unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+		if (0 == __get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			return;
+		pv__digest_have_crc32 = (0 != (ecx & bit_SSE4_2)) ? true : false;
+		if ((0 == (ecx & bit_SSSE3)) || (0 == (ecx & bit_SSE4_1)))
+			return;
+		if (__get_cpuid_max(0, NULL) < 7)
+			return;
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		/* EBX bit 29 of leaf 7 is the SHA extensions. */
+		pv__digest_have_sha = (0 != (ebx & (1U << 29))) ? true : false;
+	}
+#endif				/* HAVE_X86_HASH_INSTRUCTIONS */
+
+	debug("%s: %s=%s, %s=%s", "digest instructions", "crc32", pv__digest_have_crc32 ? "yes" : "no", "sha",
+	      pv__digest_have_sha ? "yes" : "no");
+}
+
+
+static uint64_t pv__digest_load64le(const unsigned char *p)
+{
+	return ((uint64_t) p[0]) | ((uint64_t) p[1] << 8) | ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24)
+	    | ((uint64_t) p[4] << 32) | ((uint64_t) p[5] << 40) | ((uint64_t) p[6] << 48) | ((uint64_t) p[7] << 56);
+}
+
+
+static uint32_t pv__digest_load32le(const unsigned char *p)
+{
+	return ((uint32_t) p[0]) | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+/*
+ * Add "length" bytes to a CRC32C, eight bytes at a time using the tables.
+ */
+static uint32_t pv__crc32c_soft(uint32_t crc, const unsigned char *data, size_t length)
+{
+	while (length >= 8) {
+		uint32_t one = crc ^ pv__digest_load32le(data);
+		uint32_t two = pv__digest_load32le(data + 4);
+		crc = pv__crc32c_table[7][one & 0xff] ^ pv__crc32c_table[6][(one >> 8) & 0xff]
+		    ^ pv__crc32c_table[5][(one >> 16) & 0xff] ^ pv__crc32c_table[4][one >> 24]
+		    ^ pv__crc32c_table[3][two & 0xff] ^ pv__crc32c_table[2][(two >> 8) & 0xff]
+		    ^ pv__crc32c_table[1][(two >> 16) & 0xff] ^ pv__crc32c_table[0][two >> 24];
+		data += 8;
+		length -= 8;
+	}
+	while (length > 0) {
+		crc = pv__crc32c_table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+		data++;
+		length--;
+	}
+	return crc;
+}
+
+
+/*
+ * Run SHA-256 over "blocks" 64-byte blocks of "data".
+ */
+static void pv__sha256_soft(uint32_t *hash, const unsigned char *data, size_t blocks)
+{
+	while (blocks > 0) {
+		uint32_t w[64];
+		uint32_t a, b, c, d, e, f, g, h;
+		unsigned int idx;
+
+		for (idx = 0; idx < 16; idx++) {
+			w[idx] = ((uint32_t) data[4 * idx] << 24) | ((uint32_t) data[4 * idx + 1] << 16)
+			    | ((uint32_t) data[4 * idx + 2] << 8) | ((uint32_t) data[4 * idx + 3]);
+		}
+		for (idx = 16; idx < 64; idx++) {
+			uint32_t s0, s1;
+			s0 = PV_ROTR32(w[idx - 15], 7) ^ PV_ROTR32(w[idx - 15], 18) ^ (w[idx - 15] >> 3);
+			s1 = PV_ROTR32(w[idx - 2], 17) ^ PV_ROTR32(w[idx - 2], 19) ^ (w[idx - 2] >> 10);
+			w[idx] = w[idx - 16] + s0 + w[idx - 7] + s1;
+		}
+
+		a = hash[0];
+		b = hash[1];
+		c = hash[2];
+		d = hash[3];
+		e = hash[4];
+		f = hash[5];
+		g = hash[6];
+		h = hash[7];
+
+		for (idx = 0; idx < 64; idx++) {
+			uint32_t t1, t2;
+			t1 = h + (PV_ROTR32(e, 6) ^ PV_ROTR32(e, 11) ^ PV_ROTR32(e, 25)) + ((e & f) ^ ((~e) & g))
+			    + pv__sha256_k[idx] + w[idx];
+			t2 = (PV_ROTR32(a, 2) ^ PV_ROTR32(a, 13) ^ PV_ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		hash[0] += a;
+		hash[1] += b;
+		hash[2] += c;
+		hash[3] += d;
+		hash[4] += e;
+		hash[5] += f;
+		hash[6] += g;
+		hash[7] += h;
+
+		data += 64;
+		blocks--;
+	}
+}
+
+
+#ifdef HAVE_X86_HASH_INSTRUCTIONS
+/*
+ * Add "length" bytes to a CRC32C with the SSE4.2 CRC32 instruction.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t pv__crc32c_x86(uint32_t crc, const unsigned char *data, size_t length)
+{
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	while (length >= 8) {
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		data += 8;
+		length -= 8;
+	}
+	crc = (uint32_t) crc64;
+#endif				/* __x86_64__ */
+	while (length >= 4) {
+		uint32_t word;
+		memcpy(&word, data, 4);
+		crc = _mm_crc32_u32(crc, word);
+		data += 4;
+		length -= 4;
+	}
+	while (length > 0) {
+		crc = _mm_crc32_u8(crc, *data);
+		data++;
+		length--;
+	}
+	return crc;
+}
+
+
+/*
+ * Run SHA-256 over "blocks" 64-byte blocks of "data" with the SHA
+ * extensions.  Each pass of the inner loop does four rounds, and works out
+ * the message words for later rounds as it goes; the state is held as
+ * ABEF and CDGH, as the instructions need it.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void pv__sha256_x86(uint32_t *hash, const unsigned char *data, size_t blocks)
+{
+	const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+	__m128i state0, state1, tmp;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (&hash[0])), 0xB1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (&hash[4])), 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	while (blocks > 0) {
+		__m128i msg[4], saved0, saved1, words;
+		unsigned int group;
+
+		saved0 = state0;
+		saved1 = state1;
+
+		for (group = 0; group < 16; group++) {
+			unsigned int cur = group % 4;
+
+			if (group < 4)
+				msg[cur] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * group)),
+							    byte_swap);
+
+			words = _mm_add_epi32(msg[cur], _mm_loadu_si128((const __m128i *) (&pv__sha256_k[4 * group])));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, words);
+
+			if ((group >= 3) && (group <= 14)) {
+				unsigned int next = (group + 1) % 4;
+				tmp = _mm_alignr_epi8(msg[cur], msg[(group + 3) % 4], 4);
+				msg[next] = _mm_sha256msg2_epu32(_mm_add_epi32(msg[next], tmp), msg[cur]);
+			}
+
+			words = _mm_shuffle_epi32(words, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, words);
+
+			if ((group >= 1) && (group <= 12)) {
+				unsigned int prev = (group + 3) % 4;
+				msg[prev] = _mm_sha256msg1_epu32(msg[prev], msg[cur]);
+			}
+		}
+
+		state0 = _mm_add_epi32(state0, saved0);
+		state1 = _mm_add_epi32(state1, saved1);
+
+		data += 64;
+		blocks--;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *) (&hash[0]), state0);
+	_mm_storeu_si128((__m128i *) (&hash[4]), state1);
+}
+#endif				/* HAVE_X86_HASH_INSTRUCTIONS */
+
+
+static uint64_t pv__xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * PV_XXH64_PRIME2;
+	acc = PV_ROTL64(acc, 31);
+	return acc * PV_XXH64_PRIME1;
+}
+
+
+static uint64_t pv__xxh64_merge(uint64_t acc, uint64_t value)
+{
+	acc ^= pv__xxh64_round(0, value);
+	return acc * PV_XXH64_PRIME1 + PV_XXH64_PRIME4;
+}
+
+
+/*
+ * Run XXH64 over "stripes" 32-byte stripes of "data".
+ */
+static void pv__xxh64_stripes(uint64_t *acc, const unsigned char *data, size_t stripes)
+{
+	uint64_t v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+
+	while (stripes > 0) {
+		v1 = pv__xxh64_round(v1, pv__digest_load64le(data));
+		v2 = pv__xxh64_round(v2, pv__digest_load64le(data + 8));
+		v3 = pv__xxh64_round(v3, pv__digest_load64le(data + 16));
+		v4 = pv__xxh64_round(v4, pv__digest_load64le(data + 24));
+		data += 32;
+		stripes--;
+	}
+
+	acc[0] = v1;
+	acc[1] = v2;
+	acc[2] = v3;
+	acc[3] = v4;
+}
+
+
+/*
+ * Add whole blocks of "data" to a block-based digest.
+ */
+static void pv__digest_blocks(struct pvdigest_s *digest, const unsigned char *data, size_t blocks)
+{
+	if (PV_HASH_XXH64 == digest->algorithm) {
+		pv__xxh64_stripes(digest->value.xxh64, data, blocks);
+		return;
+	}
+#ifdef HAVE_X86_HASH_INSTRUCTIONS
+	if (pv__digest_have_sha) {
+		pv__sha256_x86(digest->value.sha256, data, blocks);
+		return;
+	}
+#endif
+	pv__sha256_soft(digest->value.sha256, data, blocks);
+}
+
+
+/*
+ * Return the name of the given PV_HASH_* algorithm.
+ */
+/*@observer@ */
+const char *pv_digest_name(unsigned int algorithm)
+{
+	switch (algorithm) {
+	case PV_HASH_CRC32C:
+		return "crc32c";
+	case PV_HASH_XXH64:
+		return "xxh64";
+	case PV_HASH_SHA256:
+		return "sha256";
+	default:
+		break;
+	}
+	return "?";
+}
+
+
+/*
+ * Return the length of the digests for the given PV_HASH_* bitmask as
+ * hex, separated by spaces - the width of %{digest}.
+ */
+size_t pv_digest_text_length(unsigned int algorithms)
+{
+	size_t length = 0;
+
+	if (0 != (algorithms & PV_HASH_CRC32C))
+		length += 9;
+	if (0 != (algorithms & PV_HASH_XXH64))
+		length += 17;
+	if (0 != (algorithms & PV_HASH_SHA256))
+		length += 65;
+
+	return length > 0 ? length - 1 : 0;
+}
+
+
+/*
+ * Start a new digest using the given PV_HASH_* algorithm.
+ */
+void pv_digest_init(struct pvdigest_s *digest, unsigned int algorithm)
+{
+	pv__digest_setup();
+
+	memset(digest, 0, sizeof(*digest));
+	digest->algorithm = algorithm;
+
+	switch (algorithm) {
+	case PV_HASH_CRC32C:
+		digest->value.crc32c = 0xFFFFFFFF;
+		break;
+	case PV_HASH_XXH64:
+		digest->value.xxh64[0] = PV_XXH64_PRIME1 + PV_XXH64_PRIME2;
+		digest->value.xxh64[1] = PV_XXH64_PRIME2;
+		digest->value.xxh64[2] = 0;
+		digest->value.xxh64[3] = 0 - PV_XXH64_PRIME1;
+		break;
+	case PV_HASH_SHA256:
+		digest->value.sha256[0] = 0x6a09e667;
+		digest->value.sha256[1] = 0xbb67ae85;
+		digest->value.sha256[2] = 0x3c6ef372;
+		digest->value.sha256[3] = 0xa54ff53a;
+		digest->value.sha256[4] = 0x510e527f;
+		digest->value.sha256[5] = 0x9b05688c;
+		digest->value.sha256[6] = 0x1f83d9ab;
+		digest->value.sha256[7] = 0x5be0cd19;
+		break;
+	default:
+		break;
+	}
+}
+
+
+/*
+ * Add "length" bytes of "data" to the digest.
+ */
+void pv_digest_update(struct pvdigest_s *digest, const unsigned char *data, size_t length)
+{
+	size_t block_size;
+
+	digest->total += length;
+
+	if (PV_HASH_CRC32C == digest->algorithm) {
+#ifdef HAVE_X86_HASH_INSTRUCTIONS
+		if (pv__digest_have_crc32) {
+			digest->value.crc32c = pv__crc32c_x86(digest->value.crc32c, data, length);
+			return;
+		}
+#endif
+		digest->value.crc32c = pv__crc32c_soft(digest->value.crc32c, data, length);
+		return;
+	}
+
+	block_size = (PV_HASH_XXH64 == digest->algorithm) ? 32 : 64;
+
+	/* Complete any partial block left over from last time. */
+	if (digest->block_bytes > 0) {
+		size_t to_copy = block_size - digest->block_bytes;
+		if (to_copy > length)
+			to_copy = length;
+		memcpy(digest->block + digest->block_bytes, data, to_copy);
+		digest->block_bytes += to_copy;
+		data += to_copy;
+		length -= to_copy;
+		if (digest->block_bytes < block_size)
+			return;
+		pv__digest_blocks(digest, digest->block, 1);
+		digest->block_bytes = 0;
+	}
+
+	/* Hash whole blocks straight from the data. */
+	if (length >= block_size) {
+		size_t blocks = length / block_size;
+		pv__digest_blocks(digest, data, blocks);
+		data += blocks * block_size;
+		length -= blocks * block_size;
+	}
+
+	/* Keep the rest for next time. */
+	if (length > 0) {
+		memcpy(digest->block, data, length);
+		digest->block_bytes = length;
+	}
+}
+
+
+/*
+ * Finish the digest, and write it into "buffer" in hex.  The digest can't
+ * be added to afterwards.
+ */
+void pv_digest_hex(struct pvdigest_s *digest, char *buffer, size_t buffer_size)
+{
+	const unsigned char *tail;
+	uint64_t xxh;
+	size_t remaining;
+	unsigned int idx;
+
+	if (buffer_size < 1)
+		return;
+	buffer[0] = '\0';
+
+	switch (digest->algorithm) {
+	case PV_HASH_CRC32C:
+		(void) pv_snprintf(buffer, buffer_size, "%08lx",
+				   (unsigned long) (digest->value.crc32c ^ 0xFFFFFFFF));
+		break;
+
+	case PV_HASH_XXH64:
+		if (digest->total >= 32) {
+			uint64_t *v = digest->value.xxh64;
+			xxh = PV_ROTL64(v[0], 1) + PV_ROTL64(v[1], 7) + PV_ROTL64(v[2], 12) + PV_ROTL64(v[3], 18);
+			xxh = pv__xxh64_merge(xxh, v[0]);
+			xxh = pv__xxh64_merge(xxh, v[1]);
+			xxh = pv__xxh64_merge(xxh, v[2]);
+			xxh = pv__xxh64_merge(xxh, v[3]);
+		} else {
+			xxh = PV_XXH64_PRIME5;
+		}
+		xxh += digest->total;
+
+		tail = digest->block;
+		remaining = digest->block_bytes;
+		while (remaining >= 8) {
+			xxh ^= pv__xxh64_round(0, pv__digest_load64le(tail));
+			xxh = PV_ROTL64(xxh, 27) * PV_XXH64_PRIME1 + PV_XXH64_PRIME4;
+			tail += 8;
+			remaining -= 8;
+		}
+		if (remaining >= 4) {
+			xxh ^= (uint64_t) (pv__digest_load32le(tail)) * PV_XXH64_PRIME1;
+			xxh = PV_ROTL64(xxh, 23) * PV_XXH64_PRIME2 + PV_XXH64_PRIME3;
+			tail += 4;
+			remaining -= 4;
+		}
+		while (remaining > 0) {
+			xxh ^= (uint64_t) (*tail) * PV_XXH64_PRIME5;
+			xxh = PV_ROTL64(xxh, 11) * PV_XXH64_PRIME1;
+			tail++;
+			remaining--;
+		}
+
+		xxh ^= xxh >> 33;
+		xxh *= PV_XXH64_PRIME2;
+		xxh ^= xxh >> 29;
+		xxh *= PV_XXH64_PRIME3;
+		xxh ^= xxh >> 32;
+
+		(void) pv_snprintf(buffer, buffer_size, "%016llx", (unsigned long long) xxh);
+		break;
+
+	case PV_HASH_SHA256:
+		{
+			uint64_t bits = digest->total * 8;
+
+			/* Pad to 56 bytes into a block, then add the length. */
+			digest->block[digest->block_bytes++] = 0x80;
+			if (digest->block_bytes > 56) {
+				memset(digest->block + digest->block_bytes, 0, 64 - digest->block_bytes);
+				pv__digest_blocks(digest, digest->block, 1);
+				digest->block_bytes = 0;
+			}
+			memset(digest->block + digest->block_bytes, 0, 56 - digest->block_bytes);
+			for (idx = 0; idx < 8; idx++)
+				digest->block[56 + idx] = (unsigned char) (bits >> (56 - 8 * idx));
+			pv__digest_blocks(digest, digest->block, 1);
+			digest->block_bytes = 0;
+
+			for (idx = 0; idx < 8 && (idx * 8 + 8) < buffer_size; idx++) {
+				(void) pv_snprintf(buffer + idx * 8, buffer_size - idx * 8, "%08lx",
+						   (unsigned long) (digest->value.sha256[idx]));
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+}
@@ -0,0 +1,635 @@
+/*
+ * The total size of the files under a directory, for "--size @DIR".
+ *
+ * With threads, several workers walk the tree at once, each taking the
+ * next directory from a shared queue, reading its entries, and adding up
+ * the sizes of the regular files in it with one statx() - or fstatat() -
+ * per file, relative to the open directory.  The type of each entry comes
+ * from readdir() where the filesystem gives it, so that directories and
+ * anything else that isn't a regular file are never stat()ed.  On a
+ * network filesystem, where each of these is a round trip to the server,
+ * it is having several in flight at once that makes the walk quicker.
+ *
+ * The transfer does not wait for the walk: if it hasn't finished after
+ * PV_DIRSIZE_START_WAIT, the transfer starts anyway, with the total so far
+ * as an estimate of the size, which pv_dirsize_update() keeps up to date
+ * until the walk is complete.
+ *
+ * Without threads, the tree is walked with nftw() before the transfer.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef PV_DIRSIZE_THREADED
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#elif defined(HAVE_NFTW)
+#ifdef HAVE_FTW_H
+#include <ftw.h>
+#endif
+#endif
+
+
+#ifdef PV_DIRSIZE_THREADED
+
+/* Number of files to add up before adding them to the shared total. */
+#define PV_DIRSIZE_BATCH	1024
+
+/*
+ * The directory tree walk.  Directories waiting to be read are kept as
+ * full paths, rather than as open descriptors, so that a wide tree can't
+ * use up the descriptor limit.  They are taken from the end of the queue,
+ * so the walk goes depth-first and the queue stays short.
+ *
+ * Everything marked "shared" is accessed with atomic builtins.
+ */
+struct pvdirsize_s {
+	pthread_t threads[PV_DIRSIZE_THREADS];
+	unsigned int thread_count;		/* number of threads started */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;			/* signalled when the queue or "busy" changes */
+
+	/* Protected by the mutex. */
+	/*@only@ */ char **queue;		/* directories waiting to be read */
+	size_t queue_length;			/* number of directories in the queue */
+	size_t queue_size;			/* allocated size of the queue */
+	unsigned int busy;			/* number of workers reading a directory */
+	bool stop;				/* set to make the workers give up */
+
+	/* Shared. */
+	unsigned long long total_bytes;		/* size of all files found so far */
+	unsigned long long file_count;		/* number of files found so far */
+	bool finished;				/* set when the whole tree has been read */
+};
+
+
+/*
+ * Add the "count" directories in "paths" to the end of the queue, taking
+ * over the strings.  Returns false, leaving the strings with the caller,
+ * if the queue could not be extended.
+ *
+ * Must be called with the mutex held.
+ */
+static bool pv__dirsize_queue_add(pvdirsize_t dirsize, char **paths, size_t count)
+{
+	if (dirsize->queue_length + count > dirsize->queue_size) {
+		size_t new_size;
+		char **new_queue;
+
+		new_size = 2 * dirsize->queue_size;
+		if (new_size < dirsize->queue_length + count)
+			new_size = dirsize->queue_length + count + 64;
+		new_queue = realloc(dirsize->queue, new_size * sizeof(char *));
+		if (NULL == new_queue)
+			return false;
+		dirsize->queue = new_queue;
+		dirsize->queue_size = new_size;
+	}
+
+	memcpy(dirsize->queue + dirsize->queue_length, paths, count * sizeof(char *));	/* flawfinder: ignore */
+	/* flawfinder - the queue was extended to fit, above. */
+	dirsize->queue_length += count;
+
+	return true;
+}
+
+
+/*
+ * Return a newly allocated "parent/name", or NULL on error.
+ */
+/*@null@ */
+/*@only@ */
+static char *pv__dirsize_join(const char *parent, const char *name)
+{
+	size_t parent_length, name_length;
+	char *path;
+
+	parent_length = strlen(parent);	/* flawfinder: ignore */
+	name_length = strlen(name);	/* flawfinder: ignore */
+	/* flawfinder - both are null-terminated, from the queue or readdir(). */
+
+	path = malloc(parent_length + name_length + 2);
+	if (NULL == path)
+		return NULL;
+
+	memcpy(path, parent, parent_length);	/* flawfinder: ignore */
+	if ((parent_length > 0) && ('/' != parent[parent_length - 1]))
+		path[parent_length++] = '/';
+	memcpy(path + parent_length, name, name_length + 1);	/* flawfinder: ignore */
+	/* flawfinder - the allocation covers both parts, the separator, and the terminator. */
+
+	return path;
+}
+
+
+/*
+ * Look up the entry "name" in the directory open as "dir_fd", without
+ * following symbolic links or triggering automounts, storing its type in
+ * "*mode" and its size in "*size"; returns false on error.
+ */
+static bool pv__dirsize_stat(int dir_fd, const char *name, mode_t *mode, off_t *size)
+{
+#if defined(HAVE_STATX) && defined(STATX_SIZE)
+	struct statx stx;
+	int flags = AT_SYMLINK_NOFOLLOW;
+
+#ifdef AT_NO_AUTOMOUNT
+	flags |= AT_NO_AUTOMOUNT;
+#endif
+
+	/* Only the type and size are needed, so ask for nothing else. */
+	memset(&stx, 0, sizeof(stx));
+	if (0 != statx(dir_fd, name, flags, STATX_TYPE | STATX_SIZE, &stx))
+		return false;
+	*mode = (mode_t) (stx.stx_mode);
+	*size = (off_t) (stx.stx_size);
+#else
+	struct stat sb;
+
+	memset(&sb, 0, sizeof(sb));
+	if (0 != fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW))
+		return false;
+	*mode = sb.st_mode;
+	*size = sb.st_size;
+#endif
+	return true;
+}
+
+
+/*
+ * Read the directory "path", adding the sizes of the regular files in it
+ * to the total, and adding its subdirectories to the queue.  Directories
+ * that can't be read are skipped, as nftw() would skip them.
+ */
+static void pv__dirsize_read(pvdirsize_t dirsize, const char *path)
+{
+	char **subdirs;
+	size_t subdir_count, subdir_size, idx;
+	unsigned long long bytes, files;
+	struct dirent *entry;
+	DIR *dir;
+	int fd, flags;
+
+	flags = O_RDONLY | O_DIRECTORY;
+#ifdef O_CLOEXEC
+	flags |= O_CLOEXEC;
+#endif
+	fd = open(path, flags);		/* flawfinder: ignore */
+	/* flawfinder - only read, to list its entries, and the tree is the operator's choice. */
+	if (fd < 0) {
+		debug("%s: %s", path, strerror(errno));
+		return;
+	}
+
+	dir = fdopendir(fd);
+	if (NULL == dir) {
+		debug("%s: %s: %s", path, "fdopendir", strerror(errno));
+		(void) close(fd);
+		return;
+	}
+
+	subdirs = NULL;
+	subdir_count = 0;
+	subdir_size = 0;
+	bytes = 0;
+	files = 0;
+
+	while ((NULL != (entry = readdir(dir))) && !__atomic_load_n(&(dirsize->stop), __ATOMIC_SEQ_CST)) {
+		const char *name = entry->d_name;
+		bool is_dir = false;
+		mode_t mode;
+		off_t size;
+
+		if (('.' == name[0]) && (('\0' == name[1]) || (('.' == name[1]) && ('\0' == name[2]))))
+			continue;
+
+#ifdef DT_DIR
+		if (DT_DIR == entry->d_type) {
+			is_dir = true;
+		} else if ((DT_REG != entry->d_type) && (DT_UNKNOWN != entry->d_type)) {
+			/* Symbolic links, devices, and so on - not counted. */
+			continue;
+		}
+#endif
+
+		if (!is_dir) {
+			mode = 0;
+			size = 0;
+			if (!pv__dirsize_stat(dirfd(dir), name, &mode, &size))
+				continue;
+			if (S_ISDIR(mode)) {
+				is_dir = true;
+			} else if (S_ISREG(mode)) {
+				bytes += (unsigned long long) size;
+				files++;
+				if (files >= PV_DIRSIZE_BATCH) {
+					__atomic_add_fetch(&(dirsize->total_bytes), bytes, __ATOMIC_SEQ_CST);
+					__atomic_add_fetch(&(dirsize->file_count), files, __ATOMIC_SEQ_CST);
+					bytes = 0;
+					files = 0;
+				}
+				continue;
+			} else {
+				continue;
+			}
+		}
+
+		/* A subdirectory - keep it to add to the queue at the end. */
+		if (subdir_count >= subdir_size) {
+			char **new_subdirs;
+			subdir_size = subdir_size < 16 ? 16 : 2 * subdir_size;
+			new_subdirs = realloc(subdirs, subdir_size * sizeof(char *));
+			if (NULL == new_subdirs) {
+				debug("%s: %s", "subdirectory list allocation failed", strerror(errno));
+				break;
+			}
+			subdirs = new_subdirs;
+		}
+		subdirs[subdir_count] = pv__dirsize_join(path, name);
+		if (NULL != subdirs[subdir_count])
+			subdir_count++;
+	}
+
+	(void) closedir(dir);
+
+	__atomic_add_fetch(&(dirsize->total_bytes), bytes, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&(dirsize->file_count), files, __ATOMIC_SEQ_CST);
+
+	if (subdir_count > 0) {
+		bool added;
+
+		(void) pthread_mutex_lock(&(dirsize->mutex));
+		added = pv__dirsize_queue_add(dirsize, subdirs, subdir_count);
+		if (added)
+			(void) pthread_cond_broadcast(&(dirsize->cond));
+		(void) pthread_mutex_unlock(&(dirsize->mutex));
+
+		if (!added) {
+			debug("%s: %s", "directory queue allocation failed", strerror(errno));
+			for (idx = 0; idx < subdir_count; idx++)
+				free(subdirs[idx]);
+		}
+	}
+
+	if (NULL != subdirs)
+		free(subdirs);
+}
+
+
+/*
+ * Worker thread: read directories from the queue until there are none
+ * left and no other worker is reading one (which might add more), or the
+ * walk is being stopped.
+ */
+static void *pv__dirsize_worker(void *arg)
+{
+	pvdirsize_t dirsize = (pvdirsize_t) arg;
+
+	(void) pthread_mutex_lock(&(dirsize->mutex));
+
+	while (!dirsize->stop) {
+		char *path;
+
+		if (0 == dirsize->queue_length) {
+			if (0 == dirsize->busy)
+				break;
+			(void) pthread_cond_wait(&(dirsize->cond), &(dirsize->mutex));
+			continue;
+		}
+
+		dirsize->queue_length--;
+		path = dirsize->queue[dirsize->queue_length];
+		dirsize->busy++;
+		(void) pthread_mutex_unlock(&(dirsize->mutex));
+
+		pv__dirsize_read(dirsize, path);
+		free(path);
+
+		(void) pthread_mutex_lock(&(dirsize->mutex));
+		dirsize->busy--;
+	}
+
+	if ((!dirsize->stop) && (0 == dirsize->queue_length) && (0 == dirsize->busy)
+	    && (!__atomic_load_n(&(dirsize->finished), __ATOMIC_SEQ_CST))) {
+		__atomic_store_n(&(dirsize->finished), true, __ATOMIC_SEQ_CST);
+		debug("%s: %llu %s, %llu %s", "directory walk finished",
+		      __atomic_load_n(&(dirsize->file_count), __ATOMIC_SEQ_CST), "files",
+		      __atomic_load_n(&(dirsize->total_bytes), __ATOMIC_SEQ_CST), "bytes");
+	}
+
+	/* Wake the others, and anyone waiting for the walk to finish. */
+	(void) pthread_cond_broadcast(&(dirsize->cond));
+	(void) pthread_mutex_unlock(&(dirsize->mutex));
+
+	return NULL;
+}
+
+
+/*
+ * Stop the worker threads and free the directory tree walk.
+ */
+void pv_dirsize_free( /*@only@ */ pvdirsize_t dirsize)
+{
+	unsigned int idx;
+	size_t queue_idx;
+
+	if (NULL == dirsize)
+		return;
+
+	(void) pthread_mutex_lock(&(dirsize->mutex));
+	__atomic_store_n(&(dirsize->stop), true, __ATOMIC_SEQ_CST);
+	(void) pthread_cond_broadcast(&(dirsize->cond));
+	(void) pthread_mutex_unlock(&(dirsize->mutex));
+
+	for (idx = 0; idx < dirsize->thread_count; idx++) {
+		(void) pthread_join(dirsize->threads[idx], NULL);
+	}
+
+	for (queue_idx = 0; queue_idx < dirsize->queue_length; queue_idx++) {
+		free(dirsize->queue[queue_idx]);
+	}
+	if (NULL != dirsize->queue)
+		free(dirsize->queue);
+
+	(void) pthread_cond_destroy(&(dirsize->cond));
+	(void) pthread_mutex_destroy(&(dirsize->mutex));
+
+	free(dirsize);
+}
+
+
+/*
+ * Start walking the directory tree under "path" in the background.
+ * Returns NULL, with errno set, if the directory can't be read or the
+ * walk couldn't be started.
+ */
+/*@null@ */
+/*@only@ */
+static pvdirsize_t pv__dirsize_start(const char *path)
+{
+	pvdirsize_t dirsize;
+	sigset_t all_signals, old_signals;
+	char *root;
+	int fd, rc;
+
+	/* Report an unreadable top directory now, rather than skipping it. */
+	fd = open(path, O_RDONLY | O_DIRECTORY);	/* flawfinder: ignore */
+	/* flawfinder - only opened to check that it can be. */
+	if (fd < 0)
+		return NULL;
+	(void) close(fd);
+
+	dirsize = calloc(1, sizeof(*dirsize));
+	if (NULL == dirsize)
+		return NULL;
+
+	root = pv_strdup(path);
+	if ((NULL == root) || (0 != pthread_mutex_init(&(dirsize->mutex), NULL))) {
+		if (NULL != root)
+			free(root);
+		free(dirsize);
+		return NULL;
+	}
+	if (0 != pthread_cond_init(&(dirsize->cond), NULL)) {
+		(void) pthread_mutex_destroy(&(dirsize->mutex));
+		free(root);
+		free(dirsize);
+		return NULL;
+	}
+	if (!pv__dirsize_queue_add(dirsize, &root, 1)) {
+		free(root);
+		pv_dirsize_free(dirsize);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* Signals are always handled by the main thread - see pv_linecount_start(). */
+	(void) sigfillset(&all_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+	rc = 0;
+	while (dirsize->thread_count < PV_DIRSIZE_THREADS) {
+		rc = pthread_create(&(dirsize->threads[dirsize->thread_count]), NULL, pv__dirsize_worker, dirsize);
+		if (0 != rc)
+			break;
+		dirsize->thread_count++;
+	}
+
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 == dirsize->thread_count) {
+		pv_dirsize_free(dirsize);
+		errno = 0 == rc ? EINVAL : rc;
+		return NULL;
+	}
+
+	debug("%s: %s: %u %s", "directory walk started", path, dirsize->thread_count, "threads");
+
+	return dirsize;
+}
+
+
+/*
+ * Wait for the directory tree walk to finish, for up to "nsec"
+ * nanoseconds, or for as long as it takes if "nsec" is negative.
+ */
+static void pv__dirsize_wait(pvdirsize_t dirsize, long long nsec)
+{
+	struct timespec deadline;
+
+	memset(&deadline, 0, sizeof(deadline));
+	if (nsec >= 0) {
+		(void) clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += (time_t) (nsec / 1000000000LL);
+		deadline.tv_nsec += (long) (nsec % 1000000000LL);
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	(void) pthread_mutex_lock(&(dirsize->mutex));
+	while (!__atomic_load_n(&(dirsize->finished), __ATOMIC_SEQ_CST)) {
+		if (nsec < 0) {
+			(void) pthread_cond_wait(&(dirsize->cond), &(dirsize->mutex));
+		} else if (ETIMEDOUT == pthread_cond_timedwait(&(dirsize->cond), &(dirsize->mutex), &deadline)) {
+			break;
+		}
+	}
+	(void) pthread_mutex_unlock(&(dirsize->mutex));
+}
+
+
+/*
+ * Check on the directory tree walk in state->files.dirsize, if there is
+ * one, and update state->control.size - with the full total if the walk
+ * has finished, or the total so far as an estimate if it hasn't.  The
+ * estimate is never less than what has already been transferred.
+ *
+ * If "final_update" is true, the transfer has finished, so the walk is
+ * abandoned if it is still running.
+ */
+void pv_dirsize_update(pvstate_t state, bool final_update)
+{
+	pvdirsize_t dirsize;
+	off_t total;
+
+	dirsize = state->files.dirsize;
+	if (NULL == dirsize)
+		return;
+
+	total = (off_t) __atomic_load_n(&(dirsize->total_bytes), __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&(dirsize->finished), __ATOMIC_SEQ_CST)) {
+		state->control.size = total;
+		state->control.size_estimated = false;
+		pv_dirsize_free(dirsize);
+		state->files.dirsize = NULL;
+		return;
+	}
+
+	if ((!state->control.linemode) && (total < state->transfer.transferred))
+		total = state->transfer.transferred;
+	state->control.size = total;
+
+	if (final_update) {
+		debug("%s: %lld", "transfer finished before directory walk - using total so far", (long long) total);
+		state->control.size_estimated = false;
+		pv_dirsize_free(dirsize);
+		state->files.dirsize = NULL;
+		return;
+	}
+
+	state->control.size_estimated = true;
+}
+
+#else				/* !PV_DIRSIZE_THREADED */
+
+void pv_dirsize_update( /*@unused@ */  __attribute__((unused)) pvstate_t state,
+		       /*@unused@ */  __attribute__((unused)) bool final_update)
+{
+}
+
+void pv_dirsize_free( /*@unused@ */  __attribute__((unused)) pvdirsize_t dirsize)
+{
+}
+
+#ifdef HAVE_NFTW
+/*
+ * Callback function for nftw() to add the size of the given file to the
+ * total size so far.
+ */
+static off_t dir_tree_file_size_so_far = 0;
+static int dir_tree_total_file_size( /*@unused@ */  __attribute__((unused))
+				    const char *fpath, const struct stat *sb, int typeflag,	/*@unused@ */
+				    __attribute__((unused))
+				    struct FTW *ftwbuf)
+{
+	if (typeflag != FTW_F)
+		return 0;
+	if (NULL == sb)
+		return 0;
+	dir_tree_file_size_so_far += (off_t) (sb->st_size);
+	return 0;
+}
+#endif				/* HAVE_NFTW */
+
+#endif				/* !PV_DIRSIZE_THREADED */
+
+
+/*
+ * Set the total size to the sum of the sizes of all regular files under
+ * the directory "path", returning the size, or -1 on error (which is
+ * reported).
+ *
+ * If "background" is true and the walk hasn't finished after
+ * PV_DIRSIZE_START_WAIT, it carries on while the main loop runs, and the
+ * size returned, and set, is the total so far.  This is not done with
+ * --stop-at-size, since there the total is used as a hard limit.
+ */
+off_t pv_state_size_directory(pvstate_t state, const char *path, bool background)
+{
+#ifdef PV_DIRSIZE_THREADED
+	pvdirsize_t dirsize;
+	off_t total;
+
+	if (NULL != state->files.dirsize)
+		pv_dirsize_free(state->files.dirsize);
+	state->files.dirsize = NULL;
+
+	dirsize = pv__dirsize_start(path);
+	if (NULL == dirsize) {
+		pv_error("%s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	pv__dirsize_wait(dirsize, (background && !state->control.stop_at_size) ? PV_DIRSIZE_START_WAIT : -1);
+
+	total = (off_t) __atomic_load_n(&(dirsize->total_bytes), __ATOMIC_SEQ_CST);
+	state->control.size = total;
+
+	if (__atomic_load_n(&(dirsize->finished), __ATOMIC_SEQ_CST)) {
+		state->control.size_estimated = false;
+		pv_dirsize_free(dirsize);
+		return total;
+	}
+
+	debug("%s: %lld", "directory walk continuing in the background - size so far", (long long) total);
+	state->control.size_estimated = true;
+	state->files.dirsize = dirsize;
+
+	return total;
+#elif defined(HAVE_NFTW)
+	int maxfds, rc_nftw;
+
+	(void) background;
+
+	maxfds = -1;
+#ifdef _POSIX_OPEN_MAX
+	maxfds = _POSIX_OPEN_MAX;
+#endif
+	if (maxfds < 1) {
+		maxfds = (int) sysconf(_SC_OPEN_MAX);
+	}
+
+	dir_tree_file_size_so_far = 0;
+	rc_nftw = nftw(path, dir_tree_total_file_size, maxfds, 0
+#ifdef FTW_PHYS
+		       | FTW_PHYS
+#endif
+	    );
+
+	if (rc_nftw < 0) {
+		pv_error("%s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	state->control.size = dir_tree_file_size_so_far;
+	return dir_tree_file_size_so_far;
+#else				/* !HAVE_NFTW */
+	(void) state;
+	(void) background;
+	/*@-mustfreefresh@ */
+	pv_error("%s: %s", path, _("is a directory"));
+	/*@+mustfreefresh@ */
+	/* splint - see the note about _() in pv_error() callers. */
+	return -1;
+#endif				/* !HAVE_NFTW */
+}
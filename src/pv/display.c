@@ -18,6 +18,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#ifdef HAVE_LOCALE_H
+#include <locale.h>
+#endif
+
 #ifdef HAVE_TERMIOS_H
 #include <termios.h>
 #endif
@@ -58,6 +62,7 @@
 static char pv__error_prefix[64];	 /* flawfinder: ignore */
 static bool pv__error_prefix_set = false;
 static bool pv__output_produced = false;
+static unsigned long pv__error_count = 0;
 
 /*
  * flawfinder rationale: zeroed before use, string copy is bounded to 1 less
@@ -95,6 +100,8 @@ void pv_error(char *format, ...)
 	va_list ap;
 	if (pv__output_produced)
 		fprintf(stderr, "\n");
+	/* The progress line is no longer where pv__display_line() left it. */
+	pv__error_count++;
 	if (pv__error_prefix_set)
 		fprintf(stderr, "%s: ", pv__error_prefix);
 	va_start(ap, format);
@@ -403,6 +410,179 @@ void pv_si_prefix(long double *value, char *prefix, const long double ratio, pvt
 }
 
 
+/*
+ * Append up to "maxbytes" bytes of "string" to "buffer" (max length
+ * "bufsize") at "offset", keeping it \0-terminated, and return the new
+ * offset.
+ */
+static size_t pv__append_string(char *buffer, size_t bufsize, size_t offset, const char *string, size_t maxbytes)
+{
+	size_t idx;
+
+	for (idx = 0; idx < maxbytes && '\0' != string[idx] && offset + 1 < bufsize; idx++)
+		buffer[offset++] = string[idx];
+	if (offset < bufsize)
+		buffer[offset] = '\0';
+
+	return offset;
+}
+
+
+/*
+ * Append the decimal digits of "value" to "buffer" (max length "bufsize")
+ * at "offset", padded with leading zeroes to at least "min_digits" digits,
+ * and return the new offset.  Nothing is added if there is not room for
+ * all of the digits.
+ */
+static size_t pv__append_digits(char *buffer, size_t bufsize, size_t offset, unsigned long value,
+				unsigned int min_digits)
+{
+	char digits[32];		 /* flawfinder: ignore - bounded below */
+	size_t count;
+
+	count = 0;
+	do {
+		digits[count++] = (char) ('0' + (value % 10));
+		value /= 10;
+	} while ((value > 0 || count < (size_t) min_digits) && count < sizeof(digits));
+
+	if (offset + count >= bufsize)
+		return offset;
+
+	while (count > 0)
+		buffer[offset++] = digits[--count];
+	buffer[offset] = '\0';
+
+	return offset;
+}
+
+
+/*
+ * Put a string in "buffer" (max length "bufsize") describing "seconds" as
+ * hours, minutes, and seconds ("H:MM:SS"), with a day count at the start
+ * ("D:HH:MM:SS") if it is more than a day.  Negative values are shown as
+ * zero.
+ *
+ * The timer and ETA call this on every update, so the digits are generated
+ * directly instead of with pv_snprintf().
+ */
+void pv_describe_duration(char *buffer, size_t bufsize, long seconds)
+{
+	size_t offset;
+
+	if (bufsize < 1)
+		return;
+	buffer[0] = '\0';
+
+	if (seconds < 0)
+		seconds = 0;
+
+	offset = 0;
+	if (seconds > 86400L) {
+		offset = pv__append_digits(buffer, bufsize, offset, (unsigned long) (seconds / 86400), 1);
+		offset = pv__append_string(buffer, bufsize, offset, ":", 1);
+		offset = pv__append_digits(buffer, bufsize, offset, (unsigned long) ((seconds / 3600) % 24), 2);
+	} else {
+		offset = pv__append_digits(buffer, bufsize, offset, (unsigned long) (seconds / 3600), 1);
+	}
+	offset = pv__append_string(buffer, bufsize, offset, ":", 1);
+	offset = pv__append_digits(buffer, bufsize, offset, (unsigned long) ((seconds / 60) % 60), 2);
+	offset = pv__append_string(buffer, bufsize, offset, ":", 1);
+	(void) pv__append_digits(buffer, bufsize, offset, (unsigned long) (seconds % 60), 2);
+}
+
+
+/*
+ * Write "value" into "buffer" (max length "bufsize") just as "%4ld" would
+ * if its magnitude is over 99.9, or as "%#4.3Lg" would otherwise, and
+ * return the number of bytes written.
+ *
+ * Returns 0 without writing anything for the values that are left to
+ * pv_snprintf(): those needing an exponent, and those so close to halfway
+ * between two results that the rounding would depend on more precision
+ * than is calculated here.
+ */
+static size_t pv__describe_number(char *buffer, size_t bufsize, long double value)
+{
+	static char decimal_point[8];	 /* flawfinder: ignore - bounded by pv__append_string() */
+	static bool have_decimal_point = false;
+	long double magnitude, fraction;
+	unsigned long scaled, scale;
+	size_t offset;
+	bool negative;
+
+	/*
+	 * The decimal mark comes from the locale, as it would for
+	 * pv_snprintf(); the locale is set up before any display is shown,
+	 * and isn't changed afterwards, so it's only looked up once.
+	 */
+	if (!have_decimal_point) {
+#ifdef HAVE_LOCALE_H
+		struct lconv *locale_info = localeconv();
+		(void) pv__append_string(decimal_point, sizeof(decimal_point), 0,
+					 (NULL == locale_info || NULL == locale_info->decimal_point
+					  || '\0' == locale_info->decimal_point[0]) ? "." : locale_info->decimal_point,
+					 sizeof(decimal_point) - 1);
+#else
+		(void) pv__append_string(decimal_point, sizeof(decimal_point), 0, ".", 1);
+#endif
+		have_decimal_point = true;
+	}
+
+	if (bufsize < 32)
+		return 0;
+
+	negative = value < 0.0;
+	magnitude = negative ? -value : value;
+
+	/* NaN, or too large to hold as an integer. */
+	if (!(magnitude >= 0.0) || magnitude > 1000000000.0)
+		return 0;
+
+	offset = 0;
+
+	if (magnitude > 99.9) {
+		unsigned long whole, remaining;
+		int width;
+
+		whole = (unsigned long) magnitude;
+		width = negative ? 2 : 1;
+		for (remaining = whole; remaining >= 10; remaining /= 10)
+			width++;
+		for (; width < 4; width++)
+			buffer[offset++] = ' ';
+		if (negative)
+			buffer[offset++] = '-';
+		return pv__append_digits(buffer, bufsize, offset, whole, 1);
+	}
+
+	/* Only zero is shown without an exponent below 1. */
+	if (magnitude < 1.0 && magnitude > 0.0)
+		return 0;
+
+	/* Three significant digits: "X.XX" or "XX.X". */
+	scale = magnitude >= 10.0 ? 10 : 100;
+	fraction = magnitude * (long double) scale;
+	scaled = (unsigned long) fraction;
+	fraction -= (long double) scaled;
+	if (fraction > 0.499999 && fraction < 0.500001)
+		return 0;
+	if (fraction >= 0.5)
+		scaled++;
+	if (scaled >= 1000) {
+		/* Rounded up from 9.995 or more, to "10.0". */
+		scaled /= 10;
+		scale = 10;
+	}
+
+	if (negative)
+		buffer[offset++] = '-';
+	offset = pv__append_digits(buffer, bufsize, offset, scaled / scale, 1);
+	offset = pv__append_string(buffer, bufsize, offset, decimal_point, sizeof(decimal_point));
+	return pv__append_digits(buffer, bufsize, offset, scaled % scale, 100 == scale ? 2 : 1);
+}
+
+
 /*
  * Put a string in "buffer" (max length "bufsize") containing "amount"
  * formatted such that it's 3 or 4 digits followed by an SI suffix and then
@@ -414,6 +594,10 @@ void pv_si_prefix(long double *value, char *prefix, const long double ratio, pvt
  *
  * The "format" string is in sprintf format and must contain exactly one %
  * parameter, a %s, which will expand to the string described above.
+ *
+ * Since this is called several times for every display update, the number
+ * is written by pv__describe_number() and the format is expanded here,
+ * with pv_snprintf() only used for the cases those don't cover.
  */
 void pv_describe_amount(char *buffer, size_t bufsize, char *format,
 			long double amount, char *suffix_basic, char *suffix_bytes, pvtransfercount_t count_type)
@@ -423,16 +607,16 @@ void pv_describe_amount(char *buffer, size_t bufsize, char *format,
 	long double divider;
 	long double display_amount;
 	char *suffix;
+	size_t offset, format_idx;
 
 	/*
-	 * flawfinder: sizestr_buffer and si_prefix are explicitly zeroed;
-	 * sizestr_buffer is only ever used with pv_snprintf() along with
-	 * its buffer size; si_prefix is only populated by pv_snprintf()
-	 * along with its size, and by pv_si_prefix() which explicitly only
-	 * needs 3 bytes.
+	 * flawfinder: sizestr_buffer and si_prefix are explicitly
+	 * terminated; sizestr_buffer is only ever written with its buffer
+	 * size; si_prefix is only populated by pv_snprintf() along with its
+	 * size, and by pv_si_prefix() which explicitly only needs 3 bytes.
 	 */
 
-	memset(sizestr_buffer, 0, sizeof(sizestr_buffer));
+	sizestr_buffer[0] = '\0';
 	memset(si_prefix, 0, sizeof(si_prefix));
 
 	(void) pv_snprintf(si_prefix, sizeof(si_prefix), "%s", "  ");
@@ -458,23 +642,49 @@ void pv_describe_amount(char *buffer, size_t bufsize, char *format,
 	if (display_amount < -100000)
 		display_amount = -100000;
 
-	/* Fix for display of "1.01e+03" instead of "1010" */
-	if ((display_amount > 99.9) || (display_amount < -99.9)) {
-		(void) pv_snprintf(sizestr_buffer, sizeof(sizestr_buffer),
-				   "%4ld%.2s%.16s", (long) display_amount, si_prefix, suffix);
-	} else {
-		/*
-		 * AIX breaks with %4.3Lg%.2s%.16s for some reason, so
-		 * instead, display_amount is written separately first.
-		 */
-		char str_disp[64];	 /* flawfinder: ignore - only used with pv_snprintf(). */
-		memset(str_disp, 0, sizeof(str_disp));
-		/* Use '#' to get 13.0GB instead of 13GB for consistency (#1477). */
-		(void) pv_snprintf(str_disp, sizeof(str_disp), "%#4.3Lg", display_amount);
-		(void) pv_snprintf(sizestr_buffer, sizeof(sizestr_buffer), "%s%.2s%.16s", str_disp, si_prefix, suffix);
+	offset = pv__describe_number(sizestr_buffer, sizeof(sizestr_buffer), display_amount);
+
+	if (0 == offset) {
+		/* Fix for display of "1.01e+03" instead of "1010" */
+		if ((display_amount > 99.9) || (display_amount < -99.9)) {
+			(void) pv_snprintf(sizestr_buffer, sizeof(sizestr_buffer), "%4ld", (long) display_amount);
+		} else {
+			/*
+			 * AIX breaks with %4.3Lg%.2s%.16s for some reason,
+			 * so display_amount is written on its own.
+			 */
+			/* Use '#' to get 13.0GB instead of 13GB for consistency (#1477). */
+			(void) pv_snprintf(sizestr_buffer, sizeof(sizestr_buffer), "%#4.3Lg", display_amount);
+		}
+		offset = strlen(sizestr_buffer);	/* flawfinder: ignore */
+		/* flawfinder: always \0-terminated by pv_snprintf(). */
 	}
 
-	(void) pv_snprintf(buffer, bufsize, format, sizestr_buffer);
+	offset = pv__append_string(sizestr_buffer, sizeof(sizestr_buffer), offset, si_prefix, 2);
+	(void) pv__append_string(sizestr_buffer, sizeof(sizestr_buffer), offset, suffix, 16);
+
+	/*
+	 * Expand the format, handing anything other than "%s" and "%%" to
+	 * pv_snprintf().
+	 */
+	if (bufsize < 1)
+		return;
+	buffer[0] = '\0';
+	offset = 0;
+	for (format_idx = 0; '\0' != format[format_idx]; format_idx++) {
+		if ('%' != format[format_idx]) {
+			offset = pv__append_string(buffer, bufsize, offset, &(format[format_idx]), 1);
+		} else if ('s' == format[format_idx + 1]) {
+			offset = pv__append_string(buffer, bufsize, offset, sizestr_buffer, sizeof(sizestr_buffer));
+			format_idx++;
+		} else if ('%' == format[format_idx + 1]) {
+			offset = pv__append_string(buffer, bufsize, offset, "%", 1);
+			format_idx++;
+		} else {
+			(void) pv_snprintf(buffer, bufsize, format, sizestr_buffer);
+			return;
+		}
+	}
 }
 
 
@@ -545,6 +755,10 @@ pvdisplay_bytecount_t pv_formatter_segmentcontent(char *content, pvformatter_arg
 		{ "N", &pv_formatter_name, false },
 		{ "{name}", &pv_formatter_name, false },
 		{ "{sgr:colour,...}", &pv_formatter_sgr, false },
+		{ "{bottleneck}", &pv_formatter_bottleneck, false },
+		{ "{wait-in}", &pv_formatter_wait_in, false },
+		{ "{wait-out}", &pv_formatter_wait_out, false },
+		{ "{digest}", &pv_formatter_digest, false },
 		{ NULL, NULL, false }
 	};
 	return format_component_array;
@@ -627,6 +841,7 @@ static void pv__format_init(pvprogramstatus_t status, readonly_pvcontrol_t contr
 	display->showing_rate = false;
 	display->showing_last_written = false;
 	display->showing_previous_line = false;
+	display->showing_bottleneck = false;
 	display->format_uses_colour = false;
 
 	display_format = NULL == format_supplied ? control->default_format : format_supplied;
@@ -797,6 +1012,8 @@ static void pv__format_init(pvprogramstatus_t status, readonly_pvcontrol_t contr
 		display->format[segment].chosen_size = chosen_size;
 		display->format[segment].string_parameter = string_parameter;
 		display->format[segment].string_parameter_bytes = string_parameter_bytes;
+		display->format[segment].function = NULL;
+		display->format[segment].fixed_width = true;
 
 		if (-1 == component_type) {
 			if (0 == str_bytes)
@@ -816,6 +1033,16 @@ static void pv__format_init(pvprogramstatus_t status, readonly_pvcontrol_t contr
 			display->format[segment].offset = 0;
 			display->format[segment].bytes = 0;
 
+			/*
+			 * Bind the segment directly to its formatter, and
+			 * decide now which pass of pv_format() it belongs
+			 * in, so that the component table isn't consulted
+			 * again until the format next changes.
+			 */
+			display->format[segment].function = format_component_array[component_type].function;
+			if (format_component_array[component_type].dynamic && 0 == chosen_size)
+				display->format[segment].fixed_width = false;
+
 			/*
 			 * Run the formatter function with a zero-sized
 			 * buffer, to invoke its side effects such as
@@ -841,7 +1068,7 @@ static void pv__format_init(pvprogramstatus_t status, readonly_pvcontrol_t contr
 			formatter_info.offset = 0;
 
 			/*@-compmempass@ */
-			(void) format_component_array[component_type].function(&formatter_info);
+			(void) display->format[segment].function(&formatter_info);
 			/*@+compmempass@ */
 			/*
 			 * splint - the formatter_info's buffer is on the
@@ -977,7 +1204,6 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 	       readonly_pvtransfercalc_t calc, /*@null@ */ const char *format_supplied, pvdisplay_t display,
 	       bool reinitialise, bool final)
 {
-	struct pvdisplay_component_s *format_component_array;
 	char display_segments[PV_SIZEOF_FORMAT_SEGMENTS_BUF];	/* flawfinder: ignore - always bounded */
 	size_t segment_idx, dynamic_segment_count;
 	const char *display_format;
@@ -1010,8 +1236,6 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 	formatter_info.transfer = transfer;
 	formatter_info.calc = calc;
 
-	format_component_array = pv__format_components();
-
 	/* Populate the display's "final" flag, for formatters. */
 	display->final_update = final;
 
@@ -1080,22 +1304,15 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 
 	for (segment_idx = 0; segment_idx < display->format_segment_count; segment_idx++) {
 		pvdisplay_segment_t segment;
-		struct pvdisplay_component_s *component;
 		size_t bytes_added;
-		bool fixed_width;
 
 		segment = &(display->format[segment_idx]);
-		if (-1 == segment->type) {
+		if ((-1 == segment->type) || (NULL == segment->function)) {
 			static_portion_width += segment->width;
 			continue;
 		}
-		component = &(format_component_array[segment->type]);
-
-		fixed_width = true;
-		if (component->dynamic && 0 == segment->chosen_size)
-			fixed_width = false;
 
-		if (!fixed_width) {
+		if (!segment->fixed_width) {
 			dynamic_segment_count++;
 			continue;
 		}
@@ -1104,8 +1321,8 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 
 		formatter_info.segment = segment;
 		/*@-compmempass@ */
-		bytes_added = component->function(&formatter_info);
-		/*@+compmempass@ *//* see format_component_array[].function() in pv__format_init(). */
+		bytes_added = segment->function(&formatter_info);
+		/*@+compmempass@ *//* see format[].function() in pv__format_init(). */
 
 		segment->width = 0;
 		if (bytes_added > 0) {
@@ -1137,29 +1354,22 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 
 	for (segment_idx = 0; segment_idx < display->format_segment_count; segment_idx++) {
 		pvdisplay_segment_t segment;
-		struct pvdisplay_component_s *component;
 		size_t bytes_added;
-		bool fixed_width;
 
 		segment = &(display->format[segment_idx]);
-		if (-1 == segment->type) {
+		if ((-1 == segment->type) || (NULL == segment->function)) {
 			static_portion_width += segment->width;
 			continue;
 		}
-		component = &(format_component_array[segment->type]);
-
-		fixed_width = true;
-		if (component->dynamic && 0 == segment->chosen_size)
-			fixed_width = false;
 
-		if (fixed_width)
+		if (segment->fixed_width)
 			continue;
 
 		segment->width = dynamic_segment_width;
 
 		formatter_info.segment = segment;
 		/*@-compmempass@ */
-		bytes_added = component->function(&formatter_info);
+		bytes_added = segment->function(&formatter_info);
 		/*@+compmempass@ *//* see earlier ->function() note. */
 
 		formatter_info.offset += bytes_added;
@@ -1169,7 +1379,7 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 	 * Populate the display buffer from the segments.
 	 */
 
-	memset(display->display_buffer, 0, display->display_buffer_size);
+	display->display_buffer[0] = '\0';
 	display_buffer_offset = 0;
 	display_buffer_remaining = display->display_buffer_size - 1;
 	new_display_string_bytes = 0;
@@ -1202,6 +1412,7 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 		debug("segment[%d]: bytes=%d, width=%d: [%.*s]", segment_idx, segment->bytes, segment->width,
 		      segment->bytes, display->display_buffer + display_buffer_offset - segment->bytes);
 	}
+	display->display_buffer[display_buffer_offset] = '\0';
 
 	/* If the SGR active codes flag is set, emit an SGR reset. */
 	if (display->sgr_code_active) {
@@ -1247,6 +1458,173 @@ bool pv_format(pvprogramstatus_t status, readonly_pvcontrol_t control, readonly_
 }
 
 
+/*
+ * Forget what the terminal line for this display shows, so that the next
+ * update rewrites all of it - for when something else may have been
+ * written over it, or it has moved.
+ */
+void pv_display_invalidate(pvdisplay_t display)
+{
+	display->shown_valid = false;
+}
+
+
+/*
+ * Write the display buffer to the terminal as the current line, followed
+ * by a carriage return.
+ *
+ * If the terminal line is known to show the previous update, only what
+ * has changed is sent: nothing at all if the line is the same, and if the
+ * old and new lines are plain ASCII of the same length, just the runs of
+ * changed characters, skipping over long unchanged stretches with cursor
+ * forward (CUF) sequences.  Otherwise the whole line is written.
+ *
+ * When standard error is not a terminal, such as with "--force" when it
+ * is being read by another program, every update is written in full, as
+ * those programs may expect.
+ */
+static void pv__display_line(pvtransientflags_t flags, pvdisplay_t display)
+{
+	const char *line;
+	size_t line_bytes, update_bytes, column, idx;
+	bool plain;
+
+	line = display->display_buffer;
+	line_bytes = display->display_string_bytes;
+	if (NULL == line)
+		return;
+
+	/* Make sure there is room to keep a copy of the line. */
+	if ((NULL == display->shown_buffer) || (display->shown_buffer_size < line_bytes + 1)) {
+		char *new_shown, *new_update;
+		size_t new_size;
+
+		if (NULL != display->shown_buffer)
+			free(display->shown_buffer);
+		if (NULL != display->update_buffer)
+			free(display->update_buffer);
+		display->shown_buffer = NULL;
+		display->update_buffer = NULL;
+		display->shown_buffer_size = 0;
+		display->shown_valid = false;
+
+		new_size = display->display_buffer_size + 1;
+		if (new_size < line_bytes + 1)
+			new_size = line_bytes + 1;
+		new_shown = malloc(new_size);
+		new_update = malloc(new_size + 1);
+		if ((NULL == new_shown) || (NULL == new_update)) {
+			/* Just write the whole line every time. */
+			if (NULL != new_shown)
+				free(new_shown);
+			if (NULL != new_update)
+				free(new_update);
+			pv_tty_write(flags, line, line_bytes);
+			pv_tty_write(flags, "\r", 1);
+			return;
+		}
+		display->shown_buffer = new_shown;
+		display->update_buffer = new_update;
+		display->shown_buffer_size = new_size;
+		display->shown_on_tty = (0 != isatty(STDERR_FILENO)) ? true : false;
+	}
+
+	if (!display->shown_on_tty) {
+		pv_tty_write(flags, line, line_bytes);
+		pv_tty_write(flags, "\r", 1);
+		return;
+	}
+
+	if (display->shown_interruptions != pv__error_count)
+		display->shown_valid = false;
+
+	if (display->shown_valid && (display->shown_bytes == line_bytes)
+	    && (0 == memcmp(display->shown_buffer, line, line_bytes))) {
+		return;
+	}
+
+	plain = display->shown_valid && (display->shown_bytes == line_bytes);
+	for (idx = 0; plain && idx < line_bytes; idx++) {
+		if ((line[idx] < 0x20) || (line[idx] > 0x7e) || (display->shown_buffer[idx] < 0x20)
+		    || (display->shown_buffer[idx] > 0x7e))
+			plain = false;
+	}
+
+	/*
+	 * Build the changes in update_buffer, which is one byte longer than
+	 * the line, giving up in favour of writing the whole line if they
+	 * won't fit in the length of the line - so the changes are only
+	 * sent if they are shorter.  The cursor starts at the left, after
+	 * the carriage return at the end of the last update.
+	 */
+	update_bytes = 0;
+	column = 0;
+	idx = 0;
+	while (plain && idx < line_bytes) {
+		size_t run_end, scan;
+
+		if (line[idx] == display->shown_buffer[idx]) {
+			idx++;
+			continue;
+		}
+
+		/* Move from "column" to "idx". */
+		if (idx - column > 6) {
+			char cuf_cmd[16];	/* flawfinder: ignore - bounded, terminated by pv_snprintf() */
+			int cuf_length;
+			cuf_length = pv_snprintf(cuf_cmd, sizeof(cuf_cmd), "\033[%uC", (unsigned int) (idx - column));
+			if ((cuf_length < 1) || (update_bytes + (size_t) cuf_length >= line_bytes)) {
+				plain = false;
+				break;
+			}
+			memcpy(display->update_buffer + update_bytes, cuf_cmd, (size_t) cuf_length);
+			update_bytes += (size_t) cuf_length;
+		} else if (idx > column) {
+			if (update_bytes + (idx - column) >= line_bytes) {
+				plain = false;
+				break;
+			}
+			memcpy(display->update_buffer + update_bytes, line + column, idx - column);
+			update_bytes += idx - column;
+		}
+
+		/*
+		 * The run of changes continues until there are more than 6
+		 * unchanged characters in a row, since that's about the
+		 * cost of a CUF sequence to skip them.
+		 */
+		run_end = idx + 1;
+		for (scan = idx + 1; scan < line_bytes && scan - run_end <= 6; scan++) {
+			if (line[scan] != display->shown_buffer[scan])
+				run_end = scan + 1;
+		}
+
+		if (update_bytes + (run_end - idx) >= line_bytes) {
+			plain = false;
+			break;
+		}
+		memcpy(display->update_buffer + update_bytes, line + idx, run_end - idx);
+		update_bytes += run_end - idx;
+		column = run_end;
+		idx = run_end;
+	}
+
+	if (plain) {
+		display->update_buffer[update_bytes++] = '\r';
+		pv_tty_write(flags, display->update_buffer, update_bytes);
+	} else {
+		pv_tty_write(flags, line, line_bytes);
+		pv_tty_write(flags, "\r", 1);
+	}
+
+	memcpy(display->shown_buffer, line, line_bytes);
+	display->shown_buffer[line_bytes] = '\0';
+	display->shown_bytes = line_bytes;
+	display->shown_interruptions = pv__error_count;
+	display->shown_valid = true;
+}
+
+
 /*
  * Output status information on standard error.
  *
@@ -1293,6 +1671,7 @@ void pv_display(pvprogramstatus_t status, readonly_pvcontrol_t control, pvtransi
 	if (0 != flags->reparse_display) {
 		reinitialise = true;
 		flags->reparse_display = 0;
+		pv_display_invalidate(display);
 	}
 
 	if (!pv_format(status, control, transfer, calc, control->format_string, display, reinitialise, final))
@@ -1318,10 +1697,12 @@ void pv_display(pvprogramstatus_t status, readonly_pvcontrol_t control, pvtransi
 		}
 	} else {
 		if (control->force || pv_in_foreground()) {
-			pv_tty_write(flags, display->display_buffer, display->display_string_bytes);
-			pv_tty_write(flags, "\r", 1);
+			pv__display_line(flags, display);
 			display->output_produced = true;
 			pv__output_produced = true;
+		} else {
+			/* The terminal may be used by something else meanwhile. */
+			pv_display_invalidate(display);
 		}
 	}
 
@@ -0,0 +1,238 @@
+/*
+ * Waiting for the input and output to become ready, using epoll where it
+ * is available.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#include <sys/epoll.h>
+#endif
+
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+/*
+ * Make the epoll instance watch for "events" on "fd", as watched slot
+ * "side" (0 for the input, 1 for the output).  If "fd" is negative, that
+ * side is not being waited for, so the descriptor already in the slot is
+ * kept registered with no events, and is switched back with
+ * EPOLL_CTL_MOD once it is wanted again; it is only removed from the
+ * epoll instance when the slot is given a different descriptor.
+ *
+ * Returns 0 on success, or -1 if epoll can't be used for this descriptor.
+ */
+static int pv__event_watch(pvstate_t state, int side, int fd, uint32_t events)
+{
+	struct epoll_event ev;
+	int watched_fd;
+
+	watched_fd = state->transfer.epoll_watch_fd[side];
+
+	if (fd < 0) {
+		fd = watched_fd;
+		events = 0;
+		if (fd < 0)
+			return 0;
+	}
+
+	/*
+	 * Nothing to do if the descriptor is already being watched for
+	 * these events.  An unpollable descriptor isn't registered, so it
+	 * can stay in its slot whatever is wanted, to save trying again.
+	 */
+	if ((fd == watched_fd)
+	    && (state->transfer.epoll_unpollable[side] || (events == state->transfer.epoll_watch_events[side])))
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+
+	if (fd == watched_fd) {
+		if (0 == epoll_ctl(state->transfer.epoll_fd, EPOLL_CTL_MOD, fd, &ev)) {
+			state->transfer.epoll_watch_events[side] = events;
+			return 0;
+		}
+		/*
+		 * ENOENT means the old descriptor was closed, and this is
+		 * a new one that was given the same number.
+		 */
+		if (ENOENT != errno) {
+			debug("%s %d: %s: %s", "fd", fd, "epoll_ctl MOD", strerror(errno));
+			return -1;
+		}
+	} else if ((watched_fd >= 0) && (!state->transfer.epoll_unpollable[side])) {
+		(void) epoll_ctl(state->transfer.epoll_fd, EPOLL_CTL_DEL, watched_fd, NULL);
+	}
+	state->transfer.epoll_watch_fd[side] = -1;
+	state->transfer.epoll_watch_events[side] = 0;
+	state->transfer.epoll_unpollable[side] = false;
+
+	if (0 == events)
+		return 0;
+
+	if (0 != epoll_ctl(state->transfer.epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		/*
+		 * EPERM means the descriptor doesn't support polling,
+		 * which is the case for regular files - these are always
+		 * ready, as they are with select().
+		 */
+		if (EPERM != errno) {
+			debug("%s %d: %s: %s", "fd", fd, "epoll_ctl ADD", strerror(errno));
+			return -1;
+		}
+		debug("%s %d: %s", "fd", fd, "not pollable - treating as always ready");
+		state->transfer.epoll_unpollable[side] = true;
+	}
+	state->transfer.epoll_watch_fd[side] = fd;
+	state->transfer.epoll_watch_events[side] = events;
+
+	return 0;
+}
+
+
+/*
+ * A hangup or error is reported even for a descriptor registered with no
+ * events, so if one arrives on a side that isn't being waited for, remove
+ * that descriptor from the epoll instance until it is wanted again, so
+ * that it doesn't keep cutting the wait short.
+ */
+static void pv__event_park_idle(pvstate_t state, int fd)
+{
+	int side;
+
+	for (side = 0; side < 2; side++) {
+		if ((fd != state->transfer.epoll_watch_fd[side]) || (0 != state->transfer.epoll_watch_events[side])
+		    || state->transfer.epoll_unpollable[side])
+			continue;
+		debug("%s %d: %s", "fd", fd, "hangup while not waited for - removing from epoll");
+		(void) epoll_ctl(state->transfer.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+		state->transfer.epoll_watch_fd[side] = -1;
+	}
+}
+#endif				/* HAVE_SYS_EPOLL_H && HAVE_EPOLL_CREATE1 */
+
+
+/*
+ * Wait up to "usec" microseconds for "fd_in" to be ready to read, or
+ * "fd_out" to be ready to write, with the same arguments and return values
+ * as is_data_ready() in transfer.c, except that -2 is returned if epoll
+ * can't be used, in which case the caller should fall back to that.
+ *
+ * The descriptors stay registered with the epoll instance between calls,
+ * and only have their events changed when what is being waited for
+ * changes, so a wait usually costs just the one epoll_wait() call,
+ * whatever the descriptor numbers are.
+ */
+int pv_event_wait(pvstate_t state, int fd_in, /*@null@ */ bool *fd_in_ready, int fd_out,
+		  /*@null@ */ bool *fd_out_ready, long usec)
+{
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+	struct epoll_event events[2];
+	int timeout_ms, result, idx, ready;
+	bool in_ready, out_ready;
+
+	if (state->transfer.epoll_failed)
+		return -2;
+	if ((fd_in >= 0) && (fd_in == fd_out))
+		return -2;
+
+	if (state->transfer.epoll_fd < 0) {
+		state->transfer.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (state->transfer.epoll_fd < 0) {
+			debug("%s: %s", "epoll_create1", strerror(errno));
+			state->transfer.epoll_failed = true;
+			return -2;
+		}
+	}
+
+	if ((0 != pv__event_watch(state, 0, fd_in, EPOLLIN))
+	    || (0 != pv__event_watch(state, 1, fd_out, EPOLLOUT))) {
+		debug("%s", "falling back from epoll");
+		pv_event_close(state);
+		state->transfer.epoll_failed = true;
+		return -2;
+	}
+
+	in_ready = (fd_in >= 0) && state->transfer.epoll_unpollable[0];
+	out_ready = (fd_out >= 0) && state->transfer.epoll_unpollable[1];
+
+	/* Don't wait if either side is always ready. */
+	timeout_ms = (int) ((usec + 999) / 1000);
+	if (in_ready || out_ready)
+		timeout_ms = 0;
+
+	memset(events, 0, sizeof(events));
+	result = epoll_wait(state->transfer.epoll_fd, events, 2, timeout_ms);
+	if (result < 0)
+		return result;
+
+	for (idx = 0; idx < result; idx++) {
+		pv__event_park_idle(state, events[idx].data.fd);
+		if ((fd_in >= 0) && (events[idx].data.fd == fd_in)
+		    && (0 != (events[idx].events & (EPOLLIN | EPOLLHUP | EPOLLERR))))
+			in_ready = true;
+		if ((fd_out >= 0) && (events[idx].data.fd == fd_out)
+		    && (0 != (events[idx].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))))
+			out_ready = true;
+	}
+
+	ready = (in_ready ? 1 : 0) + (out_ready ? 1 : 0);
+
+	if (NULL != fd_in_ready)
+		*fd_in_ready = in_ready;
+	if (NULL != fd_out_ready)
+		*fd_out_ready = out_ready;
+
+	return ready;
+#else				/* !HAVE_SYS_EPOLL_H || !HAVE_EPOLL_CREATE1 */
+	return -2;
+#endif				/* HAVE_SYS_EPOLL_H && HAVE_EPOLL_CREATE1 */
+}
+
+
+/*
+ * Remove the current input from the epoll instance, before it is closed,
+ * since the next input file may be given the same descriptor and would
+ * otherwise be mistaken for one that is already registered.
+ */
+void pv_event_forget_input(pvstate_t state)
+{
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+	if (state->transfer.epoll_watch_fd[0] < 0)
+		return;
+	if ((state->transfer.epoll_fd >= 0) && (!state->transfer.epoll_unpollable[0]))
+		(void) epoll_ctl(state->transfer.epoll_fd, EPOLL_CTL_DEL, state->transfer.epoll_watch_fd[0], NULL);
+#endif				/* HAVE_SYS_EPOLL_H && HAVE_EPOLL_CREATE1 */
+	state->transfer.epoll_watch_fd[0] = -1;
+	state->transfer.epoll_watch_events[0] = 0;
+	state->transfer.epoll_unpollable[0] = false;
+}
+
+
+/*
+ * Close the epoll instance, if there is one.
+ */
+void pv_event_close(pvstate_t state)
+{
+	if (state->transfer.epoll_fd >= 0)
+		(void) close(state->transfer.epoll_fd);
+	state->transfer.epoll_fd = -1;
+	state->transfer.epoll_watch_fd[0] = -1;
+	state->transfer.epoll_watch_fd[1] = -1;
+	state->transfer.epoll_watch_events[0] = 0;
+	state->transfer.epoll_watch_events[1] = 0;
+	state->transfer.epoll_unpollable[0] = false;
+	state->transfer.epoll_unpollable[1] = false;
+}
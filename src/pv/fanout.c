@@ -0,0 +1,414 @@
+/*
+ * Extra outputs for --tee, which are each sent a copy of everything
+ * written to the main output.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+#include <poll.h>
+#endif
+
+
+/*
+ * The data is read once, into the transfer buffer, and each chunk that
+ * the main output takes is then written from the transfer buffer to each
+ * extra output in turn.  Outputs other than regular files and block
+ * devices are non-blocking, and whatever one of those can't take straight
+ * away is copied into a backlog of its own, to be written before anything
+ * else; an output that is keeping up never has anything copied.
+ *
+ * Once an output's backlog reaches pv__fanout_backlog_limit(), the main
+ * transfer is held until it has gone down again, so the slowest output
+ * sets the pace; or, with --tee-drop, the output is closed instead, so
+ * that the others carry on at full speed.
+ */
+
+
+/*
+ * Return the largest backlog an output may have before the transfer waits
+ * for it, or it is dropped.
+ */
+static size_t pv__fanout_backlog_limit(pvstate_t state)
+{
+	if (state->transfer.buffer_size > PV_FANOUT_BACKLOG_MIN)
+		return state->transfer.buffer_size;
+	return PV_FANOUT_BACKLOG_MIN;
+}
+
+
+/*
+ * Close "output", discarding its backlog.
+ */
+static void pv__fanout_end(pvstate_t state, pvfanoutput_t output)
+{
+	if (NULL == output)
+		return;
+
+	if ((output->fd >= 0) && (0 != close(output->fd))) {
+		pv_error("%s: %s: %s", NULL == output->line.name ? "(null)" : output->line.name, _("close failed"),
+			 strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	}
+	output->fd = -1;
+	output->finished = true;
+	output->pending_start = 0;
+	output->pending_end = 0;
+}
+
+
+/*
+ * Write as much of the "length" bytes at "data" to "output" as it will
+ * take without waiting, and return the number of bytes written.  On a
+ * write error, the output is closed; if it was because the output's reader
+ * has gone away, no error is reported, just as for the main output.
+ */
+static size_t pv__fanout_write(pvstate_t state, pvfanoutput_t output, const char *data, size_t length)
+{
+	size_t done;
+
+	if ((NULL == output) || (output->fd < 0))
+		return 0;
+
+	done = 0;
+	while (done < length) {
+		ssize_t nwritten;
+
+		nwritten = write(output->fd, data + done, length - done);
+		if (nwritten > 0) {
+			done += (size_t) nwritten;
+			continue;
+		}
+		if (0 == nwritten)
+			break;
+		if (EINTR == errno)
+			continue;
+		if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+			break;
+		if (EPIPE == errno) {
+			debug("%s: %s", output->line.name, "pipe closed - closing output");
+		} else {
+			pv_error("%s: %s: %s", NULL == output->line.name ? "(null)" : output->line.name, _("write failed"),
+				 strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		}
+		pv__fanout_end(state, output);
+		break;
+	}
+
+	if (!state->control.linemode) {
+		output->line.transferred += (off_t) done;
+	} else if (done > 0) {
+		output->line.transferred +=
+		    (off_t) pv_memcount(data, state->control.null_terminated_lines ? '\0' : '\n', done);
+	}
+
+	return done;
+}
+
+
+/*
+ * Add "length" bytes from "data" to the end of the backlog of "output",
+ * moving what is already there to the start of the buffer or enlarging
+ * the buffer as needed.  Returns false if the buffer couldn't be enlarged.
+ */
+static bool pv__fanout_append(pvfanoutput_t output, const char *data, size_t length)
+{
+	size_t held;
+
+	held = output->pending_end - output->pending_start;
+
+	if ((output->pending_start > 0) && (output->pending_end + length > output->pending_size)) {
+		if (held > 0)
+			memmove(output->pending, output->pending + output->pending_start, held);
+		output->pending_start = 0;
+		output->pending_end = held;
+	}
+
+	if ((NULL == output->pending) || (output->pending_end + length > output->pending_size)) {
+		char *new_pending;
+		size_t new_size;
+
+		new_size = held + length;
+		new_size += new_size / 2;
+		new_pending = realloc(output->pending, new_size);
+		if (NULL == new_pending)
+			return false;
+		output->pending = new_pending;
+		output->pending_size = new_size;
+	}
+
+	memcpy(output->pending + output->pending_end, data, length);	/* flawfinder: ignore */
+	/* flawfinder rationale: the buffer was made big enough just above. */
+	output->pending_end += length;
+
+	return true;
+}
+
+
+/*
+ * Write what each output will take of its backlog without waiting.
+ */
+static void pv__fanout_flush(pvstate_t state)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < state->fanout.count; idx++) {
+		pvfanoutput_t output = &(state->fanout.output[idx]);
+		size_t nwritten;
+
+		if ((output->fd < 0) || (output->pending_end == output->pending_start))
+			continue;
+		if (NULL == output->pending)
+			continue;
+
+		nwritten =
+		    pv__fanout_write(state, output, output->pending + output->pending_start,
+				     output->pending_end - output->pending_start);
+		if (output->fd < 0)
+			continue;
+		output->pending_start += nwritten;
+		if (output->pending_start >= output->pending_end) {
+			output->pending_start = 0;
+			output->pending_end = 0;
+		}
+	}
+}
+
+
+/*
+ * Open the --tee outputs that haven't been opened yet, truncating them as
+ * the main output is truncated, and make those that could make us wait
+ * non-blocking.
+ *
+ * An output that can't be opened is reported, and left out, and the
+ * transfer goes ahead without it.
+ */
+void pv_fanout_open(pvstate_t state)
+{
+	unsigned int idx;
+
+	if (NULL == state->fanout.output)
+		return;
+
+	for (idx = 0; idx < state->fanout.count; idx++) {
+		pvfanoutput_t output = &(state->fanout.output[idx]);
+		struct stat sb;
+
+		if ((output->fd >= 0) || output->finished || (NULL == output->line.name))
+			continue;
+
+		output->fd = open(output->line.name, O_WRONLY | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+		/*
+		 * flawfinder rationale: as with the main output, the name
+		 * has been given explicitly, and may well be a device or
+		 * other special file, so there is no checking that could
+		 * be done to make this safer.
+		 */
+		if (output->fd < 0) {
+			pv_error("%s: %s", output->line.name, strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_ACCESS;
+			output->finished = true;
+			continue;
+		}
+
+		(void) fcntl(output->fd, F_SETFD, FD_CLOEXEC);
+
+		memset(&sb, 0, sizeof(sb));
+		if ((0 != fstat(output->fd, &sb)) || !(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode)))
+			(void) fcntl(output->fd, F_SETFL, O_NONBLOCK | fcntl(output->fd, F_GETFL));
+
+		debug("%s: %s: %d", output->line.name, "opened --tee output", output->fd);
+	}
+}
+
+
+/*
+ * Pass on "length" bytes from "data", which have just been written to the
+ * main output, to each --tee output: straight away where it will take
+ * them, and otherwise into its backlog.
+ *
+ * With --tee-drop, an output whose backlog would grow beyond the limit is
+ * closed instead, with a warning.
+ */
+void pv_fanout_queue(pvstate_t state, const char *data, size_t length)
+{
+	unsigned int idx;
+
+	if ((NULL == state->fanout.output) || (0 == length))
+		return;
+
+	pv__fanout_flush(state);
+
+	for (idx = 0; idx < state->fanout.count; idx++) {
+		pvfanoutput_t output = &(state->fanout.output[idx]);
+		size_t nwritten;
+
+		if (output->fd < 0)
+			continue;
+
+		nwritten = 0;
+		if (output->pending_end == output->pending_start)
+			nwritten = pv__fanout_write(state, output, data, length);
+		if ((nwritten >= length) || (output->fd < 0))
+			continue;
+
+		if (state->fanout.drop_slow
+		    && (output->pending_end - output->pending_start + length - nwritten >
+			pv__fanout_backlog_limit(state))) {
+			pv_error("%s: %s", NULL == output->line.name ? "(null)" : output->line.name,
+				 _("output is not keeping up - dropping it"));
+			pv__fanout_end(state, output);
+			continue;
+		}
+
+		if (!pv__fanout_append(output, data + nwritten, length - nwritten)) {
+			pv_error("%s: %s: %s", NULL == output->line.name ? "(null)" : output->line.name,
+				 _("buffer allocation failed"), strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_MEMORY;
+			pv__fanout_end(state, output);
+		}
+	}
+}
+
+
+/*
+ * Write what can be written of the outputs' backlogs, and return true
+ * if the main transfer should wait for them: because one's backlog has
+ * reached the limit (unless --tee-drop was given), or because "at_end" is
+ * true - the main transfer is complete - and any backlog is left.
+ *
+ * When returning true, up to "wait_usec" microseconds are first spent
+ * waiting for the outputs to be able to take more, so that the caller
+ * doesn't need to wait as well.
+ */
+bool pv_fanout_hold(pvstate_t state, bool at_end, long wait_usec)
+{
+	struct timespec wait_start, wait_end, wait_elapsed;
+	unsigned int idx;
+	bool hold;
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+	struct pollfd pfds[PV_FANOUT_MAX];
+	nfds_t nfds;
+#endif
+
+	if (NULL == state->fanout.output)
+		return false;
+
+	pv__fanout_flush(state);
+
+	hold = false;
+	for (idx = 0; idx < state->fanout.count; idx++) {
+		pvfanoutput_t output = &(state->fanout.output[idx]);
+		size_t held;
+
+		if (output->fd < 0)
+			continue;
+		held = output->pending_end - output->pending_start;
+		if ((held > 0) && (at_end || ((!state->fanout.drop_slow) && (held >= pv__fanout_backlog_limit(state)))))
+			hold = true;
+	}
+
+	if (!hold)
+		return false;
+
+	debug("%s", "waiting for --tee outputs");
+
+	pv_elapsedtime_read(&wait_start);
+
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+	nfds = 0;
+	for (idx = 0; idx < state->fanout.count && nfds < (nfds_t) (sizeof(pfds) / sizeof(pfds[0])); idx++) {
+		pvfanoutput_t output = &(state->fanout.output[idx]);
+		if ((output->fd < 0) || (output->pending_end == output->pending_start))
+			continue;
+		pfds[nfds].fd = output->fd;
+		pfds[nfds].events = POLLOUT;
+		pfds[nfds].revents = 0;
+		nfds++;
+	}
+	(void) poll(pfds, nfds, (int) ((wait_usec + 999) / 1000));
+#else
+	pv_nanosleep((long long) wait_usec * 1000);
+#endif
+
+	pv_elapsedtime_read(&wait_end);
+	pv_elapsedtime_subtract(&wait_elapsed, &wait_end, &wait_start);
+	pv_bottleneck_note_wait(state, false, true, pv_elapsedtime_seconds(&wait_elapsed));
+
+	return true;
+}
+
+
+/*
+ * Return true if any output still has a backlog to write.
+ */
+bool pv_fanout_pending(pvstate_t state)
+{
+	unsigned int idx;
+
+	if (NULL == state->fanout.output)
+		return false;
+
+	for (idx = 0; idx < state->fanout.count; idx++) {
+		if ((state->fanout.output[idx].fd >= 0)
+		    && (state->fanout.output[idx].pending_end > state->fanout.output[idx].pending_start))
+			return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Close all of the outputs, discarding any backlogs.
+ */
+void pv_fanout_close(pvstate_t state)
+{
+	unsigned int idx;
+
+	if (NULL == state->fanout.output)
+		return;
+
+	for (idx = 0; idx < state->fanout.count; idx++) {
+		if (state->fanout.output[idx].fd >= 0)
+			pv__fanout_end(state, &(state->fanout.output[idx]));
+	}
+}
+
+
+/*
+ * Close all of the outputs and free everything to do with them.
+ */
+void pv_fanout_free(pvstate_t state)
+{
+	unsigned int idx;
+
+	pv_fanout_close(state);
+
+	if (NULL != state->fanout.output) {
+		for (idx = 0; idx < state->fanout.count; idx++) {
+			pvfanoutput_t output = &(state->fanout.output[idx]);
+			pv_freecontents_subline(&(output->line));
+			if (NULL != output->pending)
+				free(output->pending);
+			output->pending = NULL;
+		}
+		free(state->fanout.output);
+		state->fanout.output = NULL;
+	}
+	state->fanout.count = 0;
+}
@@ -18,11 +18,47 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
+
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif				/* HAVE_THREADS */
+
+
+/*
+ * The next input file, opened while the current one is still being read,
+ * so that any delay opening it - and reading its first few MiB - happens
+ * out of the way of the transfer instead of at the boundary between the
+ * files.  With threads, the opening is done in the background.
+ *
+ * Only regular files and block devices are opened ahead, since opening
+ * anything else may block or have side effects.  If the file can't be
+ * opened ahead, pv_next_file() opens it as usual when its turn comes, so
+ * that errors are reported as they always were.
+ */
+struct pvprefetch_s {
+#ifdef HAVE_THREADS
+	pthread_t thread;
+	bool thread_started;		/* set if the thread needs joining */
+#endif				/* HAVE_THREADS */
+	/*@dependent@ */ const char *filename;
+	unsigned int filenum;		/* index of the file in the list */
+	int fd;				/* descriptor opened ahead, or -1 */
+};
 
 
 /*@-type@*/
 /* splint has trouble with off_t and mode_t throughout this file. */
 
+/*
+ * Return the file descriptor to read for the input file "-", which is
+ * standard input unless another was given with pv_state_input_fd_set().
+ */
+static int pv__stdin_fd(pvstate_t state)
+{
+	return state->files.input_fd >= 0 ? state->files.input_fd : STDIN_FILENO;
+}
+
 /*
  * Calculate the total number of bytes to be transferred by adding up the
  * sizes of all input files.  If any of the input files are of indeterminate
@@ -47,7 +83,7 @@ static off_t pv_calc_total_bytes(pvstate_t state)
 	 * No files specified - check stdin.
 	 */
 	if ((state->files.file_count < 1) || (NULL == state->files.filename)) {
-		if (0 == fstat(STDIN_FILENO, &sb))
+		if (0 == fstat(pv__stdin_fd(state), &sb))
 			total = sb.st_size;
 		return total;
 	}
@@ -60,7 +96,7 @@ static off_t pv_calc_total_bytes(pvstate_t state)
 			continue;
 
 		if (0 == strcmp(state->files.filename[file_idx], "-")) {
-			rc = fstat(STDIN_FILENO, &sb);
+			rc = fstat(pv__stdin_fd(state), &sb);
 			if (rc != 0) {
 				total = 0;
 				return total;
@@ -171,6 +207,134 @@ static off_t pv_calc_total_bytes(pvstate_t state)
 }
 
 
+/*
+ * Open input file number "file_idx" for counting its lines, returning the
+ * new file descriptor and filling in "sb" with its details; or returning
+ * -1 if it cannot be opened or is not a regular file, since then the total
+ * line count can't be known.
+ */
+static int pv__open_for_line_count(pvstate_t state, unsigned int file_idx, struct stat *sb)
+{
+	int fd = -1;
+	int rc = 0;
+
+	if (0 == strcmp(state->files.filename[file_idx], "-")) {
+		rc = fstat(pv__stdin_fd(state), sb);
+		if ((rc != 0) || (!S_ISREG(sb->st_mode)))
+			return -1;
+		fd = dup(pv__stdin_fd(state));
+	} else {
+		rc = stat(state->files.filename[file_idx], sb);
+		if ((rc != 0) || (!S_ISREG(sb->st_mode)))
+			return -1;
+		fd = open(state->files.filename[file_idx], O_RDONLY);	/* flawfinder: ignore */
+		/* flawfinder - see last open() below. */
+	}
+
+	if (fd < 0) {
+		debug("%s: %s", state->files.filename[file_idx], strerror(errno));
+		return -1;
+	}
+
+	return fd;
+}
+
+
+#ifdef HAVE_THREADS
+/*
+ * Start counting the lines in all input files in the background, so that
+ * the transfer can begin straight away, and return an initial estimate of
+ * the total based on the start of the first non-empty file; the main loop
+ * refines the estimate until the count is finished, using
+ * pv_linecount_update().
+ *
+ * Returns 0 if the total is unknown or is zero, as pv_calc_total_lines()
+ * does, or -1 if the background count could not be started.
+ */
+static off_t pv__calc_total_lines_background(pvstate_t state, char separator)
+{
+	int *fds;
+	off_t total_bytes, sample_lines, sample_bytes, estimate;
+	unsigned int file_idx, opened;
+
+	fds = calloc((size_t) (state->files.file_count + 1), sizeof(int));
+	if (NULL == fds)
+		return -1;
+
+	total_bytes = 0;
+	sample_lines = 0;
+	sample_bytes = 0;
+
+	for (opened = 0; opened < state->files.file_count; opened++) {
+		struct stat sb;
+
+		fds[opened] = -1;
+
+		/* Skip any NULL entries, though they should be impossible. */
+		if (NULL == state->files.filename[opened])
+			continue;
+
+		fds[opened] = pv__open_for_line_count(state, opened, &sb);
+		if (fds[opened] < 0)
+			break;
+
+		/* Sample the start of the first file with anything in it. */
+		if ((0 == sample_bytes) && (sb.st_size > 0)) {
+			char samplebuf[65536];	/* flawfinder: ignore */
+			ssize_t numread;
+
+			/* flawfinder - always bounded, below. */
+
+			numread = pread(fds[opened], samplebuf, sizeof(samplebuf), 0);	/* flawfinder: ignore */
+			if (numread > 0) {
+				sample_lines = (off_t) pv_memcount(samplebuf, (int) separator, (size_t) numread);
+				sample_bytes = (off_t) numread;
+			}
+		}
+
+		total_bytes += sb.st_size;
+	}
+
+	if ((opened < state->files.file_count) || (0 == total_bytes)) {
+		/* The total is unknown, or there is nothing to count. */
+		for (file_idx = 0; file_idx < opened; file_idx++) {
+			if (fds[file_idx] >= 0)
+				(void) close(fds[file_idx]);
+		}
+		free(fds);
+		return 0;
+	}
+
+	state->files.linecount = pv_linecount_start(fds, state->files.file_count, total_bytes, separator);
+	if (NULL == state->files.linecount) {
+		debug("%s: %s", "failed to start background line count", strerror(errno));
+		for (file_idx = 0; file_idx < state->files.file_count; file_idx++) {
+			if (fds[file_idx] >= 0)
+				(void) close(fds[file_idx]);
+		}
+		free(fds);
+		return -1;
+	}
+
+	free(fds);
+
+	/*
+	 * Scale the sample up to the combined size of the files, assuming
+	 * there's at least one line in it.
+	 */
+	estimate = 0;
+	if (sample_bytes > 0) {
+		if (sample_lines < 1)
+			sample_lines = 1;
+		estimate = (off_t) (0.5L + (long double) sample_lines * (long double) total_bytes
+				    / (long double) sample_bytes);
+	}
+
+	return estimate;
+}
+#endif				/* HAVE_THREADS */
+
+
 /*
  * Count the total number of lines to be transferred by reading through all
  * input files.  If any of the inputs are not regular files (such as if they
@@ -180,6 +344,11 @@ static off_t pv_calc_total_bytes(pvstate_t state)
  * not readable, they will be skipped, and the total size will be set to
  * zero.
  *
+ * Where threads are available, the count happens in the background while
+ * the transfer runs, and an estimate is returned for now (see
+ * pv__calc_total_lines_background()).  This isn't done with
+ * --stop-at-size, since there the total is used as a hard limit.
+ *
  * Returns the total size, or 0 if it is unknown.
  */
 static off_t pv_calc_total_lines(pvstate_t state)
@@ -187,36 +356,33 @@ static off_t pv_calc_total_lines(pvstate_t state)
 	off_t total;
 	struct stat sb;
 	unsigned int file_idx;
+	char separator;
 
 	total = 0;
+	separator = state->control.null_terminated_lines ? '\0' : '\n';
+
+#ifdef HAVE_THREADS
+	if (NULL != state->files.linecount)
+		pv_linecount_free(state->files.linecount);
+	state->files.linecount = NULL;
+
+	if ((!state->control.stop_at_size) && (NULL != state->files.filename)) {
+		total = pv__calc_total_lines_background(state, separator);
+		if (total >= 0)
+			return total;
+		total = 0;
+	}
+#endif				/* HAVE_THREADS */
 
 	for (file_idx = 0; file_idx < state->files.file_count && NULL != state->files.filename; file_idx++) {
-		int fd = -1;
-		int rc = 0;
+		int fd;
 
 		/* Skip any NULL entries, though they should be impossible. */
 		if (NULL == state->files.filename[file_idx])
 			continue;
 
-		if (0 == strcmp(state->files.filename[file_idx], "-")) {
-			rc = fstat(STDIN_FILENO, &sb);
-			if ((rc != 0) || (!S_ISREG(sb.st_mode))) {
-				total = 0;
-				return total;
-			}
-			fd = dup(STDIN_FILENO);
-		} else {
-			rc = stat(state->files.filename[file_idx], &sb);
-			if ((rc != 0) || (!S_ISREG(sb.st_mode))) {
-				total = 0;
-				return total;
-			}
-			fd = open(state->files.filename[file_idx], O_RDONLY);	/* flawfinder: ignore */
-			/* flawfinder - see last open() below. */
-		}
-
+		fd = pv__open_for_line_count(state, file_idx, &sb);
 		if (fd < 0) {
-			debug("%s: %s", state->files.filename[file_idx], strerror(errno));
 			total = 0;
 			return total;
 		}
@@ -226,8 +392,8 @@ static off_t pv_calc_total_lines(pvstate_t state)
 #endif
 
 		while (true) {
-			char scanbuf[1024];	/* flawfinder: ignore */
-			ssize_t numread, buf_idx;
+			char scanbuf[65536];	/* flawfinder: ignore */
+			ssize_t numread;
 
 			/* flawfinder - always bounded, below. */
 
@@ -244,15 +410,7 @@ static off_t pv_calc_total_lines(pvstate_t state)
 			} else if (0 == numread) {
 				break;
 			}
-			for (buf_idx = 0; buf_idx < numread; buf_idx++) {
-				if (state->control.null_terminated_lines) {
-					if ('\0' == scanbuf[buf_idx])
-						total++;
-				} else {
-					if ('\n' == scanbuf[buf_idx])
-						total++;
-				}
-			}
+			total += (off_t) pv_memcount(scanbuf, (int) separator, (size_t) numread);
 		}
 
 		if (0 != lseek(fd, 0, SEEK_SET)) {
@@ -284,6 +442,152 @@ off_t pv_calc_total_size(pvstate_t state)
 }
 
 
+/*
+ * Open the next input file ahead of time, and ask the kernel to start
+ * reading its beginning into the cache.
+ */
+static /*@null@ */ void *pv__prefetch_open(void *arg)
+{
+	pvprefetch_t prefetch = (pvprefetch_t) arg;
+	struct stat sb;
+	int fd, fl;
+
+	prefetch->fd = -1;
+
+	if ((0 != stat(prefetch->filename, &sb)) || ((!S_ISREG(sb.st_mode)) && (!S_ISBLK(sb.st_mode))))
+		return NULL;
+
+	/*
+	 * O_NONBLOCK in case the file is replaced by something else between
+	 * the stat() and the open().
+	 */
+	fd = open(prefetch->filename, O_RDONLY | O_NONBLOCK);	/* flawfinder: ignore */
+	/* flawfinder: see pv_next_file(). */
+	if (fd < 0)
+		return NULL;
+
+	if ((0 != fstat(fd, &sb)) || ((!S_ISREG(sb.st_mode)) && (!S_ISBLK(sb.st_mode)))) {
+		(void) close(fd);
+		return NULL;
+	}
+
+	fl = fcntl(fd, F_GETFL);
+	if ((fl < 0) || (0 != fcntl(fd, F_SETFL, fl & ~O_NONBLOCK))) {
+		(void) close(fd);
+		return NULL;
+	}
+#if HAVE_POSIX_FADVISE
+	(void) posix_fadvise(fd, 0, PV_PREFETCH_BYTES, POSIX_FADV_WILLNEED);
+#endif
+
+	prefetch->fd = fd;
+
+	return NULL;
+}
+
+
+/*
+ * Wait for any open-ahead of the next input file to complete, and return
+ * the descriptor it opened, or -1 if it didn't open one.
+ */
+static int pv__prefetch_wait(pvprefetch_t prefetch)
+{
+#ifdef HAVE_THREADS
+	if (prefetch->thread_started) {
+		(void) pthread_join(prefetch->thread, NULL);
+		prefetch->thread_started = false;
+	}
+#endif				/* HAVE_THREADS */
+	return prefetch->fd;
+}
+
+
+/*
+ * Abandon any open-ahead of the next input file, closing the descriptor
+ * if one was opened.
+ */
+void pv_file_prefetch_cancel(pvstate_t state)
+{
+	pvprefetch_t prefetch;
+	int fd;
+
+	prefetch = state->files.prefetch;
+	if (NULL == prefetch)
+		return;
+	state->files.prefetch = NULL;
+
+	fd = pv__prefetch_wait(prefetch);
+	if (fd >= 0)
+		(void) close(fd);
+
+	free(prefetch);
+}
+
+
+/*
+ * Start opening input file number "filenum" ahead of time, if it is a
+ * named file.
+ */
+static void pv__prefetch_start(pvstate_t state, unsigned int filenum)
+{
+	pvprefetch_t prefetch;
+#ifdef HAVE_THREADS
+	sigset_t all_signals, old_signals;
+#endif				/* HAVE_THREADS */
+
+	pv_file_prefetch_cancel(state);
+
+	if ((filenum >= state->files.file_count) || (NULL == state->files.filename))
+		return;
+	if ((NULL == state->files.filename[filenum]) || (0 == strcmp(state->files.filename[filenum], "-")))
+		return;
+
+	prefetch = calloc(1, sizeof(*prefetch));
+	if (NULL == prefetch)
+		return;
+
+	prefetch->filename = state->files.filename[filenum];
+	prefetch->filenum = filenum;
+	prefetch->fd = -1;
+
+	state->files.prefetch = prefetch;
+
+#ifdef HAVE_THREADS
+	/* The thread must not take any signals - see pv_linecount_start(). */
+	(void) sigfillset(&all_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	if (0 == pthread_create(&(prefetch->thread), NULL, pv__prefetch_open, prefetch))
+		prefetch->thread_started = true;
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	if (prefetch->thread_started)
+		return;
+#endif				/* HAVE_THREADS */
+
+	(void) pv__prefetch_open(prefetch);
+}
+
+
+/*
+ * If input file number "filenum" was opened ahead of time, return its
+ * descriptor, or -1 if it wasn't.
+ */
+static int pv__prefetch_take(pvstate_t state, unsigned int filenum)
+{
+	pvprefetch_t prefetch;
+	int fd;
+
+	prefetch = state->files.prefetch;
+	if ((NULL == prefetch) || (prefetch->filenum != filenum))
+		return -1;
+
+	fd = pv__prefetch_wait(prefetch);
+	prefetch->fd = -1;
+	pv_file_prefetch_cancel(state);
+
+	return fd;
+}
+
+
 /*
  * Close the given file descriptor and open the next one, whose number in
  * the list is "filenum", returning the new file descriptor (or negative on
@@ -301,6 +605,7 @@ int pv_next_file(pvstate_t state, unsigned int filenum, int oldfd)
 	char *next_filename;
 
 	if (oldfd >= 0) {
+		pv_event_forget_input(state);
 		if (0 != close(oldfd)) {
 			pv_error("%s: %s", _("failed to close file"), strerror(errno));
 			state->status.exit_status |= PV_ERROREXIT_TRANSITION;
@@ -324,9 +629,16 @@ int pv_next_file(pvstate_t state, unsigned int filenum, int oldfd)
 		}
 	}
 
+	fd = -1;
 	if ((NULL == next_filename) || (0 == strcmp(next_filename, "-"))) {
-		fd = STDIN_FILENO;
+		fd = pv__stdin_fd(state);
 	} else {
+		fd = pv__prefetch_take(state, filenum);
+		if (fd >= 0)
+			debug("%s: %s: fd=%d", "using file opened ahead", next_filename, fd);
+	}
+
+	if (fd < 0) {
 		fd = open(next_filename, O_RDONLY);	/* flawfinder: ignore */
 		/*
 		 * flawfinder rationale: the input file list is under the
@@ -395,10 +707,20 @@ int pv_next_file(pvstate_t state, unsigned int filenum, int oldfd)
 	 * Don't clear direct_io_changed here, to avoid race conditions that
 	 * could cause the input and output settings to differ.
 	 */
+	state->transfer.direct_input_fd = -1;
 #endif				/* O_DIRECT */
 
+#if HAVE_POSIX_FADVISE
+	/* Advise the OS that all reads will be sequential. */
+	if (S_ISREG(isb.st_mode))
+		(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
 	debug("%s: %d: %s: fd=%d", "next file opened", filenum, pv_current_file_name(state), fd);
 
+	/* Start opening the file after this one. */
+	pv__prefetch_start(state, filenum + 1);
+
 	return fd;
 }
 
@@ -0,0 +1,149 @@
+/*
+ * Formatter functions for showing whether the input or the output is
+ * holding up the transfer, and how much of the time is spent waiting for
+ * each.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+
+/*
+ * Update the display's record of the fractions of time spent waiting for
+ * the input and the output, at the end of each PV_BOTTLENECK_WINDOW, so
+ * that they reflect what is happening now rather than over the whole
+ * transfer.  Until the first window is complete, the fractions are over
+ * the time since the format was parsed (since the waits are only measured
+ * from then on), and on the final update, they are over all of the time
+ * that the waits were measured for.
+ */
+static void pv__formatter_bottleneck_measure(pvformatter_args_t args)
+{
+	pvdisplay_t display;
+	long double elapsed, window;
+
+	display = args->display;
+	display->showing_bottleneck = true;
+
+	elapsed = args->transfer->elapsed_seconds;
+
+	/* Called while parsing the format - start the first window. */
+	if (0 == args->buffer_size) {
+		if (!display->bottleneck_measured) {
+			display->bottleneck_window_start = elapsed;
+			display->bottleneck_wait_in_start = args->transfer->wait_input_seconds;
+			display->bottleneck_wait_out_start = args->transfer->wait_output_seconds;
+		}
+		return;
+	}
+
+	window = elapsed - display->bottleneck_window_start;
+
+	if (display->final_update) {
+		long double measured;
+		measured = elapsed - args->transfer->instrumented_since;
+		if (measured > 0.0) {
+			display->bottleneck_wait_in_fraction = args->transfer->wait_input_seconds / measured;
+			display->bottleneck_wait_out_fraction = args->transfer->wait_output_seconds / measured;
+		}
+	} else if ((!display->bottleneck_measured) && (window > 0.0)) {
+		display->bottleneck_wait_in_fraction =
+		    (args->transfer->wait_input_seconds - display->bottleneck_wait_in_start) / window;
+		display->bottleneck_wait_out_fraction =
+		    (args->transfer->wait_output_seconds - display->bottleneck_wait_out_start) / window;
+	}
+
+	if ((!display->final_update) && (window >= PV_BOTTLENECK_WINDOW)) {
+		display->bottleneck_wait_in_fraction =
+		    (args->transfer->wait_input_seconds - display->bottleneck_wait_in_start) / window;
+		display->bottleneck_wait_out_fraction =
+		    (args->transfer->wait_output_seconds - display->bottleneck_wait_out_start) / window;
+		display->bottleneck_window_start = elapsed;
+		display->bottleneck_wait_in_start = args->transfer->wait_input_seconds;
+		display->bottleneck_wait_out_start = args->transfer->wait_output_seconds;
+		display->bottleneck_measured = true;
+	}
+
+	if (display->bottleneck_wait_in_fraction > 1.0)
+		display->bottleneck_wait_in_fraction = 1.0;
+	if (display->bottleneck_wait_in_fraction < 0.0)
+		display->bottleneck_wait_in_fraction = 0.0;
+	if (display->bottleneck_wait_out_fraction > 1.0)
+		display->bottleneck_wait_out_fraction = 1.0;
+	if (display->bottleneck_wait_out_fraction < 0.0)
+		display->bottleneck_wait_out_fraction = 0.0;
+}
+
+
+/*
+ * Which side the transfer is waiting for most: "input" if the data isn't
+ * arriving fast enough, "output" if it isn't being taken away fast enough,
+ * or "-" if neither is waited for more than PV_BOTTLENECK_THRESHOLD of the
+ * time.
+ */
+pvdisplay_bytecount_t pv_formatter_bottleneck(pvformatter_args_t args)
+{
+	char content[32];		 /* flawfinder: ignore - always bounded */
+	long double wait_in, wait_out;
+	const char *side;
+
+	pv__formatter_bottleneck_measure(args);
+	if (0 == args->buffer_size)
+		return 0;
+
+	wait_in = args->display->bottleneck_wait_in_fraction;
+	wait_out = args->display->bottleneck_wait_out_fraction;
+
+	side = "-";
+	if ((wait_in >= wait_out) && (wait_in >= PV_BOTTLENECK_THRESHOLD)) {
+		side = _("input");
+	} else if (wait_out >= PV_BOTTLENECK_THRESHOLD) {
+		side = _("output");
+	}
+
+	content[0] = '\0';
+	(void) pv_snprintf(content, sizeof(content), "%-6s", side);
+
+	return pv_formatter_segmentcontent(content, args);
+}
+
+
+/*
+ * Percentage of the time spent waiting for the input.
+ */
+pvdisplay_bytecount_t pv_formatter_wait_in(pvformatter_args_t args)
+{
+	char content[16];		 /* flawfinder: ignore - always bounded */
+
+	pv__formatter_bottleneck_measure(args);
+	if (0 == args->buffer_size)
+		return 0;
+
+	content[0] = '\0';
+	(void) pv_snprintf(content, sizeof(content), "%3.0Lf%%", 100.0 * args->display->bottleneck_wait_in_fraction);
+
+	return pv_formatter_segmentcontent(content, args);
+}
+
+
+/*
+ * Percentage of the time spent waiting for the output.
+ */
+pvdisplay_bytecount_t pv_formatter_wait_out(pvformatter_args_t args)
+{
+	char content[16];		 /* flawfinder: ignore - always bounded */
+
+	pv__formatter_bottleneck_measure(args);
+	if (0 == args->buffer_size)
+		return 0;
+
+	content[0] = '\0';
+	(void) pv_snprintf(content, sizeof(content), "%3.0Lf%%", 100.0 * args->display->bottleneck_wait_out_fraction);
+
+	return pv_formatter_segmentcontent(content, args);
+}
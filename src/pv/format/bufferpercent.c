@@ -30,6 +30,17 @@ pvdisplay_bytecount_t pv_formatter_buffer_percent(pvformatter_args_t args)
 						(args->transfer->buffer_size));
 		(void) pv_snprintf(content, sizeof(content), "{%3.0f%%}", pct_used);
 	}
+#ifdef HAVE_THREADS
+	/* With the threaded pipeline, show how full its ring is. */
+	if (NULL != args->transfer->pipeline) {
+		size_t used, capacity;
+		used = pv_pipeline_buffered(args->transfer->pipeline, &capacity);
+		if (capacity > 0) {
+			double pct_used = pv_percentage((off_t) used, (off_t) capacity);
+			(void) pv_snprintf(content, sizeof(content), "{%3.0f%%}", pct_used);
+		}
+	}
+#endif				/* HAVE_THREADS */
 #ifdef HAVE_SPLICE
 	if (args->transfer->splice_used)
 		(void) pv_snprintf(content, sizeof(content), "{%s}", "----");
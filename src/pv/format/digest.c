@@ -0,0 +1,40 @@
+/*
+ * Formatter function for showing the --hash digests.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <string.h>
+
+
+/*
+ * Display the digests of what has been written, once the transfer has
+ * finished, or blank space the same width until then.
+ */
+pvdisplay_bytecount_t pv_formatter_digest(pvformatter_args_t args)
+{
+	char content[PV_HASH_MAX * PV_DIGEST_HEX_MAX];	/* flawfinder: ignore - always bounded */
+	size_t width;
+
+	if (0 == args->buffer_size)
+		return 0;
+
+	content[0] = '\0';
+	if (NULL != args->transfer->digest) {
+		(void) pv_snprintf(content, sizeof(content), "%s", args->transfer->digest);
+	} else {
+		width = pv_digest_text_length(args->control->hash_algorithms);
+		if (width >= sizeof(content))
+			width = sizeof(content) - 1;
+		memset(content, ' ', width);
+		content[width] = '\0';
+	}
+
+	return pv_formatter_segmentcontent(content, args);
+}
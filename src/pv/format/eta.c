@@ -17,6 +17,8 @@
 pvdisplay_bytecount_t pv_formatter_eta(pvformatter_args_t args)
 {
 	char content[128];		 /* flawfinder: ignore - always bounded */
+	const char *label;
+	size_t label_bytes;
 	long eta;
 
 	content[0] = '\0';
@@ -41,21 +43,24 @@ pvdisplay_bytecount_t pv_formatter_eta(pvformatter_args_t args)
 	eta = pv_bound_long(eta, 0, (long) 360000000L);
 
 	/*
-	 * If the ETA is more than a day, include a day count as well as
-	 * hours, minutes, and seconds.
+	 * Show hours, minutes, and seconds after the "ETA" label - and a day
+	 * count as well, if it is more than a day.
 	 */
 	/*@-mustfreefresh@ */
-	if (eta > 86400L) {
-		(void) pv_snprintf(content,
-				   sizeof(content),
-				   "%.16s %ld:%02ld:%02ld:%02ld",
-				   _("ETA"), eta / 86400, (eta / 3600) % 24, (eta / 60) % 60, eta % 60);
-	} else {
-		(void) pv_snprintf(content,
-				   sizeof(content),
-				   "%.16s %ld:%02ld:%02ld", _("ETA"), eta / 3600, (eta / 60) % 60, eta % 60);
-	}
+	label = _("ETA");
 	/*@+mustfreefresh@ *//* splint: see above. */
+	label_bytes = 0;
+	if (NULL != label) {
+		while (label_bytes < 16 && '\0' != label[label_bytes]) {
+			content[label_bytes] = label[label_bytes];
+			label_bytes++;
+		}
+	}
+	content[label_bytes++] = ' ';
+	/* Mark the ETA as rough while the total size is still an estimate. */
+	if (args->control->size_estimated)
+		content[label_bytes++] = '~';
+	pv_describe_duration(content + label_bytes, sizeof(content) - label_bytes, eta);
 
 	/*
 	 * If this is the final update, show a blank space where the ETA
@@ -77,7 +77,8 @@ pvdisplay_bytecount_t pv_formatter_fineta(pvformatter_args_t args)
 		size_t content_bytes;
 
 		/*@-mustfreefresh@ */
-		(void) pv_snprintf(content, sizeof(content), "%.16s ", _("FIN"));
+		(void) pv_snprintf(content, sizeof(content), "%.16s %s", _("FIN"),
+				   args->control->size_estimated ? "~" : "");
 		/*@+mustfreefresh@ *//* splint: see above. */
 		content_bytes = strlen(content);	/* flawfinder: ignore */
 		/* flawfinder: always bounded with \0 by pv_snprintf(). */
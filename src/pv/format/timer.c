@@ -43,23 +43,9 @@ pvdisplay_bytecount_t pv_formatter_timer(pvformatter_args_t args)
 	if (args->control->numeric) {
 		/* Numeric mode - show the number of seconds, unformatted. */
 		(void) pv_snprintf(content, sizeof(content), "%.4Lf", elapsed_seconds);
-	} else if (elapsed_seconds > (long double) 86400.0L) {
-		/*
-		 * If the elapsed time is more than a day, include a day count as
-		 * well as hours, minutes, and seconds.
-		 */
-		(void) pv_snprintf(content,
-				   sizeof(content),
-				   "%ld:%02ld:%02ld:%02ld",
-				   ((long) (elapsed_seconds)) / 86400,
-				   (((long) (elapsed_seconds)) / 3600) %
-				   24, (((long) (elapsed_seconds)) / 60) % 60, ((long) (elapsed_seconds)) % 60);
 	} else {
-		(void) pv_snprintf(content,
-				   sizeof(content),
-				   "%ld:%02ld:%02ld",
-				   ((long) (elapsed_seconds)) / 3600,
-				   (((long) (elapsed_seconds)) / 60) % 60, ((long) (elapsed_seconds)) % 60);
+		/* Hours, minutes, and seconds, with days if over a day. */
+		pv_describe_duration(content, sizeof(content), (long) elapsed_seconds);
 	}
 
 	return pv_formatter_segmentcontent(content, args);
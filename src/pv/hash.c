@@ -0,0 +1,410 @@
+/*
+ * Digests of the data written, for --hash.  Everything written to the
+ * output is copied into a ring, and a helper thread works the digests out
+ * from there, so that hashing happens alongside the transfer instead of
+ * holding it up.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_THREADS
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+
+/*
+ * The digests, in the order of their PV_HASH_* values.
+ *
+ * With threads, the ring counters "head" and "tail" count the bytes copied
+ * into the ring by the main thread and hashed by the helper thread, so
+ * the ring is empty when they are equal and full when they differ by
+ * ring_size.  As in pipeline.c, each is only written by one thread, and
+ * the mutex and condition variable are only used to sleep when one side
+ * has to wait for the other.  Everything marked "shared" is accessed with
+ * atomic builtins.
+ *
+ * If the helper thread can't be started, "running" is false, and the
+ * main thread hashes the data itself.
+ */
+struct pvhash_s {
+	struct pvdigest_s digest[PV_HASH_MAX];
+	unsigned int digest_count;
+#ifdef HAVE_THREADS
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	/*@null@*/ /*@only@*/ unsigned char *ring;
+	size_t ring_size;
+
+	/* Shared. */
+	unsigned long long head;
+	unsigned long long tail;
+	bool worker_waiting;
+	bool feeder_waiting;
+	bool stop;
+
+	/* Only used by the main thread. */
+	bool running;
+#endif				/* HAVE_THREADS */
+};
+
+
+/*
+ * Add "length" bytes of "data" to all of the digests.
+ */
+static void pv__hash_update(pvhash_t hash, const unsigned char *data, size_t length)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < hash->digest_count; idx++)
+		pv_digest_update(&(hash->digest[idx]), data, length);
+}
+
+
+#ifdef HAVE_THREADS
+/*
+ * Sleep until "ready" says there is something to do, or the helper thread
+ * is being stopped - see pv__pipeline_sleep().
+ */
+static void pv__hash_sleep(pvhash_t hash, bool *waiting, bool (*ready)(pvhash_t))
+{
+	(void) pthread_mutex_lock(&(hash->mutex));
+	__atomic_store_n(waiting, true, __ATOMIC_SEQ_CST);
+	while ((!ready(hash)) && (!__atomic_load_n(&(hash->stop), __ATOMIC_SEQ_CST))) {
+		(void) pthread_cond_wait(&(hash->cond), &(hash->mutex));
+	}
+	__atomic_store_n(waiting, false, __ATOMIC_SEQ_CST);
+	(void) pthread_mutex_unlock(&(hash->mutex));
+}
+
+
+/*
+ * Wake the other side if "waiting" says it is asleep, or unconditionally
+ * if "waiting" is NULL.
+ */
+static void pv__hash_wake(pvhash_t hash, /*@null@ */ bool *waiting)
+{
+	if ((NULL != waiting) && (!__atomic_load_n(waiting, __ATOMIC_SEQ_CST)))
+		return;
+	(void) pthread_mutex_lock(&(hash->mutex));
+	(void) pthread_cond_broadcast(&(hash->cond));
+	(void) pthread_mutex_unlock(&(hash->mutex));
+}
+
+
+static bool pv__hash_has_data(pvhash_t hash)
+{
+	return __atomic_load_n(&(hash->head), __ATOMIC_SEQ_CST) != __atomic_load_n(&(hash->tail), __ATOMIC_SEQ_CST);
+}
+
+
+static bool pv__hash_has_space(pvhash_t hash)
+{
+	return (__atomic_load_n(&(hash->head), __ATOMIC_SEQ_CST)
+		- __atomic_load_n(&(hash->tail), __ATOMIC_SEQ_CST)) < (unsigned long long) (hash->ring_size);
+}
+
+
+/*
+ * Helper thread: hash whatever is in the ring, until told to stop and
+ * the ring is empty.  The data is hashed in chunks of at most
+ * PV_HASH_CHUNK bytes, so that space is handed back to the main thread
+ * as it goes.
+ */
+/*@null@ */
+static void *pv__hash_worker(void *arg)
+{
+	pvhash_t hash = (pvhash_t) arg;
+
+	while (true) {
+		unsigned long long head, tail;
+		size_t offset, length;
+		bool stopping;
+
+		/* Check "stop" first, so that the last data isn't missed. */
+		stopping = __atomic_load_n(&(hash->stop), __ATOMIC_SEQ_CST);
+		head = __atomic_load_n(&(hash->head), __ATOMIC_SEQ_CST);
+		tail = __atomic_load_n(&(hash->tail), __ATOMIC_RELAXED);
+
+		if (head == tail) {
+			if (stopping)
+				break;
+			pv__hash_sleep(hash, &(hash->worker_waiting), pv__hash_has_data);
+			continue;
+		}
+
+		offset = (size_t) (tail % hash->ring_size);
+		length = (size_t) (head - tail);
+		if (length > hash->ring_size - offset)
+			length = hash->ring_size - offset;
+		if (length > PV_HASH_CHUNK)
+			length = PV_HASH_CHUNK;
+
+		pv__hash_update(hash, hash->ring + offset, length);
+
+		__atomic_store_n(&(hash->tail), tail + length, __ATOMIC_SEQ_CST);
+		pv__hash_wake(hash, &(hash->feeder_waiting));
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Start the helper thread, with all signals blocked so that they are
+ * still handled by the main thread.  If it can't be started, the main
+ * thread hashes everything itself.
+ */
+static void pv__hash_start(pvhash_t hash)
+{
+	sigset_t all_signals, old_signals;
+	int rc;
+
+	hash->ring_size = PV_HASH_RING_SIZE;
+	hash->ring = malloc(hash->ring_size);
+	if (NULL == hash->ring) {
+		debug("%s: %s", "hash ring allocation failed - hashing inline", strerror(errno));
+		return;
+	}
+
+	(void) pthread_mutex_init(&(hash->mutex), NULL);
+	(void) pthread_cond_init(&(hash->cond), NULL);
+
+	(void) sigfillset(&all_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(hash->thread), NULL, pv__hash_worker, hash);
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		debug("%s: %s", "failed to start hash thread - hashing inline", strerror(rc));
+		(void) pthread_cond_destroy(&(hash->cond));
+		(void) pthread_mutex_destroy(&(hash->mutex));
+		free(hash->ring);
+		hash->ring = NULL;
+		return;
+	}
+
+	hash->running = true;
+}
+
+
+/*
+ * Let the helper thread hash whatever is left in the ring, and reap it.
+ */
+static void pv__hash_stop(pvhash_t hash)
+{
+	if (!hash->running)
+		return;
+
+	__atomic_store_n(&(hash->stop), true, __ATOMIC_SEQ_CST);
+	pv__hash_wake(hash, NULL);
+	(void) pthread_join(hash->thread, NULL);
+
+	(void) pthread_cond_destroy(&(hash->cond));
+	(void) pthread_mutex_destroy(&(hash->mutex));
+	if (NULL != hash->ring)
+		free(hash->ring);
+	hash->ring = NULL;
+	hash->running = false;
+}
+
+
+/*
+ * Copy "length" bytes of "data" into the ring for the helper thread,
+ * waiting for it to make room if the ring is full.
+ */
+static void pv__hash_queue(pvhash_t hash, const unsigned char *data, size_t length)
+{
+	if (NULL == hash->ring)
+		return;
+
+	while (length > 0) {
+		unsigned long long head, tail;
+		size_t space, offset, chunk;
+
+		head = __atomic_load_n(&(hash->head), __ATOMIC_RELAXED);
+		tail = __atomic_load_n(&(hash->tail), __ATOMIC_SEQ_CST);
+
+		space = hash->ring_size - (size_t) (head - tail);
+		if (0 == space) {
+			pv__hash_sleep(hash, &(hash->feeder_waiting), pv__hash_has_space);
+			continue;
+		}
+
+		offset = (size_t) (head % hash->ring_size);
+		chunk = length;
+		if (chunk > space)
+			chunk = space;
+		if (chunk > hash->ring_size - offset)
+			chunk = hash->ring_size - offset;
+
+		memcpy(hash->ring + offset, data, chunk);
+
+		__atomic_store_n(&(hash->head), head + chunk, __ATOMIC_SEQ_CST);
+		pv__hash_wake(hash, &(hash->worker_waiting));
+
+		data += chunk;
+		length -= chunk;
+	}
+}
+#endif				/* HAVE_THREADS */
+
+
+/*
+ * Return the running digests, setting them up first if this is the first
+ * call.  Returns NULL if no digests are wanted, or if they are already
+ * finished.
+ */
+/*@null@ */
+/*@dependent@ */
+static pvhash_t pv__hash_engine(pvstate_t state)
+{
+	pvhash_t hash;
+	unsigned int algorithm;
+
+	if (NULL != state->hash.engine)
+		return state->hash.engine;
+	if ((0 == state->control.hash_algorithms) || state->hash.finished)
+		return NULL;
+
+	hash = calloc(1, sizeof(*hash));
+	if (NULL == hash) {
+		pv_error("%s: %s", _("hash"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		state->hash.finished = true;
+		return NULL;
+	}
+
+	for (algorithm = PV_HASH_CRC32C; algorithm <= PV_HASH_SHA256; algorithm <<= 1) {
+		if (0 == (state->control.hash_algorithms & algorithm))
+			continue;
+		pv_digest_init(&(hash->digest[hash->digest_count]), algorithm);
+		hash->digest_count++;
+	}
+
+#ifdef HAVE_THREADS
+	pv__hash_start(hash);
+#endif
+
+	state->hash.engine = hash;
+	return hash;
+}
+
+
+/*
+ * Add "length" bytes of "data", which have just been written to the
+ * output, to the --hash digests.
+ */
+void pv_hash_feed(pvstate_t state, const char *data, size_t length)
+{
+	pvhash_t hash;
+
+	if ((0 == state->control.hash_algorithms) || (0 == length))
+		return;
+
+	hash = pv__hash_engine(state);
+	if (NULL == hash)
+		return;
+
+#ifdef HAVE_THREADS
+	if (hash->running) {
+		pv__hash_queue(hash, (const unsigned char *) data, length);
+		return;
+	}
+#endif
+
+	pv__hash_update(hash, (const unsigned char *) data, length);
+}
+
+
+/*
+ * Finish the --hash digests once everything has been written, putting
+ * them in state->hash and pointing state->transfer.digest at them for the
+ * display.  Calling this again does nothing.
+ */
+void pv_hash_finish(pvstate_t state)
+{
+	pvhash_t hash;
+	size_t offset;
+	unsigned int idx;
+
+	if ((0 == state->control.hash_algorithms) || state->hash.finished)
+		return;
+
+	hash = pv__hash_engine(state);
+	state->hash.finished = true;
+	if (NULL == hash)
+		return;
+
+#ifdef HAVE_THREADS
+	pv__hash_stop(hash);
+#endif
+
+	offset = 0;
+	state->hash.text[0] = '\0';
+	for (idx = 0; idx < hash->digest_count; idx++) {
+		pv_digest_hex(&(hash->digest[idx]), state->hash.hex[idx], sizeof(state->hash.hex[idx]));
+		debug("%s: %s", pv_digest_name(hash->digest[idx].algorithm), state->hash.hex[idx]);
+		(void) pv_snprintf(state->hash.text + offset, sizeof(state->hash.text) - offset, "%s%s",
+				   idx > 0 ? " " : "", state->hash.hex[idx]);
+		offset = strlen(state->hash.text);	/* flawfinder: ignore */
+		/* flawfinder: pv_snprintf() always terminates the string. */
+	}
+
+	state->transfer.digest = state->hash.text;
+}
+
+
+/*
+ * Write the --hash digests to the terminal, one per line, after the
+ * statistics from --stats.
+ */
+void pv_hash_report(pvstate_t state)
+{
+	unsigned int idx;
+
+	if ((!state->hash.finished) || (NULL == state->hash.engine))
+		return;
+
+	for (idx = 0; idx < state->hash.engine->digest_count; idx++) {
+		char report_buf[128];	 /* flawfinder: ignore */
+		int report_size;
+
+		/* flawfinder: made safe by use of pv_snprintf(). */
+
+		memset(report_buf, 0, sizeof(report_buf));
+		report_size =
+		    pv_snprintf(report_buf, sizeof(report_buf), "%s = %s\n",
+				pv_digest_name(state->hash.engine->digest[idx].algorithm), state->hash.hex[idx]);
+
+		if (report_size > 0 && report_size < (int) (sizeof(report_buf)))
+			pv_tty_write(&(state->flags), report_buf, (size_t) report_size);
+	}
+}
+
+
+/*
+ * Stop hashing and free the digests.
+ */
+void pv_hash_free(pvstate_t state)
+{
+	if (NULL == state->hash.engine)
+		return;
+#ifdef HAVE_THREADS
+	pv__hash_stop(state->hash.engine);
+#endif
+	free(state->hash.engine);
+	state->hash.engine = NULL;
+	state->transfer.digest = NULL;
+}
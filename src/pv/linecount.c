@@ -0,0 +1,333 @@
+/*
+ * Background line counting: worker threads read through the input files
+ * to find their total line count while the transfer is already running,
+ * and until they finish, the total is estimated from the number of bytes
+ * per line seen so far.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_THREADS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+/*
+ * One input file being counted.  The file descriptor belongs to the line
+ * counter, and is read with pread() so that it doesn't matter if it shares
+ * a file position with the descriptor being transferred (as it will for
+ * standard input).
+ */
+struct pvlinecount_file_s {
+	int fd;					/* descriptor to read, or -1 */
+	/* Shared. */
+	unsigned long long lines;		/* separators counted so far */
+	unsigned long long scanned;		/* bytes read so far */
+	int read_errno;				/* nonzero if reading failed */
+};
+
+/*
+ * The line counter.  Each worker thread takes the next file that nobody
+ * has started on, until there are none left, so there is one worker per
+ * input file up to PV_LINECOUNT_THREADS.
+ *
+ * Everything marked "shared" is accessed with atomic builtins.
+ */
+struct pvlinecount_s {
+	pthread_t threads[PV_LINECOUNT_THREADS];
+	unsigned int thread_count;		/* number of threads started */
+	/*@only@ */ struct pvlinecount_file_s *files;
+	unsigned int file_count;
+	off_t total_bytes;			/* combined size of all files */
+	char separator;
+
+	/* Shared. */
+	unsigned int next_file;			/* index of next file to start */
+	unsigned int threads_finished;		/* number of threads that have ended */
+	bool failed;				/* set if a worker couldn't run */
+	bool stop;
+};
+
+
+/*
+ * Worker thread: count the separators in each file it takes on, in large
+ * chunks, until there are no files left or the counter is being stopped.
+ */
+static void *pv__linecount_worker(void *arg)
+{
+	pvlinecount_t linecount = (pvlinecount_t) arg;
+	char *chunk;
+
+	chunk = malloc(PV_LINECOUNT_CHUNK);
+	if (NULL == chunk) {
+		__atomic_store_n(&(linecount->failed), true, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&(linecount->threads_finished), 1, __ATOMIC_SEQ_CST);
+		return NULL;
+	}
+
+	while (!__atomic_load_n(&(linecount->stop), __ATOMIC_SEQ_CST)) {
+		struct pvlinecount_file_s *file;
+		unsigned int file_idx;
+		off_t offset;
+
+		file_idx = __atomic_fetch_add(&(linecount->next_file), 1, __ATOMIC_SEQ_CST);
+		if (file_idx >= linecount->file_count)
+			break;
+
+		file = &(linecount->files[file_idx]);
+		if (file->fd < 0)
+			continue;
+
+#if HAVE_POSIX_FADVISE
+		/* Advise the OS that all reads will be sequential. */
+		(void) posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+		offset = 0;
+		while (!__atomic_load_n(&(linecount->stop), __ATOMIC_SEQ_CST)) {
+			ssize_t numread;
+			size_t lines;
+
+			numread = pread(file->fd, chunk, PV_LINECOUNT_CHUNK, offset);	/* flawfinder: ignore */
+			/* flawfinder - always reads into the start of the chunk, bounded by its size. */
+			if (numread < 0) {
+				if (EINTR == errno)
+					continue;
+				__atomic_store_n(&(file->read_errno), errno, __ATOMIC_SEQ_CST);
+				break;
+			} else if (0 == numread) {
+				break;
+			}
+
+			offset += (off_t) numread;
+			lines = pv_memcount(chunk, (int) (linecount->separator), (size_t) numread);
+			__atomic_add_fetch(&(file->lines), (unsigned long long) lines, __ATOMIC_SEQ_CST);
+			__atomic_add_fetch(&(file->scanned), (unsigned long long) numread, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	free(chunk);
+	__atomic_add_fetch(&(linecount->threads_finished), 1, __ATOMIC_SEQ_CST);
+
+	return NULL;
+}
+
+
+/*
+ * Stop the worker threads, close the files, and free the line counter.
+ */
+void pv_linecount_free( /*@only@ */ pvlinecount_t linecount)
+{
+	unsigned int idx;
+
+	if (NULL == linecount)
+		return;
+
+	__atomic_store_n(&(linecount->stop), true, __ATOMIC_SEQ_CST);
+	for (idx = 0; idx < linecount->thread_count; idx++) {
+		(void) pthread_join(linecount->threads[idx], NULL);
+	}
+
+	for (idx = 0; idx < linecount->file_count; idx++) {
+		if (linecount->files[idx].fd >= 0)
+			(void) close(linecount->files[idx].fd);
+	}
+
+	free(linecount->files);
+	free(linecount);
+}
+
+
+/*
+ * Start counting the lines in the "file_count" files whose descriptors
+ * are in "fds" (where any negative entries are skipped), whose sizes add
+ * up to "total_bytes", in the background.
+ *
+ * On success, the line counter takes over the file descriptors and closes
+ * them when it is freed.  Returns NULL, with errno set, on error, in which
+ * case the descriptors are left alone.
+ */
+/*@null@ */
+/*@only@ */
+pvlinecount_t pv_linecount_start(const int *fds, unsigned int file_count, off_t total_bytes, char separator)
+{
+	pvlinecount_t linecount;
+	sigset_t all_signals, old_signals;
+	unsigned int idx;
+	int rc;
+
+	linecount = calloc(1, sizeof(*linecount));
+	if (NULL == linecount)
+		return NULL;
+
+	linecount->files = calloc((size_t) (file_count + 1), sizeof(struct pvlinecount_file_s));
+	if (NULL == linecount->files) {
+		free(linecount);
+		return NULL;
+	}
+
+	for (idx = 0; idx < file_count; idx++) {
+		linecount->files[idx].fd = fds[idx];
+	}
+	linecount->file_count = file_count;
+	linecount->total_bytes = total_bytes;
+	linecount->separator = separator;
+
+	/*
+	 * All signals are blocked while the threads are created, so that
+	 * they inherit a full signal mask and signals are always handled
+	 * by the main thread.
+	 */
+	(void) sigfillset(&all_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+	rc = 0;
+	while ((linecount->thread_count < PV_LINECOUNT_THREADS) && (linecount->thread_count < file_count)) {
+		rc = pthread_create(&(linecount->threads[linecount->thread_count]), NULL, pv__linecount_worker,
+				    linecount);
+		if (0 != rc)
+			break;
+		linecount->thread_count++;
+	}
+
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 == linecount->thread_count) {
+		/* Don't let pv_linecount_free() close the caller's files. */
+		for (idx = 0; idx < file_count; idx++) {
+			linecount->files[idx].fd = -1;
+		}
+		pv_linecount_free(linecount);
+		errno = 0 == rc ? EINVAL : rc;
+		return NULL;
+	}
+
+	debug("%s: %u %s, %u %s, %lld %s", "background line count started", file_count, "files",
+	      linecount->thread_count, "threads", (long long) total_bytes, "bytes");
+
+	return linecount;
+}
+
+
+/*
+ * Return an estimate of the total line count, based on the bytes per line
+ * seen so far either by the line counter or by the transfer itself,
+ * whichever has seen more; or 0 if there is nothing to base it on yet.
+ */
+static off_t pv__linecount_estimate(pvstate_t state, pvlinecount_t linecount)
+{
+	unsigned long long sample_lines, sample_bytes;
+	off_t written_bytes, estimate;
+	unsigned int idx;
+
+	sample_lines = 0;
+	sample_bytes = 0;
+	for (idx = 0; idx < linecount->file_count; idx++) {
+		sample_lines += __atomic_load_n(&(linecount->files[idx].lines), __ATOMIC_SEQ_CST);
+		sample_bytes += __atomic_load_n(&(linecount->files[idx].scanned), __ATOMIC_SEQ_CST);
+	}
+
+	/*
+	 * The transfer has counted state->transfer.total_written lines in
+	 * whatever it has read and is no longer holding in its buffer.
+	 */
+	written_bytes = state->transfer.total_bytes_read;
+	if (state->transfer.read_position > state->transfer.write_position)
+		written_bytes -= (off_t) (state->transfer.read_position - state->transfer.write_position);
+	if ((written_bytes > 0) && ((unsigned long long) written_bytes > sample_bytes)
+	    && (state->transfer.total_written > 0)) {
+		sample_lines = (unsigned long long) (state->transfer.total_written);
+		sample_bytes = (unsigned long long) written_bytes;
+	}
+
+	if ((sample_lines < 1) || (sample_bytes < 1))
+		return 0;
+
+	estimate = (off_t) (0.5L + (long double) sample_lines * (long double) (linecount->total_bytes)
+			    / (long double) sample_bytes);
+
+	/* The total can't be fewer than the lines already seen. */
+	if (estimate < (off_t) sample_lines)
+		estimate = (off_t) sample_lines;
+	if (estimate < state->transfer.total_written)
+		estimate = state->transfer.total_written;
+
+	return estimate;
+}
+
+
+/*
+ * Check on the background line count in state->files.linecount, if there
+ * is one, and update state->control.size - with the exact total if the
+ * count has finished, or an estimate if it hasn't.
+ *
+ * If "final_update" is true, the transfer has finished, so the number of
+ * lines transferred is the exact total, and the count is abandoned if it
+ * is still running.
+ */
+void pv_linecount_update(pvstate_t state, bool final_update)
+{
+	pvlinecount_t linecount;
+	unsigned int idx;
+	off_t total;
+
+	linecount = state->files.linecount;
+	if (NULL == linecount)
+		return;
+
+	/*
+	 * If a worker couldn't run, the count will never be complete, so
+	 * it is treated as still running, and estimates are used throughout.
+	 */
+	if ((__atomic_load_n(&(linecount->threads_finished), __ATOMIC_SEQ_CST) < linecount->thread_count)
+	    || (__atomic_load_n(&(linecount->failed), __ATOMIC_SEQ_CST))) {
+		if (final_update) {
+			debug("%s: %lld", "transfer finished before line count - using lines transferred",
+			      (long long) (state->transfer.total_written));
+			state->control.size = state->transfer.total_written;
+			pv_linecount_free(linecount);
+			state->files.linecount = NULL;
+			return;
+		}
+		total = pv__linecount_estimate(state, linecount);
+		if (total > 0)
+			state->control.size = total;
+		return;
+	}
+
+	total = 0;
+	for (idx = 0; idx < linecount->file_count; idx++) {
+		int read_errno;
+
+		total += (off_t) __atomic_load_n(&(linecount->files[idx].lines), __ATOMIC_SEQ_CST);
+
+		read_errno = __atomic_load_n(&(linecount->files[idx].read_errno), __ATOMIC_SEQ_CST);
+		if (0 == read_errno)
+			continue;
+		pv_error("%s: %s",
+			 (NULL != state->files.filename && idx < state->files.file_count
+			  && NULL != state->files.filename[idx]) ? state->files.filename[idx] : "-",
+			 strerror(read_errno));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+	}
+
+	debug("%s: %lld", "background line count finished", (long long) total);
+
+	state->control.size = total;
+	pv_linecount_free(linecount);
+	state->files.linecount = NULL;
+}
+
+#endif				/* HAVE_THREADS */
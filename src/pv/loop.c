@@ -30,6 +30,7 @@
 #endif
 
 int pv_remote_transferstate_fetch(pvstate_t, pid_t, /*@null@ */ off_t *, bool);
+static bool format_contains_name(const char *);
 
 
 #if HAVE_SQRTL
@@ -82,6 +83,62 @@ static bool pv__resize_display_on_signal(pvstate_t state)
 }
 
 
+/*
+ * Add the time between "start" and "end", taken by one call of
+ * pv_transfer(), to the --stats chunk time histogram.
+ */
+static void pv__record_chunk_time(pvstate_t state, const struct timespec *start, const struct timespec *end)
+{
+	struct timespec taken;
+	long double nsec;
+	unsigned int bucket;
+
+	pv_elapsedtime_subtract(&taken, end, start);
+	nsec = pv_elapsedtime_seconds(&taken) * 1000000000.0L;
+
+	bucket = 0;
+	while ((nsec >= 2.0L) && (bucket < PV_CHUNK_TIME_BUCKETS - 1)) {
+		nsec /= 2.0L;
+		bucket++;
+	}
+
+	state->transfer.chunk_time_histogram[bucket]++;
+	state->transfer.chunk_count++;
+}
+
+
+/*
+ * Return the time in microseconds that the given fraction of the chunks
+ * in the --stats chunk time histogram took at most, as the upper end of
+ * the histogram bucket it falls in.
+ */
+static long double pv__chunk_time_percentile(pvstate_t state, long double fraction)
+{
+	unsigned long wanted, so_far;
+	unsigned int bucket;
+	long double upper;
+
+	wanted = (unsigned long) (fraction * (long double) (state->transfer.chunk_count));
+	if (wanted < 1)
+		wanted = 1;
+
+	so_far = 0;
+	for (bucket = 0; bucket < PV_CHUNK_TIME_BUCKETS - 1; bucket++) {
+		so_far += state->transfer.chunk_time_histogram[bucket];
+		if (so_far >= wanted)
+			break;
+	}
+
+	upper = 2.0L;
+	while (bucket > 0) {
+		upper *= 2.0L;
+		bucket--;
+	}
+
+	return upper / 1000.0L;
+}
+
+
 /*
  * Calculate and display the transfer statistics at the end of the transfer,
  * if stats are enabled and any measurements were taken.
@@ -123,6 +180,22 @@ static void pv__show_stats(pvstate_t state)
 
 		if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
 			pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
+
+		/*
+		 * Percentiles of the measured rates, to the nearest 12.5%,
+		 * and the number of times the transfer stalled, which the
+		 * mean hides.
+		 */
+		memset(stats_buf, 0, sizeof(stats_buf));
+		stats_size =
+		    pv_snprintf(stats_buf, sizeof(stats_buf), "%s = %.3Lf/%.3Lf/%.3Lf %s (%lu %s)\n",
+				_("rate p50/p95/p99"), pv_calculate_rate_percentile(&(state->calc), 0.5L),
+				pv_calculate_rate_percentile(&(state->calc), 0.95L),
+				pv_calculate_rate_percentile(&(state->calc), 0.99L),
+				state->control.bits ? _("b/s") : _("B/s"), state->calc.stall_count, _("stalls"));
+
+		if (stats_size > 0 && stats_size < (int) (sizeof(stats_buf)))
+			pv_tty_write(&(state->flags), stats_buf, (size_t) stats_size);
 	} else if (state->control.show_stats && state->calc.measurements_taken < 1) {
 		char msg_buf[256];	 /* flawfinder: ignore */
 		int msg_size;
@@ -135,6 +208,146 @@ static void pv__show_stats(pvstate_t state)
 		if (msg_size > 0 && msg_size < (int) (sizeof(msg_buf)))
 			pv_tty_write(&(state->flags), msg_buf, (size_t) msg_size);
 	}
+
+	/*
+	 * Show how the transfer buffer's memory was set up, if anything
+	 * other than the default was asked for, since the kernel may not
+	 * have been able to do all of it.
+	 */
+	if ((state->control.huge_pages || state->control.lock_memory || (state->control.numa_node >= 0))
+	    && (state->transfer.buffer_mem.size > 0)) {
+		struct pvbuffermem_s *mem = &(state->transfer.buffer_mem);
+		char mem_buf[256];	 /* flawfinder: ignore */
+		char node_buf[64];	 /* flawfinder: ignore */
+		int mem_size;
+
+		/* flawfinder: made safe by use of pv_snprintf(). */
+
+		memset(node_buf, 0, sizeof(node_buf));
+		if (mem->node >= 0) {
+			(void) pv_snprintf(node_buf, sizeof(node_buf), "%s %d", _("NUMA node"), mem->node);
+		} else {
+			(void) pv_snprintf(node_buf, sizeof(node_buf), "%s", _("no NUMA node"));
+		}
+
+		memset(mem_buf, 0, sizeof(mem_buf));
+		mem_size =
+		    pv_snprintf(mem_buf, sizeof(mem_buf), "%s = %s (%lu %s), %s, %s\n", _("buffer memory"),
+				mem->hugetlb ? _("reserved huge pages") : (mem->thp ? _("transparent huge pages") :
+									   _("normal pages")),
+				(unsigned long) (mem->page_size / 1024), _("KiB"), node_buf,
+				mem->locked ? _("locked") : _("not locked"));
+		if (mem_size > 0 && mem_size < (int) (sizeof(mem_buf)))
+			pv_tty_write(&(state->flags), mem_buf, (size_t) mem_size);
+	}
+
+	/*
+	 * Show how many zero-copy sends there were, and how many of them
+	 * the kernel ended up copying anyway.
+	 */
+	if (state->transfer.zerocopy_sent > 0) {
+		char zc_buf[256];	 /* flawfinder: ignore */
+		int zc_size;
+
+		/* flawfinder: made safe by use of pv_snprintf(). */
+
+		memset(zc_buf, 0, sizeof(zc_buf));
+		zc_size =
+		    pv_snprintf(zc_buf, sizeof(zc_buf), "%s = %lu (%lu %s)\n", _("zero-copy sends"),
+				state->transfer.zerocopy_sent, state->transfer.zerocopy_copied, _("copied"));
+		if (zc_size > 0 && zc_size < (int) (sizeof(zc_buf)))
+			pv_tty_write(&(state->flags), zc_buf, (size_t) zc_size);
+	}
+
+	/*
+	 * Show how long each chunk of the transfer took - the time taken by
+	 * each pass of the main loop that moved some data.
+	 */
+	if (state->transfer.chunk_count > 0) {
+		char chunk_buf[256];	 /* flawfinder: ignore */
+		int chunk_size;
+
+		/* flawfinder: made safe by use of pv_snprintf(). */
+
+		memset(chunk_buf, 0, sizeof(chunk_buf));
+		chunk_size =
+		    pv_snprintf(chunk_buf, sizeof(chunk_buf), "%s = %.3Lf/%.3Lf %s (%lu %s)\n",
+				_("chunk time p50/p99"), pv__chunk_time_percentile(state, 0.5L),
+				pv__chunk_time_percentile(state, 0.99L), _("us"), state->transfer.chunk_count,
+				_("chunks"));
+		if (chunk_size > 0 && chunk_size < (int) (sizeof(chunk_buf)))
+			pv_tty_write(&(state->flags), chunk_buf, (size_t) chunk_size);
+	}
+
+	/*
+	 * Show how long was spent waiting for each side, and the sizes of
+	 * the reads and writes, to show which side was holding things up.
+	 */
+	if (state->transfer.instrumented) {
+		char wait_buf[768];	 /* flawfinder: ignore */
+		char sizes_buf[512];	 /* flawfinder: ignore */
+		long double elapsed;
+		int wait_size;
+
+		/* flawfinder: made safe by use of pv_snprintf(). */
+
+		elapsed = state->transfer.elapsed_seconds - state->transfer.instrumented_since;
+		if (elapsed <= 0.0)
+			elapsed = 0.000001;
+
+		memset(wait_buf, 0, sizeof(wait_buf));
+		wait_size =
+		    pv_snprintf(wait_buf, sizeof(wait_buf), "%s = %.3Lf/%.3Lf %s (%.0Lf%%/%.0Lf%%)\n",
+				_("time waiting for input/output"), state->transfer.wait_input_seconds,
+				state->transfer.wait_output_seconds, _("s"),
+				100.0 * state->transfer.wait_input_seconds / elapsed,
+				100.0 * state->transfer.wait_output_seconds / elapsed);
+		if (wait_size > 0 && wait_size < (int) (sizeof(wait_buf)))
+			pv_tty_write(&(state->flags), wait_buf, (size_t) wait_size);
+
+		memset(sizes_buf, 0, sizeof(sizes_buf));
+		pv_bottleneck_describe_sizes(sizes_buf, sizeof(sizes_buf), state->transfer.read_size_histogram);
+		memset(wait_buf, 0, sizeof(wait_buf));
+		wait_size = pv_snprintf(wait_buf, sizeof(wait_buf), "%s = %s\n", _("read sizes"), sizes_buf);
+		if (wait_size > 0 && wait_size < (int) (sizeof(wait_buf)))
+			pv_tty_write(&(state->flags), wait_buf, (size_t) wait_size);
+
+		memset(sizes_buf, 0, sizeof(sizes_buf));
+		pv_bottleneck_describe_sizes(sizes_buf, sizeof(sizes_buf), state->transfer.write_size_histogram);
+		memset(wait_buf, 0, sizeof(wait_buf));
+		wait_size = pv_snprintf(wait_buf, sizeof(wait_buf), "%s = %s\n", _("write sizes"), sizes_buf);
+		if (wait_size > 0 && wait_size < (int) (sizeof(wait_buf)))
+			pv_tty_write(&(state->flags), wait_buf, (size_t) wait_size);
+	}
+
+	/*
+	 * With --auto-buffer, also show what the buffer size and the pipe
+	 * capacities were tuned to.
+	 */
+	if (state->control.auto_buffer && (state->transfer.autotune_initial_size > 0)) {
+		char tune_buf[256];	 /* flawfinder: ignore */
+		int tune_size;
+
+		/* flawfinder: made safe by use of pv_snprintf(). */
+
+		memset(tune_buf, 0, sizeof(tune_buf));
+		tune_size =
+		    pv_snprintf(tune_buf, sizeof(tune_buf), "%s = %ld/%ld/%ld (%u %s)\n",
+				_("buffer size initial/largest/final"), (long) (state->transfer.autotune_initial_size),
+				(long) (state->transfer.autotune_largest_size), (long) (state->transfer.buffer_size),
+				state->transfer.autotune_changes, _("changes"));
+		if (tune_size > 0 && tune_size < (int) (sizeof(tune_buf)))
+			pv_tty_write(&(state->flags), tune_buf, (size_t) tune_size);
+
+		if ((state->transfer.input_pipe_size > 0) || (state->transfer.output_pipe_size > 0)) {
+			memset(tune_buf, 0, sizeof(tune_buf));
+			tune_size =
+			    pv_snprintf(tune_buf, sizeof(tune_buf), "%s = %d/%d\n", _("pipe capacity input/output"),
+					state->transfer.input_pipe_size, state->transfer.output_pipe_size);
+			if (tune_size > 0 && tune_size < (int) (sizeof(tune_buf)))
+				pv_tty_write(&(state->flags), tune_buf, (size_t) tune_size);
+		}
+	}
 }
 
 
@@ -170,11 +383,22 @@ static long double pv__elapsed_transfer_time(const struct timespec *loop_start_t
 /*
  * Exchange information with the other side of the "-M both" monitor about
  * the amount of data transferred.
+ *
+ * If the two sides share counters in memory, this is just a store and a
+ * load, and is done on every pass of the main loop; otherwise the counts
+ * are sent through pipes, every MONITOR_EXCHANGE_INTERVAL.
  */
 static void pv__monitor_exchange(pvstate_t state)
 {
 	bool written_yet = false;
 
+	if ((NULL != state->control.othermonitor_own_count) && (NULL != state->control.othermonitor_other_count)) {
+		__atomic_store_n(state->control.othermonitor_own_count, state->transfer.transferred, __ATOMIC_RELEASE);
+		state->transfer.otherside_transferred =
+		    __atomic_load_n(state->control.othermonitor_other_count, __ATOMIC_ACQUIRE);
+		return;
+	}
+
 	while ((state->control.othermonitor_read_fd >= 0) || (state->control.othermonitor_write_fd >= 0)) {
 		struct timeval tv;
 		fd_set readfds;
@@ -288,6 +512,246 @@ static void pv__monitor_exchange(pvstate_t state)
 }
 
 
+/*
+ * Draw one of the progress lines below the main one, on the next line of
+ * the terminal, using the format already set in state->control.
+ */
+static void pv__subline_display(pvstate_t state, struct pvsubline_s *line, bool final_update)
+{
+	off_t main_size;
+	char *main_name;
+
+	pv_tty_write(&(state->flags), "\n", 1);
+
+	line->transfer.elapsed_seconds = state->transfer.elapsed_seconds;
+	line->transfer.total_written = line->transferred;
+	line->transfer.transferred = line->transferred;
+
+	main_size = state->control.size;
+	main_name = state->control.name;
+	state->control.size = line->size;
+	state->control.name = line->name;
+
+	pv_display(&(state->status), &(state->control), &(line->flags), &(line->transfer),
+		   &(line->calc), &(state->cursor), &(line->display), NULL, final_update);
+
+	/*@-mustfreeonly@ */
+	state->control.size = main_size;
+	state->control.name = main_name;
+	/*
+	 * splint warns of a memory leak, but the name was only swapped out
+	 * for an alias of the line's own name while drawing it.
+	 */
+	/*@+mustfreeonly@ */
+}
+
+
+/*
+ * Show a progress line for each --merge input and each --tee output, and
+ * for the real output with --overlap, below the main one, leaving the cursor at the start of the main line
+ * again.  Like the lines drawn by pv_watchfd_loop(), each starts with the
+ * input or output's name, unless the format already shows a name.  If
+ * "reparse" is true, the format may have changed.
+ */
+static void pv__sublines_display(pvstate_t state, bool reparse, bool final_update)
+{
+	char *main_format_string;
+	unsigned int idx, line_count;
+
+	line_count = 0;
+	if (NULL != state->merge.input)
+		line_count += state->merge.count;
+	if (NULL != state->fanout.output)
+		line_count += state->fanout.count;
+	if ((NULL != state->spool.engine) && (NULL != state->spool.line))
+		line_count++;
+
+	if (0 == line_count)
+		return;
+	if (state->control.numeric || state->control.cursor || (!state->display.output_produced))
+		return;
+
+	if (reparse || (NULL == state->sublines.format_string)
+	    || (state->sublines.width_shown != (unsigned int) (state->control.width))) {
+		char new_format_string[512];	 /* flawfinder: ignore */
+		const char *original_format_string;
+
+		/*
+		 * flawfinder rationale (new_format_string): zeroed with
+		 * memset(), only written to with pv_snprintf() which checks
+		 * boundaries, and explicitly terminated with \0.
+		 */
+
+		original_format_string = state->control.format_string;
+		if (NULL == original_format_string)
+			original_format_string = state->control.default_format;
+
+		memset(new_format_string, 0, sizeof(new_format_string));
+		if (format_contains_name(original_format_string)) {
+			(void) pv_snprintf(new_format_string, sizeof(new_format_string), "%s", original_format_string);
+		} else {
+			(void) pv_snprintf(new_format_string, sizeof(new_format_string), "%%N %s",
+					   original_format_string);
+		}
+		new_format_string[sizeof(new_format_string) - 1] = '\0';
+
+		if (NULL != state->sublines.format_string)
+			free(state->sublines.format_string);
+		state->sublines.format_string = pv_strdup(new_format_string);
+		if (NULL == state->sublines.format_string)
+			return;
+
+		for (idx = 0; NULL != state->merge.input && idx < state->merge.count; idx++)
+			state->merge.input[idx].line.flags.reparse_display = 1;
+		for (idx = 0; NULL != state->fanout.output && idx < state->fanout.count; idx++)
+			state->fanout.output[idx].line.flags.reparse_display = 1;
+		if (NULL != state->spool.line)
+			state->spool.line->flags.reparse_display = 1;
+		state->sublines.width_shown = (unsigned int) (state->control.width);
+	}
+
+	main_format_string = state->control.format_string;
+	state->control.format_string = state->sublines.format_string;
+
+	for (idx = 0; NULL != state->merge.input && idx < state->merge.count; idx++)
+		pv__subline_display(state, &(state->merge.input[idx].line), final_update);
+	for (idx = 0; NULL != state->fanout.output && idx < state->fanout.count; idx++)
+		pv__subline_display(state, &(state->fanout.output[idx].line), final_update);
+	if ((NULL != state->spool.engine) && (NULL != state->spool.line))
+		pv__subline_display(state, state->spool.line, final_update);
+
+	/*@-mustfreeonly@ */
+	state->control.format_string = main_format_string;
+	/* splint - see pv__subline_display(). */
+	/*@+mustfreeonly@ */
+
+	for (idx = 0; idx < line_count; idx++)
+		pv_tty_write(&(state->flags), "\033[A", 3);
+
+	state->sublines.lines_shown = line_count;
+}
+
+
+/*
+ * The main loop's timers.  There are only a handful, so the next one due
+ * is found by looking at each in turn, rather than by keeping them in a
+ * heap.  Timers that "wake" the loop limit how long pv_transfer() may
+ * wait for the input or output; the others are only acted on when the
+ * loop comes round anyway.
+ *
+ * A timer may have some slack, so that the loop sleeps up to that much
+ * longer than it needs to for it, to give an I/O wakeup the chance to act
+ * on the timer as well - this lets a display update show data that
+ * arrives just after it was due, rather than waiting for the next one.
+ */
+typedef enum {
+	PV_TIMER_MONITOR,		/* exchange data in "-M both" mode */
+	PV_TIMER_RATE,			/* -L rate allowance is due */
+	PV_TIMER_UPDATE,		/* update the display */
+	PV_TIMER_COUNT
+} pvtimer_t;
+
+struct pvtimers_s {
+	struct timespec due[PV_TIMER_COUNT];
+	long slack_usec[PV_TIMER_COUNT];
+	bool wakes[PV_TIMER_COUNT];
+};
+
+
+/*
+ * Set "timer" to be due "nsec" nanoseconds after "base", and whether to
+ * wake the loop for it.
+ */
+static void pv__timer_set(struct pvtimers_s *timers, pvtimer_t timer, const struct timespec *base, long long nsec,
+			  bool wakes)
+{
+	pv_elapsedtime_copy(&(timers->due[timer]), base);
+	if (nsec > 0)
+		pv_elapsedtime_add_nsec(&(timers->due[timer]), nsec);
+	timers->wakes[timer] = wakes;
+}
+
+
+/*
+ * Return true if "timer" is due at time "now".
+ */
+static bool pv__timer_due(const struct pvtimers_s *timers, pvtimer_t timer, const struct timespec *now)
+{
+	return pv_elapsedtime_compare(now, &(timers->due[timer])) > 0 ? true : false;
+}
+
+
+/*
+ * Return the number of microseconds from "now" until the first timer that
+ * wakes the loop is due, plus its slack, between LOOP_WAIT_MIN and
+ * LOOP_WAIT_MAX.  The
+ * lower bound stops a timer that is due but not being acted on, such as
+ * the display update while "-W" is waiting for data, from making the loop
+ * spin.
+ */
+static long pv__timers_wait_usec(const struct pvtimers_s *timers, const struct timespec *now)
+{
+	long wait_usec = LOOP_WAIT_MAX;
+	int timer;
+
+	for (timer = 0; timer < (int) PV_TIMER_COUNT; timer++) {
+		struct timespec until;
+		long long usec;
+
+		if (!timers->wakes[timer])
+			continue;
+		if (pv_elapsedtime_compare(&(timers->due[timer]), now) <= 0)
+			return LOOP_WAIT_MIN;
+
+		pv_elapsedtime_subtract(&until, &(timers->due[timer]), now);
+		usec = (long long) (until.tv_sec) * 1000000 + (long long) (until.tv_nsec / 1000);
+		usec += (long long) (timers->slack_usec[timer]);
+		if (usec < (long long) wait_usec)
+			wait_usec = (long) usec;
+	}
+
+	if (wait_usec < LOOP_WAIT_MIN)
+		wait_usec = LOOP_WAIT_MIN;
+
+	return wait_usec;
+}
+
+
+/*
+ * Top up the -L rate allowance "*target" when the rate timer is due,
+ * with RATE_GRANULARITY's worth of the rate limit, up to RATE_BURST_WINDOW
+ * seconds' worth - or in a rate limit group, with what is drawn from the
+ * group's bucket.  Returns how much may be written now.
+ *
+ * The loop only wakes for the rate timer while there is nothing left to
+ * write, so that it sleeps until the allowance is next topped up, rather
+ * than looking every so often to see whether it has been.
+ */
+static off_t pv__rate_refill(pvstate_t state, struct pvtimers_s *timers, const struct timespec *now,
+			     long double *target)
+{
+	if (pv__timer_due(timers, PV_TIMER_RATE, now)) {
+		long double from_group = pv_rategroup_draw(state, *target);
+		if (from_group >= 0.0) {
+			/* In a group, the group's bucket sets the limit. */
+			*target += from_group;
+		} else {
+			long double burst_max;
+			*target += ((long double) (state->control.rate_limit)) *
+			    (long double) (RATE_GRANULARITY) / 1000000000.0;
+			burst_max = ((long double) (state->control.rate_limit * RATE_BURST_WINDOW));
+			if (*target > burst_max)
+				*target = burst_max;
+		}
+		pv_elapsedtime_add_nsec(&(timers->due[PV_TIMER_RATE]), RATE_GRANULARITY);
+	}
+
+	timers->wakes[PV_TIMER_RATE] = (*target < 1.0) ? true : false;
+
+	return (off_t) (*target);
+}
+
+
 /*
  * Transfer data from a list of files to standard output, giving information
  * about the transfer on standard error according to the given options.
@@ -301,11 +765,11 @@ int pv_main_loop(pvstate_t state)
 	ssize_t written;
 	long double target;
 	bool eof_in, eof_out, final_update;
-	struct timespec start_time, next_update, next_ratecheck, cur_time;
-	struct timespec next_remotecheck, next_monitor_exchange;
+	struct timespec start_time, cur_time;
+	struct pvtimers_s timers;
 	int input_fd, output_fd;
 	unsigned int file_idx;
-	bool output_is_pipe;
+	bool output_is_pipe, output_is_socket;
 
 	/*
 	 * Notes on line mode:
@@ -328,8 +792,9 @@ int pv_main_loop(pvstate_t state)
 	if (output_fd < 0)
 		output_fd = STDOUT_FILENO;
 
-	/* Determine whether the output is a pipe. */
+	/* Determine whether the output is a pipe, or a TCP socket. */
 	output_is_pipe = false;
+	output_is_socket = false;
 	{
 		struct stat sb;
 		memset(&sb, 0, sizeof(sb));
@@ -338,6 +803,11 @@ int pv_main_loop(pvstate_t state)
 			if ((sb.st_mode & S_IFMT) == S_IFIFO) {
 				output_is_pipe = true;
 				debug("%s (fd %d)", "output is a pipe", output_fd);
+#ifdef S_IFSOCK
+			} else if (((sb.st_mode & S_IFMT) == S_IFSOCK) && pv_socket_is_tcp(output_fd)) {
+				output_is_socket = true;
+				debug("%s (fd %d)", "output is a TCP socket", output_fd);
+#endif
 			}
 			/*@+type@ *//* splint says st_mode is __mode_t, not mode_t */
 		} else {
@@ -345,6 +815,26 @@ int pv_main_loop(pvstate_t state)
 		}
 	}
 
+	/*
+	 * In line mode, line positions need to be kept for as much output
+	 * as the pipe, or the socket's send buffer, can hold, to work out
+	 * how many lines are still in it.
+	 */
+	if (output_is_pipe && state->control.linemode) {
+		state->transfer.line_positions_window = PV_LINE_POSITIONS_WINDOW;
+#ifdef F_GETPIPE_SZ
+		{
+			int capacity = fcntl(output_fd, F_GETPIPE_SZ);
+			if (capacity > 0)
+				state->transfer.line_positions_window = (size_t) capacity;
+		}
+#endif
+	} else if (output_is_socket && state->control.linemode) {
+		state->transfer.line_positions_window = pv_socket_send_buffer(output_fd);
+		if (0 == state->transfer.line_positions_window)
+			state->transfer.line_positions_window = PV_LINE_POSITIONS_WINDOW;
+	}
+
 	/*
 	 * There can be a problem where data is written to the output and
 	 * from the writer's point of view, it's complete, but because the
@@ -361,6 +851,10 @@ int pv_main_loop(pvstate_t state)
 	 * available, the amount of data waiting in the pipe buffer is
 	 * checked ("written_but_not_consumed"), and used to adjust the
 	 * reported progress.
+	 *
+	 * The same goes for a TCP socket, whose send queue can hold many
+	 * megabytes, where the SIOCOUTQ ioctl gives the amount that the
+	 * receiver has not yet acknowledged.
 	 */
 
 	pv_crs_init(&(state->cursor), &(state->control), &(state->flags));
@@ -378,31 +872,76 @@ int pv_main_loop(pvstate_t state)
 	pv_elapsedtime_read(&cur_time);
 	pv_elapsedtime_copy(&start_time, &cur_time);
 
-	memset(&next_ratecheck, 0, sizeof(next_ratecheck));
-	memset(&next_remotecheck, 0, sizeof(next_remotecheck));
-	memset(&next_monitor_exchange, 0, sizeof(next_monitor_exchange));
-	memset(&next_update, 0, sizeof(next_update));
+	memset(&timers, 0, sizeof(timers));
 
-	pv_elapsedtime_copy(&next_ratecheck, &cur_time);
-	pv_elapsedtime_copy(&next_remotecheck, &cur_time);
-	pv_elapsedtime_copy(&next_monitor_exchange, &cur_time);
-	pv_elapsedtime_copy(&next_update, &cur_time);
+	pv__timer_set(&timers, PV_TIMER_MONITOR, &cur_time, 0, false);
+	pv__timer_set(&timers, PV_TIMER_RATE, &cur_time, 0, false);
 	if ((state->control.delay_start > 0)
 	    && (state->control.delay_start > state->control.interval)) {
-		pv_elapsedtime_add_nsec(&next_update, (long long) (1000000000.0 * state->control.delay_start));
+		pv__timer_set(&timers, PV_TIMER_UPDATE, &cur_time,
+			      (long long) (1000000000.0 * state->control.delay_start), false);
 	} else {
-		pv_elapsedtime_add_nsec(&next_update, (long long) (1000000000.0 * state->control.interval));
+		pv__timer_set(&timers, PV_TIMER_UPDATE, &cur_time,
+			      (long long) (1000000000.0 * state->control.interval), false);
 	}
+	/*
+	 * Only wake for display updates that will be acted on, and allow
+	 * them a tenth of the update interval's slack.
+	 */
+	timers.slack_usec[PV_TIMER_UPDATE] = (long) (100000.0 * state->control.interval);
+	if (timers.slack_usec[PV_TIMER_UPDATE] > LOOP_UPDATE_SLACK_MAX)
+		timers.slack_usec[PV_TIMER_UPDATE] = LOOP_UPDATE_SLACK_MAX;
+	if ((!state->control.no_display || state->control.show_stats || (NULL != state->control.progress_fn))
+	    && !state->control.wait)
+		timers.wakes[PV_TIMER_UPDATE] = true;
 
 	target = 0;
 	final_update = false;
 	file_idx = 0;
 
+	/* Join the rate limit group, if there is one. */
+	if ((NULL != state->control.rate_group) && (state->control.rate_limit > 0))
+		pv_rategroup_join(state);
+
+	/* Open the --metrics destination, if there is one. */
+	pv_metrics_open(state);
+
+	/* Publish a status page for --query, where possible. */
+	if (!state->control.embedded)
+		pv_remote_statuspage_open(state);
+
+	/* Open the --tee outputs, if there are any. */
+	pv_fanout_open(state);
+	pv_spool_open(state);
+
 	/*
-	 * Open the first readable input file.
+	 * Open the first readable input file - or with --merge, all of
+	 * them, in which case there is no moving on to the next one.
+	 *
+	 * A libpv input buffer is written out as it is, without being
+	 * copied, by making it the transfer buffer, holding everything
+	 * already read.
 	 */
 	input_fd = -1;
-	while (input_fd < 0 && file_idx < state->files.file_count) {
+	if (NULL != state->files.buffer) {
+		/*@-mustfreeonly -temptrans@ */
+		state->transfer.transfer_buffer = (char *) (state->files.buffer);
+		/*@+mustfreeonly +temptrans@ */
+		/* splint - the buffer stays the caller's; see buffer_borrowed. */
+		state->transfer.buffer_borrowed = true;
+		state->transfer.buffer_size = state->files.buffer_length;
+		state->transfer.read_position = state->files.buffer_length;
+		state->transfer.write_position = 0;
+		state->control.target_buffer_size = state->files.buffer_length;
+		eof_in = true;
+		if (0 == state->files.buffer_length)
+			eof_out = true;
+		file_idx = state->files.file_count;
+	} else if (state->control.merge_inputs && (state->files.file_count > 1)) {
+		input_fd = pv_merge_open(state);
+		file_idx = state->files.file_count - 1;
+	}
+	while (input_fd < 0 && file_idx < state->files.file_count && 0 == state->merge.count) {
 		input_fd = pv_next_file(state, file_idx, -1);
 		if (input_fd < 0)
 			file_idx++;
@@ -411,14 +950,15 @@ int pv_main_loop(pvstate_t state)
 	/*
 	 * Return early if there was no readable input file.
 	 */
-	if (input_fd < 0) {
+	if ((input_fd < 0) && (NULL == state->files.buffer)) {
 		if (state->control.cursor)
 			pv_crs_fini(&(state->cursor), &(state->control), &(state->flags));
 		return state->status.exit_status;
 	}
 #if HAVE_POSIX_FADVISE
 	/* Advise the OS that reads will all be sequential. */
-	(void) posix_fadvise(input_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (input_fd >= 0)
+		(void) posix_fadvise(input_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 #endif
 
 #ifdef O_DIRECT
@@ -429,6 +969,7 @@ int pv_main_loop(pvstate_t state)
 		debug("%s: %s", "fcntl", strerror(errno));
 	}
 	state->control.direct_io_changed = false;
+	state->transfer.direct_checked_fd = -1;
 #endif				/* O_DIRECT */
 
 #if HAVE_STRUCT_STAT_ST_BLKSIZE
@@ -463,40 +1004,35 @@ int pv_main_loop(pvstate_t state)
 		cansend = 0;
 
 		/*
-		 * Check for remote messages from -R, -Q every short while.
+		 * The clock is read once each time round, after the
+		 * transfer, so "cur_time" is from the end of the last pass.
+		 *
+		 * Check for remote messages from -R, -Q.  These arrive with
+		 * a signal, which interrupts any wait, and checking is only
+		 * a look at the flags set by the signal handlers, so this is
+		 * done every time.
 		 */
-		if (pv_elapsedtime_compare(&cur_time, &next_remotecheck) > 0) {
-			(void) pv_remote_check(state);
-			pv_elapsedtime_add_nsec(&next_remotecheck, REMOTE_INTERVAL);
-		}
+		(void) pv_remote_check(state);
 
 		/*
 		 * Exchange messages with the other side of the monitor
-		 * every short while, in monitor mode.
+		 * every short while, in monitor mode - or every time, if
+		 * the two sides share counters in memory.
 		 */
 		if ((state->control.othermonitor_pid > 0)
-		    && (pv_elapsedtime_compare(&cur_time, &next_monitor_exchange) > 0)) {
+		    && ((NULL != state->control.othermonitor_own_count)
+			|| pv__timer_due(&timers, PV_TIMER_MONITOR, &cur_time))) {
 			pv__monitor_exchange(state);
-			pv_elapsedtime_add_nsec(&next_monitor_exchange, MONITOR_EXCHANGE_INTERVAL);
+			pv__timer_set(&timers, PV_TIMER_MONITOR, &cur_time, MONITOR_EXCHANGE_INTERVAL, true);
 		}
 
 		if (1 == state->flags.trigger_exit)
 			break;
 
 		if (state->control.rate_limit > 0) {
-			pv_elapsedtime_read(&cur_time);
-			if (pv_elapsedtime_compare(&cur_time, &next_ratecheck) > 0) {
-				target +=
-				    ((long double) (state->control.rate_limit)) / (long double) (1000000000.0 /
-												 (long double)
-												 (RATE_GRANULARITY));
-				long double burst_max = ((long double) (state->control.rate_limit * RATE_BURST_WINDOW));
-				if (target > burst_max) {
-					target = burst_max;
-				}
-				pv_elapsedtime_add_nsec(&next_ratecheck, RATE_GRANULARITY);
-			}
-			cansend = (off_t) target;
+			cansend = pv__rate_refill(state, &timers, &cur_time, &target);
+		} else {
+			timers.wakes[PV_TIMER_RATE] = false;
 		}
 
 		/*
@@ -519,7 +1055,19 @@ int pv_main_loop(pvstate_t state)
 		if ((0 < state->control.size) && (state->control.stop_at_size)
 		    && (0 >= cansend) && eof_in && eof_out) {
 			written = 0;
+			/* The --tee outputs, or the real output, may still have some to take. */
+			if (!pv_fanout_hold(state, true, 90000))
+				(void) pv_spool_hold(state, true, 90000);
+		} else if (state->control.show_stats) {
+			struct timespec chunk_start, chunk_end;
+			state->transfer.wait_usec = pv__timers_wait_usec(&timers, &cur_time);
+			pv_elapsedtime_read(&chunk_start);
+			written = pv_transfer(state, input_fd, &eof_in, &eof_out, cansend, &lineswritten);
+			pv_elapsedtime_read(&chunk_end);
+			if (written > 0)
+				pv__record_chunk_time(state, &chunk_start, &chunk_end);
 		} else {
+			state->transfer.wait_usec = pv__timers_wait_usec(&timers, &cur_time);
 			written = pv_transfer(state, input_fd, &eof_in, &eof_out, cansend, &lineswritten);
 		}
 
@@ -528,6 +1076,11 @@ int pv_main_loop(pvstate_t state)
 			debug("%s: %s", "write error from pv_transfer", strerror(errno));
 			if (state->control.cursor)
 				pv_crs_fini(&(state->cursor), &(state->control), &(state->flags));
+			if (state->merge.count > 0) {
+				pv_merge_close(state);
+			} else if (input_fd >= 0) {
+				(void) close(input_fd);
+			}
 			return state->status.exit_status;
 		}
 
@@ -570,8 +1123,27 @@ int pv_main_loop(pvstate_t state)
 		}
 #endif
 
+		/*
+		 * If writing to a TCP socket, look at how much is in its
+		 * send queue, unsent or unacknowledged.  Once the
+		 * connection has gone, nothing in it will be delivered.
+		 */
+		if (output_is_socket) {
+			ssize_t nbytes = -1;
+			if (0 == state->flags.pipe_closed)
+				nbytes = pv_socket_unsent(output_fd);
+			if (nbytes < 0)
+				nbytes = 0;
+			/* A socket passed in may have held data from before. */
+			if ((!state->control.linemode) && ((off_t) nbytes > state->transfer.total_written))
+				nbytes = (ssize_t) (state->transfer.total_written);
+			if (((size_t) nbytes) != state->transfer.written_but_not_consumed)
+				debug("%s: %ld", "written_but_not_consumed is now", (long) nbytes);
+			state->transfer.written_but_not_consumed = (size_t) nbytes;
+		}
+
 		state->transfer.transferred = state->transfer.total_written;
-		if (output_is_pipe && !state->control.linemode) {
+		if ((output_is_pipe || output_is_socket) && !state->control.linemode) {
 			/*
 			 * Writing bytes to a pipe - the amount transferred
 			 * to the receiver is the total amount written,
@@ -580,43 +1152,19 @@ int pv_main_loop(pvstate_t state)
 			 */
 			state->transfer.transferred -= state->transfer.written_but_not_consumed;
 
-		} else if (output_is_pipe && state->control.linemode && state->transfer.written_but_not_consumed > 0
-			   && NULL != state->transfer.line_positions) {
+		} else if ((output_is_pipe || output_is_socket) && state->control.linemode
+			   && state->transfer.written_but_not_consumed > 0 && NULL != state->transfer.line_positions) {
 			/*
 			 * Writing lines to a pipe - similar to above, but
 			 * with the added complication of having to
 			 * determine how many lines the yet-to-be-consumed
 			 * data in the buffer equates to.
 			 *
-			 * To do this, walk backwards through the record of
-			 * the line positions in the output.
-			 */
-			off_t last_consumed_position =
-			    state->transfer.last_output_position - state->transfer.written_but_not_consumed;
-			size_t lines_not_consumed = 0;
-			size_t line_from_end = 0;
-
-			/*
-			 * positions[head-1] = position of last separator written
-			 * positions[head-2] = position of second last separator written
-			 * etc
-			 *
-			 * Start at [head-1] and go backwards, wrapping
-			 * around as it's a circular buffer, stopping at the
-			 * length (number of positions stored), or after
-			 * going before the last consumed position.
+			 * To do this, look through the record of the line
+			 * positions in the output.
 			 */
-			for (line_from_end = 0; line_from_end < state->transfer.line_positions_length; line_from_end++) {
-				size_t array_index;
-				array_index =
-				    state->transfer.line_positions_head + state->transfer.line_positions_capacity -
-				    line_from_end - 1;
-				while (array_index >= state->transfer.line_positions_capacity)
-					array_index -= state->transfer.line_positions_capacity;
-				if (state->transfer.line_positions[array_index] <= last_consumed_position)
-					break;
-				lines_not_consumed++;
-			}
+			size_t lines_not_consumed =
+			    pv_transfer_lines_not_consumed(state, state->transfer.written_but_not_consumed);
 
 			debug("%s: %lld -> %lld", "written_but_not_consumed bytes to lines",
 			      (unsigned long long) (state->transfer.written_but_not_consumed),
@@ -628,7 +1176,7 @@ int pv_main_loop(pvstate_t state)
 		/*
 		 * EOF, and files remain - advance to the next file.
 		 */
-		while (eof_in && eof_out && file_idx < (state->files.file_count - 1)) {
+		while (eof_in && eof_out && (file_idx + 1 < state->files.file_count)) {
 			file_idx++;
 			input_fd = pv_next_file(state, file_idx, input_fd);
 			if (input_fd >= 0) {
@@ -649,11 +1197,14 @@ int pv_main_loop(pvstate_t state)
 		 * pipe buffer is empty, then set the final update flag, and
 		 * force a display update.
 		 */
-		if (eof_in && eof_out && 0 == state->transfer.written_but_not_consumed) {
+		if (eof_in && eof_out && 0 == state->transfer.written_but_not_consumed && !pv_fanout_pending(state)
+		    && !pv_spool_pending(state)) {
 			final_update = true;
+			/* Finish the --hash digests in time for the final display. */
+			pv_hash_finish(state);
 			if ((state->display.output_produced)
 			    || (state->control.delay_start < 0.001)) {
-				pv_elapsedtime_copy(&next_update, &cur_time);
+				pv__timer_set(&timers, PV_TIMER_UPDATE, &cur_time, 0, true);
 			}
 			/*
 			 * In "--monitor both" mode, run a final exchange of
@@ -712,46 +1263,74 @@ int pv_main_loop(pvstate_t state)
 			 * Start the display, but only at the next interval,
 			 * not immediately.
 			 */
-			pv_elapsedtime_copy(&next_update, &start_time);
-			pv_elapsedtime_add_nsec(&next_update, (long long) (1000000000.0 * state->control.interval));
+			pv__timer_set(&timers, PV_TIMER_UPDATE, &start_time,
+				      (long long) (1000000000.0 * state->control.interval), false);
 		}
 
 		/* Calculate the elapsed transfer time. */
 		state->transfer.elapsed_seconds =
 		    pv__elapsed_transfer_time(&start_time, &cur_time, &(state->signal.total_stoppage_time));
 
+		/* Keep the --query status page up to date. */
+		pv_remote_statuspage_update(state);
+
+		/* Write a --metrics record if one is due. */
+		pv_metrics_update(state, &cur_time, final_update);
+
 		/*
-		 * Restart the loop if there's no display and statistics are
-		 * not being reported.
+		 * Restart the loop if there's no display, statistics are
+		 * not being reported, and there is no libpv progress
+		 * callback.
 		 */
-		if (state->control.no_display && !state->control.show_stats) {
+		if (state->control.no_display && !state->control.show_stats && (NULL == state->control.progress_fn)) {
+			timers.wakes[PV_TIMER_UPDATE] = false;
 			continue;
 		}
 
-		/* Restart the loop if it's not time to update the display. */
-		if (pv_elapsedtime_compare(&cur_time, &next_update) < 0) {
+		/*
+		 * Restart the loop if it's not time to update the display,
+		 * making sure to wake up for it.
+		 */
+		timers.wakes[PV_TIMER_UPDATE] = true;
+		if (pv_elapsedtime_compare(&cur_time, &(timers.due[PV_TIMER_UPDATE])) < 0) {
 			continue;
 		}
 
-		pv_elapsedtime_add_nsec(&next_update, (long long) (1000000000.0 * state->control.interval));
+		pv_elapsedtime_add_nsec(&(timers.due[PV_TIMER_UPDATE]),
+					(long long) (1000000000.0 * state->control.interval));
 
 		/* Set the "next update" time to now, if it's in the past. */
-		if (pv_elapsedtime_compare(&next_update, &cur_time) < 0)
-			pv_elapsedtime_copy(&next_update, &cur_time);
+		if (pv_elapsedtime_compare(&(timers.due[PV_TIMER_UPDATE]), &cur_time) < 0)
+			pv_elapsedtime_copy(&(timers.due[PV_TIMER_UPDATE]), &cur_time);
 
 		/* Resize the display, if a resize signal was received. */
 		(void) pv__resize_display_on_signal(state);
 
+#ifdef HAVE_THREADS
+		/* Pick up the latest line count estimate, or the final total. */
+		if (NULL != state->files.linecount)
+			pv_linecount_update(state, final_update);
+#endif				/* HAVE_THREADS */
+
+		/* Likewise the total size from a background directory walk. */
+		if (NULL != state->files.dirsize)
+			pv_dirsize_update(state, final_update);
+
 		if (state->control.no_display) {
 			/* If there's no display, calculate rate for the statistics. */
 			pv_calculate_transfer_rate(&(state->calc), &(state->transfer), &(state->control),
 						   &(state->display), final_update);
 		} else {
+			bool reparse = (0 != state->flags.reparse_display) ? true : false;
 			/* Produce the display. */
 			pv_display(&(state->status), &(state->control), &(state->flags), &(state->transfer),
 				   &(state->calc), &(state->cursor), &(state->display), &(state->extra_display),
 				   final_update);
+			pv__sublines_display(state, reparse, final_update);
 		}
+
+		if (NULL != state->control.progress_fn)
+			state->control.progress_fn(state, final_update, state->control.progress_userdata);
 	}
 
 	debug("%s: %s=%s, %s=%s", "loop ended", "eof_in", eof_in ? "true" : "false", "eof_out",
@@ -761,18 +1340,43 @@ int pv_main_loop(pvstate_t state)
 		pv_crs_fini(&(state->cursor), &(state->control), &(state->flags));
 	} else {
 		if ((!state->control.numeric) && (!state->control.no_display)
-		    && (state->display.output_produced))
+		    && (state->display.output_produced)) {
+			/* Move past the --merge and --tee lines too. */
+			while (state->sublines.lines_shown > 0) {
+				pv_tty_write(&(state->flags), "\n", 1);
+				state->sublines.lines_shown--;
+			}
 			pv_tty_write(&(state->flags), "\n", 1);
+		}
 	}
 
+	/* Close the --tee outputs, and the real output with --overlap. */
+	pv_fanout_close(state);
+	pv_spool_close(state);
+
 	if (1 == state->flags.trigger_exit)
 		state->status.exit_status |= PV_ERROREXIT_SIGNAL;
 
-	if (input_fd >= 0)
+	if (state->merge.count > 0) {
+		pv_merge_close(state);
+	} else if (input_fd >= 0) {
 		(void) close(input_fd);
+	}
 
-	/* Calculate and display the transfer statistics. */
+	/* Make sure the last --metrics record is marked as final. */
+	pv_elapsedtime_read(&cur_time);
+	pv_metrics_update(state, &cur_time, true);
+
+	/* Remove the --query status page. */
+	pv_remote_statuspage_close(state);
+
+	/* Collect the last zero-copy completions, for --stats. */
+	pv_zerocopy_finish(&(state->transfer));
+
+	/* Calculate and display the transfer statistics, and the digests. */
+	pv_hash_finish(state);
 	pv__show_stats(state);
+	pv_hash_report(state);
 
 	return state->status.exit_status;
 }
@@ -959,6 +1563,7 @@ int pv_watchfd_loop(pvstate_t state)
 			 * If this is a whole-PID watch, do the initial FD
 			 * scan to list all the FDs under that PID.
 			 */
+			pv_watchpid_track(&(watching[watch_idx]));
 			rc = pv_watchpid_scanfds(state, watching[watch_idx].pid, -1,
 						 &(watching[watch_idx].array_length),
 						 &(watching[watch_idx].info_array));
@@ -1091,11 +1696,17 @@ int pv_watchfd_loop(pvstate_t state)
 				int rc;
 				/*
 				 * If this watched item is a whole PID,
-				 * rescan that PID's FDs.
+				 * rescan that PID's FDs, if it's still
+				 * running and they may have changed.
 				 */
-				rc = pv_watchpid_scanfds(state, watching[watch_idx].pid, -1,
-							 &(watching[watch_idx].array_length),
-							 &(watching[watch_idx].info_array));
+				rc = 0;
+				if (pv_watchpid_exited(&(watching[watch_idx]))) {
+					rc = 1;
+				} else if (pv_watchpid_rescan_due(&(watching[watch_idx]), &cur_time)) {
+					rc = pv_watchpid_scanfds(state, watching[watch_idx].pid, -1,
+								 &(watching[watch_idx].array_length),
+								 &(watching[watch_idx].info_array));
+				}
 				if (rc != 0) {
 					/*
 					 * PID now inaccessible - mark it as
@@ -1142,6 +1753,7 @@ int pv_watchfd_loop(pvstate_t state)
 					if (pv_watchfd_changed(info_item)) {
 						debug("%s %d: %s", "fd", info_item->watch_fd,
 						      "non-displayable, and has changed - removing");
+						watching[watch_idx].rescan = true;
 						info_item->unused = true;
 						info_item->displayable = false;
 						pv_freecontents_watchfd(info_item);
@@ -1200,6 +1812,7 @@ int pv_watchfd_loop(pvstate_t state)
 						debug("%s %d: %s", "fd", info_item->watch_fd, "marking as closed");
 						pv_elapsedtime_copy(&(info_item->end_time), &cur_time);
 						info_item->closed = true;
+						watching[watch_idx].rescan = true;
 					}
 				}
 
@@ -1210,7 +1823,7 @@ int pv_watchfd_loop(pvstate_t state)
 					 * its position and timers.
 					 */
 					info_item->position = position_now;
-					info_item->transfer.elapsed_seconds =
+					info_item->shown->transfer.elapsed_seconds =
 					    pv__elapsed_transfer_time(&(info_item->start_time), &cur_time,
 								      &(info_item->total_stoppage_time));
 				}
@@ -1225,23 +1838,33 @@ int pv_watchfd_loop(pvstate_t state)
 				}
 
 				debug("%s %d, %s %d [%d/%d]: %Lf / %Ld", "pid", (int) (info_item->watch_pid), "fd",
-				      info_item->watch_fd, watch_idx, info_idx, info_item->transfer.elapsed_seconds,
+				      info_item->watch_fd, watch_idx, info_idx, info_item->shown->transfer.elapsed_seconds,
 				      info_item->position);
 
 				if (terminal_resized) {
 					pv_watchpid_setname(state, info_item);
-					info_item->flags.reparse_display = 1;
+					info_item->shown->flags.reparse_display = 1;
 				}
 
-				info_item->transfer.transferred = info_item->position;
-				info_item->transfer.total_written = info_item->position;
-				state->control.name = info_item->display_name;
+				info_item->shown->transfer.transferred = info_item->position;
+				info_item->shown->transfer.total_written = info_item->position;
+				state->control.name = info_item->shown->display_name;
 				state->control.size = info_item->size;
 
+				/*
+				 * If this fd's line has moved, because others
+				 * have come or gone, the terminal line it's
+				 * about to be written to shows something else.
+				 */
+				if (info_item->shown_row != displayed_lines) {
+					pv_display_invalidate(&(info_item->shown->display));
+					info_item->shown_row = displayed_lines;
+				}
+
 				pv_display(&(state->status),
-					   &(state->control), &(info_item->flags),
-					   &(info_item->transfer), &(info_item->calc),
-					   &(state->cursor), &(info_item->display), NULL, false);
+					   &(state->control), &(info_item->shown->flags),
+					   &(info_item->shown->transfer), &(info_item->shown->calc),
+					   &(state->cursor), &(info_item->shown->display), NULL, false);
 
 				/*@-mustfreeonly@ */
 				state->control.name = NULL;
@@ -0,0 +1,255 @@
+/*
+ * Transfer buffer memory: back buffers with huge pages, bind them to a
+ * NUMA node, and lock them into memory, as asked for by --huge-pages,
+ * --numa-node, and --lock-memory.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+/*
+ * The NUMA policy used to bind buffers, and the flag to move any pages
+ * already allocated, as defined in <linux/mempolicy.h> - defined here so
+ * that the kernel headers aren't needed.  A preferred node, rather than a
+ * strict binding, means that the allocation still succeeds, from another
+ * node, if the preferred one is full.
+ */
+#define PV_MPOL_PREFERRED	1
+#define PV_MPOL_MF_MOVE		2
+
+/* Size of the node mask passed to mbind(), in longs and in bits. */
+#define PV_NUMA_MASK_LONGS	16
+#define PV_NUMA_MASK_BITS	(8 * sizeof(unsigned long) * PV_NUMA_MASK_LONGS)
+
+
+/*
+ * Return the system's default huge page size, from /proc/meminfo, or
+ * PV_HUGE_PAGE_DEFAULT if it can't be found.
+ */
+static size_t pv__huge_page_size(void)
+{
+	FILE *fptr;
+	char line[256];			 /* flawfinder: ignore */
+	size_t page_size = PV_HUGE_PAGE_DEFAULT;
+
+	/*
+	 * flawfinder rationale: only the fixed path is opened, and "line"
+	 * is only written to by fgets(), which is bounded by its size.
+	 */
+	fptr = fopen("/proc/meminfo", "r");	/* flawfinder: ignore */
+	if (NULL == fptr)
+		return page_size;
+
+	memset(line, 0, sizeof(line));
+	while (NULL != fgets(line, (int) (sizeof(line)), fptr)) {
+		unsigned long size_kib = 0;
+		if (1 == sscanf(line, "Hugepagesize: %lu kB", &size_kib)) {
+			if (size_kib > 0)
+				page_size = (size_t) size_kib * 1024;
+			break;
+		}
+	}
+
+	(void) fclose(fptr);
+
+	return page_size;
+}
+
+
+/*
+ * Return the NUMA node of the CPU this thread is running on, or -1 if it
+ * can't be determined.
+ */
+static int pv__current_numa_node(void)
+{
+#if defined(HAVE_SYS_SYSCALL_H) && defined(SYS_getcpu)
+	unsigned int cpu = 0, node = 0;
+	if (0 == syscall(SYS_getcpu, &cpu, &node, NULL))
+		return (int) node;
+#endif
+	return -1;
+}
+
+
+/*
+ * Tell the kernel to prefer NUMA node "node" for the pages of the "size"
+ * bytes at "addr", moving any already allocated.  Returns true on success.
+ */
+static bool pv__numa_bind( /*@unused@ */  __attribute__((unused)) void *addr,
+			  /*@unused@ */  __attribute__((unused)) size_t size,
+			  /*@unused@ */  __attribute__((unused)) int node)
+{
+#if defined(HAVE_SYS_SYSCALL_H) && defined(SYS_mbind)
+	unsigned long nodemask[PV_NUMA_MASK_LONGS];
+
+	if ((node < 0) || ((size_t) node >= PV_NUMA_MASK_BITS))
+		return false;
+
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[(size_t) node / (8 * sizeof(unsigned long))] |= 1UL << ((size_t) node % (8 * sizeof(unsigned long)));
+
+	/* The kernel takes one less than "maxnode" as the mask size. */
+	if (0 == syscall(SYS_mbind, addr, size, PV_MPOL_PREFERRED, nodemask, PV_NUMA_MASK_BITS + 1, PV_MPOL_MF_MOVE))
+		return true;
+	debug("%s: %d: %s", "mbind", node, strerror(errno));
+#endif
+	return false;
+}
+
+
+/*
+ * Allocate a buffer of at least "size" bytes, aligned to "alignment" bytes
+ * (which must be a power of 2, or 0 for the page size), zeroed, and backed
+ * as requested:
+ *
+ *  - with "huge_pages", from the reserved huge page pool (MAP_HUGETLB) if
+ *    it has room, otherwise from transparent huge pages, by aligning the
+ *    buffer to the huge page size and advising MADV_HUGEPAGE;
+ *  - on NUMA node "numa_node", or if that is -1, on the node of the CPU
+ *    the calling thread is running on - the buffer is bound to the node
+ *    before it is first touched;
+ *  - with "lock", locked into memory with mlock() so that it is never
+ *    paged out.
+ *
+ * Each of these is done if possible, and quietly left out if not; what was
+ * actually done is recorded in "*mem", which must be passed to
+ * pv_buffer_free() to free the buffer.
+ *
+ * Returns NULL on complete allocation failure.
+ */
+/*@null@*/
+/*@only@*/
+char *pv_buffer_alloc(size_t size, size_t alignment, bool huge_pages, bool lock, int numa_node,
+		      struct pvbuffermem_s *mem)
+{
+	void *newptr;
+	size_t page_size;
+
+	memset(mem, 0, sizeof(*mem));
+	mem->node = -1;
+
+#if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
+	page_size = (size_t) sysconf(_SC_PAGESIZE);
+#else
+	page_size = 4096;
+#endif
+	if (page_size < 1)
+		page_size = 4096;
+	if (alignment < page_size)
+		alignment = page_size;
+
+	if (huge_pages) {
+		page_size = pv__huge_page_size();
+		if (alignment < page_size)
+			alignment = page_size;
+	}
+
+	/* Whole pages, so that binding and locking cover all of them. */
+	size = ((size + page_size - 1) / page_size) * page_size;
+	mem->page_size = page_size;
+
+	newptr = NULL;
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB) && defined(MAP_ANONYMOUS)
+	if (huge_pages) {
+		newptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (MAP_FAILED == newptr) {
+			debug("%s: %s", "MAP_HUGETLB", strerror(errno));
+			newptr = NULL;
+		} else {
+			mem->mapped = true;
+			mem->hugetlb = true;
+		}
+	}
+#endif
+
+	if (NULL == newptr) {
+#ifdef HAVE_POSIX_MEMALIGN
+		/*@-unrecog@ */
+		/* splint doesn't know of posix_memalign(). */
+		if (0 != posix_memalign(&newptr, alignment, size))
+			newptr = NULL;
+		/*@+unrecog@ */
+#else
+		newptr = malloc(size);
+#endif
+		if (NULL == newptr)
+			return NULL;
+#if defined(HAVE_MADVISE) && defined(HAVE_SYS_MMAN_H) && defined(MADV_HUGEPAGE)
+		if (huge_pages) {
+			if (0 == madvise(newptr, size, MADV_HUGEPAGE)) {
+				mem->thp = true;
+			} else {
+				debug("%s: %s", "MADV_HUGEPAGE", strerror(errno));
+			}
+		}
+#endif
+	}
+
+	mem->size = size;
+
+	if (numa_node < 0)
+		numa_node = pv__current_numa_node();
+	if (pv__numa_bind(newptr, size, numa_node))
+		mem->node = numa_node;
+
+	/* Fault the pages in now, where they have been bound to. */
+	memset(newptr, 0, size);
+
+#if defined(HAVE_MLOCK) && defined(HAVE_SYS_MMAN_H)
+	if (lock) {
+		if (0 == mlock(newptr, size)) {
+			mem->locked = true;
+		} else {
+			debug("%s: %s", "mlock", strerror(errno));
+		}
+	}
+#endif
+
+	debug("%s: %ld %s, %ld %s, %s, %s %d, %s", "buffer memory", (long) size, "bytes", (long) page_size,
+	      "byte pages", mem->hugetlb ? "hugetlb" : (mem->thp ? "transparent huge pages" : "normal pages"),
+	      "node", mem->node, mem->locked ? "locked" : "not locked");
+
+	return (char *) newptr;
+}
+
+
+/*
+ * Free a buffer allocated by pv_buffer_alloc(), or by malloc() if "*mem"
+ * is all zero, and clear "*mem".
+ */
+void pv_buffer_free( /*@only@ */ char *buffer, struct pvbuffermem_s *mem)
+{
+#if defined(HAVE_MLOCK) && defined(HAVE_SYS_MMAN_H)
+	if (mem->locked)
+		(void) munlock(buffer, mem->size);
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+	if (mem->mapped) {
+		(void) munmap(buffer, mem->size);
+		memset(mem, 0, sizeof(*mem));
+		mem->node = -1;
+		return;
+	}
+#endif
+	free(buffer);
+	memset(mem, 0, sizeof(*mem));
+	mem->node = -1;
+}
@@ -0,0 +1,504 @@
+/*
+ * Reading all of the input files at once, for --merge.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+#include <poll.h>
+#endif
+
+
+/*
+ * Instead of reading the input files one after another, all of them are
+ * opened at the start, and each time the transfer buffer has room, it is
+ * filled from whichever of them have data waiting, taking turns so that
+ * one busy input can't shut the others out.  This suits inputs such as
+ * named pipes being written to by several producers at once.
+ *
+ * In line mode, only whole lines are passed on: whatever follows the last
+ * separator in a read is held back in that input's "carry" buffer, and
+ * put in front of the next read from the same input, so lines from
+ * different inputs are never mixed together.  A line longer than
+ * pv__merge_carry_limit() is passed on in pieces, so that it can't stall
+ * the transfer.  If an input ends with an unterminated line, a separator
+ * is added after it.
+ *
+ * Each input has a progress line of its own, showing how much has been
+ * read from it, below the main one.
+ */
+
+
+/*
+ * Return the longest partial line an input may have held back.
+ */
+static size_t pv__merge_carry_limit(pvstate_t state)
+{
+	return state->transfer.buffer_size / 2;
+}
+
+
+/*
+ * Hold back the "length" bytes at "data", the start of an unfinished line
+ * from "input", until the rest of the line arrives.  Returns false if the
+ * carry buffer couldn't be enlarged.
+ */
+static bool pv__merge_hold_back(pvmergeinput_t input, const char *data, size_t length)
+{
+	if (0 == length) {
+		input->carry_bytes = 0;
+		return true;
+	}
+
+	if ((NULL == input->carry) || (length > input->carry_size)) {
+		char *new_carry;
+		size_t new_size;
+
+		new_size = length + length / 2;
+		new_carry = realloc(input->carry, new_size);
+		if (NULL == new_carry)
+			return false;
+		input->carry = new_carry;
+		input->carry_size = new_size;
+	}
+
+	memmove(input->carry, data, length);
+	input->carry_bytes = length;
+
+	return true;
+}
+
+
+/*
+ * Mark "input" as having ended.  It is left open until pv_merge_close(),
+ * so that its descriptor isn't reused while the transfer still refers to
+ * it.
+ */
+static void pv__merge_end(pvmergeinput_t input)
+{
+	input->finished = true;
+	input->ready = false;
+	input->carry_bytes = 0;
+}
+
+
+/*
+ * Open all of the input files, returning the first one's file descriptor,
+ * or -1 if none could be opened - in which case the transfer can't go
+ * ahead.  Files that can't be opened are reported by pv_next_file(), and
+ * left out.
+ *
+ * Opening a named pipe waits for something to open it for writing, so
+ * each producer has to have started before the transfer does.
+ */
+int pv_merge_open(pvstate_t state)
+{
+	unsigned int input_count, idx;
+	int first_fd;
+
+	pv_merge_free(state);
+
+	input_count = state->files.file_count;
+	if (input_count > PV_MERGE_MAX) {
+		/*@-mustfreefresh@ *//* splint - _() may allocate, but not here */
+		pv_error("%s: %d", _("too many input files to --merge - the limit is"), PV_MERGE_MAX);
+		/*@+mustfreefresh@ */
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		return -1;
+	}
+
+	state->merge.input = calloc((size_t) input_count, sizeof(state->merge.input[0]));
+	if (NULL == state->merge.input) {
+		/*@-mustfreefresh@ *//* see above */
+		pv_error("%s: %s", _("input list allocation failed"), strerror(errno));
+		/*@+mustfreefresh@ */
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		return -1;
+	}
+	state->merge.count = input_count;
+	state->merge.next = 0;
+
+	first_fd = -1;
+	for (idx = 0; idx < input_count; idx++) {
+		pvmergeinput_t input = &(state->merge.input[idx]);
+		struct stat sb;
+
+		pv_reset_subline(state, &(input->line));
+		input->file_idx = idx;
+		input->fd = pv_next_file(state, idx, -1);
+		if (input->fd < 0) {
+			input->finished = true;
+			continue;
+		}
+
+		/*@-compdef@ *//* splint - the file list has been populated */
+		input->line.name = pv_strdup(pv_current_file_name(state));
+		/*@+compdef@ */
+
+		memset(&sb, 0, sizeof(sb));
+		if ((!state->control.linemode) && (0 == fstat(input->fd, &sb)) && S_ISREG(sb.st_mode))
+			input->line.size = (off_t) (sb.st_size);
+
+		if (first_fd < 0)
+			first_fd = input->fd;
+	}
+
+	for (idx = 0; idx < input_count; idx++) {
+		if (state->merge.input[idx].fd == first_fd) {
+			state->status.current_input_file = idx;
+			break;
+		}
+	}
+
+	return first_fd;
+}
+
+
+/*
+ * Return true if "input" can be read from now: it hasn't ended, and any
+ * partial line it is holding back will fit in the transfer buffer.
+ */
+static bool pv__merge_readable(pvstate_t state, pvmergeinput_t input)
+{
+	if ((input->fd < 0) || input->finished)
+		return false;
+	if ((input->carry_bytes > 0) && (0 != state->transfer.read_position)
+	    && (input->carry_bytes >= state->transfer.buffer_size - state->transfer.read_position))
+		return false;
+	return true;
+}
+
+
+/*
+ * Wait for up to "usec" microseconds for any of the inputs to have data
+ * ready to read, or for "fd_out" to be writable, in the same way as
+ * is_data_ready() in transfer.c, marking the inputs that are ready.
+ * Inputs whose partial line won't fit in the buffer yet aren't waited for.
+ */
+int pv_merge_wait(pvstate_t state, /*@null@ */ bool *fd_in_ready, int fd_out, /*@null@ */ bool *fd_out_ready,
+		  long usec)
+{
+	unsigned int idx;
+	int result;
+	bool all_finished;
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+	struct pollfd pfds[PV_MERGE_MAX + 1];
+	unsigned int owner[PV_MERGE_MAX];
+	nfds_t nfds, input_nfds;
+#else
+	struct timeval tv;
+	fd_set readfds;
+	fd_set writefds;
+	int max_fd;
+#endif
+
+	if (NULL != fd_in_ready)
+		*fd_in_ready = false;
+	if (NULL != fd_out_ready)
+		*fd_out_ready = false;
+
+	if (NULL == state->merge.input)
+		return 0;
+
+	/*
+	 * An input left ready last time still has data waiting; and once
+	 * they have all ended, the input counts as ready, so that the end
+	 * is read.
+	 */
+	all_finished = true;
+	for (idx = 0; idx < state->merge.count; idx++) {
+		if (state->merge.input[idx].finished)
+			continue;
+		all_finished = false;
+		if (state->merge.input[idx].ready && pv__merge_readable(state, &(state->merge.input[idx])))
+			usec = 0;
+	}
+	if (all_finished) {
+		if (NULL != fd_in_ready)
+			*fd_in_ready = true;
+		return 1;
+	}
+
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+	memset(pfds, 0, sizeof(pfds));
+	nfds = 0;
+	for (idx = 0; idx < state->merge.count && idx < PV_MERGE_MAX; idx++) {
+		pvmergeinput_t input = &(state->merge.input[idx]);
+		if (!pv__merge_readable(state, input))
+			continue;
+		pfds[nfds].fd = input->fd;
+		pfds[nfds].events = POLLIN;
+		owner[nfds] = idx;
+		nfds++;
+	}
+	input_nfds = nfds;
+	if (fd_out >= 0) {
+		pfds[nfds].fd = fd_out;
+		pfds[nfds].events = POLLOUT;
+		nfds++;
+	}
+
+	result = poll(pfds, nfds, (int) ((usec + 999) / 1000));
+	if (result < 0)
+		return result;
+
+	for (idx = 0; idx < (unsigned int) nfds; idx++) {
+		if (0 != (pfds[idx].revents & POLLNVAL)) {
+			errno = EBADF;
+			return -1;
+		}
+		if (0 == (pfds[idx].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)))
+			continue;
+		if (idx < (unsigned int) input_nfds) {
+			state->merge.input[owner[idx]].ready = true;
+		} else if (NULL != fd_out_ready) {
+			*fd_out_ready = true;
+		}
+	}
+#else				/* !HAVE_POLL || !HAVE_POLL_H */
+	memset(&tv, 0, sizeof(tv));
+	tv.tv_sec = usec / 1000000;
+	tv.tv_usec = usec % 1000000;
+
+	max_fd = fd_out;
+
+#if SPLINT
+	/* splint doesn't like FD_ZERO and FD_SET - see transfer.c. */
+	memset(&readfds, 0, sizeof(readfds));
+	memset(&writefds, 0, sizeof(writefds));
+#else				/* !SPLINT */
+	FD_ZERO(&readfds);
+	FD_ZERO(&writefds);
+	for (idx = 0; idx < state->merge.count; idx++) {
+		pvmergeinput_t input = &(state->merge.input[idx]);
+		if (!pv__merge_readable(state, input))
+			continue;
+		FD_SET(input->fd, &readfds);
+		if (input->fd > max_fd)
+			max_fd = input->fd;
+	}
+	if (fd_out >= 0)
+		FD_SET(fd_out, &writefds);
+#endif				/* !SPLINT */
+
+	result = select(max_fd + 1, &readfds, &writefds, NULL, &tv);
+	if (result < 0)
+		return result;
+
+#ifndef SPLINT
+	for (idx = 0; idx < state->merge.count; idx++) {
+		pvmergeinput_t input = &(state->merge.input[idx]);
+		if ((input->fd >= 0) && (!input->finished) && FD_ISSET(input->fd, &readfds))
+			input->ready = true;
+	}
+	if ((fd_out >= 0) && (NULL != fd_out_ready) && FD_ISSET(fd_out, &writefds))
+		*fd_out_ready = true;
+#endif				/* !SPLINT */
+#endif				/* HAVE_POLL && HAVE_POLL_H */
+
+	for (idx = 0; idx < state->merge.count; idx++) {
+		if (state->merge.input[idx].ready && pv__merge_readable(state, &(state->merge.input[idx]))
+		    && (NULL != fd_in_ready)) {
+			*fd_in_ready = true;
+			if (0 == result)
+				result = 1;
+		}
+	}
+
+	return result;
+}
+
+
+/*
+ * Read up to "count" bytes into "buf" from the inputs that pv_merge_wait()
+ * found to be ready, one read from each in turn.  Returns the number of
+ * bytes put into "buf", 0 once every input has ended, or -1 with errno
+ * set to EAGAIN if none of them had anything to give.
+ *
+ * A read error is reported, and ends that input; the others carry on.
+ */
+ssize_t pv_merge_read(pvstate_t state, char *buf, size_t count)
+{
+	unsigned int step;
+	size_t done;
+	char separator;
+	bool live;
+
+	if ((NULL == state->merge.input) || (0 == state->merge.count))
+		return 0;
+
+	separator = state->control.null_terminated_lines ? '\0' : '\n';
+	done = 0;
+	live = false;
+
+	for (step = 0; step < state->merge.count; step++) {
+		pvmergeinput_t input;
+		size_t start, end, room, tail;
+		ssize_t nread;
+
+		input = &(state->merge.input[(state->merge.next + step) % state->merge.count]);
+		if (input->finished)
+			continue;
+		live = true;
+		if ((!input->ready) || (done >= count))
+			continue;
+
+		room = count - done;
+		start = done;
+
+		/*
+		 * Put back the input's partial line first.  If there isn't
+		 * room for it, leave it until the buffer has been written
+		 * out, unless even an empty buffer is too small for it, in
+		 * which case pass on as much as fits.
+		 */
+		if (input->carry_bytes >= room) {
+			if ((done > 0) || (state->transfer.read_position > 0))
+				continue;
+			memcpy(buf, input->carry, room);	/* flawfinder: ignore */
+			/* flawfinder rationale: only "room" bytes, which fit. */
+			(void) pv__merge_hold_back(input, input->carry + room, input->carry_bytes - room);
+			if (!state->control.linemode)
+				input->line.transferred += (off_t) room;
+			done = count;
+			continue;
+		}
+		if (input->carry_bytes > 0) {
+			memcpy(buf + start, input->carry, input->carry_bytes);	/* flawfinder: ignore */
+			/* flawfinder rationale: checked against "room" above. */
+		}
+		end = start + input->carry_bytes;
+
+		input->ready = false;
+		nread = read(input->fd, buf + end, room - input->carry_bytes);	/* flawfinder: ignore */
+		/* flawfinder rationale: bounded by the space left in "buf". */
+
+		if (nread < 0) {
+			if ((EINTR == errno) || (EAGAIN == errno) || (EWOULDBLOCK == errno))
+				continue;
+			pv_error("%s: %s: %s", NULL == input->line.name ? "(null)" : input->line.name,
+				 _("read failed"), strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+			nread = 0;
+		}
+
+		state->status.current_input_file = input->file_idx;
+
+		if (0 == nread) {
+			debug("%s: %s", NULL == input->line.name ? "(null)" : input->line.name, "merged input ended");
+			/*
+			 * Finish off an unterminated last line, or if there's
+			 * no room for the separator, hold the line back until
+			 * there is.
+			 */
+			if (state->control.linemode && (end > start) && (buf[end - 1] != separator)) {
+				if ((end >= count) && pv__merge_hold_back(input, buf + start, end - start)) {
+					input->ready = true;
+					continue;
+				}
+				buf[end++] = separator;
+			}
+			if (state->control.linemode && (end > start))
+				input->line.transferred += (off_t) pv_memcount(buf + start, separator, end - start);
+			pv__merge_end(input);
+			done = end;
+			continue;
+		}
+
+		end += (size_t) nread;
+
+		if (!state->control.linemode) {
+			input->line.transferred += (off_t) nread;
+			input->carry_bytes = 0;
+			done = end;
+			continue;
+		}
+
+		/* Hold back anything after the last separator. */
+		{
+			const char *last_separator;
+			last_separator = pv_memrchr(buf + start, separator, end - start);
+			tail = NULL == last_separator ? end - start : (size_t) (buf + end - last_separator - 1);
+		}
+		if ((tail > 0) && (tail <= pv__merge_carry_limit(state))) {
+			if (pv__merge_hold_back(input, buf + end - tail, tail)) {
+				end -= tail;
+			} else {
+				input->carry_bytes = 0;
+			}
+		} else {
+			input->carry_bytes = 0;
+		}
+
+		if (end > start)
+			input->line.transferred += (off_t) pv_memcount(buf + start, separator, end - start);
+		done = end;
+	}
+
+	state->merge.next = (state->merge.next + 1) % state->merge.count;
+
+	if (done > 0)
+		return (ssize_t) done;
+	if (!live)
+		return 0;
+
+	errno = EAGAIN;
+	return -1;
+}
+
+
+/*
+ * Close all of the inputs.
+ */
+void pv_merge_close(pvstate_t state)
+{
+	unsigned int idx;
+
+	if (NULL == state->merge.input)
+		return;
+
+	for (idx = 0; idx < state->merge.count; idx++) {
+		pvmergeinput_t input = &(state->merge.input[idx]);
+		if (input->fd >= 0)
+			(void) close(input->fd);
+		input->fd = -1;
+		pv__merge_end(input);
+	}
+}
+
+
+/*
+ * Close all of the inputs and free everything to do with them.
+ */
+void pv_merge_free(pvstate_t state)
+{
+	unsigned int idx;
+
+	pv_merge_close(state);
+
+	if (NULL != state->merge.input) {
+		for (idx = 0; idx < state->merge.count; idx++) {
+			pvmergeinput_t input = &(state->merge.input[idx]);
+			pv_freecontents_subline(&(input->line));
+			if (NULL != input->carry)
+				free(input->carry);
+			input->carry = NULL;
+		}
+		free(state->merge.input);
+		state->merge.input = NULL;
+	}
+	state->merge.count = 0;
+}
@@ -0,0 +1,390 @@
+/*
+ * Machine-readable metrics records, written at their own interval to a
+ * file, descriptor, or UNIX socket, for --metrics.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H)
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+
+/*
+ * Each record is one line of JSON, with a fixed set of members, written
+ * with a single write() where possible.  All of the values are integers,
+ * so that the output doesn't depend on the locale's decimal separator:
+ *
+ *   elapsed_us     microseconds of transfer time so far
+ *   transferred    bytes (or lines, with --line-mode) transferred
+ *   size           expected total, or null if not known
+ *   rate           transfer rate since the previous record, per second
+ *   average_rate   transfer rate over the whole transfer, per second
+ *   eta            seconds remaining at the average rate, or null
+ *   bytes_read     bytes read from the input
+ *   bytes_written  bytes written to the output
+ *   buffered       bytes held in the transfer buffer
+ *   rate_min       lowest rate measured for the display or --stats
+ *   rate_max       highest rate measured for the display or --stats
+ *   measurements   number of rate measurements taken for those
+ *   rate_p50       median of those measured rates, to within 12.5%
+ *   rate_p95       95th percentile of them
+ *   rate_p99       99th percentile of them
+ *   stalls         number of times the measured rate fell to zero
+ *   dropped        records dropped so far because the reader was slow
+ *   final          true for the last record of the transfer
+ *
+ * The rates here are calculated from the records themselves, so that
+ * writing records doesn't disturb the rate calculations used by the
+ * display.
+ */
+
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H)
+/*
+ * Connect to the UNIX socket at "path", trying a stream socket first and
+ * then a datagram socket, and return the connected descriptor, or -1 on
+ * error, with errno set.
+ */
+static int pv__metrics_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int types[2] = { SOCK_STREAM, SOCK_DGRAM };
+	int type_idx, fd, connect_errno;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {	/* flawfinder: ignore */
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	/*
+	 * flawfinder rationale: "path" comes from a command-line argument,
+	 * which is always \0-terminated.
+	 */
+
+	connect_errno = 0;
+	for (type_idx = 0; type_idx < 2; type_idx++) {
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		addr.sun_path[0] = '\0';
+		(void) pv_strlcat(addr.sun_path, path, sizeof(addr.sun_path));
+
+		fd = socket(AF_UNIX, types[type_idx], 0);
+		if (fd < 0)
+			return -1;
+		if (0 == connect(fd, (struct sockaddr *) &addr, (socklen_t) sizeof(addr)))
+			return fd;
+		connect_errno = errno;
+		(void) close(fd);
+		/* EPROTOTYPE means the socket is of the other type. */
+		if (EPROTOTYPE != connect_errno)
+			break;
+	}
+
+	errno = connect_errno;
+	return -1;
+}
+#endif				/* HAVE_SYS_SOCKET_H && HAVE_SYS_UN_H */
+
+
+/*
+ * Open the destination given by control.metrics_dest, if there is one:
+ * "fd:N" for an already open descriptor N, the path of a UNIX socket to
+ * connect to, or the path of a file to append to.  Sockets and FIFOs are
+ * made non-blocking.
+ *
+ * On failure, an error is reported and no records are written.
+ */
+void pv_metrics_open(pvstate_t state)
+{
+	const char *dest;
+	struct stat sb;
+	bool nonblocking;
+
+	dest = state->control.metrics_dest;
+	if ((NULL == dest) || (state->metrics.fd >= 0))
+		return;
+
+	nonblocking = false;
+	memset(&sb, 0, sizeof(sb));
+
+	if (0 == strncmp(dest, "fd:", 3)) {
+		char *end_ptr = NULL;
+		long fd_number;
+
+		fd_number = strtol(dest + 3, &end_ptr, 10);
+		if ((NULL == end_ptr) || ('\0' != end_ptr[0]) || (end_ptr == dest + 3) || (fd_number < 0)
+		    || (fd_number > 65535) || (fcntl((int) fd_number, F_GETFL) < 0)) {
+			pv_error("%s: %s", dest, _("not a valid open file descriptor"));
+			state->status.exit_status |= PV_ERROREXIT_ACCESS;
+			return;
+		}
+		state->metrics.fd = (int) fd_number;
+		state->metrics.close_fd = false;
+	} else if ((0 == stat(dest, &sb)) && S_ISSOCK(sb.st_mode)) {
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H)
+		state->metrics.fd = pv__metrics_connect(dest);
+		if (state->metrics.fd < 0) {
+			pv_error("%s: %s: %s", dest, _("failed to connect to metrics socket"), strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_ACCESS;
+			return;
+		}
+		state->metrics.close_fd = true;
+		nonblocking = true;
+#else				/* !HAVE_SYS_SOCKET_H || !HAVE_SYS_UN_H */
+		pv_error("%s: %s", dest, _("sockets are not supported on this system"));
+		state->status.exit_status |= PV_ERROREXIT_ACCESS;
+		return;
+#endif				/* HAVE_SYS_SOCKET_H && HAVE_SYS_UN_H */
+	} else {
+		/*
+		 * Open FIFOs without blocking, so a FIFO with no reader
+		 * fails (with ENXIO) instead of hanging.
+		 */
+		int openflags;
+
+		nonblocking = S_ISFIFO(sb.st_mode);
+		openflags = O_WRONLY | O_CREAT | O_APPEND;
+		if (nonblocking)
+			openflags |= O_NONBLOCK;
+
+		state->metrics.fd = open(dest, openflags, 0600);	/* flawfinder: ignore */
+		/*
+		 * flawfinder rationale: the destination is named by the
+		 * user on the command line, and is only appended to.
+		 */
+		if (state->metrics.fd < 0) {
+			pv_error("%s: %s: %s", dest, _("failed to open metrics destination"), strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_ACCESS;
+			return;
+		}
+		state->metrics.close_fd = true;
+	}
+
+	if (nonblocking) {
+		int flags = fcntl(state->metrics.fd, F_GETFL);
+		if ((flags >= 0) && (0 != fcntl(state->metrics.fd, F_SETFL, flags | O_NONBLOCK)))
+			debug("%s: %s", "fcntl O_NONBLOCK", strerror(errno));
+	}
+	if (state->metrics.close_fd)
+		(void) fcntl(state->metrics.fd, F_SETFD, FD_CLOEXEC);
+
+	debug("%s: %s: %d", "metrics destination opened", dest, state->metrics.fd);
+
+	/* The first record is written straight away. */
+	pv_elapsedtime_read(&(state->metrics.next_record));
+}
+
+
+/*
+ * Write "count" bytes from "data" to the metrics destination, returning
+ * the number of bytes written, or -1 if the destination failed and has
+ * been closed.  A full socket or FIFO counts as writing nothing.
+ */
+static ssize_t pv__metrics_send(pvstate_t state, const char *data, size_t count)
+{
+	ssize_t written;
+
+	do {
+		written = write(state->metrics.fd, data, count);
+	} while ((written < 0) && (EINTR == errno));
+
+	if (written >= 0)
+		return written;
+
+	if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+		return 0;
+
+	debug("%s: %s", "metrics write failed - closing", strerror(errno));
+	pv_metrics_close(state);
+	return -1;
+}
+
+
+/*
+ * Send what's left of a partly written record.  If "deadline" is not
+ * NULL, wait for the destination to take it, until then; otherwise, only
+ * send what it will take now.  Returns true if nothing is left pending.
+ */
+static bool pv__metrics_flush(pvstate_t state, /*@null@ */ const struct timespec *deadline)
+{
+	while (state->metrics.pending_bytes > 0) {
+		struct timespec now, remaining;
+		struct timeval tv;
+		fd_set fds;
+		ssize_t written;
+
+		written = pv__metrics_send(state, state->metrics.pending, state->metrics.pending_bytes);
+		if (written < 0)
+			return false;
+		if (written > 0) {
+			memmove(state->metrics.pending, state->metrics.pending + written,
+				state->metrics.pending_bytes - (size_t) written);
+			state->metrics.pending_bytes -= (size_t) written;
+			continue;
+		}
+
+		if (NULL == deadline)
+			return false;
+		pv_elapsedtime_read(&now);
+		if (pv_elapsedtime_compare(&now, deadline) >= 0) {
+			debug("%s", "timed out sending the final metrics record");
+			return false;
+		}
+		pv_elapsedtime_subtract(&remaining, deadline, &now);
+
+		FD_ZERO(&fds);
+		FD_SET(state->metrics.fd, &fds);
+		tv.tv_sec = remaining.tv_sec;
+		tv.tv_usec = remaining.tv_nsec / 1000;
+		(void) select(state->metrics.fd + 1, NULL, &fds, NULL, &tv);
+	}
+
+	return true;
+}
+
+
+/*
+ * Write a metrics record if one is due at "now", or if "final" is true, in
+ * which case this is the last record.
+ */
+void pv_metrics_update(pvstate_t state, const struct timespec *now, bool final)
+{
+	char record[PV_METRICS_RECORD_MAX];	/* flawfinder: ignore - bounded by pv_snprintf() */
+	char size_str[32], eta_str[32];	/* flawfinder: ignore - bounded by pv_snprintf() */
+	struct timespec final_deadline;
+	long double elapsed, interval, rate, average_rate;
+	off_t transferred, buffered;
+	ssize_t written;
+	int length;
+
+	if ((state->metrics.fd < 0) || state->metrics.final_written)
+		return;
+	if ((!final) && (pv_elapsedtime_compare(now, &(state->metrics.next_record)) < 0))
+		return;
+
+	pv_elapsedtime_copy(&(state->metrics.next_record), now);
+	pv_elapsedtime_add_nsec(&(state->metrics.next_record),
+				(long long) (1000000000.0 * state->control.metrics_interval));
+
+	/*
+	 * Send what's left of the previous record first, dropping this one
+	 * if it can't all be sent yet - unless this is the final record, in
+	 * which case wait a while for the destination to take it.
+	 */
+	pv_elapsedtime_zero(&final_deadline);
+	if (final) {
+		pv_elapsedtime_read(&final_deadline);
+		pv_elapsedtime_add_nsec(&final_deadline, PV_METRICS_FINAL_WAIT);
+	}
+	if (!pv__metrics_flush(state, final ? &final_deadline : NULL)) {
+		if (state->metrics.fd >= 0)
+			state->metrics.dropped++;
+		return;
+	}
+
+	elapsed = state->transfer.elapsed_seconds;
+	transferred = state->transfer.transferred;
+
+	rate = 0.0;
+	interval = elapsed - state->metrics.prev_elapsed;
+	if (interval > 0.0)
+		rate = (long double) (transferred - state->metrics.prev_transferred) / interval;
+
+	average_rate = 0.0;
+	if (elapsed > 0.0)
+		average_rate = (long double) transferred / elapsed;
+
+	(void) pv_snprintf(size_str, sizeof(size_str), "%s", "null");
+	(void) pv_snprintf(eta_str, sizeof(eta_str), "%s", "null");
+	if (state->control.size > 0) {
+		(void) pv_snprintf(size_str, sizeof(size_str), "%lld", (long long) (state->control.size));
+		if (transferred >= state->control.size) {
+			(void) pv_snprintf(eta_str, sizeof(eta_str), "%d", 0);
+		} else if (average_rate > 0.0) {
+			(void) pv_snprintf(eta_str, sizeof(eta_str), "%lld",
+					   (long long) ((long double) (state->control.size - transferred) /
+							average_rate));
+		}
+	}
+
+	buffered = 0;
+	if (state->transfer.read_position > state->transfer.write_position)
+		buffered = (off_t) (state->transfer.read_position - state->transfer.write_position);
+
+	length =
+	    pv_snprintf(record, sizeof(record),
+			"{\"elapsed_us\":%lld,\"transferred\":%lld,\"size\":%s,\"rate\":%lld,\"average_rate\":%lld,"
+			"\"eta\":%s,\"bytes_read\":%lld,\"bytes_written\":%lld,\"buffered\":%lld,"
+			"\"rate_min\":%lld,\"rate_max\":%lld,\"measurements\":%lu,"
+			"\"rate_p50\":%lld,\"rate_p95\":%lld,\"rate_p99\":%lld,\"stalls\":%lu,"
+			"\"dropped\":%lu,\"final\":%s}\n",
+			(long long) (elapsed * 1000000.0), (long long) transferred, size_str, (long long) rate,
+			(long long) average_rate, eta_str, (long long) (state->transfer.total_bytes_read),
+			(long long) (state->transfer.total_written), (long long) buffered,
+			(long long) (state->calc.rate_min), (long long) (state->calc.rate_max),
+			state->calc.measurements_taken,
+			(long long) pv_calculate_rate_percentile(&(state->calc), 0.5L),
+			(long long) pv_calculate_rate_percentile(&(state->calc), 0.95L),
+			(long long) pv_calculate_rate_percentile(&(state->calc), 0.99L), state->calc.stall_count,
+			state->metrics.dropped, final ? "true" : "false");
+	if ((length < 1) || (length >= (int) sizeof(record)))
+		return;
+
+	state->metrics.prev_elapsed = elapsed;
+	state->metrics.prev_transferred = transferred;
+	if (final)
+		state->metrics.final_written = true;
+
+	written = pv__metrics_send(state, record, (size_t) length);
+	if (written < 0)
+		return;
+	if ((0 == written) && (!final)) {
+		state->metrics.dropped++;
+		return;
+	}
+
+	state->metrics.records++;
+
+	/* Keep the rest of a partly written record, to send next time. */
+	if (written < (ssize_t) length) {
+		state->metrics.pending_bytes = (size_t) (length - written);
+		memcpy(state->metrics.pending, record + written, state->metrics.pending_bytes);	/* flawfinder: ignore */
+		/*
+		 * flawfinder rationale: "pending" is the same size as
+		 * "record", and fewer bytes than "length" are copied.
+		 */
+	}
+
+	/* Nothing else will be sent after the final record. */
+	if (final)
+		(void) pv__metrics_flush(state, &final_deadline);
+}
+
+
+/*
+ * Close the metrics destination, if we opened it.
+ */
+void pv_metrics_close(pvstate_t state)
+{
+	if ((state->metrics.fd >= 0) && state->metrics.close_fd)
+		(void) close(state->metrics.fd);
+	state->metrics.fd = -1;
+	state->metrics.close_fd = false;
+	state->metrics.pending_bytes = 0;
+}
@@ -0,0 +1,605 @@
+/*
+ * Parallel chunked copy: when both the input and the output are regular
+ * files or block devices, split what is left of the input into chunks and
+ * copy them with pread() and pwrite() from several worker threads at once,
+ * so that striped arrays and NVMe devices see several streams of requests.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_THREADS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * The workers take chunks in turn by adding to "next_offset", so each
+ * chunk is copied by exactly one of them, in whatever order they finish.
+ * The input range runs from input_start to input_end, and the matching
+ * output range starts at output_start.
+ *
+ * Everything marked "shared" is accessed with atomic builtins; the mutex
+ * and condition variable are only used to sleep while waiting for rate
+ * limit budget, and to tell the main thread when the workers are done.
+ */
+struct pvparallel_s {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t threads[PV_PARALLEL_MAX_THREADS];
+	unsigned int thread_count;		/* number of threads started */
+
+	/* Fixed while the threads are running. */
+	int input_fd;
+	int output_fd;
+	off_t input_start;			/* where the input was when we started */
+	off_t input_end;			/* where to stop reading */
+	off_t output_start;			/* where the output was when we started */
+	size_t chunk_size;			/* bytes taken by a worker at a time */
+	size_t sparse_block;			/* output block size if sparse, or 0 */
+	bool sync_after_write;			/* fdatasync() after each write */
+	bool huge_pages;			/* --huge-pages for chunk buffers */
+	bool lock_memory;			/* --lock-memory for chunk buffers */
+	int numa_node;				/* --numa-node, or -1 */
+
+	/* Shared. */
+	long long next_offset;			/* next chunk's offset from input_start */
+	long long eof_offset;			/* offset the input was found to end at */
+	unsigned long long bytes_read;
+	unsigned long long bytes_written;
+	long long write_budget;			/* bytes the workers may write, if rate_limited */
+	unsigned int threads_done;
+	int read_errno;
+	int write_errno;
+	bool rate_limited;			/* set if write_budget applies */
+	bool stop;
+
+	/* Only used by the main thread. */
+	unsigned long long reported_read;
+	unsigned long long reported_written;
+	bool running;
+};
+
+
+static bool pv__parallel_has_budget(pvparallel_t parallel)
+{
+	return (!__atomic_load_n(&(parallel->rate_limited), __ATOMIC_SEQ_CST))
+	    || (__atomic_load_n(&(parallel->write_budget), __ATOMIC_SEQ_CST) > 0)
+	    || __atomic_load_n(&(parallel->stop), __ATOMIC_SEQ_CST);
+}
+
+
+/*
+ * Wake everything sleeping on the condition variable.
+ */
+static void pv__parallel_wake(pvparallel_t parallel)
+{
+	(void) pthread_mutex_lock(&(parallel->mutex));
+	(void) pthread_cond_broadcast(&(parallel->cond));
+	(void) pthread_mutex_unlock(&(parallel->mutex));
+}
+
+
+/*
+ * Return how many of the "wanted" bytes the calling worker may write now,
+ * taking them from the rate limit budget if there is one, and sleeping
+ * until there is some budget if it has run out.  Returns 0 if the copy is
+ * being stopped.
+ */
+static size_t pv__parallel_take_budget(pvparallel_t parallel, size_t wanted)
+{
+	while (!__atomic_load_n(&(parallel->stop), __ATOMIC_SEQ_CST)) {
+		long long budget, granted;
+
+		if (!__atomic_load_n(&(parallel->rate_limited), __ATOMIC_SEQ_CST))
+			return wanted;
+
+		budget = __atomic_load_n(&(parallel->write_budget), __ATOMIC_SEQ_CST);
+		if (budget <= 0) {
+			(void) pthread_mutex_lock(&(parallel->mutex));
+			while (!pv__parallel_has_budget(parallel))
+				(void) pthread_cond_wait(&(parallel->cond), &(parallel->mutex));
+			(void) pthread_mutex_unlock(&(parallel->mutex));
+			continue;
+		}
+
+		granted = budget < (long long) wanted ? budget : (long long) wanted;
+		if (__atomic_compare_exchange_n
+		    (&(parallel->write_budget), &budget, budget - granted, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			return (size_t) granted;
+	}
+	return 0;
+}
+
+
+/*
+ * Write "length" bytes from "buffer" at output offset "offset", retrying
+ * after partial writes.  In sparse mode, blocks that are entirely null,
+ * aligned to the output block size, are left as holes.
+ *
+ * Returns false, with errno set, on error.
+ */
+static bool pv__parallel_write(pvparallel_t parallel, const char *buffer, size_t length, off_t offset)
+{
+	size_t done = 0;
+
+	while (done < length) {
+		size_t run;
+		ssize_t nwritten;
+
+		run = length - done;
+		if (parallel->sparse_block > 0) {
+			size_t into_block = (size_t) ((offset + (off_t) done) % (off_t) (parallel->sparse_block));
+			if (run > parallel->sparse_block - into_block)
+				run = parallel->sparse_block - into_block;
+			if (pv_is_zero(buffer + done, run)) {
+				done += run;
+				continue;
+			}
+		}
+
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		nwritten = pwrite(parallel->output_fd, buffer + done, run, offset + (off_t) done);
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (nwritten < 0) {
+			if (EINTR == errno)
+				continue;
+			return false;
+		}
+		if (0 == nwritten) {
+			errno = ENOSPC;
+			return false;
+		}
+		done += (size_t) nwritten;
+	}
+
+#ifdef HAVE_FDATASYNC
+	/* As in pv__transfer_write_repeated(), only EIO counts. */
+	if (parallel->sync_after_write && (fdatasync(parallel->output_fd) < 0) && (EIO == errno))
+		return false;
+#endif				/* HAVE_FDATASYNC */
+
+	return true;
+}
+
+
+/*
+ * Worker thread: take chunks of the input in turn, read each with
+ * pread(), and write it to the same place in the output with pwrite(), a
+ * piece at a time if rate limited.  A short read means the input was
+ * found to end early, and nothing after it is copied.
+ */
+/*@null@ */
+static void *pv__parallel_worker(void *arg)
+{
+	pvparallel_t parallel = (pvparallel_t) arg;
+	struct pvbuffermem_s buffer_mem;
+	char *buffer;
+
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	/*
+	 * Each worker allocates its own buffer, so that with no --numa-node
+	 * given, it is on the node of the CPU that worker is running on.
+	 */
+	memset(&buffer_mem, 0, sizeof(buffer_mem));
+	if (parallel->huge_pages || parallel->lock_memory || (parallel->numa_node >= 0)) {
+		buffer =
+		    pv_buffer_alloc(parallel->chunk_size, 0, parallel->huge_pages, parallel->lock_memory,
+				    parallel->numa_node, &buffer_mem);
+	} else {
+		buffer = malloc(parallel->chunk_size);
+	}
+	if (NULL == buffer) {
+		__atomic_store_n(&(parallel->read_errno), errno, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&(parallel->stop), true, __ATOMIC_SEQ_CST);
+		goto pv__parallel_worker_finished;
+	}
+
+	while (!__atomic_load_n(&(parallel->stop), __ATOMIC_SEQ_CST)) {
+		long long chunk_offset;
+		size_t length, got, written;
+
+		chunk_offset =
+		    __atomic_fetch_add(&(parallel->next_offset), (long long) (parallel->chunk_size), __ATOMIC_SEQ_CST);
+		if (chunk_offset >= __atomic_load_n(&(parallel->eof_offset), __ATOMIC_SEQ_CST))
+			break;
+		if (parallel->input_start + (off_t) chunk_offset >= parallel->input_end)
+			break;
+
+		length = parallel->chunk_size;
+		if ((off_t) length > parallel->input_end - parallel->input_start - (off_t) chunk_offset)
+			length = (size_t) (parallel->input_end - parallel->input_start - (off_t) chunk_offset);
+
+		got = 0;
+		while (got < length) {
+			ssize_t nread;
+			(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+			nread = pread(parallel->input_fd, buffer + got, length - got,	/* flawfinder: ignore */
+				      parallel->input_start + (off_t) chunk_offset + (off_t) got);
+			(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+			/*
+			 * flawfinder rationale: the buffer is chunk_size
+			 * bytes long, and length is never more than that.
+			 */
+			if (nread < 0) {
+				if (EINTR == errno)
+					continue;
+				__atomic_store_n(&(parallel->read_errno), errno, __ATOMIC_SEQ_CST);
+				__atomic_store_n(&(parallel->stop), true, __ATOMIC_SEQ_CST);
+				goto pv__parallel_worker_finished;
+			}
+			if (0 == nread)
+				break;
+			got += (size_t) nread;
+		}
+		__atomic_add_fetch(&(parallel->bytes_read), (unsigned long long) got, __ATOMIC_SEQ_CST);
+
+		if (got < length) {
+			long long end = chunk_offset + (long long) got;
+			long long seen = __atomic_load_n(&(parallel->eof_offset), __ATOMIC_SEQ_CST);
+			while ((end < seen)
+			       && (!__atomic_compare_exchange_n
+				   (&(parallel->eof_offset), &seen, end, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))) {
+				/* Retry with the updated value of "seen". */
+			}
+		}
+
+		written = 0;
+		while (written < got) {
+			size_t piece = pv__parallel_take_budget(parallel, got - written);
+			if (0 == piece)
+				goto pv__parallel_worker_finished;
+			if (!pv__parallel_write
+			    (parallel, buffer + written, piece,
+			     parallel->output_start + (off_t) chunk_offset + (off_t) written)) {
+				__atomic_store_n(&(parallel->write_errno), errno, __ATOMIC_SEQ_CST);
+				__atomic_store_n(&(parallel->stop), true, __ATOMIC_SEQ_CST);
+				goto pv__parallel_worker_finished;
+			}
+			written += piece;
+			__atomic_add_fetch(&(parallel->bytes_written), (unsigned long long) piece, __ATOMIC_SEQ_CST);
+		}
+
+		if (got < length)
+			break;
+	}
+
+      pv__parallel_worker_finished:
+	if (NULL != buffer)
+		pv_buffer_free(buffer, &buffer_mem);
+	__atomic_add_fetch(&(parallel->threads_done), 1, __ATOMIC_SEQ_CST);
+	pv__parallel_wake(parallel);
+
+	return NULL;
+}
+
+
+/*
+ * Stop and reap the worker threads, cancelling any stuck in pread() or
+ * pwrite().
+ */
+static void pv__parallel_join(pvparallel_t parallel)
+{
+	unsigned int idx;
+
+	if (!parallel->running)
+		return;
+
+	__atomic_store_n(&(parallel->stop), true, __ATOMIC_SEQ_CST);
+	pv__parallel_wake(parallel);
+
+	if (__atomic_load_n(&(parallel->threads_done), __ATOMIC_SEQ_CST) < parallel->thread_count) {
+		for (idx = 0; idx < parallel->thread_count; idx++)
+			(void) pthread_cancel(parallel->threads[idx]);
+	}
+	for (idx = 0; idx < parallel->thread_count; idx++)
+		(void) pthread_join(parallel->threads[idx], NULL);
+
+	parallel->thread_count = 0;
+	parallel->running = false;
+}
+
+
+/*
+ * Start the worker threads to copy the rest of input "fd", from its
+ * current position to its end, or to where --stop-at-size says to stop,
+ * to the output at its current position.  The threads block all signals,
+ * so that signals are still handled by the main thread.
+ *
+ * Returns false, with errno set, if the copy could not be started.
+ */
+static bool pv__parallel_start(pvstate_t state, pvparallel_t parallel, int fd)
+{
+	sigset_t all_signals, old_signals;
+	unsigned int want, idx;
+	off_t input_start, input_end, output_start;
+	int rc;
+
+	/*@+longintegral@ */
+	/* splint has trouble with off_t / __off_t, in the lseek() calls. */
+	input_start = (off_t) lseek(fd, 0, SEEK_CUR);
+	input_end = (off_t) lseek(fd, 0, SEEK_END);
+	if ((input_start < 0) || (input_end < 0))
+		return false;
+	if ((off_t) lseek(fd, input_start, SEEK_SET) < 0)
+		return false;
+	output_start = (off_t) lseek(state->control.output_fd, 0, SEEK_CUR);
+	if (output_start < 0)
+		return false;
+	/*@-longintegral@ */
+
+	if (state->control.stop_at_size && (state->control.size > 0)) {
+		off_t remaining = state->control.size - state->transfer.total_bytes_read;
+		if (remaining < 0)
+			remaining = 0;
+		if (input_end - input_start > remaining)
+			input_end = input_start + remaining;
+	}
+	if (input_end < input_start)
+		input_end = input_start;
+
+	parallel->input_fd = fd;
+	parallel->output_fd = state->control.output_fd;
+	parallel->input_start = input_start;
+	parallel->input_end = input_end;
+	parallel->output_start = output_start;
+	parallel->huge_pages = state->control.huge_pages;
+	parallel->lock_memory = state->control.lock_memory;
+	parallel->numa_node = state->control.numa_node;
+
+	/* Take whole pages at a time, and at least PV_PARALLEL_CHUNK_MIN. */
+	parallel->chunk_size = state->transfer.buffer_size & ~((size_t) 4095);
+	if (parallel->chunk_size < PV_PARALLEL_CHUNK_MIN)
+		parallel->chunk_size = PV_PARALLEL_CHUNK_MIN;
+
+	parallel->sparse_block = 0;
+	if (state->control.sparse_output) {
+		struct stat sb;
+		parallel->sparse_block = PV_SPARSE_BLOCK_DEFAULT;
+		memset(&sb, 0, sizeof(sb));
+		if ((0 == fstat(parallel->output_fd, &sb)) && (sb.st_blksize >= 512)
+		    && ((size_t) (sb.st_blksize) <= PV_SPARSE_BLOCK_MAX))
+			parallel->sparse_block = (size_t) (sb.st_blksize);
+	}
+	parallel->sync_after_write = state->control.sync_after_write;
+
+	parallel->next_offset = 0;
+	parallel->eof_offset = (long long) (input_end - input_start);
+	parallel->bytes_read = 0;
+	parallel->bytes_written = 0;
+	parallel->write_budget = 0;
+	parallel->rate_limited = false;
+	parallel->threads_done = 0;
+	parallel->read_errno = 0;
+	parallel->write_errno = 0;
+	parallel->stop = false;
+	parallel->reported_read = 0;
+	parallel->reported_written = 0;
+
+	/* No more threads than there are chunks to copy. */
+	want = state->control.parallel;
+	if (want > PV_PARALLEL_MAX_THREADS)
+		want = PV_PARALLEL_MAX_THREADS;
+	if ((off_t) want * (off_t) (parallel->chunk_size) > input_end - input_start)
+		want = (unsigned int) ((input_end - input_start + (off_t) (parallel->chunk_size) - 1)
+				       / (off_t) (parallel->chunk_size));
+	if (want < 1)
+		want = 1;
+
+	(void) sigfillset(&all_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+	rc = 0;
+	parallel->thread_count = 0;
+	for (idx = 0; idx < want; idx++) {
+		rc = pthread_create(&(parallel->threads[idx]), NULL, pv__parallel_worker, parallel);
+		if (0 != rc)
+			break;
+		parallel->thread_count++;
+	}
+
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 == parallel->thread_count) {
+		errno = rc;
+		return false;
+	}
+
+	debug("%s %d: %s: %u x %ld: %lld-%lld -> %lld", "fd", fd, "parallel copy started", parallel->thread_count,
+	      (long) (parallel->chunk_size), (long long) input_start, (long long) input_end,
+	      (long long) output_start);
+
+	parallel->running = true;
+	return true;
+}
+
+
+/*
+ * Stop any running threads and free the parallel copy state.
+ */
+void pv_parallel_free( /*@only@ */ pvparallel_t parallel)
+{
+	if (NULL == parallel)
+		return;
+	pv__parallel_join(parallel);
+	(void) pthread_cond_destroy(&(parallel->cond));
+	(void) pthread_mutex_destroy(&(parallel->mutex));
+	free(parallel);
+}
+
+
+/*
+ * Copy input "fd" to the output with parallel worker threads, starting
+ * them if this is a new input.  This waits for as long as pv_transfer()
+ * would, or until the copy finishes, and then reports what has been
+ * written since the last call, with the same return values and arguments
+ * as pv_transfer().
+ *
+ * Once the copy finishes, the input and output positions are moved past
+ * what was copied and state->transfer.parallel_usable is cleared, so that
+ * the normal path carries on from there - reading anything that was added
+ * to the input since, and finding its end.
+ *
+ * If the copy can't be started, sets state->transfer.parallel_failed so
+ * that the normal path is used instead, and returns 0.
+ */
+ssize_t pv_parallel_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed)
+{
+	pvparallel_t parallel;
+	unsigned long long total;
+	struct timespec deadline;
+	ssize_t written;
+	off_t copied;
+	long wait_usec;
+	int read_errno, write_errno;
+
+	if (NULL == state->transfer.parallel) {
+		parallel = calloc(1, sizeof(*parallel));
+		if (NULL == parallel) {
+			debug("%s: %s", "parallel copy allocation failed", strerror(errno));
+			state->transfer.parallel_failed = true;
+			return 0;
+		}
+		(void) pthread_mutex_init(&(parallel->mutex), NULL);
+		(void) pthread_cond_init(&(parallel->cond), NULL);
+		state->transfer.parallel = parallel;
+	}
+	parallel = state->transfer.parallel;
+
+	if (parallel->running && (fd != parallel->input_fd))
+		pv__parallel_join(parallel);
+
+	if (!parallel->running) {
+		if (!pv__parallel_start(state, parallel, fd)) {
+			debug("%s: %s", "failed to start parallel copy - using read/write", strerror(errno));
+			state->transfer.parallel_failed = true;
+			return 0;
+		}
+	}
+
+	/*
+	 * Give the workers their new budget when rate limited.
+	 */
+	if ((state->control.rate_limit > 0) || (allowed > 0)) {
+		__atomic_store_n(&(parallel->write_budget), (long long) allowed, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&(parallel->rate_limited), true, __ATOMIC_SEQ_CST);
+	} else {
+		__atomic_store_n(&(parallel->rate_limited), false, __ATOMIC_SEQ_CST);
+	}
+	pv__parallel_wake(parallel);
+
+	/*
+	 * Wait until the workers finish or the timeout expires.
+	 */
+	memset(&deadline, 0, sizeof(deadline));
+	(void) clock_gettime(CLOCK_REALTIME, &deadline);
+	wait_usec = pv_transfer_wait_usec(state);
+	deadline.tv_sec += wait_usec / 1000000;
+	deadline.tv_nsec += (wait_usec % 1000000) * 1000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	(void) pthread_mutex_lock(&(parallel->mutex));
+	while (__atomic_load_n(&(parallel->threads_done), __ATOMIC_SEQ_CST) < parallel->thread_count) {
+		if (ETIMEDOUT == pthread_cond_timedwait(&(parallel->cond), &(parallel->mutex), &deadline))
+			break;
+	}
+	(void) pthread_mutex_unlock(&(parallel->mutex));
+
+	/*
+	 * Collect the counters.
+	 */
+	total = __atomic_load_n(&(parallel->bytes_read), __ATOMIC_SEQ_CST);
+	state->transfer.total_bytes_read += (off_t) (total - parallel->reported_read);
+	parallel->reported_read = total;
+
+	total = __atomic_load_n(&(parallel->bytes_written), __ATOMIC_SEQ_CST);
+	written = (ssize_t) (total - parallel->reported_written);
+	parallel->reported_written = total;
+
+	state->transfer.written = written;
+
+	if (__atomic_load_n(&(parallel->threads_done), __ATOMIC_SEQ_CST) < parallel->thread_count)
+		return written;
+
+	/*
+	 * All the workers have finished - the range has been copied, or
+	 * there was an error.
+	 */
+	pv__parallel_join(parallel);
+	state->transfer.parallel_usable = false;
+
+	read_errno = parallel->read_errno;
+	write_errno = parallel->write_errno;
+
+	if ((0 != read_errno) || (0 != write_errno)) {
+		*eof_in = true;
+		*eof_out = true;
+		state->transfer.parallel_fd = -1;
+	}
+
+	if (0 != read_errno) {
+		/*@-compdef@ */
+		pv_error("%s: %s: %s", pv_current_file_name(state), _("read failed"), strerror(read_errno));
+		/*@+compdef@ */
+		/* splint - see pv_current_file_name() calls in transfer.c. */
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	}
+
+	if (0 != write_errno) {
+		pv_error("%s: %s", _("write failed"), strerror(write_errno));
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		state->transfer.written = -1;
+		return -1;
+	}
+
+	if (0 != read_errno)
+		return written;
+
+	/*
+	 * Leave both files positioned after what was copied, so that the
+	 * normal path can carry on.  If the last blocks were left as holes,
+	 * the output has to be extended over them.
+	 */
+	copied = (off_t) (parallel->bytes_written);
+	/*@+longintegral@ */
+	if ((off_t) lseek(fd, parallel->input_start + copied, SEEK_SET) < 0) {
+		debug("%s %d: %s: %s", "fd", fd, "lseek", strerror(errno));
+	}
+	if ((off_t) lseek(parallel->output_fd, parallel->output_start + copied, SEEK_SET) < 0) {
+		debug("%s %d: %s: %s", "fd", parallel->output_fd, "lseek", strerror(errno));
+	}
+	/*@-longintegral@ */
+	if (parallel->sparse_block > 0) {
+		struct stat sb;
+		memset(&sb, 0, sizeof(sb));
+		if ((0 == fstat(parallel->output_fd, &sb)) && S_ISREG(sb.st_mode)
+		    && (sb.st_size < parallel->output_start + copied)) {
+			if (0 != ftruncate(parallel->output_fd, parallel->output_start + copied)) {
+				debug("%s: %s", "ftruncate", strerror(errno));
+			}
+		}
+	}
+
+	debug("%s %d: %s: %lld", "fd", fd, "parallel copy finished", (long long) copied);
+
+	return written;
+}
+
+#endif				/* HAVE_THREADS */
@@ -0,0 +1,619 @@
+/*
+ * Threaded transfer pipeline: a reader thread and a writer thread sharing
+ * a single-producer, single-consumer ring of fixed-size slots carved out
+ * of the transfer buffer, so that input and output can proceed at the
+ * same time.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_THREADS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/select.h>
+
+/*
+ * The ring indexes "head" and "tail" count slots filled by the reader and
+ * drained by the writer, so the ring is empty when they are equal and full
+ * when they differ by the number of slots.  Each is only written by one
+ * thread, so the ring itself needs no locks; the mutex and condition
+ * variable are only used to sleep when a thread has nothing to do, and
+ * the "*_waiting" flags let the other side skip the wakeup when nobody is
+ * asleep.
+ *
+ * Everything marked "shared" is accessed with atomic builtins.
+ */
+struct pvpipeline_s {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t reader_thread;
+	pthread_t writer_thread;
+
+	/* Fixed while the threads are running. */
+	char *buffer;				/* the transfer buffer */
+	size_t slot_size;			/* bytes per slot */
+	unsigned int slot_count;		/* number of slots in use */
+	int input_fd;
+	int output_fd;
+	off_t read_limit;			/* max bytes to read, or -1 */
+	char separator;				/* line separator to count */
+	bool count_lines;			/* whether to count lines written */
+	bool sync_after_write;			/* fdatasync() after each write */
+	bool discard;				/* consume without writing */
+
+	size_t slot_length[PV_PIPELINE_SLOTS];	/* bytes filled in each slot */
+
+	/* Shared. */
+	unsigned long head;
+	unsigned long tail;
+	unsigned long long bytes_read;
+	unsigned long long bytes_written;
+	unsigned long long lines_written;
+	long long write_budget;			/* bytes the writer may write, if rate_limited */
+	long wait_usec;				/* max to wait for a non-blocking fd */
+	int read_errno;
+	int write_errno;
+	bool reader_done;
+	bool writer_done;
+	bool reader_waiting;
+	bool writer_waiting;
+	bool rate_limited;			/* set if write_budget applies */
+	bool stop;
+
+	/* Only used by the main thread. */
+	unsigned long long reported_read;
+	unsigned long long reported_written;
+	unsigned long long reported_lines;
+	bool running;
+};
+
+
+/*
+ * Sleep until "ready" says there is something to do, or the pipeline is
+ * being stopped.  The waiting flag is set before "ready" is checked, so
+ * that either this thread sees the other side's update, or the other side
+ * sees the flag and wakes us.
+ */
+static void pv__pipeline_sleep(pvpipeline_t pipeline, bool *waiting, bool (*ready)(pvpipeline_t))
+{
+	(void) pthread_mutex_lock(&(pipeline->mutex));
+	__atomic_store_n(waiting, true, __ATOMIC_SEQ_CST);
+	while ((!ready(pipeline)) && (!__atomic_load_n(&(pipeline->stop), __ATOMIC_SEQ_CST))) {
+		(void) pthread_cond_wait(&(pipeline->cond), &(pipeline->mutex));
+	}
+	__atomic_store_n(waiting, false, __ATOMIC_SEQ_CST);
+	(void) pthread_mutex_unlock(&(pipeline->mutex));
+}
+
+
+/*
+ * Wake any thread sleeping on the pipeline, if "waiting" says there is
+ * one, or unconditionally if "waiting" is NULL.
+ */
+static void pv__pipeline_wake(pvpipeline_t pipeline, /*@null@ */ bool *waiting)
+{
+	if ((NULL != waiting) && (!__atomic_load_n(waiting, __ATOMIC_SEQ_CST)))
+		return;
+	(void) pthread_mutex_lock(&(pipeline->mutex));
+	(void) pthread_cond_broadcast(&(pipeline->cond));
+	(void) pthread_mutex_unlock(&(pipeline->mutex));
+}
+
+
+/*
+ * Wait for "fd" to become readable, or writable if "for_writing" is true,
+ * for non-blocking descriptors that returned EAGAIN - for no longer than
+ * the main thread last allowed itself to wait.  The thread can be
+ * cancelled while waiting, as it can while blocked in read() or write().
+ */
+static void pv__pipeline_wait_fd(pvpipeline_t pipeline, int fd, bool for_writing)
+{
+	struct timeval tv;
+	fd_set fds;
+	long wait_usec;
+
+	wait_usec = __atomic_load_n(&(pipeline->wait_usec), __ATOMIC_SEQ_CST);
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	tv.tv_sec = wait_usec / 1000000;
+	tv.tv_usec = wait_usec % 1000000;
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	(void) select(fd + 1, for_writing ? NULL : &fds, for_writing ? &fds : NULL, NULL, &tv);
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+}
+
+
+static bool pv__pipeline_has_space(pvpipeline_t pipeline)
+{
+	return (__atomic_load_n(&(pipeline->head), __ATOMIC_SEQ_CST)
+		- __atomic_load_n(&(pipeline->tail), __ATOMIC_SEQ_CST)) < pipeline->slot_count;
+}
+
+
+static bool pv__pipeline_has_data(pvpipeline_t pipeline)
+{
+	return (__atomic_load_n(&(pipeline->head), __ATOMIC_SEQ_CST)
+		!= __atomic_load_n(&(pipeline->tail), __ATOMIC_SEQ_CST))
+	    || __atomic_load_n(&(pipeline->reader_done), __ATOMIC_SEQ_CST);
+}
+
+
+static bool pv__pipeline_has_budget(pvpipeline_t pipeline)
+{
+	return (!__atomic_load_n(&(pipeline->rate_limited), __ATOMIC_SEQ_CST))
+	    || (__atomic_load_n(&(pipeline->write_budget), __ATOMIC_SEQ_CST) > 0);
+}
+
+
+/*
+ * Reader thread: fill slots from the input until end of file, a read
+ * error, or the read limit.
+ *
+ * Cancellation is only enabled around read(), so that if the writer gives
+ * up early, a reader blocked on a slow input can still be stopped.
+ */
+/*@null@ */
+static void *pv__pipeline_reader(void *arg)
+{
+	pvpipeline_t pipeline = (pvpipeline_t) arg;
+
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	while (!__atomic_load_n(&(pipeline->stop), __ATOMIC_SEQ_CST)) {
+		unsigned long head;
+		size_t length;
+		char *slot;
+		ssize_t nread;
+
+		if (!pv__pipeline_has_space(pipeline)) {
+			pv__pipeline_sleep(pipeline, &(pipeline->reader_waiting), pv__pipeline_has_space);
+			continue;
+		}
+
+		head = __atomic_load_n(&(pipeline->head), __ATOMIC_RELAXED);
+		slot = pipeline->buffer + (head % pipeline->slot_count) * pipeline->slot_size;
+		length = pipeline->slot_size;
+
+		if (pipeline->read_limit >= 0) {
+			unsigned long long remaining;
+			if ((unsigned long long) (pipeline->read_limit) <= pipeline->bytes_read)
+				break;
+			remaining = (unsigned long long) (pipeline->read_limit) - pipeline->bytes_read;
+			if (remaining < (unsigned long long) length)
+				length = (size_t) remaining;
+		}
+
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		nread = read(pipeline->input_fd, slot, length);	/* flawfinder: ignore */
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		/*
+		 * flawfinder rationale: the slot is slot_size bytes long,
+		 * and length is never more than that.
+		 */
+
+		if (nread < 0) {
+			if (EINTR == errno)
+				continue;
+			if (EAGAIN == errno) {
+				pv__pipeline_wait_fd(pipeline, pipeline->input_fd, false);
+				continue;
+			}
+			__atomic_store_n(&(pipeline->read_errno), errno, __ATOMIC_SEQ_CST);
+			break;
+		}
+		if (0 == nread)
+			break;
+
+		pipeline->slot_length[head % pipeline->slot_count] = (size_t) nread;
+		__atomic_add_fetch(&(pipeline->bytes_read), (unsigned long long) nread, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&(pipeline->head), head + 1, __ATOMIC_SEQ_CST);
+		pv__pipeline_wake(pipeline, &(pipeline->writer_waiting));
+	}
+
+	__atomic_store_n(&(pipeline->reader_done), true, __ATOMIC_SEQ_CST);
+	pv__pipeline_wake(pipeline, NULL);
+
+	return NULL;
+}
+
+
+/*
+ * Writer thread: drain slots to the output until the reader has finished
+ * and the ring is empty, or a write error occurs.  When rate limited, only
+ * write as much as the budget given by the main thread allows.
+ */
+/*@null@ */
+static void *pv__pipeline_writer(void *arg)
+{
+	pvpipeline_t pipeline = (pvpipeline_t) arg;
+
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	while (!__atomic_load_n(&(pipeline->stop), __ATOMIC_SEQ_CST)) {
+		unsigned long tail;
+		size_t length, offset;
+		char *slot;
+
+		tail = __atomic_load_n(&(pipeline->tail), __ATOMIC_RELAXED);
+		if (tail == __atomic_load_n(&(pipeline->head), __ATOMIC_SEQ_CST)) {
+			if (__atomic_load_n(&(pipeline->reader_done), __ATOMIC_SEQ_CST)
+			    && (tail == __atomic_load_n(&(pipeline->head), __ATOMIC_SEQ_CST)))
+				break;
+			pv__pipeline_sleep(pipeline, &(pipeline->writer_waiting), pv__pipeline_has_data);
+			continue;
+		}
+
+		slot = pipeline->buffer + (tail % pipeline->slot_count) * pipeline->slot_size;
+		length = pipeline->slot_length[tail % pipeline->slot_count];
+		offset = 0;
+
+		while ((offset < length) && (!__atomic_load_n(&(pipeline->stop), __ATOMIC_SEQ_CST))) {
+			bool limited;
+			long long budget;
+			size_t chunk;
+			ssize_t nwritten;
+
+			chunk = length - offset;
+
+			limited = __atomic_load_n(&(pipeline->rate_limited), __ATOMIC_SEQ_CST);
+			budget = __atomic_load_n(&(pipeline->write_budget), __ATOMIC_SEQ_CST);
+			if (limited && (budget <= 0)) {
+				pv__pipeline_sleep(pipeline, &(pipeline->writer_waiting), pv__pipeline_has_budget);
+				continue;
+			}
+			if (limited && ((unsigned long long) budget < (unsigned long long) chunk))
+				chunk = (size_t) budget;
+
+			if (pipeline->discard) {
+				nwritten = (ssize_t) chunk;
+			} else {
+				(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+				nwritten = write(pipeline->output_fd, slot + offset, chunk);
+				(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+			}
+
+			if (nwritten < 0) {
+				if (EINTR == errno)
+					continue;
+				if (EAGAIN == errno) {
+					pv__pipeline_wait_fd(pipeline, pipeline->output_fd, true);
+					continue;
+				}
+				__atomic_store_n(&(pipeline->write_errno), errno, __ATOMIC_SEQ_CST);
+				goto pv__pipeline_writer_finished;
+			}
+			if (0 == nwritten) {
+				pv__pipeline_wait_fd(pipeline, pipeline->output_fd, true);
+				continue;
+			}
+#ifdef HAVE_FDATASYNC
+			if (pipeline->sync_after_write && !pipeline->discard) {
+				/* As in pv__transfer_write_repeated(), only EIO counts. */
+				if ((fdatasync(pipeline->output_fd) < 0) && (EIO == errno)) {
+					__atomic_store_n(&(pipeline->write_errno), EIO, __ATOMIC_SEQ_CST);
+					goto pv__pipeline_writer_finished;
+				}
+			}
+#endif				/* HAVE_FDATASYNC */
+
+			if (pipeline->count_lines) {
+				unsigned long long lines = 0;
+				const char *scan = slot + offset;
+				const char *end = scan + nwritten;
+				while (NULL !=
+				       (scan = memchr(scan, (int) (pipeline->separator), (size_t) (end - scan)))) {
+					lines++;
+					scan++;
+				}
+				__atomic_add_fetch(&(pipeline->lines_written), lines, __ATOMIC_SEQ_CST);
+			}
+
+			if (limited)
+				__atomic_sub_fetch(&(pipeline->write_budget), (long long) nwritten, __ATOMIC_SEQ_CST);
+			__atomic_add_fetch(&(pipeline->bytes_written), (unsigned long long) nwritten,
+					   __ATOMIC_SEQ_CST);
+			offset += (size_t) nwritten;
+		}
+
+		__atomic_store_n(&(pipeline->tail), tail + 1, __ATOMIC_SEQ_CST);
+		pv__pipeline_wake(pipeline, &(pipeline->reader_waiting));
+	}
+
+      pv__pipeline_writer_finished:
+	__atomic_store_n(&(pipeline->writer_done), true, __ATOMIC_SEQ_CST);
+	pv__pipeline_wake(pipeline, NULL);
+
+	return NULL;
+}
+
+
+/*
+ * Stop and reap the pipeline's threads.  Threads stuck in read() or
+ * write() are cancelled; any others are woken and exit by themselves.
+ */
+static void pv__pipeline_join(pvpipeline_t pipeline)
+{
+	if (!pipeline->running)
+		return;
+
+	__atomic_store_n(&(pipeline->stop), true, __ATOMIC_SEQ_CST);
+	pv__pipeline_wake(pipeline, NULL);
+
+	if (!__atomic_load_n(&(pipeline->reader_done), __ATOMIC_SEQ_CST))
+		(void) pthread_cancel(pipeline->reader_thread);
+	if (!__atomic_load_n(&(pipeline->writer_done), __ATOMIC_SEQ_CST))
+		(void) pthread_cancel(pipeline->writer_thread);
+
+	(void) pthread_join(pipeline->reader_thread, NULL);
+	(void) pthread_join(pipeline->writer_thread, NULL);
+
+	pipeline->running = false;
+}
+
+
+/*
+ * Start the reader and writer threads for input "fd".  The threads block
+ * all signals, so that signals are still handled by the main thread.
+ *
+ * Returns false, with errno set, if the threads could not be created.
+ */
+static bool pv__pipeline_start(pvstate_t state, pvpipeline_t pipeline, int fd)
+{
+	sigset_t all_signals, old_signals;
+	int rc;
+
+	pipeline->buffer = state->transfer.transfer_buffer;
+	pipeline->slot_count = PV_PIPELINE_SLOTS;
+	pipeline->slot_size = state->transfer.buffer_size / PV_PIPELINE_SLOTS;
+	/* Keep slots a whole number of pages where possible, for O_DIRECT. */
+	if (pipeline->slot_size > 4096)
+		pipeline->slot_size &= ~((size_t) 4095);
+	if (pipeline->slot_size < 1) {
+		pipeline->slot_size = state->transfer.buffer_size;
+		pipeline->slot_count = 1;
+	}
+
+	pipeline->input_fd = fd;
+	pipeline->output_fd = state->control.output_fd;
+	pipeline->read_limit = -1;
+	if (state->control.stop_at_size && !state->control.linemode && (state->control.size > 0)) {
+		pipeline->read_limit = state->control.size - state->transfer.total_bytes_read;
+		if (pipeline->read_limit < 0)
+			pipeline->read_limit = 0;
+	}
+	pipeline->separator = state->control.null_terminated_lines ? '\0' : '\n';
+	pipeline->count_lines = state->control.linemode;
+	pipeline->sync_after_write = state->control.sync_after_write;
+	pipeline->discard = state->control.discard_input;
+
+	pipeline->head = 0;
+	pipeline->tail = 0;
+	pipeline->bytes_read = 0;
+	pipeline->bytes_written = 0;
+	pipeline->lines_written = 0;
+	pipeline->write_budget = 0;
+	pipeline->rate_limited = false;
+	pipeline->read_errno = 0;
+	pipeline->write_errno = 0;
+	pipeline->reader_done = false;
+	pipeline->writer_done = false;
+	pipeline->reader_waiting = false;
+	pipeline->writer_waiting = false;
+	pipeline->stop = false;
+	pipeline->reported_read = 0;
+	pipeline->reported_written = 0;
+	pipeline->reported_lines = 0;
+
+	(void) sigfillset(&all_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+	rc = pthread_create(&(pipeline->reader_thread), NULL, pv__pipeline_reader, pipeline);
+	if (0 == rc) {
+		rc = pthread_create(&(pipeline->writer_thread), NULL, pv__pipeline_writer, pipeline);
+		if (0 != rc) {
+			__atomic_store_n(&(pipeline->stop), true, __ATOMIC_SEQ_CST);
+			pv__pipeline_wake(pipeline, NULL);
+			(void) pthread_cancel(pipeline->reader_thread);
+			(void) pthread_join(pipeline->reader_thread, NULL);
+		}
+	}
+
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		errno = rc;
+		return false;
+	}
+
+	debug("%s %d: %s: %u x %ld", "fd", fd, "pipeline started", pipeline->slot_count,
+	      (long) (pipeline->slot_size));
+
+	pipeline->running = true;
+	return true;
+}
+
+
+/*
+ * Stop any running threads and free the pipeline.
+ */
+void pv_pipeline_free( /*@only@ */ pvpipeline_t pipeline)
+{
+	if (NULL == pipeline)
+		return;
+	pv__pipeline_join(pipeline);
+	(void) pthread_cond_destroy(&(pipeline->cond));
+	(void) pthread_mutex_destroy(&(pipeline->mutex));
+	free(pipeline);
+}
+
+
+/*
+ * Return the number of bytes currently held in the pipeline's ring, and
+ * put the ring's capacity into *capacity.
+ */
+size_t pv_pipeline_buffered(pvpipeline_t pipeline, size_t *capacity)
+{
+	unsigned long long bytes_read, bytes_written;
+
+	*capacity = 0;
+	if ((NULL == pipeline) || (!pipeline->running))
+		return 0;
+
+	*capacity = pipeline->slot_size * pipeline->slot_count;
+	bytes_written = __atomic_load_n(&(pipeline->bytes_written), __ATOMIC_SEQ_CST);
+	bytes_read = __atomic_load_n(&(pipeline->bytes_read), __ATOMIC_SEQ_CST);
+	if (bytes_read <= bytes_written)
+		return 0;
+
+	return (size_t) (bytes_read - bytes_written);
+}
+
+
+/*
+ * Transfer data from "fd" to the output using the threaded pipeline,
+ * starting its threads if this is a new input.  This waits for as long as
+ * pv_transfer() would, or until the pipeline finishes, and then reports
+ * what the writer thread has written since the last call, with the same
+ * return values and arguments as pv_transfer().
+ *
+ * If the threads can't be started, sets state->transfer.pipeline_failed so
+ * that the normal path is used instead, and returns 0.
+ */
+ssize_t pv_pipeline_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+			     long *lineswritten)
+{
+	pvpipeline_t pipeline;
+	unsigned long long total;
+	struct timespec deadline;
+	ssize_t written;
+	long wait_usec;
+	int read_errno, write_errno;
+
+	if (NULL == state->transfer.pipeline) {
+		pipeline = calloc(1, sizeof(*pipeline));
+		if (NULL == pipeline) {
+			debug("%s: %s", "pipeline allocation failed", strerror(errno));
+			state->transfer.pipeline_failed = true;
+			return 0;
+		}
+		(void) pthread_mutex_init(&(pipeline->mutex), NULL);
+		(void) pthread_cond_init(&(pipeline->cond), NULL);
+		state->transfer.pipeline = pipeline;
+	}
+	pipeline = state->transfer.pipeline;
+
+	if (pipeline->running && (fd != pipeline->input_fd))
+		pv__pipeline_join(pipeline);
+
+	wait_usec = pv_transfer_wait_usec(state);
+	__atomic_store_n(&(pipeline->wait_usec), wait_usec, __ATOMIC_SEQ_CST);
+
+	if (!pipeline->running) {
+		if (!pv__pipeline_start(state, pipeline, fd)) {
+			debug("%s: %s", "failed to start pipeline threads - using read/write", strerror(errno));
+			state->transfer.pipeline_failed = true;
+			return 0;
+		}
+	}
+
+	state->transfer.buffer_pinned = true;
+
+	/*
+	 * Give the writer its new budget when rate limited.
+	 */
+	if ((state->control.rate_limit > 0) || (allowed > 0)) {
+		__atomic_store_n(&(pipeline->write_budget), (long long) allowed, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&(pipeline->rate_limited), true, __ATOMIC_SEQ_CST);
+	} else {
+		__atomic_store_n(&(pipeline->rate_limited), false, __ATOMIC_SEQ_CST);
+	}
+	pv__pipeline_wake(pipeline, &(pipeline->writer_waiting));
+
+	/*
+	 * Wait until the writer finishes or the timeout expires.
+	 */
+	memset(&deadline, 0, sizeof(deadline));
+	(void) clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += wait_usec / 1000000;
+	deadline.tv_nsec += (wait_usec % 1000000) * 1000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	(void) pthread_mutex_lock(&(pipeline->mutex));
+	while (!__atomic_load_n(&(pipeline->writer_done), __ATOMIC_SEQ_CST)) {
+		if (ETIMEDOUT == pthread_cond_timedwait(&(pipeline->cond), &(pipeline->mutex), &deadline))
+			break;
+	}
+	(void) pthread_mutex_unlock(&(pipeline->mutex));
+
+	/*
+	 * Collect the counters.
+	 */
+	total = __atomic_load_n(&(pipeline->bytes_read), __ATOMIC_SEQ_CST);
+	state->transfer.total_bytes_read += (off_t) (total - pipeline->reported_read);
+	pipeline->reported_read = total;
+
+	total = __atomic_load_n(&(pipeline->bytes_written), __ATOMIC_SEQ_CST);
+	written = (ssize_t) (total - pipeline->reported_written);
+	pipeline->reported_written = total;
+
+	total = __atomic_load_n(&(pipeline->lines_written), __ATOMIC_SEQ_CST);
+	if ((state->control.linemode) && (NULL != lineswritten))
+		*lineswritten = (long) (total - pipeline->reported_lines);
+	pipeline->reported_lines = total;
+
+	state->transfer.written = written;
+
+	if (!__atomic_load_n(&(pipeline->writer_done), __ATOMIC_SEQ_CST))
+		return written;
+
+	/*
+	 * The writer has finished - the input has been fully written, or
+	 * there was an error.
+	 */
+	pv__pipeline_join(pipeline);
+	state->transfer.buffer_pinned = false;
+
+	*eof_in = true;
+	*eof_out = true;
+
+	read_errno = pipeline->read_errno;
+	write_errno = pipeline->write_errno;
+
+	if (0 != read_errno) {
+		/*@-compdef@ */
+		pv_error("%s: %s: %s", pv_current_file_name(state), _("read failed"), strerror(read_errno));
+		/*@+compdef@ */
+		/* splint - see pv_current_file_name() calls in transfer.c. */
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	}
+
+	if (EPIPE == write_errno) {
+		state->flags.pipe_closed = 1;
+		debug("%s", "EPIPE received - setting pipe_closed");
+	} else if (0 != write_errno) {
+		pv_error("%s: %s", _("write failed"), strerror(write_errno));
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		state->transfer.written = -1;
+		return -1;
+	}
+
+	return written;
+}
+
+#endif				/* HAVE_THREADS */
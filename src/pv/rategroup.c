@@ -0,0 +1,320 @@
+/*
+ * Rate limit groups, where several "pv" processes share one rate limit.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef HAVE_IPC
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif				/* HAVE_IPC */
+
+
+/*
+ * The members of a group share a token bucket in a SysV shared memory
+ * segment, whose key is derived from a per-euid lock file named after the
+ * group in ${TMPDIR:-${TMP:-/tmp}}; the lock file is also used to
+ * serialise access to the segment.
+ *
+ * The bucket is refilled at the group's rate limit, up to a maximum of
+ * RATE_BURST_WINDOW seconds' worth.  Every RATE_GRANULARITY, each member
+ * tops up its own allowance from the bucket by at most its share of what
+ * is in it, where the share is divided between the members that have been
+ * drawing from it recently.  Members which are idle don't use up their
+ * allowance, so they stop drawing, and their share goes to the others.
+ */
+
+
+#ifdef HAVE_IPC
+/*
+ * Lock or unlock the group's lock file.
+ */
+static void pv__rategroup_lock(pvrategroupstate_t rategroup, bool lock)
+{
+	struct flock fl;
+
+	if (rategroup->lock_fd < 0)
+		return;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = (short) (lock ? F_WRLCK : F_UNLCK);
+	fl.l_whence = (short) SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 1;
+
+	if (!lock) {
+		(void) fcntl(rategroup->lock_fd, F_SETLK, &fl);
+		return;
+	}
+
+	while (fcntl(rategroup->lock_fd, F_SETLKW, &fl) < 0) {
+		if (EINTR != errno) {
+			debug("%s: %s", "rate group lock failed", strerror(errno));
+			return;
+		}
+	}
+}
+
+
+/*
+ * Return the number of processes attached to the group's shared memory.
+ */
+static int pv__rategroup_members(pvrategroupstate_t rategroup)
+{
+	struct shmid_ds buf;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.shm_nattch = 0;
+	(void) shmctl(rategroup->shmid, IPC_STAT, &buf);
+
+	return (int) (buf.shm_nattch);
+}
+#endif				/* HAVE_IPC */
+
+
+/*
+ * Join the rate limit group named in state->control.rate_group, creating
+ * it if this is the first member, in which case the group's rate limit is
+ * this process's own; otherwise this process adopts the group's existing
+ * limit.
+ *
+ * On failure, an error is reported and the process limits its own rate as
+ * usual.
+ */
+void pv_rategroup_join(pvstate_t state)
+{
+#ifdef HAVE_IPC
+	pvrategroupstate_t rategroup;
+	char *tmpdir;
+	int openflags;
+	key_t key;
+
+	if (NULL == state->control.rate_group)
+		return;
+
+	rategroup = &(state->rategroup);
+	if (rategroup->joined)
+		return;
+
+	tmpdir = (char *) getenv("TMPDIR");	/* flawfinder: ignore */
+	if ((NULL == tmpdir) || ('\0' == tmpdir[0]))
+		tmpdir = (char *) getenv("TMP");	/* flawfinder: ignore */
+	if ((NULL == tmpdir) || ('\0' == tmpdir[0]))
+		tmpdir = "/tmp";
+
+	/*
+	 * flawfinder rationale: null and zero-size values of $TMPDIR and
+	 * $TMP are rejected, and the destination buffer is bounded.
+	 */
+
+	memset(rategroup->lock_file, 0, PV_SIZEOF_CRS_LOCK_FILE);
+	(void) pv_snprintf(rategroup->lock_file, PV_SIZEOF_CRS_LOCK_FILE, "%s/pv-rategroup-%s-%i.lock", tmpdir,
+			   state->control.rate_group, (int) geteuid());
+
+#ifdef O_NOFOLLOW
+	openflags = O_RDWR | O_CREAT | O_NOFOLLOW;
+#else
+	openflags = O_RDWR | O_CREAT;
+#endif
+
+	rategroup->lock_fd = open(rategroup->lock_file, openflags, 0600);	/* flawfinder: ignore */
+
+	/*
+	 * flawfinder rationale: as with the cursor lock file, the file
+	 * isn't truncated or written to, and O_NOFOLLOW is used where
+	 * available.
+	 */
+
+	if (rategroup->lock_fd < 0) {
+		pv_error("%s: %s: %s", rategroup->lock_file, _("failed to open lock file"), strerror(errno));
+		return;
+	}
+
+	key = ftok(rategroup->lock_file, (int) 'L');
+	if (-1 == key) {
+		pv_error("%s: %s: %s", state->control.rate_group, _("failed to join rate limit group"),
+			 strerror(errno));
+		(void) close(rategroup->lock_fd);
+		rategroup->lock_fd = -1;
+		return;
+	}
+
+	pv__rategroup_lock(rategroup, true);
+
+	rategroup->shmid = shmget(key, sizeof(struct pvipcrategroup_s), 0600 | IPC_CREAT);
+	if (rategroup->shmid >= 0) {
+		void *addr;
+		/*@-nullpass@ */
+		/* splint doesn't know shmaddr can be NULL. */
+		addr = shmat(rategroup->shmid, NULL, 0);
+		/*@+nullpass@ */
+		if ((void *) -1 != addr)
+			rategroup->shared = addr;
+	}
+
+	if (NULL == rategroup->shared) {
+		pv_error("%s: %s: %s", state->control.rate_group, _("failed to join rate limit group"),
+			 strerror(errno));
+		pv__rategroup_lock(rategroup, false);
+		(void) close(rategroup->lock_fd);
+		rategroup->lock_fd = -1;
+		return;
+	}
+
+	if (!rategroup->shared->initialised) {
+		/* A new segment is zeroed, so the first member sets it up. */
+		pv_elapsedtime_read(&(rategroup->shared->last_refill));
+		pv_elapsedtime_copy(&(rategroup->shared->tick_start), &(rategroup->shared->last_refill));
+		rategroup->shared->rate_limit = state->control.rate_limit;
+		rategroup->shared->tokens = 0.0;
+		rategroup->shared->generation = 1;
+		rategroup->shared->initialised = true;
+		debug("%s: %s: %lld", state->control.rate_group, "created rate group",
+		      (long long) (state->control.rate_limit));
+	} else if (rategroup->shared->rate_limit > 0) {
+		state->control.rate_limit = rategroup->shared->rate_limit;
+		debug("%s: %s: %lld", state->control.rate_group, "joined rate group",
+		      (long long) (state->control.rate_limit));
+	}
+
+	rategroup->limit_seen = state->control.rate_limit;
+	rategroup->generation_seen = rategroup->shared->generation;
+	rategroup->joined = true;
+
+	pv__rategroup_lock(rategroup, false);
+#else				/* !HAVE_IPC */
+	if (NULL == state->control.rate_group)
+		return;
+	pv_error("%s: %s", state->control.rate_group, _("rate limit groups are not supported on this system"));
+#endif				/* HAVE_IPC */
+}
+
+
+/*
+ * Return how much to add to this member's allowance "allowance", taken
+ * from the group's bucket; called every RATE_GRANULARITY.  Also picks up
+ * changes to the group's rate limit made through other members, and
+ * passes on changes made to this member's limit (with "-R").
+ *
+ * Returns -1 if this process is not in a group, in which case it should
+ * limit its own rate as usual.
+ */
+long double pv_rategroup_draw(pvstate_t state, long double allowance)
+{
+#ifdef HAVE_IPC
+	pvrategroupstate_t rategroup;
+	struct pvipcrategroup_s *shared;
+	struct timespec now, elapsed;
+	long double share, drawn, burst_max;
+	unsigned int active;
+
+	rategroup = &(state->rategroup);
+	if ((!rategroup->joined) || (NULL == rategroup->shared))
+		return -1.0;
+
+	shared = rategroup->shared;
+
+	pv__rategroup_lock(rategroup, true);
+
+	if (state->control.rate_limit != rategroup->limit_seen) {
+		shared->rate_limit = state->control.rate_limit;
+		shared->generation++;
+		debug("%s: %s: %lld", state->control.rate_group, "rate group limit changed here",
+		      (long long) (state->control.rate_limit));
+	} else if (shared->generation != rategroup->generation_seen) {
+		state->control.rate_limit = shared->rate_limit;
+		debug("%s: %s: %lld", state->control.rate_group, "rate group limit changed elsewhere",
+		      (long long) (state->control.rate_limit));
+	}
+	rategroup->limit_seen = state->control.rate_limit;
+	rategroup->generation_seen = shared->generation;
+
+	pv_elapsedtime_read(&now);
+
+	/* Refill the bucket for the time since it was last refilled. */
+	pv_elapsedtime_subtract(&elapsed, &now, &(shared->last_refill));
+	shared->tokens += ((long double) (shared->rate_limit)) * pv_elapsedtime_seconds(&elapsed);
+	burst_max = (long double) (shared->rate_limit * RATE_BURST_WINDOW);
+	if (shared->tokens > burst_max)
+		shared->tokens = burst_max;
+	pv_elapsedtime_copy(&(shared->last_refill), &now);
+
+	/* Count the members drawing from the bucket in each interval. */
+	pv_elapsedtime_subtract(&elapsed, &now, &(shared->tick_start));
+	if (pv_elapsedtime_seconds(&elapsed) * 1000000000.0 >= (long double) (RATE_GRANULARITY)) {
+		shared->draws_last_tick = shared->draws_this_tick;
+		shared->draws_this_tick = 0;
+		pv_elapsedtime_copy(&(shared->tick_start), &now);
+	}
+
+	active = shared->draws_this_tick + 1;
+	if (shared->draws_last_tick > active)
+		active = shared->draws_last_tick;
+
+	share = shared->tokens / (long double) active;
+	drawn = 0.0;
+	if (share > allowance) {
+		drawn = share - allowance;
+		shared->tokens -= drawn;
+		shared->draws_this_tick++;
+	}
+
+	pv__rategroup_lock(rategroup, false);
+
+	return drawn;
+#else				/* !HAVE_IPC */
+	return -1.0;
+#endif				/* HAVE_IPC */
+}
+
+
+/*
+ * Leave the rate limit group, removing the shared memory if this was the
+ * last member.
+ */
+void pv_rategroup_leave(pvstate_t state)
+{
+#ifdef HAVE_IPC
+	pvrategroupstate_t rategroup;
+
+	rategroup = &(state->rategroup);
+	if (!rategroup->joined)
+		return;
+
+	pv__rategroup_lock(rategroup, true);
+
+	if (pv__rategroup_members(rategroup) < 2) {
+		struct shmid_ds shm_buf;
+		memset(&shm_buf, 0, sizeof(shm_buf));
+		(void) shmctl(rategroup->shmid, IPC_RMID, &shm_buf);
+		debug("%s: %s", state->control.rate_group, "last to leave rate group - removed");
+	}
+	if (NULL != rategroup->shared)
+		(void) shmdt(rategroup->shared);
+	rategroup->shared = NULL;
+	rategroup->joined = false;
+
+	pv__rategroup_lock(rategroup, false);
+
+	/*
+	 * The lock file is left in place, since other members may be
+	 * about to use it, and removing it would let a new member create
+	 * a different one and so use a different segment.
+	 */
+	(void) close(rategroup->lock_fd);
+	rategroup->lock_fd = -1;
+#endif				/* HAVE_IPC */
+}
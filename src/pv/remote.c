@@ -20,6 +20,9 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#ifdef PV_STATUS_PAGE
+#include <sys/mman.h>
+#endif
 
 #ifdef PV_REMOTE_CONTROL
 
@@ -500,6 +503,287 @@ bool pv_remote_check(pvstate_t state)
 }
 
 
+#ifdef PV_STATUS_PAGE
+/*
+ * The status page is a file in /run/user/<uid>/ which the transferring
+ * process maps into memory and updates on every pass of the main loop.
+ * While it exists, the process holds a read lock on it, so that a reader
+ * can tell with F_GETLK that the page isn't a leftover from a process that
+ * was killed, and that the process holding it has the expected PID.
+ *
+ * Unlike the control files, there is no fallback to $HOME/.pv/, so that
+ * an ordinary transfer never creates anything in the home directory; if
+ * there is no page, --query falls back to sending a signal.
+ */
+
+/*
+ * Write the status page filename for the given process into "filename".
+ */
+static void pv__statuspage_filename(char *filename, size_t bufsize, pid_t pid)
+{
+	memset(filename, 0, bufsize);
+	(void) pv_snprintf(filename, bufsize, "/run/user/%lu/pv.status.%lu", (unsigned long) geteuid(),
+			   (unsigned long) pid);
+}
+
+
+/*
+ * Create and map this process's status page, for --query to read.  On
+ * failure, there is no status page, and queries use signals instead.
+ */
+void pv_remote_statuspage_open(pvstate_t state)
+{
+	pvstatuspagestate_t statuspage;
+	struct stat sb;
+	struct flock fl;
+	void *mapped;
+	int fd, openflags;
+
+	statuspage = &(state->statuspage);
+	if (NULL != statuspage->page)
+		return;
+
+	pv__statuspage_filename(statuspage->filename, sizeof(statuspage->filename), getpid());
+
+	openflags = O_RDWR | O_CREAT;
+#ifdef O_NOFOLLOW
+	openflags |= O_NOFOLLOW;
+#endif
+#ifdef O_CLOEXEC
+	openflags |= O_CLOEXEC;
+#endif
+
+	fd = open(statuspage->filename, openflags, 0600);	/* flawfinder: ignore */
+	/*
+	 * flawfinder rationale: /run/user/<uid> can only be written to by
+	 * its owner, and the final component is not allowed to be a
+	 * symbolic link; the owner and type are checked below.
+	 */
+	if (fd < 0) {
+		debug("%s: %s", statuspage->filename, strerror(errno));
+		statuspage->filename[0] = '\0';
+		return;
+	}
+
+	memset(&sb, 0, sizeof(sb));
+	if ((0 != fstat(fd, &sb)) || (!S_ISREG(sb.st_mode)) || (sb.st_uid != geteuid())) {
+		debug("%s: %s", statuspage->filename, "not a regular file owned by us - not using it");
+		(void) close(fd);
+		statuspage->filename[0] = '\0';
+		return;
+	}
+
+	/* Discard any contents left behind by a previous process. */
+	if ((0 != ftruncate(fd, 0)) || (0 != ftruncate(fd, (off_t) sizeof(struct pvstatuspage_s)))) {
+		debug("%s: %s", "ftruncate", strerror(errno));
+		(void) close(fd);
+		(void) remove(statuspage->filename);
+		statuspage->filename[0] = '\0';
+		return;
+	}
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = (short) F_RDLCK;
+	fl.l_whence = (short) SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 1;
+	if (0 != fcntl(fd, F_SETLK, &fl)) {
+		debug("%s: %s", "fcntl", strerror(errno));
+		(void) close(fd);
+		(void) remove(statuspage->filename);
+		statuspage->filename[0] = '\0';
+		return;
+	}
+
+	mapped = mmap(NULL, sizeof(struct pvstatuspage_s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == mapped) {
+		debug("%s: %s", "mmap", strerror(errno));
+		(void) close(fd);
+		(void) remove(statuspage->filename);
+		statuspage->filename[0] = '\0';
+		return;
+	}
+
+	statuspage->fd = fd;
+	statuspage->page = (volatile struct pvstatuspage_s *) mapped;
+	statuspage->page->struct_size = (uint32_t) sizeof(struct pvstatuspage_s);
+	statuspage->page->pid = getpid();
+	statuspage->page->sequence = 0;
+	__atomic_store_n(&(statuspage->page->magic), PV_STATUSPAGE_MAGIC, __ATOMIC_RELEASE);
+
+	debug("%s: %s", "status page", statuspage->filename);
+
+	pv_remote_statuspage_update(state);
+}
+
+
+/*
+ * Copy the current transfer state to the status page, if there is one.
+ */
+void pv_remote_statuspage_update(pvstate_t state)
+{
+	volatile struct pvstatuspage_s *page;
+	uint32_t sequence;
+
+	page = state->statuspage.page;
+	if (NULL == page)
+		return;
+
+	sequence = page->sequence;
+	__atomic_store_n(&(page->sequence), sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	page->elapsed_seconds = state->transfer.elapsed_seconds;
+	page->transferred = state->transfer.transferred;
+	page->size = state->control.size;
+
+	__atomic_store_n(&(page->sequence), sequence + 2, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Unmap and remove the status page, if there is one.
+ */
+void pv_remote_statuspage_close(pvstate_t state)
+{
+	pvstatuspagestate_t statuspage;
+
+	statuspage = &(state->statuspage);
+	if (NULL == statuspage->page)
+		return;
+
+	(void) munmap((void *) (statuspage->page), sizeof(struct pvstatuspage_s));
+	statuspage->page = NULL;
+	(void) remove(statuspage->filename);
+	statuspage->filename[0] = '\0';
+	if (statuspage->fd >= 0)
+		(void) close(statuspage->fd);
+	statuspage->fd = -1;
+}
+
+
+/*
+ * Read the transfer state of the given process from its status page, into
+ * the local state.  Returns false if there is no usable status page, such
+ * as when the other process is an older version, or isn't transferring
+ * data.
+ */
+static bool pv__statuspage_fetch(pvstate_t state, pid_t query, /*@null@ */ off_t *sizeptr)
+{
+	char filename[PV_SIZEOF_STATUSPAGE_FILE];	/* flawfinder: ignore - zeroed, bounded */
+	volatile const struct pvstatuspage_s *page;
+	struct stat sb;
+	struct flock fl;
+	void *mapped;
+	long double elapsed_seconds;
+	off_t transferred, size;
+	uint32_t magic, struct_size;
+	pid_t pid;
+	int fd, openflags, attempt;
+	bool consistent;
+
+	pv__statuspage_filename(filename, sizeof(filename), query);
+
+	openflags = O_RDONLY;
+#ifdef O_NOFOLLOW
+	openflags |= O_NOFOLLOW;
+#endif
+#ifdef O_CLOEXEC
+	openflags |= O_CLOEXEC;
+#endif
+
+	fd = open(filename, openflags);	/* flawfinder: ignore - see pv_remote_statuspage_open() */
+	if (fd < 0)
+		return false;
+
+	memset(&sb, 0, sizeof(sb));
+	if ((0 != fstat(fd, &sb)) || (!S_ISREG(sb.st_mode)) || (sb.st_uid != geteuid())
+	    || (sb.st_size < (off_t) sizeof(struct pvstatuspage_s))) {
+		(void) close(fd);
+		return false;
+	}
+
+	/* The page is only live while its writer holds a read lock on it. */
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = (short) F_WRLCK;
+	fl.l_whence = (short) SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 1;
+	if ((0 != fcntl(fd, F_GETLK, &fl)) || (F_RDLCK != fl.l_type) || (query != fl.l_pid)) {
+		debug("%s: %s", filename, "not locked by the process - ignoring");
+		(void) close(fd);
+		return false;
+	}
+
+	mapped = mmap(NULL, sizeof(struct pvstatuspage_s), PROT_READ, MAP_SHARED, fd, 0);
+	(void) close(fd);
+	if (MAP_FAILED == mapped)
+		return false;
+	page = (volatile const struct pvstatuspage_s *) mapped;
+
+	elapsed_seconds = 0;
+	transferred = 0;
+	size = 0;
+	magic = 0;
+	struct_size = 0;
+	pid = 0;
+	consistent = false;
+
+	for (attempt = 0; attempt < 1000 && !consistent; attempt++) {
+		uint32_t sequence_before, sequence_after;
+
+		sequence_before = __atomic_load_n(&(page->sequence), __ATOMIC_ACQUIRE);
+		if (0 != (sequence_before & 1))
+			continue;
+
+		magic = __atomic_load_n(&(page->magic), __ATOMIC_ACQUIRE);
+		struct_size = page->struct_size;
+		pid = page->pid;
+		elapsed_seconds = page->elapsed_seconds;
+		transferred = page->transferred;
+		size = page->size;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		sequence_after = __atomic_load_n(&(page->sequence), __ATOMIC_RELAXED);
+		consistent = (sequence_before == sequence_after) ? true : false;
+	}
+
+	(void) munmap(mapped, sizeof(struct pvstatuspage_s));
+
+	if ((!consistent) || (PV_STATUSPAGE_MAGIC != magic) || (sizeof(struct pvstatuspage_s) != struct_size)
+	    || (query != pid))
+		return false;
+
+	debug("%s: %d [%Lg, %ld, %ld]", "status page read", query, elapsed_seconds, transferred, size);
+
+	state->transfer.elapsed_seconds = elapsed_seconds;
+	state->transfer.transferred = transferred;
+	state->control.size = size;
+	if (NULL != sizeptr)
+		*sizeptr = size;
+
+	return true;
+}
+
+#else				/* !PV_STATUS_PAGE */
+
+void pv_remote_statuspage_open( /*@unused@ */  __attribute__((unused)) pvstate_t state)
+{
+}
+
+
+void pv_remote_statuspage_update( /*@unused@ */  __attribute__((unused)) pvstate_t state)
+{
+}
+
+
+void pv_remote_statuspage_close( /*@unused@ */  __attribute__((unused)) pvstate_t state)
+{
+}
+
+#endif				/* PV_STATUS_PAGE */
+
+
 /*
  * Replace the transfer state with that of the given process, including the
  * total transfer size.  If sizeptr is not NULL, the size is also copied to
@@ -532,6 +816,12 @@ int pv_remote_transferstate_fetch(pvstate_t state, pid_t query, /*@null@ */ off_
 		return PV_ERROREXIT_REMOTE_OR_PID;
 	}
 
+#ifdef PV_STATUS_PAGE
+	/* Read the process's status page instead, if it has one. */
+	if (pv__statuspage_fetch(state, query, sizeptr))
+		return 0;
+#endif
+
 	/* Set up the query message. */
 	memset(&msgbuf, 0, sizeof(msgbuf));
 	msgbuf.response = false;
@@ -647,6 +937,21 @@ bool pv_remote_check( /*@unused@ */  __attribute__((unused)) pvstate_t state)
 }
 
 
+void pv_remote_statuspage_open( /*@unused@ */  __attribute__((unused)) pvstate_t state)
+{
+}
+
+
+void pv_remote_statuspage_update( /*@unused@ */  __attribute__((unused)) pvstate_t state)
+{
+}
+
+
+void pv_remote_statuspage_close( /*@unused@ */  __attribute__((unused)) pvstate_t state)
+{
+}
+
+
 int pv_remote_set(			 /*@unused@ */
 			 __attribute__((unused)) pvstate_t state, /*@unused@ */  __attribute__((unused)) pid_t remote)
 {
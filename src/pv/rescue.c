@@ -0,0 +1,676 @@
+/*
+ * Multi-pass reading of damaged input, recorded in a map file so that it
+ * can be resumed, for --error-map.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+
+/*
+ * The map divides the input into ranges, each with a status using the
+ * same characters as GNU ddrescue's map files, so that the same tools can
+ * be used to look at them:
+ *
+ *   '?' - not tried yet
+ *   '*' - unreadable in blocks of the size tried so far, to be retried
+ *   '-' - unreadable even in blocks of PV_RESCUE_BLOCK_MIN bytes
+ *   '+' - read successfully
+ *
+ * The first pass reads everything not tried yet, skipping past read
+ * errors in big jumps and marking what was skipped with '*'.  Each pass
+ * after that reads only the '*' ranges, in blocks half the size of the
+ * previous pass, so that the bad areas are split in two each time until
+ * the blocks are PV_RESCUE_BLOCK_MIN bytes, at which point whatever still
+ * can't be read is marked '-'.
+ *
+ * Everything not to be read on the current pass is skipped over, in both
+ * the input and the output, which therefore have to be at the same
+ * position all the time - so there is only one input, and the output is a
+ * regular file or block device.  The map is saved every few seconds and
+ * at the end of each pass, so that an interrupted run can carry on where
+ * it left off without reading anything again that has already been read.
+ */
+struct pvrescuerange_s {
+	off_t start;
+	off_t size;
+	char status;
+};
+
+struct pvrescue_s {
+	/*@null@*/ /*@only@*/ struct pvrescuerange_s *ranges;	/* in order, from 0 to "size" */
+	size_t count;			 /* number of ranges in use */
+	size_t allocated;		 /* number of ranges allocated */
+	off_t size;			 /* size of the input */
+	off_t read_offset;		 /* input offset of the current read */
+	size_t block;			 /* block size for the current pass */
+	size_t first_block;		 /* block size for the first pass */
+	unsigned int pass;		 /* current pass, from 1 */
+	struct timespec next_save;	 /* when to save the map again */
+	bool changed;			 /* set if changed since last saved */
+	bool save_failed;		 /* set once a save error has been shown */
+};
+
+
+/*
+ * Return the index of the range containing "offset", or map->count if it
+ * is past the end.
+ */
+static size_t pv__rescue_find(pvrescue_t map, off_t offset)
+{
+	size_t low, high;
+
+	if (NULL == map->ranges)
+		return map->count;
+
+	low = 0;
+	high = map->count;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (offset < map->ranges[middle].start) {
+			high = middle;
+		} else if (offset >= map->ranges[middle].start + map->ranges[middle].size) {
+			low = middle + 1;
+		} else {
+			return middle;
+		}
+	}
+
+	return map->count;
+}
+
+
+/*
+ * Make sure that there is a range boundary at "offset", splitting the
+ * range containing it if necessary.  Returns false on allocation failure.
+ */
+static bool pv__rescue_split(pvrescue_t map, off_t offset)
+{
+	struct pvrescuerange_s *range;
+	size_t idx;
+
+	idx = pv__rescue_find(map, offset);
+	if ((idx >= map->count) || (NULL == map->ranges) || (map->ranges[idx].start == offset))
+		return true;
+
+	if (map->count >= map->allocated) {
+		struct pvrescuerange_s *newptr;
+		size_t new_allocated = map->allocated < 64 ? 64 : map->allocated * 2;
+		newptr = realloc(map->ranges, new_allocated * sizeof(*newptr));
+		if (NULL == newptr)
+			return false;
+		map->ranges = newptr;
+		map->allocated = new_allocated;
+	}
+
+	memmove(map->ranges + idx + 1, map->ranges + idx, (map->count - idx) * sizeof(*(map->ranges)));
+	map->count++;
+
+	range = map->ranges + idx;
+	range[1].start = offset;
+	range[1].size = range[0].start + range[0].size - offset;
+	range[0].size = offset - range[0].start;
+
+	return true;
+}
+
+
+/*
+ * Give the map a single '?' range covering the whole input.  Returns false
+ * on allocation failure.
+ */
+static bool pv__rescue_init(pvrescue_t map)
+{
+	if (NULL == map->ranges) {
+		map->ranges = malloc(64 * sizeof(*(map->ranges)));
+		if (NULL == map->ranges)
+			return false;
+		map->allocated = 64;
+	}
+	map->ranges[0].start = 0;
+	map->ranges[0].size = map->size;
+	map->ranges[0].status = '?';
+	map->count = map->size > 0 ? 1 : 0;
+	return true;
+}
+
+
+/*
+ * Set the status of "size" bytes from "start" to "status", merging the
+ * range with its neighbours if they have the same status.  Returns false
+ * on allocation failure.
+ */
+static bool pv__rescue_set(pvrescue_t map, off_t start, off_t size, char status)
+{
+	size_t first, last;
+
+	if (start + size > map->size)
+		size = map->size - start;
+	if ((size <= 0) || (start < 0) || (NULL == map->ranges))
+		return true;
+
+	if (!pv__rescue_split(map, start))
+		return false;
+	if (!pv__rescue_split(map, start + size))
+		return false;
+
+	first = pv__rescue_find(map, start);
+	last = first;
+	while ((last < map->count) && (map->ranges[last].start < start + size))
+		last++;
+
+	/* Ranges "first" to "last"-1 are replaced by one. */
+	map->ranges[first].size = size;
+	map->ranges[first].status = status;
+	if (last > first + 1) {
+		memmove(map->ranges + first + 1, map->ranges + last, (map->count - last) * sizeof(*(map->ranges)));
+		map->count -= last - first - 1;
+	}
+
+	if ((first + 1 < map->count) && (map->ranges[first + 1].status == status)) {
+		map->ranges[first].size += map->ranges[first + 1].size;
+		memmove(map->ranges + first + 1, map->ranges + first + 2,
+			(map->count - first - 2) * sizeof(*(map->ranges)));
+		map->count--;
+	}
+	if ((first > 0) && (map->ranges[first - 1].status == status)) {
+		map->ranges[first - 1].size += map->ranges[first].size;
+		memmove(map->ranges + first, map->ranges + first + 1,
+			(map->count - first - 1) * sizeof(*(map->ranges)));
+		map->count--;
+	}
+
+	map->changed = true;
+
+	return true;
+}
+
+
+/*
+ * Return true if ranges with the given status are read on the current
+ * pass.
+ */
+static bool pv__rescue_wanted(pvrescue_t map, char status)
+{
+	if ('*' == status)
+		return map->pass > 1;
+	return '?' == status;
+}
+
+
+/*
+ * Return the total size of the ranges with the given status.
+ */
+static off_t pv__rescue_total(pvrescue_t map, char status)
+{
+	off_t total;
+	size_t idx;
+
+	if (NULL == map->ranges)
+		return 0;
+
+	total = 0;
+	for (idx = 0; idx < map->count; idx++) {
+		if (map->ranges[idx].status == status)
+			total += map->ranges[idx].size;
+	}
+
+	return total;
+}
+
+
+/*
+ * Load the map from "filename", if it exists, returning false after
+ * reporting any error.  Anything the map doesn't cover is left as '?'.
+ */
+static bool pv__rescue_load(pvrescue_t map, const char *filename)
+{
+	char line[256];			 /* flawfinder: ignore */
+	bool seen_position;
+	unsigned int line_number;
+	FILE *fptr;
+
+	/*
+	 * flawfinder rationale: the buffer is only written to by fgets(),
+	 * which is given its size.
+	 */
+
+	if (!pv__rescue_init(map)) {
+		pv_error("%s: %s", filename, strerror(errno));
+		return false;
+	}
+
+	fptr = fopen(filename, "r");	/* flawfinder: ignore */
+	/* flawfinder rationale: the file name was given explicitly. */
+	if (NULL == fptr) {
+		if (ENOENT == errno)
+			return true;
+		pv_error("%s: %s", filename, strerror(errno));
+		return false;
+	}
+
+	seen_position = false;
+	line_number = 0;
+	map->changed = false;
+
+	memset(line, 0, sizeof(line));
+	while (NULL != fgets(line, (int) sizeof(line), fptr)) {
+		long long start, size;
+		unsigned int pass;
+		char status;
+		char *ptr;
+
+		line_number++;
+
+		ptr = line;
+		while ((' ' == *ptr) || ('\t' == *ptr))
+			ptr++;
+		if (('#' == *ptr) || ('\n' == *ptr) || ('\0' == *ptr))
+			continue;
+
+		/*
+		 * The first line is the current position, status, and
+		 * pass; the rest are ranges.
+		 */
+		if (!seen_position) {
+			seen_position = true;
+			pass = 1;
+			if (sscanf(ptr, "%lli %c %u", &start, &status, &pass) >= 2) {
+				map->pass = pass > 0 ? pass : 1;
+				continue;
+			}
+		} else if ((3 == sscanf(ptr, "%lli %lli %c", &start, &size, &status))
+			   && (start >= 0) && (size > 0) && (NULL != strchr("?*/-+", (int) status))) {
+			/* ddrescue's "non-scraped" is retried like "non-trimmed". */
+			if ('/' == status)
+				status = '*';
+			if (!pv__rescue_set(map, (off_t) start, (off_t) size, status)) {
+				pv_error("%s: %s", filename, strerror(errno));
+				(void) fclose(fptr);
+				return false;
+			}
+			continue;
+		}
+
+		pv_error("%s:%u: %s", filename, line_number, _("invalid error map line"));
+		(void) fclose(fptr);
+		return false;
+	}
+
+	(void) fclose(fptr);
+
+	debug("%s: %s: %u, %s: %lld, %s: %lld", filename, "loaded error map - pass", map->pass, "done",
+	      (long long) pv__rescue_total(map, '+'), "bad", (long long) (pv__rescue_total(map, '-')));
+
+	return true;
+}
+
+
+/*
+ * Save the map to "filename", by writing a new file and renaming it over
+ * the old one, so that there is always a complete map.  Errors are shown
+ * once.  Returns false on error.
+ */
+static bool pv__rescue_save(pvrescue_t map, const char *filename, bool finished)
+{
+	char new_filename[4096];	 /* flawfinder: ignore */
+	char current_status;
+	off_t current_pos;
+	size_t idx;
+	FILE *fptr;
+	bool ok;
+
+	/* flawfinder rationale: zeroed with memset and bounded by pv_snprintf. */
+
+	memset(new_filename, 0, sizeof(new_filename));
+	(void) pv_snprintf(new_filename, sizeof(new_filename), "%s.new", filename);
+
+	current_status = finished ? '+' : (map->pass > 1 ? '*' : '?');
+	current_pos = map->read_offset;
+
+	ok = false;
+	fptr = fopen(new_filename, "w");	/* flawfinder: ignore */
+	/* flawfinder rationale: the file name was given explicitly. */
+	if (NULL != fptr) {
+		ok = true;
+		if (fprintf(fptr, "# %s %s %s\n", "Mapfile. Created by", PACKAGE_NAME, PACKAGE_VERSION) < 0)
+			ok = false;
+		if (fprintf(fptr, "# %s\n0x%08llX     %c               %u\n",
+			    "current_pos  current_status  current_pass", (unsigned long long) current_pos,
+			    current_status, map->pass) < 0)
+			ok = false;
+		if (fprintf(fptr, "#      %s\n", "pos        size  status") < 0)
+			ok = false;
+		for (idx = 0; ok && (NULL != map->ranges) && (idx < map->count); idx++) {
+			if (fprintf(fptr, "0x%08llX  0x%08llX  %c\n", (unsigned long long) (map->ranges[idx].start),
+				    (unsigned long long) (map->ranges[idx].size), map->ranges[idx].status) < 0)
+				ok = false;
+		}
+		if (0 != fclose(fptr))
+			ok = false;
+		if (ok && (0 != rename(new_filename, filename)))
+			ok = false;
+	}
+
+	if (!ok) {
+		if (!map->save_failed)
+			pv_error("%s: %s: %s", filename, _("failed to save error map"), strerror(errno));
+		map->save_failed = true;
+		(void) remove(new_filename);
+		return false;
+	}
+
+	map->changed = false;
+	pv_elapsedtime_read(&(map->next_save));
+	pv_elapsedtime_add_nsec(&(map->next_save), PV_RESCUE_SAVE_INTERVAL);
+
+	return true;
+}
+
+
+/*
+ * Mark "size" bytes from "start" with "status", saving the map if it is
+ * time to.
+ */
+static void pv__rescue_mark(pvstate_t state, off_t start, off_t size, char status)
+{
+	pvrescue_t map = state->rescue.map;
+	struct timespec now;
+
+	if ((NULL == map) || (NULL == state->rescue.filename))
+		return;
+
+	if (!pv__rescue_set(map, start, size, status)) {
+		pv_error("%s: %s", _("error map"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		return;
+	}
+
+	pv_elapsedtime_read(&now);
+	if (map->changed && (pv_elapsedtime_compare(&now, &(map->next_save)) > 0))
+		(void) pv__rescue_save(map, state->rescue.filename, false);
+}
+
+
+/*
+ * Before reading from "fd", check the map: if the current position is in
+ * a range to be read on this pass, cap *bytes_can_read so that the read
+ * stays within it - and, after the first pass, within the current block -
+ * and return 0.
+ *
+ * Otherwise, skip both the input and the output to the next range to be
+ * read, or to the end, and return the number of bytes skipped; or return
+ * -1 if the transfer buffer needs to be written out first, since the input
+ * and output are only at the same position when it is empty.
+ */
+off_t pv_rescue_read_limit(pvstate_t state, int fd, size_t *bytes_can_read)
+{
+	pvrescue_t map = state->rescue.map;
+	off_t offset, next;
+	size_t idx;
+
+	if (NULL == map)
+		return 0;
+
+	offset = (off_t) lseek(fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return 0;
+	map->read_offset = offset;
+
+	idx = pv__rescue_find(map, offset);
+	if ((idx >= map->count) || (NULL == map->ranges))
+		return 0;
+
+	if (pv__rescue_wanted(map, map->ranges[idx].status)) {
+		off_t limit = map->ranges[idx].start + map->ranges[idx].size - offset;
+		if (map->pass > 1) {
+			off_t to_boundary = (off_t) (map->block) - (offset % (off_t) (map->block));
+			if (limit > to_boundary)
+				limit = to_boundary;
+		}
+		if ((off_t) (*bytes_can_read) > limit)
+			*bytes_can_read = (size_t) limit;
+		return 0;
+	}
+
+	if (state->transfer.read_position != state->transfer.write_position)
+		return -1;
+
+	next = map->size;
+	for (idx++; idx < map->count; idx++) {
+		if (pv__rescue_wanted(map, map->ranges[idx].status)) {
+			next = map->ranges[idx].start;
+			break;
+		}
+	}
+
+	if (((off_t) - 1 == lseek(fd, next, SEEK_SET))
+	    || ((off_t) - 1 == lseek(state->control.output_fd, next, SEEK_SET))) {
+		/*@-compdef@ */
+		pv_error("%s: %s: %s", pv_current_file_name(state), _("failed to seek"), strerror(errno));
+		/*@+compdef@ */
+		/* splint - see pv__transfer_read(). */
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		(void) lseek(fd, offset, SEEK_SET);
+		return 0;
+	}
+
+	debug("%s: %lld @ %lld", "skipped range not read on this pass", (long long) (next - offset),
+	      (long long) offset);
+
+	return next - offset;
+}
+
+
+/*
+ * Record that "nread" bytes were read successfully by the read that
+ * pv_rescue_read_limit() was last called for.
+ */
+void pv_rescue_read_done(pvstate_t state, ssize_t nread)
+{
+	if ((NULL == state->rescue.map) || (nread <= 0))
+		return;
+	pv__rescue_mark(state, state->rescue.map->read_offset, (off_t) nread, '+');
+	state->rescue.map->read_offset += (off_t) nread;
+}
+
+
+/*
+ * After a read error at "offset", return how far to skip: to the end of
+ * the current block - which on the first pass gets bigger the more errors
+ * there are in a row, so that large bad areas are passed quickly - but
+ * within the current range and at most "bytes_can_read".
+ */
+off_t pv_rescue_skip_amount(pvstate_t state, off_t offset, size_t bytes_can_read)
+{
+	pvrescue_t map = state->rescue.map;
+	off_t jump, amount;
+	size_t idx;
+
+	if (NULL == map)
+		return 1;
+
+	jump = (off_t) (map->block);
+	if ((1 == map->pass) && (state->transfer.read_errors_in_a_row > 1)) {
+		off_t errors = state->transfer.read_errors_in_a_row - 1;
+		jump <<= (errors > 4 ? 4 : errors);
+	}
+
+	amount = jump - (offset % jump);
+
+	idx = pv__rescue_find(map, offset);
+	if ((idx < map->count) && (NULL != map->ranges)
+	    && (amount > map->ranges[idx].start + map->ranges[idx].size - offset))
+		amount = map->ranges[idx].start + map->ranges[idx].size - offset;
+	if (amount > (off_t) bytes_can_read)
+		amount = (off_t) bytes_can_read;
+	if (amount < 1)
+		amount = 1;
+
+	return amount;
+}
+
+
+/*
+ * Record that "size" bytes from "offset" could not be read, and have been
+ * skipped.
+ */
+void pv_rescue_read_failed(pvstate_t state, off_t offset, off_t size)
+{
+	pvrescue_t map = state->rescue.map;
+	if (NULL == map)
+		return;
+	pv__rescue_mark(state, offset, size, map->block > PV_RESCUE_BLOCK_MIN ? '*' : '-');
+}
+
+
+/*
+ * Run the main loop once for each pass over the input, as described at
+ * the top of this file, keeping the map in state->rescue.filename up to
+ * date, and return the combined exit status.
+ *
+ * With no map file set, this is the same as pv_main_loop().
+ */
+int pv_rescue_loop(pvstate_t state)
+{
+	struct pvrescue_s map;
+	struct stat sb;
+	off_t unread, bad;
+	int input_fd, retcode;
+	bool fresh, interrupted;
+
+	if (NULL == state)
+		return 0;
+	if (NULL == state->rescue.filename)
+		return pv_main_loop(state);
+
+	if ((1 != state->files.file_count) || (NULL == state->files.filename)) {
+		pv_error("%s: %s", state->rescue.filename, _("there must be exactly one input file"));
+		return PV_ERROREXIT_ACCESS;
+	}
+
+	memset(&sb, 0, sizeof(sb));
+	if ((0 != fstat(state->control.output_fd, &sb)) || !(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))) {
+		pv_error("%s: %s", state->rescue.filename, _("the output must be a regular file or block device"));
+		return PV_ERROREXIT_ACCESS;
+	}
+
+	memset(&map, 0, sizeof(map));
+	map.pass = 1;
+
+	/* Find the size of the input, which must be seekable. */
+	input_fd = open(state->files.filename[0], O_RDONLY);	/* flawfinder: ignore */
+	/* flawfinder rationale: this is the input file we were given. */
+	if (input_fd >= 0) {
+		map.size = (off_t) lseek(input_fd, 0, SEEK_END);
+		(void) close(input_fd);
+	}
+	if ((input_fd < 0) || (map.size < 0)) {
+		pv_error("%s: %s", state->files.filename[0], strerror(errno));
+		return PV_ERROREXIT_ACCESS;
+	}
+
+	if (!pv__rescue_load(&map, state->rescue.filename)) {
+		if (NULL != map.ranges)
+			free(map.ranges);
+		return PV_ERROREXIT_ACCESS;
+	}
+
+	/*
+	 * Starting afresh, an existing output file is emptied, as it would
+	 * be without --error-map; otherwise it is left as it is.
+	 */
+	fresh = (map.pass < 2) && (map.size == pv__rescue_total(&map, '?'));
+	if (fresh && S_ISREG(sb.st_mode) && (0 != ftruncate(state->control.output_fd, 0))) {
+		debug("%s: %s", "ftruncate", strerror(errno));
+	}
+
+	map.first_block = state->control.error_skip_block > 0 ? (size_t) (state->control.error_skip_block) :
+	    PV_RESCUE_BLOCK_FIRST;
+	if (map.first_block < PV_RESCUE_BLOCK_MIN)
+		map.first_block = PV_RESCUE_BLOCK_MIN;
+
+	state->rescue.map = &map;
+	pv_elapsedtime_read(&(map.next_save));
+	pv_elapsedtime_add_nsec(&(map.next_save), PV_RESCUE_SAVE_INTERVAL);
+
+	retcode = 0;
+	interrupted = false;
+
+	while (true) {
+		off_t to_read;
+
+		/* Halve the block size with each pass after the first. */
+		map.block = map.first_block;
+		if (map.pass > 1) {
+			unsigned int halvings = map.pass - 1;
+			while ((halvings-- > 0) && (map.block > PV_RESCUE_BLOCK_MIN))
+				map.block /= 2;
+			if (map.block < PV_RESCUE_BLOCK_MIN)
+				map.block = PV_RESCUE_BLOCK_MIN;
+		}
+
+		to_read = pv__rescue_total(&map, map.pass > 1 ? '*' : '?');
+		debug("%s %u: %s: %lld, %s: %ld", "pass", map.pass, "bytes to read", (long long) to_read,
+		      "block size", (long) (map.block));
+
+		if (to_read > 0) {
+			pv_state_reset(state);
+			if ((off_t) - 1 == lseek(state->control.output_fd, 0, SEEK_SET)) {
+				pv_error("%s: %s", _("failed to seek"), strerror(errno));
+				retcode |= PV_ERROREXIT_TRANSFER;
+				break;
+			}
+			map.read_offset = 0;
+			retcode |= pv_main_loop(state);
+			if ((1 == state->flags.trigger_exit) || (0 != (retcode & PV_ERROREXIT_SIGNAL)))
+				interrupted = true;
+		}
+
+		if (interrupted)
+			break;
+
+		/* Anything left unread on the first pass is given up on. */
+		if (map.pass > 1 || (0 == pv__rescue_total(&map, '?'))) {
+			if ((0 == pv__rescue_total(&map, '*')) || (map.block <= PV_RESCUE_BLOCK_MIN))
+				break;
+		} else {
+			break;
+		}
+
+		map.pass++;
+		(void) pv__rescue_save(&map, state->rescue.filename, false);
+	}
+
+	unread = pv__rescue_total(&map, '?') + pv__rescue_total(&map, '*');
+	bad = pv__rescue_total(&map, '-');
+
+	if (!pv__rescue_save(&map, state->rescue.filename, 0 == unread))
+		retcode |= PV_ERROREXIT_ACCESS;
+
+	if (bad > 0) {
+		pv_error("%s: %lld %s", state->files.filename[0], (long long) bad, _("bytes could not be read"));
+	}
+	if ((unread > 0) && (!interrupted)) {
+		pv_error("%s: %lld %s", state->files.filename[0], (long long) unread, _("bytes not read"));
+	}
+
+	state->rescue.map = NULL;
+	if (NULL != map.ranges)
+		free(map.ranges);
+
+	return retcode;
+}
@@ -0,0 +1,321 @@
+/*
+ * TCP socket outputs: how much of what has been written is still waiting
+ * in the send queue, and zero-copy sends for --zero-copy.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+#ifdef HAVE_LINUX_SOCKIOS_H
+#include <linux/sockios.h>
+#endif
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+#include <poll.h>
+#endif
+
+/*
+ * The ioctl() giving the number of bytes in a socket's send queue, which
+ * for TCP covers both what has not been sent yet and what has been sent
+ * but not acknowledged by the receiver.
+ */
+#if defined(SIOCOUTQ)
+#define PV_SOCKET_OUTQ	SIOCOUTQ
+#elif defined(FIONWRITE)
+#define PV_SOCKET_OUTQ	FIONWRITE
+#endif
+
+/*
+ * Zero-copy sends need MSG_ZEROCOPY, and the completion notifications
+ * from <linux/errqueue.h>; they also need poll() to wait for them.
+ */
+#if defined(HAVE_SYS_SOCKET_H) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY) \
+    && defined(HAVE_POLL) && defined(HAVE_POLL_H)
+#define PV_ZEROCOPY 1
+#endif
+
+
+/*
+ * Return true if "fd" is a TCP socket.
+ */
+bool pv_socket_is_tcp( /*@unused@ */  __attribute__((unused)) int fd)
+{
+#ifdef HAVE_SYS_SOCKET_H
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	int sock_type;
+	socklen_t type_len;
+
+	sock_type = 0;
+	type_len = (socklen_t) sizeof(sock_type);
+	if ((0 != getsockopt(fd, SOL_SOCKET, SO_TYPE, &sock_type, &type_len)) || (SOCK_STREAM != sock_type))
+		return false;
+
+	memset(&addr, 0, sizeof(addr));
+	addr_len = (socklen_t) sizeof(addr);
+	if (0 != getsockname(fd, (struct sockaddr *) &addr, &addr_len))
+		return false;
+
+	if (AF_INET == addr.ss_family)
+		return true;
+#ifdef AF_INET6
+	if (AF_INET6 == addr.ss_family)
+		return true;
+#endif
+#endif				/* HAVE_SYS_SOCKET_H */
+	return false;
+}
+
+
+/*
+ * Return the size of the send buffer of socket "fd", or 0 if it can't be
+ * found.
+ */
+size_t pv_socket_send_buffer( /*@unused@ */  __attribute__((unused)) int fd)
+{
+#if defined(HAVE_SYS_SOCKET_H) && defined(SO_SNDBUF)
+	int size = 0;
+	socklen_t size_len = (socklen_t) sizeof(size);
+	if ((0 == getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, &size_len)) && (size > 0))
+		return (size_t) size;
+#endif
+	return 0;
+}
+
+
+/*
+ * Return the number of bytes written to socket "fd" that the receiver has
+ * not yet acknowledged, or -1 if this can't be found.
+ */
+ssize_t pv_socket_unsent( /*@unused@ */  __attribute__((unused)) int fd)
+{
+#ifdef PV_SOCKET_OUTQ
+	int nbytes = 0;
+	if (0 != ioctl(fd, PV_SOCKET_OUTQ, &nbytes)) {
+		debug("%s(%d,%s): %s", "ioctl", fd, "SIOCOUTQ", strerror(errno));
+		return -1;
+	}
+	if (nbytes < 0) {
+		debug("%s: %d", "SIOCOUTQ gave a negative byte count", nbytes);
+		return -1;
+	}
+	return (ssize_t) nbytes;
+#else
+	return -1;
+#endif
+}
+
+
+/*
+ * With MSG_ZEROCOPY, the kernel sends straight from our buffer instead of
+ * copying it first, so the part of the transfer buffer that has been sent
+ * must not be changed until the kernel says, through the socket's error
+ * queue, that it has finished with it.  Each send() is given the next
+ * number in sequence from 0, and each notification covers a range of
+ * them; so all of them have completed when the number of sends matches
+ * the number of completions.
+ *
+ * The transfer buffer is not rewound to the start while any are still in
+ * flight (see pv__transfer_write_result()), so reads carry on into the
+ * unused part of the buffer, and only when it is full is the transfer
+ * held up until the sends complete.
+ *
+ * If the kernel has to copy the data anyway - as it does when the other
+ * end is on the same host, or the network card can't gather from user
+ * memory - the notifications say so, and after PV_ZEROCOPY_COPIED_LIMIT
+ * of those with no real zero-copy sends, ordinary writes are used instead
+ * since they are then cheaper.
+ */
+
+
+/*
+ * Return true if any zero-copy sends have not yet completed.
+ */
+bool pv_zerocopy_pending(pvtransferstate_t transfer)
+{
+	return transfer->zerocopy_completed != transfer->zerocopy_sent;
+}
+
+
+/*
+ * Return true if "count" bytes should be written to the output "fd" with
+ * pv_zerocopy_send(), turning on SO_ZEROCOPY for it the first time.
+ */
+bool pv_zerocopy_usable(pvstate_t state, int fd, size_t count)
+{
+	if (!state->control.zero_copy)
+		return false;
+
+	if (fd != state->transfer.zerocopy_fd) {
+		/* Don't lose track of sends still in flight on the old one. */
+		if (pv_zerocopy_pending(&(state->transfer)))
+			return false;
+		state->transfer.zerocopy_fd = fd;
+		state->transfer.zerocopy_usable = false;
+#ifdef PV_ZEROCOPY
+		if (pv_socket_is_tcp(fd)) {
+			int on = 1;
+			if (0 == setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, (socklen_t) sizeof(on))) {
+				state->transfer.zerocopy_usable = true;
+				debug("%s %d: %s", "fd", fd, "using zero-copy sends");
+			} else {
+				debug("%s %d: %s: %s", "fd", fd, "SO_ZEROCOPY", strerror(errno));
+			}
+		}
+#endif				/* PV_ZEROCOPY */
+	}
+
+	return state->transfer.zerocopy_usable && (count >= PV_ZEROCOPY_MIN_SEND);
+}
+
+
+/*
+ * Collect the completion notifications from the zero-copy output's error
+ * queue, waiting up to "wait_usec" microseconds for one if any sends are
+ * still in flight and none have arrived.
+ */
+void pv_zerocopy_reap(pvtransferstate_t transfer, long wait_usec)
+{
+#ifdef PV_ZEROCOPY
+	bool waited = false;
+
+	while (pv_zerocopy_pending(transfer)) {
+		struct msghdr msg;
+		char control[128];	 /* flawfinder: ignore */
+		struct cmsghdr *cmsg;
+		ssize_t got;
+
+		/* flawfinder rationale: only written by recvmsg(), bounded by its size. */
+
+		memset(&msg, 0, sizeof(msg));
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		got = recvmsg(transfer->zerocopy_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+		if (got < 0) {
+			struct pollfd pfd;
+
+			if ((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno)) {
+				/*
+				 * The socket has gone, so nothing more will
+				 * arrive, and the kernel has let go of the
+				 * buffer.
+				 */
+				debug("%s: %s", "MSG_ERRQUEUE", strerror(errno));
+				transfer->zerocopy_completed = transfer->zerocopy_sent;
+				break;
+			}
+			if (waited || (wait_usec <= 0))
+				break;
+
+			/* The error queue shows up as POLLERR. */
+			memset(&pfd, 0, sizeof(pfd));
+			pfd.fd = transfer->zerocopy_fd;
+			pfd.events = 0;
+			(void) poll(&pfd, 1, (int) ((wait_usec + 999) / 1000));
+			waited = true;
+			continue;
+		}
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); NULL != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			struct sock_extended_err serr;
+			uint32_t completed;
+
+			if (cmsg->cmsg_len < (socklen_t) CMSG_LEN(sizeof(serr)))
+				continue;
+			memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));	/* flawfinder: ignore */
+			/* flawfinder rationale: the length was checked above. */
+			if ((SO_EE_ORIGIN_ZEROCOPY != serr.ee_origin) || (0 != serr.ee_errno))
+				continue;
+
+			/* The range of sends covered is ee_info to ee_data. */
+			completed = serr.ee_data - serr.ee_info + 1;
+			transfer->zerocopy_completed += completed;
+			if (0 != (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED))
+				transfer->zerocopy_copied += completed;
+		}
+	}
+
+	if (transfer->zerocopy_usable && (transfer->zerocopy_copied >= PV_ZEROCOPY_COPIED_LIMIT)
+	    && (transfer->zerocopy_copied == transfer->zerocopy_completed)) {
+		debug("%s %d: %s", "fd", transfer->zerocopy_fd,
+		      "kernel is copying the data anyway - stopping zero-copy sends");
+		transfer->zerocopy_usable = false;
+	}
+#else				/* !PV_ZEROCOPY */
+	transfer->zerocopy_completed = transfer->zerocopy_sent;
+	(void) wait_usec;
+#endif				/* PV_ZEROCOPY */
+}
+
+
+/*
+ * Send "count" bytes from "buf" to the zero-copy output, returning the
+ * number sent, or -1 on error; like a single write(), the send may be
+ * interrupted by the write timer before all of it has gone.
+ *
+ * If the kernel refuses because too many notifications are outstanding
+ * (ENOBUFS), the notifications are collected and the data is sent with
+ * an ordinary copy instead.
+ */
+ssize_t pv_zerocopy_send(pvstate_t state, const char *buf, size_t count)
+{
+#ifdef PV_ZEROCOPY
+	ssize_t nwritten;
+
+	if (count > MAX_WRITE_AT_ONCE)
+		count = MAX_WRITE_AT_ONCE;
+
+	nwritten = send(state->transfer.zerocopy_fd, buf, count, MSG_ZEROCOPY);
+	if (nwritten > 0) {
+		state->transfer.zerocopy_sent++;
+		return nwritten;
+	}
+	if ((nwritten < 0) && (ENOBUFS == errno)) {
+		debug("%s", "zero-copy send refused - reaping completions and copying");
+		pv_zerocopy_reap(&(state->transfer), 0);
+		return send(state->transfer.zerocopy_fd, buf, count, 0);
+	}
+	return nwritten;
+#else				/* !PV_ZEROCOPY */
+	return write(state->transfer.zerocopy_fd, buf, count);
+#endif				/* PV_ZEROCOPY */
+}
+
+
+/*
+ * Wait for any zero-copy sends still in flight to complete, before the
+ * transfer buffer is freed, giving up if nothing arrives for a second.
+ */
+void pv_zerocopy_finish(pvtransferstate_t transfer)
+{
+	unsigned long before;
+
+	while (pv_zerocopy_pending(transfer)) {
+		before = transfer->zerocopy_completed;
+		pv_zerocopy_reap(transfer, 1000000);
+		if (before == transfer->zerocopy_completed) {
+			debug("%s: %lu", "gave up waiting for zero-copy sends",
+			      transfer->zerocopy_sent - transfer->zerocopy_completed);
+			break;
+		}
+	}
+}
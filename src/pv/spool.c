@@ -0,0 +1,639 @@
+/*
+ * Forwarding from the store-and-forward file while it is still being
+ * written, for --store-and-forward with --overlap.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+#include <poll.h>
+#endif
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_THREADS
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+
+/*
+ * The main loop writes the input to the spool - the store-and-forward
+ * file - as its output, and whatever is in the spool, up to its current
+ * size, is copied from there on to the real output, so nothing is
+ * forwarded before it has actually been written.  The copy is done within
+ * the kernel where possible: with copy_file_range() to a regular file,
+ * splice() to a pipe, or sendfile() to a socket.  Otherwise, and in line
+ * mode so that the lines can be counted, it is read back with pread() and
+ * written out.  As in pv__transfer_offload(), each method is dropped for
+ * the rest of the transfer the first time it fails for any reason other
+ * than the output being busy.
+ *
+ * With threads, a helper thread does the copying, so that a slow output
+ * doesn't hold up the input, which is the point of storing it; the main
+ * thread bumps "written" to tell it when more has been written, and only
+ * waits for it once all of the input has been stored.  Without threads,
+ * or if the thread can't be started, the main thread forwards what it can
+ * without waiting each time round the main loop.
+ *
+ * Everything marked "shared" is accessed with atomic builtins.
+ */
+struct pvspool_s {
+	/*@null@*/ /*@only@*/ char *buffer;	/* for reading back with pread() */
+	int output_fd;			 /* real output */
+	char separator;			 /* line separator, in line mode */
+	bool linemode;			 /* set if counting lines */
+	bool output_seekable;		 /* set if the output is a file or block device */
+	bool to_file;			 /* set if copy_file_range() may be used */
+	bool to_pipe;			 /* set if splice() may be used */
+	bool to_socket;			 /* set if sendfile() may be used */
+#ifdef HAVE_THREADS
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+
+	/* Shared. */
+	unsigned long written;		 /* bumped when the spool grows */
+	bool worker_waiting;
+	bool stop;			 /* set once all of the input is stored */
+	bool abandon;			 /* set to give up before the end */
+#endif				/* HAVE_THREADS */
+
+	/* Shared. */
+	unsigned long long forwarded;	 /* bytes forwarded so far */
+	unsigned long long lines;	 /* lines forwarded so far, in line mode */
+	int error;			 /* errno of a failure, 0 if none */
+	bool done;			 /* set once forwarding has ended */
+
+	/* Only used by the main thread. */
+	bool running;			 /* set if the helper thread is running */
+	bool stored;			 /* set once all of the input is stored */
+	bool error_reported;		 /* set once "error" has been reported */
+};
+
+
+/*
+ * Set *available to the number of bytes in the spool that haven't been
+ * forwarded yet.  Returns false, with spool->error set, on error.
+ */
+static bool pv__spool_available(pvstate_t state, pvspool_t spool, unsigned long long *available)
+{
+	struct stat sb;
+	unsigned long long forwarded;
+
+	*available = 0;
+
+	memset(&sb, 0, sizeof(sb));
+	if (0 != fstat(state->spool.fd, &sb)) {
+		__atomic_store_n(&(spool->error), errno, __ATOMIC_SEQ_CST);
+		return false;
+	}
+
+	forwarded = __atomic_load_n(&(spool->forwarded), __ATOMIC_SEQ_CST);
+	if ((sb.st_size > 0) && ((unsigned long long) (sb.st_size) > forwarded))
+		*available = (unsigned long long) (sb.st_size) - forwarded;
+
+	return true;
+}
+
+
+/*
+ * Try to copy "count" bytes of the spool from "offset" to the output
+ * within the kernel, with whichever of copy_file_range(), splice(), or
+ * sendfile() applies.  Returns the number of bytes copied, 0 if the output
+ * is busy, -1 on error with errno set, or -2 if none of them applies, in
+ * which case pread() and write() should be used instead.
+ */
+static ssize_t pv__spool_offload(pvstate_t state, pvspool_t spool, off_t offset, size_t count)
+{
+	ssize_t ncopied;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	if (spool->to_file) {
+		/*@-unrecog@ *//* splint doesn't know about copy_file_range */
+		ncopied = copy_file_range(state->spool.fd, &offset, spool->output_fd, NULL, count, 0);
+		/*@+unrecog@ */
+		if (ncopied > 0)
+			return ncopied;
+		if ((ncopied < 0) && ((EAGAIN == errno) || (EINTR == errno)))
+			return 0;
+		debug("%s: %s", "copy_file_range failed - disabling", 0 == ncopied ? "no data" : strerror(errno));
+		spool->to_file = false;
+	}
+#endif				/* HAVE_COPY_FILE_RANGE */
+
+#ifdef HAVE_SPLICE
+	if (spool->to_pipe) {
+		/*@-unrecog@ *//* splint doesn't know about splice */
+		ncopied =
+		    splice(state->spool.fd, &offset, spool->output_fd, NULL, count, SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+		/*@+unrecog@ */
+		if (ncopied > 0)
+			return ncopied;
+		if ((ncopied < 0) && ((EAGAIN == errno) || (EINTR == errno)))
+			return 0;
+		if ((ncopied < 0) && (EPIPE == errno))
+			return -1;
+		debug("%s: %s", "splice failed - disabling", 0 == ncopied ? "no data" : strerror(errno));
+		spool->to_pipe = false;
+	}
+#endif				/* HAVE_SPLICE */
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+	if (spool->to_socket) {
+		/*@-unrecog@ *//* splint doesn't know about sendfile */
+		ncopied = sendfile(spool->output_fd, state->spool.fd, &offset, count);
+		/*@+unrecog@ */
+		if (ncopied > 0)
+			return ncopied;
+		if ((ncopied < 0) && ((EAGAIN == errno) || (EINTR == errno)))
+			return 0;
+		if ((ncopied < 0) && (EPIPE == errno))
+			return -1;
+		debug("%s: %s", "sendfile failed - disabling", 0 == ncopied ? "no data" : strerror(errno));
+		spool->to_socket = false;
+	}
+#endif				/* HAVE_SENDFILE && HAVE_SYS_SENDFILE_H */
+
+	return -2;
+}
+
+
+/*
+ * Forward up to "available" bytes from the spool to the output, waiting
+ * up to "wait_msec" milliseconds for the output to be ready if it isn't
+ * a regular file or block device.  Returns the number of bytes forwarded,
+ * 0 if the output wasn't ready, or -1 on error, with spool->error set.
+ */
+static ssize_t pv__spool_forward(pvstate_t state, pvspool_t spool, unsigned long long available, int wait_msec)
+{
+	off_t offset;
+	size_t count;
+	ssize_t nread, nwritten;
+
+	count = PV_SPOOL_CHUNK;
+	if (available < (unsigned long long) count)
+		count = (size_t) available;
+	offset = (off_t) __atomic_load_n(&(spool->forwarded), __ATOMIC_SEQ_CST);
+
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+	if (!spool->output_seekable) {
+		struct pollfd pfd;
+
+		pfd.fd = spool->output_fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, wait_msec) < 1)
+			return 0;
+	}
+#endif
+
+	nwritten = pv__spool_offload(state, spool, offset, count);
+
+	if (-2 == nwritten) {
+		if (NULL == spool->buffer) {
+			spool->buffer = malloc(PV_SPOOL_CHUNK);
+			if (NULL == spool->buffer) {
+				__atomic_store_n(&(spool->error), ENOMEM, __ATOMIC_SEQ_CST);
+				return -1;
+			}
+		}
+
+		nread = pread(state->spool.fd, spool->buffer, count, offset);
+		if ((nread < 0) && (EINTR != errno)) {
+			__atomic_store_n(&(spool->error), errno, __ATOMIC_SEQ_CST);
+			return -1;
+		}
+		if (nread <= 0)
+			return 0;
+
+		nwritten = write(spool->output_fd, spool->buffer, (size_t) nread);
+		if ((nwritten < 0) && ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno)))
+			return 0;
+		if (spool->linemode && (nwritten > 0)) {
+			(void) __atomic_add_fetch(&(spool->lines),
+						  (unsigned long long) pv_memcount(spool->buffer, spool->separator,
+										   (size_t) nwritten), __ATOMIC_SEQ_CST);
+		}
+	}
+
+	if (nwritten < 0) {
+		__atomic_store_n(&(spool->error), errno, __ATOMIC_SEQ_CST);
+		return -1;
+	}
+
+	(void) __atomic_add_fetch(&(spool->forwarded), (unsigned long long) nwritten, __ATOMIC_SEQ_CST);
+	return nwritten;
+}
+
+
+#ifdef HAVE_THREADS
+/*
+ * Sleep until more has been written to the spool than when "written" was
+ * "seen", or forwarding is being stopped.
+ */
+static void pv__spool_sleep(pvspool_t spool, unsigned long seen)
+{
+	(void) pthread_mutex_lock(&(spool->mutex));
+	__atomic_store_n(&(spool->worker_waiting), true, __ATOMIC_SEQ_CST);
+	while ((__atomic_load_n(&(spool->written), __ATOMIC_SEQ_CST) == seen)
+	       && (!__atomic_load_n(&(spool->stop), __ATOMIC_SEQ_CST))
+	       && (!__atomic_load_n(&(spool->abandon), __ATOMIC_SEQ_CST))) {
+		(void) pthread_cond_wait(&(spool->cond), &(spool->mutex));
+	}
+	__atomic_store_n(&(spool->worker_waiting), false, __ATOMIC_SEQ_CST);
+	(void) pthread_mutex_unlock(&(spool->mutex));
+}
+
+
+/*
+ * Wake the helper thread if it is asleep, or unconditionally if "always"
+ * is true.
+ */
+static void pv__spool_wake(pvspool_t spool, bool always)
+{
+	if ((!always) && (!__atomic_load_n(&(spool->worker_waiting), __ATOMIC_SEQ_CST)))
+		return;
+	(void) pthread_mutex_lock(&(spool->mutex));
+	(void) pthread_cond_broadcast(&(spool->cond));
+	(void) pthread_mutex_unlock(&(spool->mutex));
+}
+
+
+/*
+ * Helper thread: forward whatever lands in the spool, until told that
+ * everything has been stored and it has all been forwarded, or until told
+ * to give up, or an error occurs.  Non-seekable outputs are polled for
+ * 100ms at a time, so that giving up is noticed promptly even if the
+ * output's reader has stalled.
+ */
+/*@null@ */
+static void *pv__spool_worker(void *arg)
+{
+	pvstate_t state = (pvstate_t) arg;
+	pvspool_t spool = state->spool.engine;
+
+	if (NULL == spool)
+		return NULL;
+
+	while (!__atomic_load_n(&(spool->abandon), __ATOMIC_SEQ_CST)) {
+		unsigned long long available;
+		unsigned long seen;
+		bool stopping;
+
+		/* Check "stop" first, so that the last data isn't missed. */
+		stopping = __atomic_load_n(&(spool->stop), __ATOMIC_SEQ_CST);
+		seen = __atomic_load_n(&(spool->written), __ATOMIC_SEQ_CST);
+
+		if (!pv__spool_available(state, spool, &available))
+			break;
+
+		if (0 == available) {
+			if (stopping)
+				break;
+			pv__spool_sleep(spool, seen);
+			continue;
+		}
+
+		if (pv__spool_forward(state, spool, available, 100) < 0)
+			break;
+	}
+
+	__atomic_store_n(&(spool->done), true, __ATOMIC_SEQ_CST);
+
+	return NULL;
+}
+
+
+/*
+ * Start the helper thread, with all signals blocked so that they are
+ * still handled by the main thread.  If it can't be started, the main
+ * thread does the forwarding itself.
+ */
+static void pv__spool_start(pvstate_t state, pvspool_t spool)
+{
+	sigset_t all_signals, old_signals;
+	int rc;
+
+	(void) pthread_mutex_init(&(spool->mutex), NULL);
+	(void) pthread_cond_init(&(spool->cond), NULL);
+
+	(void) sigfillset(&all_signals);
+	(void) pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&(spool->thread), NULL, pv__spool_worker, state);
+	(void) pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (0 != rc) {
+		debug("%s: %s", "failed to start spool thread - forwarding inline", strerror(rc));
+		(void) pthread_cond_destroy(&(spool->cond));
+		(void) pthread_mutex_destroy(&(spool->mutex));
+		return;
+	}
+
+	spool->running = true;
+}
+
+
+/*
+ * Stop the helper thread - straight away if "abandon" is true, or else
+ * once it has forwarded everything - and reap it.
+ */
+static void pv__spool_stop(pvspool_t spool, bool abandon)
+{
+	if (!spool->running)
+		return;
+
+	if (abandon)
+		__atomic_store_n(&(spool->abandon), true, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&(spool->stop), true, __ATOMIC_SEQ_CST);
+	pv__spool_wake(spool, true);
+	(void) pthread_join(spool->thread, NULL);
+
+	(void) pthread_cond_destroy(&(spool->cond));
+	(void) pthread_mutex_destroy(&(spool->mutex));
+	spool->running = false;
+}
+#endif				/* HAVE_THREADS */
+
+
+/*
+ * Bring the progress line up to date with how much has been forwarded,
+ * and report any error, once.  As with the main output and the --tee
+ * outputs, the output's reader going away is not reported as an error.
+ */
+static void pv__spool_update(pvstate_t state, pvspool_t spool)
+{
+	int error;
+
+	if (spool->linemode) {
+		state->spool.line->transferred = (off_t) __atomic_load_n(&(spool->lines), __ATOMIC_SEQ_CST);
+	} else {
+		state->spool.line->transferred = (off_t) __atomic_load_n(&(spool->forwarded), __ATOMIC_SEQ_CST);
+	}
+
+	error = __atomic_load_n(&(spool->error), __ATOMIC_SEQ_CST);
+	if ((0 == error) || spool->error_reported)
+		return;
+	spool->error_reported = true;
+
+	if (EPIPE == error) {
+		debug("%s: %s", state->spool.line->name, "pipe closed - no longer forwarding");
+		return;
+	}
+
+	pv_error("%s: %s: %s", NULL == state->spool.line->name ? "(null)" : state->spool.line->name,
+		 _("write failed"), strerror(error));
+	state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+}
+
+
+/*
+ * Once all of the input is in the spool, make sure that any hole at the
+ * end left by --sparse is included in its size, since it is only filled
+ * in by truncation once the main output is closed, and copying stops at
+ * the spool's size.
+ */
+static void pv__spool_complete(pvstate_t state)
+{
+	struct stat sb;
+	off_t position;
+
+	if (!state->control.sparse_output)
+		return;
+	if (state->transfer.output_not_seekable)
+		return;
+
+	position = (off_t) lseek(state->control.output_fd, (off_t) 0, SEEK_CUR);
+	if ((position == (off_t) - 1) || (0 != fstat(state->control.output_fd, &sb)) || (sb.st_size >= position))
+		return;
+
+	/*@+longintegral@ *//* splint has trouble with off_t / __off_t. */
+	if (0 != ftruncate(state->control.output_fd, position)) {
+		debug("%s: %s", "spool ftruncate() failed", strerror(errno));
+	}
+	/*@-longintegral@ */
+}
+
+
+/*
+ * Open the real output, truncating it, and start forwarding to it.
+ *
+ * If the output can't be opened, this is reported and the input is still
+ * stored, but nothing is forwarded.
+ */
+void pv_spool_open(pvstate_t state)
+{
+	pvspool_t spool;
+	struct stat sb;
+
+	if ((state->spool.fd < 0) || (NULL == state->spool.line) || (NULL != state->spool.engine))
+		return;
+
+	spool = calloc(1, sizeof(*spool));
+	if (NULL == spool) {
+		pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		return;
+	}
+	state->spool.engine = spool;
+
+	spool->output_fd = STDOUT_FILENO;
+	if (NULL != state->spool.output) {
+		spool->output_fd = open(state->spool.output, O_WRONLY | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+		/*
+		 * flawfinder rationale: as with the main output, the name
+		 * has been given explicitly, and may well be a device or
+		 * other special file, so there is no checking that could be
+		 * done to make this safer.
+		 */
+		if (spool->output_fd < 0) {
+			pv_error("%s: %s", state->spool.output, strerror(errno));
+			state->status.exit_status |= PV_ERROREXIT_ACCESS;
+			spool->done = true;
+			return;
+		}
+		(void) fcntl(spool->output_fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	spool->linemode = state->control.linemode;
+	spool->separator = state->control.null_terminated_lines ? '\0' : '\n';
+
+	memset(&sb, 0, sizeof(sb));
+	if (0 == fstat(spool->output_fd, &sb)) {
+		spool->output_seekable = (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode)) ? true : false;
+		if ((!spool->linemode) && (!state->control.no_splice)) {
+			spool->to_file = S_ISREG(sb.st_mode) ? true : false;
+			spool->to_pipe = S_ISFIFO(sb.st_mode) ? true : false;
+			spool->to_socket = S_ISSOCK(sb.st_mode) ? true : false;
+		}
+	}
+
+	state->spool.line->size = state->control.size;
+
+	debug("%s: %d -> %s: %d", "forwarding from spool", state->spool.fd, state->spool.line->name, spool->output_fd);
+
+#ifdef HAVE_THREADS
+	pv__spool_start(state, spool);
+#endif
+}
+
+
+/*
+ * Forward what can be forwarded from the spool, and return true if the
+ * main transfer should wait: because "at_end" is true - all of the input
+ * has been stored - and there is still some left to forward.
+ *
+ * When returning true, up to "wait_usec" microseconds are first spent
+ * waiting for the forwarding to finish, so that the caller doesn't need
+ * to wait as well.
+ */
+bool pv_spool_hold(pvstate_t state, bool at_end, long wait_usec)
+{
+	struct timespec wait_start, wait_end, wait_elapsed;
+	pvspool_t spool;
+	unsigned long long available;
+	bool hold;
+
+	spool = state->spool.engine;
+	if (NULL == spool)
+		return false;
+
+	if (__atomic_load_n(&(spool->done), __ATOMIC_SEQ_CST)) {
+		pv__spool_update(state, spool);
+		return false;
+	}
+
+	if (at_end && (!spool->stored)) {
+		pv__spool_complete(state);
+		spool->stored = true;
+	}
+
+	pv_elapsedtime_read(&wait_start);
+
+#ifdef HAVE_THREADS
+	if (spool->running) {
+		if (at_end)
+			__atomic_store_n(&(spool->stop), true, __ATOMIC_SEQ_CST);
+		(void) __atomic_add_fetch(&(spool->written), 1, __ATOMIC_SEQ_CST);
+		pv__spool_wake(spool, false);
+
+		if (at_end) {
+			long waited;
+			for (waited = 0; waited < wait_usec && !__atomic_load_n(&(spool->done), __ATOMIC_SEQ_CST);
+			     waited += 10000) {
+				pv_nanosleep(10000000LL);
+			}
+		}
+
+		hold = at_end;
+		goto update;
+	}
+#endif				/* HAVE_THREADS */
+
+	hold = false;
+	if (!pv__spool_available(state, spool, &available)) {
+		spool->done = true;
+	} else if (available > 0) {
+		if (pv__spool_forward(state, spool, available, at_end ? (int) ((wait_usec + 999) / 1000) : 0) < 0)
+			spool->done = true;
+		hold = at_end;
+	} else if (at_end) {
+		spool->done = true;
+	}
+
+#ifdef HAVE_THREADS
+      update:
+#endif
+	pv__spool_update(state, spool);
+
+	if (hold) {
+		pv_elapsedtime_read(&wait_end);
+		pv_elapsedtime_subtract(&wait_elapsed, &wait_end, &wait_start);
+		pv_bottleneck_note_wait(state, false, true, pv_elapsedtime_seconds(&wait_elapsed));
+		debug("%s", "waiting for forwarding from the spool");
+	}
+
+	return hold;
+}
+
+
+/*
+ * Return true if forwarding from the spool hasn't finished yet.
+ */
+bool pv_spool_pending(pvstate_t state)
+{
+	if (NULL == state->spool.engine)
+		return false;
+	return __atomic_load_n(&(state->spool.engine->done), __ATOMIC_SEQ_CST) ? false : true;
+}
+
+
+/*
+ * Stop forwarding, giving up on anything not yet forwarded, and close the
+ * real output.
+ */
+void pv_spool_close(pvstate_t state)
+{
+	pvspool_t spool;
+
+	spool = state->spool.engine;
+	if (NULL == spool)
+		return;
+
+#ifdef HAVE_THREADS
+	pv__spool_stop(spool, true);
+#endif
+	__atomic_store_n(&(spool->done), true, __ATOMIC_SEQ_CST);
+	pv__spool_update(state, spool);
+
+	if ((spool->output_fd >= 0) && (spool->output_fd != STDOUT_FILENO) && (0 != close(spool->output_fd))) {
+		pv_error("%s: %s: %s", NULL == state->spool.line->name ? "(null)" : state->spool.line->name,
+			 _("close failed"), strerror(errno));
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+	}
+	spool->output_fd = -1;
+}
+
+
+/*
+ * Stop forwarding, close the spool, and free everything to do with it.
+ */
+void pv_spool_free(pvstate_t state)
+{
+	pv_spool_close(state);
+
+	if (NULL != state->spool.engine) {
+		if (NULL != state->spool.engine->buffer)
+			free(state->spool.engine->buffer);
+		state->spool.engine->buffer = NULL;
+		free(state->spool.engine);
+		state->spool.engine = NULL;
+	}
+
+	if (state->spool.fd >= 0)
+		(void) close(state->spool.fd);
+	state->spool.fd = -1;
+
+	if (NULL != state->spool.output)
+		free(state->spool.output);
+	state->spool.output = NULL;
+
+	if (NULL != state->spool.line) {
+		pv_freecontents_subline(state->spool.line);
+		free(state->spool.line);
+		state->spool.line = NULL;
+	}
+}
@@ -45,7 +45,7 @@ static void pv_alloc_calc_history(pvtransfercalc_t calc)
 	}
 
 	calc->history_first = calc->history_last = 0;
-	calc->history[0].elapsed_sec = 0.0; /* to be safe, memset() not recommended for doubles */
+	calc->history[0].elapsed_ns = 0;
 }
 
 
@@ -97,11 +97,14 @@ void pv_reset_calc(pvtransfercalc_t calc)
 	calc->rate_sum = 0.0;
 	calc->ratesquared_sum = 0.0;
 	calc->measurements_taken = 0;
+	memset(calc->rate_histogram, 0, sizeof(calc->rate_histogram));
+	calc->stall_count = 0;
+	calc->stalled = false;
 	calc->prev_transferred = 0;
 	calc->percentage = 0.0;
 	calc->history_first = calc->history_last = 0;
 	if (NULL != calc->history) {
-		calc->history[0].elapsed_sec = 0.0;
+		calc->history[0].elapsed_ns = 0;
 	}
 }
 
@@ -124,12 +127,86 @@ void pv_reset_transfer(pvtransferstate_t transfer)
 	transfer->written_but_not_consumed = 0;
 	transfer->read_errors_in_a_row = 0;
 	transfer->last_read_skip_fd = 0;
+	transfer->direct_block = 0;
+	transfer->direct_input_block = 0;
+	transfer->direct_checked_fd = -1;
+	transfer->direct_input_fd = -1;
+	transfer->direct_tail_fd = -1;
+	transfer->direct_tail_failed = false;
+	transfer->buffer_mem.node = -1;
 #ifdef HAVE_SPLICE
 	transfer->splice_failed_fd = -1;
+	transfer->copy_range_failed_fd = -1;
+	transfer->sendfile_failed_fd = -1;
+	transfer->offload_checked_fd = -1;
+#ifdef HAVE_TEE
+	transfer->tee_pipe[0] = -1;
+	transfer->tee_pipe[1] = -1;
+	transfer->tee_discard_fd = -1;
+	transfer->tee_failed_fd = -1;
+	transfer->tee_pending = 0;
+	transfer->tee_unconsumed = 0;
+#endif				/* HAVE_TEE */
 #endif				/* HAVE_SPLICE */
+#ifdef HAVE_IO_URING
+	transfer->uring_reads_queued = 0;
+	transfer->uring_reads_committed = 0;
+	transfer->uring_read_fd = -1;
+	transfer->uring_read_stopped = false;
+	transfer->uring_read_eof = false;
+	transfer->uring_writes_queued = 0;
+	transfer->uring_writes_committed = 0;
+	transfer->uring_write_fd = -1;
+	transfer->uring_write_stopped = false;
+#endif				/* HAVE_IO_URING */
+	transfer->sparse_block_size = 0;
+	transfer->sparse_data_end = 0;
+	transfer->sparse_input_fd = -1;
+	transfer->sparse_input_holes = false;
+#ifdef HAVE_THREADS
+	transfer->parallel_fd = -1;
+	transfer->parallel_usable = false;
+#endif				/* HAVE_THREADS */
+	pv_elapsedtime_zero(&(transfer->autotune_window_start));
+	transfer->autotune_input_wait = 0.0;
+	transfer->autotune_output_wait = 0.0;
+	transfer->autotune_read_bytes = 0;
+	transfer->autotune_reads = 0;
+	transfer->autotune_initial_size = 0;
+	transfer->autotune_largest_size = 0;
+	transfer->autotune_changes = 0;
+	transfer->autotune_input_fd = -1;
+	transfer->input_pipe_size = 0;
+	transfer->output_pipe_size = 0;
+	transfer->autotune_output_checked = false;
+	memset(transfer->chunk_time_histogram, 0, sizeof(transfer->chunk_time_histogram));
+	transfer->chunk_count = 0;
+	transfer->wait_input_seconds = 0.0;
+	transfer->wait_output_seconds = 0.0;
+	memset(transfer->read_size_histogram, 0, sizeof(transfer->read_size_histogram));
+	memset(transfer->write_size_histogram, 0, sizeof(transfer->write_size_histogram));
+	transfer->instrumented_since = 0.0;
+	transfer->instrumented = false;
+	transfer->epoll_fd = -1;
+	transfer->epoll_watch_fd[0] = -1;
+	transfer->epoll_watch_fd[1] = -1;
+	transfer->epoll_watch_events[0] = 0;
+	transfer->epoll_watch_events[1] = 0;
+	transfer->epoll_unpollable[0] = false;
+	transfer->epoll_unpollable[1] = false;
+	transfer->epoll_failed = false;
+	transfer->output_block_checked = false;
+	transfer->output_may_block = true;
+	transfer->buffer_pinned = false;
+	transfer->zerocopy_fd = -1;
+	transfer->zerocopy_usable = false;
+	transfer->zerocopy_sent = 0;
+	transfer->zerocopy_completed = 0;
+	transfer->zerocopy_copied = 0;
 
 	transfer->line_positions_length = 0;
 	transfer->line_positions_head = 0;
+	transfer->line_positions_window = 0;
 	transfer->last_output_position = 0;
 	transfer->output_not_seekable = false;
 }
@@ -155,6 +232,12 @@ void pv_reset_display(pvdisplay_t display)
 		return;
 	display->initial_offset = 0;
 	display->output_produced = false;
+	display->bottleneck_window_start = 0.0;
+	display->bottleneck_wait_in_start = 0.0;
+	display->bottleneck_wait_out_start = 0.0;
+	display->bottleneck_wait_in_fraction = 0.0;
+	display->bottleneck_wait_out_fraction = 0.0;
+	display->bottleneck_measured = false;
 }
 
 
@@ -194,11 +277,21 @@ pvstate_t pv_state_alloc(void)
 	state->control.othermonitor_pid = 0;
 	state->control.othermonitor_read_fd = -1;
 	state->control.othermonitor_write_fd = -1;
+	state->control.numa_node = -1;
+	state->files.input_fd = -1;
 #ifdef HAVE_IPC
 	state->cursor.shmid = -1;
 	state->cursor.pvcount = 1;
+	state->cursor.slot = -1;
 #endif				/* HAVE_IPC */
 	state->cursor.lock_fd = -1;
+#ifdef HAVE_IPC
+	state->rategroup.shmid = -1;
+#endif				/* HAVE_IPC */
+	state->rategroup.lock_fd = -1;
+	state->metrics.fd = -1;
+	state->statuspage.fd = -1;
+	state->spool.fd = -1;
 
 	pv_state_reset(state);
 
@@ -228,6 +321,14 @@ void pv_freecontents_display(pvdisplay_t display)
 	if (NULL != display->display_buffer)
 		free(display->display_buffer);
 	display->display_buffer = NULL;
+	if (NULL != display->shown_buffer)
+		free(display->shown_buffer);
+	display->shown_buffer = NULL;
+	if (NULL != display->update_buffer)
+		free(display->update_buffer);
+	display->update_buffer = NULL;
+	display->shown_buffer_size = 0;
+	display->shown_valid = false;
 }
 
 
@@ -236,10 +337,33 @@ void pv_freecontents_display(pvdisplay_t display)
  */
 void pv_freecontents_transfer(pvtransferstate_t transfer)
 {
+#ifdef HAVE_THREADS
+	/* Stop the pipeline threads before the buffer goes away. */
+	if (NULL != transfer->pipeline)
+		pv_pipeline_free(transfer->pipeline);
+	transfer->pipeline = NULL;
+	if (NULL != transfer->parallel)
+		pv_parallel_free(transfer->parallel);
+	transfer->parallel = NULL;
+#endif				/* HAVE_THREADS */
+#ifdef HAVE_IO_URING
+	/*
+	 * Close the ring before freeing the buffer, since anything still in
+	 * flight refers to it.
+	 */
+	if (NULL != transfer->uring)
+		pv_uring_free(transfer->uring);
+	transfer->uring = NULL;
+#endif				/* HAVE_IO_URING */
+
+	/* The kernel may still be sending from the buffer. */
+	pv_zerocopy_finish(transfer);
+
 	/*@-keeptrans@ */
-	if (NULL != transfer->transfer_buffer)
-		free(transfer->transfer_buffer);
+	if ((NULL != transfer->transfer_buffer) && (!transfer->buffer_borrowed))
+		pv_buffer_free(transfer->transfer_buffer, &(transfer->buffer_mem));
 	transfer->transfer_buffer = NULL;
+	transfer->buffer_borrowed = false;
 	/*@+keeptrans@ */
 	/* splint - explicitly freeing this structure, so free() here is OK. */
 
@@ -260,6 +384,36 @@ void pv_freecontents_calc(pvtransfercalc_t calc)
 }
 
 
+/*
+ * Reset a progress line shown below the main one, ready for a new
+ * transfer.
+ */
+void pv_reset_subline(pvstate_t state, struct pvsubline_s *line)
+{
+	pv_reset_calc(&(line->calc));
+	pv_reset_transfer(&(line->transfer));
+	pv_reset_flags(&(line->flags));
+	pv_reset_display(&(line->display));
+	(void) pv_update_calc_average_rate_window(&(line->calc), state->control.average_rate_window);
+	line->size = 0;
+	line->transferred = 0;
+}
+
+
+/*
+ * Free dynamic contents of a progress line shown below the main one.
+ */
+void pv_freecontents_subline(struct pvsubline_s *line)
+{
+	if (NULL != line->name)
+		free(line->name);
+	line->name = NULL;
+	pv_freecontents_calc(&(line->calc));
+	pv_freecontents_transfer(&(line->transfer));
+	pv_freecontents_display(&(line->display));
+}
+
+
 /*
  * Free the contents of a watchfd watched-items array.
  */
@@ -273,6 +427,7 @@ void pv_freecontents_watchfd_items(struct pvwatcheditem_s *watching, unsigned in
 	/*@-compdestroy@ */
 	for (watch_idx = 0; watch_idx < count; watch_idx++) {
 		int info_idx;
+		pv_watchpid_untrack(&(watching[watch_idx]));
 		if (NULL == watching[watch_idx].info_array)
 			continue;
 		for (info_idx = 0; info_idx < watching[watch_idx].array_length; info_idx++) {
@@ -357,6 +512,13 @@ void pv_state_free(pvstate_t state)
 	pv_freecontents_display(&(state->display));
 	pv_freecontents_display(&(state->extra_display));
 
+#ifdef HAVE_IPC
+	if (NULL != state->cursor.paint_buffer) {
+		free(state->cursor.paint_buffer);
+		state->cursor.paint_buffer = NULL;
+	}
+#endif				/* HAVE_IPC */
+
 	if (NULL != state->control.name) {
 		free(state->control.name);
 		state->control.name = NULL;
@@ -367,6 +529,32 @@ void pv_state_free(pvstate_t state)
 		state->control.default_bar_style = NULL;
 	}
 
+	pv_rategroup_leave(state);
+	if (NULL != state->control.rate_group) {
+		free(state->control.rate_group);
+		state->control.rate_group = NULL;
+	}
+
+	pv_remote_statuspage_close(state);
+
+	pv_metrics_close(state);
+	if (NULL != state->control.metrics_dest) {
+		free(state->control.metrics_dest);
+		state->control.metrics_dest = NULL;
+	}
+
+	pv_fanout_free(state);
+	pv_merge_free(state);
+	pv_hash_free(state);
+	pv_spool_free(state);
+	if (NULL != state->rescue.filename) {
+		free(state->rescue.filename);
+		state->rescue.filename = NULL;
+	}
+	if (NULL != state->sublines.format_string)
+		free(state->sublines.format_string);
+	state->sublines.format_string = NULL;
+
 	if (NULL != state->control.format_string) {
 		free(state->control.format_string);
 		state->control.format_string = NULL;
@@ -384,8 +572,38 @@ void pv_state_free(pvstate_t state)
 
 	pv_freecontents_transfer(&(state->transfer));
 
+	/* Close the buffered descriptor used for the ends of O_DIRECT writes. */
+	if (state->transfer.direct_tail_fd >= 0)
+		(void) close(state->transfer.direct_tail_fd);
+	state->transfer.direct_tail_fd = -1;
+
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+	/* Close the private pipe that tee() copies the input into. */
+	if (state->transfer.tee_pipe[0] >= 0)
+		(void) close(state->transfer.tee_pipe[0]);
+	if (state->transfer.tee_pipe[1] >= 0)
+		(void) close(state->transfer.tee_pipe[1]);
+	if (state->transfer.tee_discard_fd >= 0)
+		(void) close(state->transfer.tee_discard_fd);
+	state->transfer.tee_pipe[0] = -1;
+	state->transfer.tee_pipe[1] = -1;
+	state->transfer.tee_discard_fd = -1;
+#endif				/* HAVE_SPLICE && HAVE_TEE */
+
+	pv_event_close(state);
+
 	pv_freecontents_calc(&(state->calc));
 
+	pv_file_prefetch_cancel(state);
+#ifdef HAVE_THREADS
+	if (NULL != state->files.linecount)
+		pv_linecount_free(state->files.linecount);
+	state->files.linecount = NULL;
+#endif				/* HAVE_THREADS */
+	if (NULL != state->files.dirsize)
+		pv_dirsize_free(state->files.dirsize);
+	state->files.dirsize = NULL;
+
 	if (NULL != state->files.filename) {
 		unsigned int file_idx;
 		for (file_idx = 0; file_idx < state->files.file_count; file_idx++) {
@@ -504,6 +722,21 @@ void pv_state_cursor_set(pvstate_t state, bool val)
 	state->control.cursor = val;
 }
 
+void pv_state_cursor_batch_set(pvstate_t state, bool val)
+{
+	state->control.cursor_batch = val;
+}
+
+void pv_state_merge_inputs_set(pvstate_t state, bool val)
+{
+	state->control.merge_inputs = val;
+}
+
+void pv_state_hash_set(pvstate_t state, unsigned int val)
+{
+	state->control.hash_algorithms = val;
+}
+
 void pv_state_show_stats_set(pvstate_t state, bool val)
 {
 	state->control.show_stats = val;
@@ -605,6 +838,107 @@ void pv_state_no_splice_set(pvstate_t state, bool val)
 	state->control.no_splice = val;
 }
 
+void pv_state_io_uring_set(pvstate_t state, bool val)
+{
+	state->control.io_uring = val;
+}
+
+void pv_state_io_depth_set(pvstate_t state, unsigned int val)
+{
+	if (val > PV_URING_MAX_DEPTH)
+		val = PV_URING_MAX_DEPTH;
+	state->control.io_depth = val;
+}
+
+void pv_state_threaded_set(pvstate_t state, bool val)
+{
+	state->control.threaded = val;
+}
+
+void pv_state_parallel_set(pvstate_t state, unsigned int val)
+{
+	if (val > PV_PARALLEL_MAX_THREADS)
+		val = PV_PARALLEL_MAX_THREADS;
+	state->control.parallel = val;
+}
+
+void pv_state_huge_pages_set(pvstate_t state, bool val)
+{
+	state->control.huge_pages = val;
+}
+
+void pv_state_lock_memory_set(pvstate_t state, bool val)
+{
+	state->control.lock_memory = val;
+}
+
+void pv_state_numa_node_set(pvstate_t state, int val)
+{
+	if (val > PV_NUMA_MAX_NODE)
+		val = PV_NUMA_MAX_NODE;
+	state->control.numa_node = val;
+}
+
+void pv_state_zero_copy_set(pvstate_t state, bool val)
+{
+	state->control.zero_copy = val;
+}
+
+void pv_state_embedded_set(pvstate_t state, bool val)
+{
+	state->control.embedded = val;
+}
+
+void pv_state_progress_set(pvstate_t state, pvprogress_fn_t fn, void *userdata)
+{
+	state->control.progress_fn = fn;
+	state->control.progress_userdata = userdata;
+}
+
+void pv_state_input_fd_set(pvstate_t state, int fd)
+{
+	state->files.input_fd = fd;
+}
+
+/*
+ * Set the buffer to transfer instead of the input files, or with NULL,
+ * go back to the input files.  Either way, any previous buffer is let go
+ * of first, so that the transfer buffer can't still point to it; and when
+ * a buffer is set, the transfer buffer from any earlier transfer is freed,
+ * since the new buffer will take its place.
+ *
+ * The buffer belongs to the caller, and must stay unchanged for as long
+ * as it is set.
+ */
+void pv_state_input_buffer_set(pvstate_t state, const char *buffer, size_t length)
+{
+	if ((NULL != buffer) && (!state->transfer.buffer_borrowed) && (NULL != state->transfer.transfer_buffer)) {
+		pv_zerocopy_finish(&(state->transfer));
+		pv_buffer_free(state->transfer.transfer_buffer, &(state->transfer.buffer_mem));
+		state->transfer.transfer_buffer = NULL;
+		state->transfer.buffer_size = 0;
+		state->transfer.read_position = 0;
+		state->transfer.write_position = 0;
+	}
+	if (state->transfer.buffer_borrowed) {
+		/*@-mustfreeonly@ */
+		state->transfer.transfer_buffer = NULL;
+		/*@+mustfreeonly@ */
+		/* splint - the borrowed buffer is not ours to free. */
+		state->transfer.buffer_borrowed = false;
+		state->transfer.buffer_size = 0;
+		state->transfer.read_position = 0;
+		state->transfer.write_position = 0;
+	}
+	state->files.buffer = buffer;
+	state->files.buffer_length = NULL == buffer ? 0 : length;
+}
+
+void pv_state_auto_buffer_set(pvstate_t state, bool val)
+{
+	state->control.auto_buffer = val;
+}
+
 void pv_state_size_set(pvstate_t state, off_t val)
 {
 	state->control.size = val;
@@ -639,6 +973,37 @@ void pv_state_name_set(pvstate_t state, /*@null@ */ const char *val)
 		state->control.name = pv_strdup(val);
 }
 
+void pv_state_error_map_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->rescue.filename) {
+		free(state->rescue.filename);
+		state->rescue.filename = NULL;
+	}
+	if (NULL != val)
+		state->rescue.filename = pv_strdup(val);
+}
+
+void pv_state_rate_group_set(pvstate_t state, /*@null@ */ const char *val)
+{
+	if (NULL != state->control.rate_group) {
+		free(state->control.rate_group);
+		state->control.rate_group = NULL;
+	}
+	if (NULL != val)
+		state->control.rate_group = pv_strdup(val);
+}
+
+void pv_state_metrics_set(pvstate_t state, /*@null@ */ const char *dest, double interval)
+{
+	if (NULL != state->control.metrics_dest) {
+		free(state->control.metrics_dest);
+		state->control.metrics_dest = NULL;
+	}
+	if (NULL != dest)
+		state->control.metrics_dest = pv_strdup(dest);
+	state->control.metrics_interval = interval;
+}
+
 void pv_state_default_bar_style_set(pvstate_t state, /*@null@ */ const char *val)
 {
 	if (NULL != state->control.default_bar_style) {
@@ -783,6 +1148,18 @@ void pv_state_othermonitor_set(pvstate_t state, pid_t pid, int read_fd, int writ
 	state->control.othermonitor_write_fd = write_fd;
 }
 
+/*
+ * Set the shared memory counters through which the two sides of "-M both"
+ * see each other's progress: this side stores its amount transferred in
+ * "own_count" and reads the other side's from "other_count".
+ */
+void pv_state_othermonitor_counts_set(pvstate_t state, /*@null@ */ volatile off_t *own_count, /*@null@ */
+				      const volatile off_t *other_count)
+{
+	state->control.othermonitor_own_count = own_count;
+	state->control.othermonitor_other_count = other_count;
+}
+
 /* If the format string is set to an empty string, stop all display output. */
 void pv_state_cancel_output_if_empty_format_string(pvstate_t state)
 {
@@ -803,6 +1180,14 @@ void pv_state_inputfiles(pvstate_t state, unsigned int input_file_count, const c
 	unsigned int file_idx;
 	/*@only@ */ nullable_string_t *new_array;
 
+	/* Abandon any open-ahead, and line count, of the old files. */
+	pv_file_prefetch_cancel(state);
+#ifdef HAVE_THREADS
+	if (NULL != state->files.linecount)
+		pv_linecount_free(state->files.linecount);
+	state->files.linecount = NULL;
+#endif				/* HAVE_THREADS */
+
 	/* Free the old array and its contents, if there was one. */
 	if (NULL != state->files.filename) {
 		for (file_idx = 0; file_idx < state->files.file_count; file_idx++) {
@@ -838,6 +1223,91 @@ void pv_state_inputfiles(pvstate_t state, unsigned int input_file_count, const c
 	state->files.file_count = input_file_count;
 }
 
+/*
+ * Set the list of extra outputs to copy everything written to the main
+ * output to, replacing any previous list, and whether to drop those that
+ * can't keep up instead of waiting for them.
+ */
+void pv_state_tee_outputs(pvstate_t state, unsigned int output_count, const char **names, bool drop_slow)
+{
+	unsigned int output_idx;
+
+	pv_fanout_free(state);
+	state->fanout.drop_slow = drop_slow;
+
+	if (0 == output_count)
+		return;
+
+	if (output_count > PV_FANOUT_MAX) {
+		/*@-mustfreefresh@ *//* see similar _() issue above */
+		pv_error("%s: %d", _("too many --tee outputs - the limit is"), PV_FANOUT_MAX);
+		/*@+mustfreefresh@ */
+		output_count = PV_FANOUT_MAX;
+	}
+
+	state->fanout.output = calloc((size_t) output_count, sizeof(state->fanout.output[0]));
+	if (NULL == state->fanout.output) {
+		/*@-mustfreefresh@ *//* see similar _() issue above */
+		pv_error("%s: %s", _("output list allocation failed"), strerror(errno));
+		/*@+mustfreefresh@ */
+		return;
+	}
+	state->fanout.count = output_count;
+
+	for (output_idx = 0; output_idx < output_count; output_idx++) {
+		pvfanoutput_t output = &(state->fanout.output[output_idx]);
+
+		pv_reset_subline(state, &(output->line));
+		output->fd = -1;
+		output->line.name = pv_strdup(names[output_idx]);
+		if (NULL == output->line.name) {
+			/*@-mustfreefresh@ *//* see similar _() issue above */
+			pv_error("%s: %s", _("output list allocation failed"), strerror(errno));
+			/*@+mustfreefresh@ */
+			output->finished = true;
+		}
+	}
+}
+
+/*
+ * Copy everything written to the main output on to "output" (stdout if it
+ * is NULL or "-") as soon as it has been written, reading it back through
+ * "fd", which the state takes over; the main output must be a regular
+ * file or a memfd.  The progress line for this is labelled "name", or the
+ * output's name if "name" is NULL.  An "fd" of -1 turns this off.
+ */
+void pv_state_spool_set(pvstate_t state, int fd, /*@null@ */ const char *output, /*@null@ */ const char *name)
+{
+	bool to_stdout;
+
+	pv_spool_free(state);
+
+	if (fd < 0)
+		return;
+
+	state->spool.fd = fd;
+	to_stdout = ((NULL == output) || (0 == strcmp(output, "-"))) ? true : false;
+
+	state->spool.line = calloc(1, sizeof(*(state->spool.line)));
+	if (NULL != state->spool.line) {
+		pv_reset_subline(state, state->spool.line);
+		if (NULL == name)
+			name = to_stdout ? "(stdout)" : output;
+		state->spool.line->name = pv_strdup(name);
+	}
+	if (!to_stdout)
+		state->spool.output = pv_strdup(output);
+
+	if ((NULL == state->spool.line) || (NULL == state->spool.line->name)
+	    || ((!to_stdout) && (NULL == state->spool.output))) {
+		/*@-mustfreefresh@ *//* see similar _() issue above */
+		pv_error("%s: %s", _("output list allocation failed"), strerror(errno));
+		/*@+mustfreefresh@ */
+		state->status.exit_status |= PV_ERROREXIT_MEMORY;
+		pv_spool_free(state);
+	}
+}
+
 /*
  * Set the arrays of watchfd process IDs and file descriptors.
  */
@@ -190,6 +190,64 @@ void *pv_memrchr(const void *buffer, int match, size_t length)
 }
 
 
+/*
+ * Return the number of times the character "match" appears in the first
+ * "length" bytes of the buffer.
+ *
+ * This steps from one match to the next with memchr(), which the C library
+ * usually implements with vector instructions, rather than comparing every
+ * byte individually.
+ */
+size_t pv_memcount(const void *buffer, int match, size_t length)
+{
+	const unsigned char *ptr;
+	const unsigned char *end;
+	size_t count;
+
+	count = 0;
+	ptr = (const unsigned char *) buffer;
+	end = ptr + length;
+
+	while (ptr < end) {
+		const unsigned char *found;
+		found = memchr(ptr, match, (size_t) (end - ptr));
+		if (NULL == found)
+			break;
+		count++;
+		ptr = found + 1;
+	}
+
+	return count;
+}
+
+
+/*
+ * Return true if the first "length" bytes of the buffer are all zero.
+ *
+ * Once the first few bytes are known to be zero, the rest of the buffer is
+ * compared against itself, offset by that many bytes, with memcmp(); this
+ * lets the C library's vectorised comparison do the work.
+ */
+bool pv_is_zero(const void *buffer, size_t length)
+{
+	const unsigned char *ptr;
+	size_t prefix, idx;
+
+	ptr = (const unsigned char *) buffer;
+	prefix = length < 16 ? length : 16;
+
+	for (idx = 0; idx < prefix; idx++) {
+		if (0 != ptr[idx])
+			return false;
+	}
+
+	if (length <= prefix)
+		return true;
+
+	return 0 == memcmp(ptr, ptr + prefix, length - prefix) ? true : false;
+}
+
+
 /*
  * Return the number of display columns needed to show the
  * non-null-terminated string "string" whose length in bytes is "bytes".
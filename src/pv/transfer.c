@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/file.h>
@@ -21,6 +22,12 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/time.h>
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+#include <poll.h>
+#endif
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#endif
 
 /*
  * splint note: In a few places we use "#if SPLINT" to substitute other code
@@ -37,10 +44,57 @@
  * or both of "fd_in" and "fd_out" may be negative to ignore that side.  If
  * fd_in_ready and/or fd_out_ready are not NULL, they will be populated with
  * true or false depending on whether data is ready on those sides.
+ *
+ * Where poll() is available it is used instead of select(), so that
+ * descriptors beyond FD_SETSIZE can be waited for.
  */
 static int is_data_ready(int fd_in, /*@null@ */ bool *fd_in_ready, int fd_out, /*@null@ */ bool *fd_out_ready,
 			 long usec)
 {
+#if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+	struct pollfd pfds[2];
+	nfds_t nfds;
+	int result;
+
+	memset(pfds, 0, sizeof(pfds));
+	nfds = 0;
+	if (fd_in >= 0) {
+		pfds[nfds].fd = fd_in;
+		pfds[nfds].events = POLLIN;
+		nfds++;
+	}
+	if (fd_out >= 0) {
+		pfds[nfds].fd = fd_out;
+		pfds[nfds].events = POLLOUT;
+		nfds++;
+	}
+
+	if (NULL != fd_in_ready)
+		*fd_in_ready = false;
+	if (NULL != fd_out_ready)
+		*fd_out_ready = false;
+
+	result = poll(pfds, nfds, (int) ((usec + 999) / 1000));
+
+	if (result > 0) {
+		/* Report a closed descriptor as select() would. */
+		if ((0 != (pfds[0].revents & POLLNVAL)) || (0 != (pfds[1].revents & POLLNVAL))) {
+			errno = EBADF;
+			return -1;
+		}
+		nfds = 0;
+		if (fd_in >= 0) {
+			if ((NULL != fd_in_ready) && (0 != (pfds[nfds].revents & (POLLIN | POLLHUP | POLLERR))))
+				*fd_in_ready = true;
+			nfds++;
+		}
+		if ((fd_out >= 0) && (NULL != fd_out_ready)
+		    && (0 != (pfds[nfds].revents & (POLLOUT | POLLHUP | POLLERR))))
+			*fd_out_ready = true;
+	}
+
+	return result;
+#else				/* !HAVE_POLL || !HAVE_POLL_H */
 	struct timeval tv;
 	fd_set readfds;
 	fd_set writefds;
@@ -99,6 +153,28 @@ static int is_data_ready(int fd_in, /*@null@ */ bool *fd_in_ready, int fd_out, /
 	}
 
 	return result;
+#endif				/* HAVE_POLL && HAVE_POLL_H */
+}
+
+
+/*
+ * Wait for the input or output to become ready, as with is_data_ready(),
+ * using the epoll instance in "state" when possible.  With --merge, all of
+ * the inputs are waited for.
+ */
+static int pv__transfer_wait(pvstate_t state, int fd_in, /*@null@ */ bool *fd_in_ready, int fd_out,
+			     /*@null@ */ bool *fd_out_ready, long usec)
+{
+	int result;
+
+	if ((fd_in >= 0) && (state->merge.count > 0))
+		return pv_merge_wait(state, fd_in_ready, fd_out, fd_out_ready, usec);
+
+	result = pv_event_wait(state, fd_in, fd_in_ready, fd_out, fd_out_ready, usec);
+	if (-2 != result)
+		return result;
+
+	return is_data_ready(fd_in, fd_in_ready, fd_out, fd_out_ready, usec);
 }
 
 
@@ -137,8 +213,29 @@ static ssize_t pv__transfer_read_repeated(int fd, char *buf, size_t count)
 		 * bounded to the buffer size the caller told us to use.
 		 */
 
+#ifdef O_DIRECT
+		/*
+		 * An O_DIRECT read that is out of line with the block size,
+		 * such as at the end of a --stop-at-size transfer, fails
+		 * with EINVAL; read through the page cache instead.
+		 */
+		if ((nread < 0) && (EINVAL == errno)) {
+			int flags = fcntl(fd, F_GETFL);
+			if ((flags >= 0) && (0 != (flags & O_DIRECT)) && (0 == fcntl(fd, F_SETFL, flags & ~O_DIRECT))) {
+				int read_errno;
+				debug("%s %d: %s", "fd", fd, "O_DIRECT read failed with EINVAL - reading buffered");
+				nread = read(fd, buf, (size_t) (count > MAX_READ_AT_ONCE ? MAX_READ_AT_ONCE : count));	/* flawfinder: ignore */
+				/* flawfinder rationale: as above. */
+				read_errno = errno;
+				(void) fcntl(fd, F_SETFL, flags);
+				errno = read_errno;
+			}
+		}
+#endif				/* O_DIRECT */
+
+		/* Keep what was read before the error; the next read will see it again. */
 		if (nread < 0)
-			return nread;
+			return total_read > 0 ? total_read : nread;
 
 		total_read += nread;
 		buf += nread;
@@ -294,6 +391,479 @@ static ssize_t pv__transfer_write_repeated(int fd, char *buf, size_t count, bool
 }
 
 
+/*
+ * Return the number of bytes that may be read into the transfer buffer at
+ * the current read position.  This is the space remaining in the buffer,
+ * capped to the number of bytes left until state->control.size is reached
+ * if state->control.stop_at_size is true.
+ */
+static size_t pv__transfer_read_limit(pvstate_t state)
+{
+	size_t bytes_can_read;
+
+	bytes_can_read = state->transfer.buffer_size - state->transfer.read_position;
+
+	/*
+	 * Don't read past control.size if stop_at_size is true (issue
+	 * #166).
+	 *
+	 * This isn't workable in line mode.
+	 */
+	if (state->control.stop_at_size && !state->control.linemode) {
+		off_t bytes_remaining_to_read = state->control.size - state->transfer.total_bytes_read;
+		if (bytes_remaining_to_read < 0)
+			bytes_remaining_to_read = 0;
+		if ((long long) bytes_can_read > (long long) bytes_remaining_to_read) {
+			debug("%lld > (%lld-%lld=%lld): %s", (long long) bytes_can_read,
+			      (long long) (state->control.size), (long long) state->transfer.total_bytes_read,
+			      (long long) bytes_remaining_to_read, "truncating for stop-at-size");
+			bytes_can_read = (size_t) bytes_remaining_to_read;
+		}
+	}
+
+	return bytes_can_read;
+}
+
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+/*
+ * In sparse output mode, if the input "fd" is a regular file positioned at
+ * a hole, skip over the hole - seeking both the input and the output past
+ * it, instead of reading and writing null bytes - and return the number of
+ * bytes skipped.  The output is only at the same position as the input
+ * when the transfer buffer is empty, so if it isn't, nothing is skipped,
+ * and -1 is returned to say that nothing should be read until it is.
+ *
+ * If the input is positioned in data instead, returns 0, and caps
+ * *bytes_can_read so that the next read stops where the data does.
+ *
+ * The number of bytes skipped is capped to "max_to_write" if rate limiting
+ * is active or "max_to_write" is >0, and to the amount left to read if
+ * state->control.stop_at_size is true.
+ */
+static off_t pv__transfer_skip_input_hole(pvstate_t state, int fd, size_t *bytes_can_read, off_t max_to_write)
+{
+	off_t offset, data_start, hole_length;
+
+	if (fd != state->transfer.sparse_input_fd) {
+		struct stat sb;
+		state->transfer.sparse_input_fd = fd;
+		state->transfer.sparse_data_end = 0;
+		state->transfer.sparse_input_holes = ((0 == fstat(fd, &sb)) && S_ISREG(sb.st_mode)) ? true : false;
+	}
+
+	if (!state->transfer.sparse_input_holes)
+		return 0;
+
+	offset = (off_t) lseek(fd, 0, SEEK_CUR);
+	if (offset < 0) {
+		state->transfer.sparse_input_holes = false;
+		return 0;
+	}
+
+	/* Still within the data found last time - just don't read past it. */
+	if (offset < state->transfer.sparse_data_end) {
+		if ((off_t) (*bytes_can_read) > state->transfer.sparse_data_end - offset)
+			*bytes_can_read = (size_t) (state->transfer.sparse_data_end - offset);
+		return 0;
+	}
+
+	/*
+	 * Find the next data at or after the current position; ENXIO means
+	 * there is none, so the rest of the file is a hole.  Note that
+	 * SEEK_DATA and SEEK_HOLE move the file position, so it has to be
+	 * put back afterwards.
+	 */
+	data_start = (off_t) lseek(fd, offset, SEEK_DATA);
+	if (data_start < 0) {
+		struct stat sb;
+		if ((ENXIO != errno) || (0 != fstat(fd, &sb))) {
+			debug("%s: %s", "SEEK_DATA failed - not skipping input holes", strerror(errno));
+			state->transfer.sparse_input_holes = false;
+			(void) lseek(fd, offset, SEEK_SET);
+			return 0;
+		}
+		data_start = sb.st_size;
+	}
+
+	if (data_start <= offset) {
+		off_t data_end;
+
+		data_end = (off_t) lseek(fd, offset, SEEK_HOLE);
+		if (offset != (off_t) lseek(fd, offset, SEEK_SET)) {
+			state->transfer.sparse_input_holes = false;
+			return 0;
+		}
+		if (data_end <= offset) {
+			state->transfer.sparse_input_holes = false;
+			return 0;
+		}
+		state->transfer.sparse_data_end = data_end;
+		if ((off_t) (*bytes_can_read) > data_end - offset)
+			*bytes_can_read = (size_t) (data_end - offset);
+		return 0;
+	}
+
+	if (state->transfer.read_position != state->transfer.write_position) {
+		(void) lseek(fd, offset, SEEK_SET);
+		return -1;
+	}
+
+	hole_length = data_start - offset;
+	if (hole_length > PV_SPARSE_SKIP_MAX)
+		hole_length = PV_SPARSE_SKIP_MAX;
+	if ((state->control.rate_limit > 0 || max_to_write != 0) && (hole_length > max_to_write))
+		hole_length = max_to_write;
+	if (state->control.stop_at_size && (state->control.size > 0)
+	    && (hole_length > state->control.size - state->transfer.total_bytes_read))
+		hole_length = state->control.size - state->transfer.total_bytes_read;
+
+	if ((hole_length < 1) || ((off_t) - 1 == lseek(fd, offset + hole_length, SEEK_SET))) {
+		(void) lseek(fd, offset, SEEK_SET);
+		return 0;
+	}
+
+	if ((off_t) - 1 == lseek(state->control.output_fd, hole_length, SEEK_CUR)) {
+		debug("%s: %s", "output lseek() failed", strerror(errno));
+		state->transfer.output_not_seekable = true;
+		(void) lseek(fd, offset, SEEK_SET);
+		return 0;
+	}
+
+	debug("%s: %lld @ %lld", "skipped input hole", (long long) hole_length, (long long) offset);
+
+	return hole_length;
+}
+#endif				/* SEEK_DATA && SEEK_HOLE */
+
+
+#ifdef HAVE_SPLICE
+/*
+ * Try to copy up to "count" bytes from "fd" to the output within the
+ * kernel, without them passing through the transfer buffer - using
+ * copy_file_range() if both are regular files, which also lets
+ * filesystems that support it share extents or copy server-side, or
+ * sendfile() if the input is a regular file and the output is a socket.
+ *
+ * Returns the number of bytes copied, or -1 with errno set to EAGAIN or
+ * EINTR if the output is busy; or -2 if neither method applies, in which
+ * case splice() or read() should be used instead.
+ *
+ * Like splice(), each method is disabled for the current input if it
+ * fails (state->transfer.copy_range_failed_fd and sendfile_failed_fd), so
+ * that the normal path can take over and report any real error.  This is
+ * also done if copy_file_range() returns 0 when asked for some data, since
+ * some special files (such as in /proc) report no data to it even though
+ * read() would find some.
+ *
+ * If "count" is 0, nothing is called, and 0 is returned.
+ */
+static ssize_t pv__transfer_offload(pvstate_t state, int fd, size_t count)
+{
+	if (0 == count)
+		return 0;
+
+	if (fd != state->transfer.offload_checked_fd) {
+		struct stat isb, osb;
+
+		state->transfer.offload_checked_fd = fd;
+		state->transfer.offload_file_to_file = false;
+		state->transfer.offload_file_to_socket = false;
+
+		if ((0 == fstat(fd, &isb)) && S_ISREG(isb.st_mode) && (0 == fstat(state->control.output_fd, &osb))) {
+			if (S_ISREG(osb.st_mode)) {
+				state->transfer.offload_file_to_file = true;
+			} else if (S_ISSOCK(osb.st_mode)) {
+				state->transfer.offload_file_to_socket = true;
+			}
+		}
+	}
+
+#ifdef HAVE_COPY_FILE_RANGE
+	if (state->transfer.offload_file_to_file && (fd != state->transfer.copy_range_failed_fd)) {
+		ssize_t ncopied;
+
+		/*@-nullpass@ */
+		/*@-unrecog@ *//* splint doesn't know about copy_file_range */
+		ncopied = copy_file_range(fd, NULL, state->control.output_fd, NULL, count, 0);
+		/*@+unrecog@ */
+		/*@+nullpass@ */
+		if ((ncopied > 0) || ((ncopied < 0) && ((EAGAIN == errno) || (EINTR == errno))))
+			return ncopied;
+		debug("%s %d: %s: %s", "fd", fd, "copy_file_range failed - disabling",
+		      0 == ncopied ? "no data" : strerror(errno));
+		state->transfer.copy_range_failed_fd = fd;
+	}
+#endif				/* HAVE_COPY_FILE_RANGE */
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+	if (state->transfer.offload_file_to_socket && (fd != state->transfer.sendfile_failed_fd)) {
+		ssize_t nsent;
+
+		/*@-nullpass@ */
+		/*@-unrecog@ *//* splint doesn't know about sendfile */
+		nsent = sendfile(state->control.output_fd, fd, NULL, count);
+		/*@+unrecog@ */
+		/*@+nullpass@ */
+		if ((nsent >= 0) || (EAGAIN == errno) || (EINTR == errno))
+			return nsent;
+		debug("%s %d: %s: %s", "fd", fd, "sendfile failed - disabling", strerror(errno));
+		state->transfer.sendfile_failed_fd = fd;
+	}
+#endif				/* HAVE_SENDFILE && HAVE_SYS_SENDFILE_H */
+
+	return -2;
+}
+
+
+#ifdef HAVE_TEE
+static void pv__transfer_track_output(pvstate_t, const char *, size_t, /*@null@ */ long *);
+
+/*
+ * Close the private pipe that tee() copies the input into, discarding
+ * whatever is still in it, and the /dev/null descriptor used to drop
+ * parts of the copy.
+ */
+static void pv__transfer_tee_close(pvstate_t state)
+{
+	if (state->transfer.tee_pipe[0] >= 0)
+		(void) close(state->transfer.tee_pipe[0]);
+	if (state->transfer.tee_pipe[1] >= 0)
+		(void) close(state->transfer.tee_pipe[1]);
+	if (state->transfer.tee_discard_fd >= 0)
+		(void) close(state->transfer.tee_discard_fd);
+	state->transfer.tee_pipe[0] = -1;
+	state->transfer.tee_pipe[1] = -1;
+	state->transfer.tee_discard_fd = -1;
+	state->transfer.tee_pending = 0;
+	state->transfer.tee_unconsumed = 0;
+}
+
+
+/*
+ * Open the private pipe for tee(), if it isn't already open, making both
+ * ends non-blocking and trying to make it as big as the transfer buffer,
+ * since that caps how much can be copied at once; and open /dev/null to
+ * splice the unwanted parts of the copy into.  Returns false on error.
+ */
+static bool pv__transfer_tee_open(pvstate_t state)
+{
+	int fds[2];
+	int discard_fd;
+
+	if (state->transfer.tee_pipe[0] >= 0)
+		return true;
+
+	discard_fd = open("/dev/null", O_WRONLY);	/* flawfinder: ignore */
+	/* flawfinder - fixed path, write only. */
+	if (discard_fd < 0) {
+		debug("%s: %s", "/dev/null", strerror(errno));
+		return false;
+	}
+
+	if (0 != pipe(fds)) {
+		debug("%s: %s", "pipe", strerror(errno));
+		(void) close(discard_fd);
+		return false;
+	}
+
+	(void) fcntl(discard_fd, F_SETFD, FD_CLOEXEC);
+	(void) fcntl(fds[0], F_SETFL, O_NONBLOCK | fcntl(fds[0], F_GETFL));
+	(void) fcntl(fds[1], F_SETFL, O_NONBLOCK | fcntl(fds[1], F_GETFL));
+	(void) fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	(void) fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#ifdef F_SETPIPE_SZ
+	if (state->transfer.buffer_size <= (size_t) INT_MAX)
+		(void) fcntl(fds[1], F_SETPIPE_SZ, (int) (state->transfer.buffer_size));
+#endif
+
+	state->transfer.tee_pipe[0] = fds[0];
+	state->transfer.tee_pipe[1] = fds[1];
+	state->transfer.tee_discard_fd = discard_fd;
+	state->transfer.tee_pending = 0;
+
+	debug("%s: %d, %d", "opened tee pipe", fds[0], fds[1]);
+
+	return true;
+}
+
+
+/*
+ * Take the next "count" bytes of the copy out of the private pipe, and
+ * pass them to pv__transfer_track_output(), using the free part of the
+ * transfer buffer to hold them.  Returns the number of bytes taken out,
+ * which is less than "count" if they couldn't all be taken out yet.
+ *
+ * Outside line mode, only the end of what was written matters (for the
+ * last bytes written and the previous line), so all but the last
+ * PV_TEE_TAIL bytes are dropped by splicing them to /dev/null, without
+ * them ever being copied into our memory - unless --hash needs them all.
+ */
+static size_t pv__transfer_tee_consume(pvstate_t state, size_t count, /*@null@ */ long *lineswritten)
+{
+	char fallback[PV_TEE_TAIL];
+	char *scratch;
+	size_t scratch_size;
+	size_t consumed = 0;
+
+	if ((!state->control.linemode) && (0 == state->control.hash_algorithms)) {
+		while (count > PV_TEE_TAIL) {
+			ssize_t ndropped;
+
+			/*@-nullpass@ */
+			/*@-type@ */
+			/* splint doesn't know about splice */
+			ndropped =
+			    splice(state->transfer.tee_pipe[0], NULL, state->transfer.tee_discard_fd, NULL,
+				   count - PV_TEE_TAIL, SPLICE_F_NONBLOCK);
+			/*@+type@ */
+			/*@+nullpass@ */
+			if ((ndropped < 0) && (EINTR == errno))
+				continue;
+			if (ndropped <= 0)
+				return consumed;
+
+			/* The line being received has lost its start. */
+			state->display.next_line_len = 0;
+			state->transfer.last_output_position += (off_t) ndropped;
+			count -= (size_t) ndropped;
+			consumed += (size_t) ndropped;
+		}
+	}
+
+	scratch = state->transfer.transfer_buffer + state->transfer.read_position;
+	scratch_size = state->transfer.buffer_size - state->transfer.read_position;
+	if (scratch_size < sizeof(fallback)) {
+		scratch = fallback;
+		scratch_size = sizeof(fallback);
+	}
+
+	while (count > 0) {
+		ssize_t nread;
+
+		nread = read(state->transfer.tee_pipe[0], scratch,	/* flawfinder: ignore */
+			     count < scratch_size ? count : scratch_size);
+		/* flawfinder - bounded by the size of the scratch area. */
+		if ((nread < 0) && (EINTR == errno))
+			continue;
+		if (nread <= 0)
+			return consumed;
+
+		pv__transfer_track_output(state, scratch, (size_t) nread, lineswritten);
+		count -= (size_t) nread;
+		consumed += (size_t) nread;
+	}
+
+	return consumed;
+}
+
+
+/*
+ * Take the copy of everything already spliced to the output out of the
+ * private pipe, as far as possible.  Returns false if some of it is still
+ * there, in which case it stays in state->transfer.tee_unconsumed, to be
+ * taken out first on the next call.
+ */
+static bool pv__transfer_tee_catch_up(pvstate_t state, /*@null@ */ long *lineswritten)
+{
+	if (0 == state->transfer.tee_unconsumed)
+		return true;
+
+	state->transfer.tee_unconsumed -=
+	    pv__transfer_tee_consume(state, state->transfer.tee_unconsumed, lineswritten);
+	if (0 == state->transfer.tee_unconsumed)
+		return true;
+
+	debug("%s: %ld", "tee pipe read incomplete - bytes held back", (long) (state->transfer.tee_unconsumed));
+	return false;
+}
+
+
+/*
+ * Move up to "count" bytes from the input pipe "fd" to the output with
+ * splice(), while copying them with tee() into the private pipe and
+ * taking the copy back out, so that line counting and the display of the
+ * previous line or the last bytes written still see the data even though
+ * it never passes through the transfer buffer.  Since tee() only
+ * duplicates references to the pipe's pages, the data is only copied
+ * into our memory where it is actually looked at.
+ *
+ * If the output takes fewer bytes than were copied, the remainder is in
+ * state->transfer.tee_pending, and is spliced before anything else is
+ * copied.
+ *
+ * Nothing more is moved until the copy of everything already moved has
+ * been taken back out, so that none of it is missed by the line count,
+ * the display, or --hash; until then, -1 is returned with errno set to
+ * EAGAIN.
+ *
+ * Returns the number of bytes moved, 0 at the end of the input, or -1 with
+ * errno set on error; or -2 if tee() or splice() can't be used on this
+ * input (in which case the failed fd is recorded), so read() should be
+ * used instead.
+ */
+static ssize_t pv__transfer_tee(pvstate_t state, int fd, size_t count, /*@null@ */ long *lineswritten)
+{
+	ssize_t nspliced;
+
+	if (!pv__transfer_tee_catch_up(state, lineswritten)) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (0 == state->transfer.tee_pending) {
+		ssize_t ncopied;
+
+		if (!pv__transfer_tee_open(state)) {
+			state->transfer.tee_failed_fd = fd;
+			return -2;
+		}
+
+		/*@-unrecog@ *//* splint doesn't know about tee */
+		ncopied = tee(fd, state->transfer.tee_pipe[1], count, SPLICE_F_NONBLOCK);
+		/*@+unrecog@ */
+		if (0 == ncopied)
+			return 0;
+		if (ncopied < 0) {
+			if ((EAGAIN == errno) || (EINTR == errno))
+				return -1;
+			debug("%s %d: %s: %s", "fd", fd, "tee failed - disabling", strerror(errno));
+			state->transfer.tee_failed_fd = fd;
+			return -2;
+		}
+		state->transfer.tee_pending = (size_t) ncopied;
+	}
+
+	if (count > state->transfer.tee_pending)
+		count = state->transfer.tee_pending;
+
+	/*@-nullpass@ */
+	/*@-type@ */
+	/* splint doesn't know about splice */
+	nspliced = splice(fd, NULL, state->control.output_fd, NULL, count, SPLICE_F_MORE);
+	/*@+type@ */
+	/*@+nullpass@ */
+	if (nspliced < 0) {
+		if (EINVAL == errno) {
+			debug("%s %d: %s", "fd", fd, "splice failed with EINVAL - disabling");
+			state->transfer.splice_failed_fd = fd;
+			/* The input still holds what was copied, so drop the copy. */
+			pv__transfer_tee_close(state);
+			return -2;
+		}
+		return -1;
+	}
+
+	state->transfer.tee_pending -= (size_t) nspliced;
+	state->transfer.tee_unconsumed += (size_t) nspliced;
+	(void) pv__transfer_tee_catch_up(state, lineswritten);
+
+	return nspliced;
+}
+#endif				/* HAVE_TEE */
+#endif				/* HAVE_SPLICE */
+
+
 /*
  * Read some data from the given file descriptor. Returns zero if there was
  * a transient error and we need to return 0 from pv_transfer, otherwise
@@ -328,7 +898,8 @@ static ssize_t pv__transfer_write_repeated(int fd, char *buf, size_t count, bool
  * sets *eof_in to true.  If all data in the buffer has been written at this
  * point, then also sets *eof_out to true.
  */
-static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t max_to_write)
+static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t max_to_write,
+			     /*@null@ */ long *lineswritten)
 {
 	bool do_not_skip_errors;
 	size_t bytes_can_read;
@@ -339,57 +910,146 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 	if (0 == state->control.skip_errors)
 		do_not_skip_errors = true;
 
-	bytes_can_read = state->transfer.buffer_size - state->transfer.read_position;
+	bytes_can_read = pv__transfer_read_limit(state);
+
+	nread = 0;
 
 	/*
-	 * Don't read past control.size if stop_at_size is true (issue
-	 * #166).
-	 *
-	 * This isn't workable in line mode.
+	 * With --error-map, skip what isn't to be read on this pass, and
+	 * keep reads within the current range or block.
 	 */
-	if (state->control.stop_at_size && !state->control.linemode) {
-		off_t bytes_remaining_to_read = state->control.size - state->transfer.total_bytes_read;
-		if ((long long) bytes_can_read > (long long) bytes_remaining_to_read) {
-			debug("%lld > (%lld-%lld=%lld): %s", (long long) bytes_can_read,
-			      (long long) (state->control.size), (long long) state->transfer.total_bytes_read,
-			      (long long) bytes_remaining_to_read, "truncating for stop-at-size");
-			bytes_can_read = (size_t) bytes_remaining_to_read;
+	if (NULL != state->rescue.map) {
+		off_t skipped;
+
+		skipped = pv_rescue_read_limit(state, fd, &bytes_can_read);
+		if (skipped < 0) {
+			/* The buffer needs to be written out before skipping. */
+			return 1;
+		} else if (skipped > 0) {
+			state->transfer.written += (ssize_t) skipped;
+			state->transfer.total_bytes_read += skipped;
+			state->transfer.read_errors_in_a_row = 0;
+			return 1;
 		}
 	}
 
-	nread = 0;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	/*
+	 * In sparse output mode, skip holes in the input without reading
+	 * them, counting them as transferred.  Line mode and --tee outputs
+	 * need to see every byte, as do --hash and skipping read errors,
+	 * which seeks the input itself; and with --merge, there is more than
+	 * one input.
+	 */
+	if (state->control.sparse_output && (!state->transfer.output_not_seekable)
+	    && (!state->control.linemode) && (0 == state->control.skip_errors) && (0 == state->fanout.count)
+	    && (0 == state->merge.count) && (0 == state->control.hash_algorithms)) {
+		off_t skipped;
+
+		skipped = pv__transfer_skip_input_hole(state, fd, &bytes_can_read, max_to_write);
+		if (skipped < 0) {
+			/* At a hole, but the buffer needs to be written out first. */
+			return 1;
+		} else if (skipped > 0) {
+			state->transfer.written += (ssize_t) skipped;
+			state->transfer.total_bytes_read += skipped;
+			state->transfer.read_errors_in_a_row = 0;
+			return 1;
+		}
+	}
+#endif				/* SEEK_DATA && SEEK_HOLE */
 
 #ifdef HAVE_SPLICE
 	state->transfer.splice_used = false;
-	if ((!state->control.linemode) && (!state->control.no_splice)
-	    && (fd != state->transfer.splice_failed_fd)
-	    && (0 == state->transfer.to_write)) {
+	/*
+	 * The --tee outputs are written from the buffer, so need it filled,
+	 * and --merge reads from several inputs through it.
+	 */
+	if ((!state->control.no_splice) && (0 == state->transfer.to_write) && (0 == state->fanout.count)
+	    && (0 == state->merge.count)) {
 		size_t bytes_to_splice;
+		bool watching_data;
 
-		if (state->control.rate_limit > 0 || max_to_write != 0) {
+		/*
+		 * Nothing passes through the buffer, so the buffer space
+		 * isn't a limit, but it is still used to cap the amount
+		 * transferred in one call, along with the rate limit and
+		 * --stop-at-size.
+		 */
+		bytes_to_splice = bytes_can_read;
+		if ((state->control.rate_limit > 0 || max_to_write != 0) && (max_to_write < (off_t) bytes_to_splice)) {
 			bytes_to_splice = (size_t) max_to_write;
-		} else {
-			bytes_to_splice = bytes_can_read;
 		}
 
-		/*@-nullpass@ */
-		/*@-type@ */
-		/* splint doesn't know about splice */
-		nread = splice(fd, NULL, state->control.output_fd, NULL, bytes_to_splice, SPLICE_F_MORE);
-		/*@+type@ */
-		/*@+nullpass@ */
+		/*
+		 * If the rate limit allows nothing to be written yet, don't
+		 * call anything - a 0 from copy_file_range() or splice()
+		 * would look like the end of the input, or like the method
+		 * not working, and the data would go through the buffer
+		 * instead.
+		 */
+		if ((0 == bytes_to_splice) && (bytes_can_read > 0)) {
+			debug("%s %d: %s", "fd", fd, "rate limit allows nothing yet - not splicing");
+			return 1;
+		}
 
-		state->transfer.splice_used = true;
-		if ((nread < 0) && (EINVAL == errno)) {
-			debug("%s %d: %s", "fd", fd, "splice failed with EINVAL - disabling");
-			state->transfer.splice_failed_fd = fd;
-			state->transfer.splice_used = false;
+		/*
+		 * Line mode, showing the previous line or the last bytes
+		 * written, and --hash, all need to see the data.
+		 */
+		watching_data = state->control.linemode || state->display.showing_previous_line
+		    || state->display.showing_last_written || (0 != state->control.hash_algorithms);
+
+		if (watching_data) {
+#ifdef HAVE_TEE
 			/*
-			 * Fall through to read() below.
+			 * Copy the data for them with tee(), unless the line
+			 * mode rate limit or --stop-at-size needs the writes
+			 * to be trimmed to whole lines.
 			 */
-		} else if (nread > 0) {
-			state->transfer.written = nread;
-			state->transfer.total_bytes_read += nread;
+			if ((fd != state->transfer.tee_failed_fd) && (fd != state->transfer.splice_failed_fd)
+			    && (!(state->control.linemode
+				  && ((state->control.rate_limit > 0) || state->control.stop_at_size)))) {
+				nread = pv__transfer_tee(state, fd, bytes_to_splice, lineswritten);
+				if (-2 != nread)
+					state->transfer.splice_used = true;
+			}
+#endif				/* HAVE_TEE */
+		} else {
+			/*
+			 * Try copy_file_range() or sendfile() first, and
+			 * splice() if neither of those applies.
+			 */
+			nread = pv__transfer_offload(state, fd, bytes_to_splice);
+			if (-2 != nread)
+				state->transfer.splice_used = true;
+		}
+
+		if (watching_data || state->transfer.splice_used) {
+			/* Already handled above. */
+		} else if (fd != state->transfer.splice_failed_fd) {
+			/*@-nullpass@ */
+			/*@-type@ */
+			/* splint doesn't know about splice */
+			nread = splice(fd, NULL, state->control.output_fd, NULL, bytes_to_splice, SPLICE_F_MORE);
+			/*@+type@ */
+			/*@+nullpass@ */
+
+			state->transfer.splice_used = true;
+			if ((nread < 0) && (EINVAL == errno)) {
+				debug("%s %d: %s", "fd", fd, "splice failed with EINVAL - disabling");
+				state->transfer.splice_failed_fd = fd;
+				state->transfer.splice_used = false;
+				/*
+				 * Fall through to read() below.
+				 */
+			}
+		}
+
+		if (!state->transfer.splice_used) {
+			/* Neither worked - use read() below. */
+		} else if (nread > 0) {
+			state->transfer.written = nread;
 #ifdef HAVE_FDATASYNC
 			if (state->control.sync_after_write) {
 				/*
@@ -415,15 +1075,24 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 			state->transfer.splice_used = false;
 		}
 	}
-	if (!state->transfer.splice_used) {
+	if (state->merge.count > 0) {
+		/* Read errors end just that input, and are never skipped. */
+		nread = pv_merge_read(state, state->transfer.transfer_buffer + state->transfer.read_position,
+				      bytes_can_read);
+	} else if (!state->transfer.splice_used) {
 		nread =
 		    pv__transfer_read_repeated(fd, state->transfer.transfer_buffer + state->transfer.read_position,
 					       bytes_can_read);
 	}
 #else
-	nread =
-	    pv__transfer_read_repeated(fd, state->transfer.transfer_buffer + state->transfer.read_position,
-				       bytes_can_read);
+	if (state->merge.count > 0) {
+		nread = pv_merge_read(state, state->transfer.transfer_buffer + state->transfer.read_position,
+				      bytes_can_read);
+	} else {
+		nread =
+		    pv__transfer_read_repeated(fd, state->transfer.transfer_buffer + state->transfer.read_position,
+					       bytes_can_read);
+	}
 #endif				/* HAVE_SPLICE */
 
 
@@ -437,6 +1106,20 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 		*eof_in = true;
 		if (state->transfer.write_position >= state->transfer.read_position)
 			*eof_out = true;
+		/* The next input file may be given the same descriptor. */
+		state->transfer.sparse_input_fd = -1;
+#ifdef HAVE_THREADS
+		state->transfer.parallel_fd = -1;
+#endif				/* HAVE_THREADS */
+#ifdef HAVE_SPLICE
+		state->transfer.offload_checked_fd = -1;
+		state->transfer.copy_range_failed_fd = -1;
+		state->transfer.sendfile_failed_fd = -1;
+#ifdef HAVE_TEE
+		state->transfer.tee_failed_fd = -1;
+		pv__transfer_tee_close(state);
+#endif				/* HAVE_TEE */
+#endif				/* HAVE_SPLICE */
 		return 1;
 	} else if (nread > 0) {
 		/*
@@ -445,6 +1128,15 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 		 * we've got in the buffer.
 		 */
 		state->transfer.read_errors_in_a_row = 0;
+		pv_rescue_read_done(state, nread);
+		if (state->control.auto_buffer)
+			pv_autotune_note_read(state, nread);
+		pv_bottleneck_note_read(state, nread);
+#ifdef HAVE_SPLICE
+		/* With splice(), the data has been written as well. */
+		if (state->transfer.splice_used)
+			pv_bottleneck_note_write(state, nread);
+#endif				/* HAVE_SPLICE */
 #ifdef HAVE_SPLICE
 		/*
 		 * If we used splice(), there isn't any more data in the
@@ -530,11 +1222,14 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 	}
 
 	/*
-	 * If a non-zero error skip block size was given, just use that,
+	 * With --error-map, the map decides how far to skip.  Otherwise, if
+	 * a non-zero error skip block size was given, just use that,
 	 * otherwise start small and ramp up based on the number of errors
 	 * in a row.
 	 */
-	if (state->control.error_skip_block > 0) {
+	if (NULL != state->rescue.map) {
+		amount_to_skip = pv_rescue_skip_amount(state, orig_offset, bytes_can_read);
+	} else if (state->control.error_skip_block > 0) {
 		amount_to_skip = state->control.error_skip_block;
 	} else {
 		if (state->transfer.read_errors_in_a_row < 10) {
@@ -552,7 +1247,7 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 	 * skip amount size.  For instance if the skip amount is 512, but
 	 * our file offset is 257, we'll jump to 512 instead of 769.
 	 */
-	if (amount_to_skip > 1) {
+	if ((amount_to_skip > 1) && (NULL == state->rescue.map)) {
 		skip_offset = orig_offset + amount_to_skip;
 		skip_offset -= (skip_offset % amount_to_skip);
 		if (skip_offset > orig_offset) {
@@ -612,6 +1307,7 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 	if (amount_skipped > 0) {
 		memset(state->transfer.transfer_buffer + state->transfer.read_position, 0, (size_t) amount_skipped);
 		state->transfer.read_position += amount_skipped;
+		pv_rescue_read_failed(state, orig_offset, amount_skipped);
 		if (state->control.skip_errors < 2) {
 			/*@-compdef@ */
 			pv_error("%s: %s: %ld - %ld (%ld %s)",
@@ -635,6 +1331,366 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
 }
 
 
+static int pv__transfer_write_result(pvstate_t, ssize_t, int, bool *, bool *, long *);
+
+
+/*
+ * Return the block size to use for sparse output, which is the output's
+ * preferred I/O block size if it can be found, and a sensible default
+ * otherwise.
+ */
+static size_t pv__transfer_sparse_block_size(pvstate_t state)
+{
+	struct stat sb;
+	size_t block_size;
+
+	if (state->transfer.sparse_block_size > 0)
+		return state->transfer.sparse_block_size;
+
+	block_size = PV_SPARSE_BLOCK_DEFAULT;
+	if ((0 == fstat(state->control.output_fd, &sb)) && (sb.st_blksize > 0))
+		block_size = (size_t) (sb.st_blksize);
+	if (block_size < 512)
+		block_size = 512;
+	if (block_size > PV_SPARSE_BLOCK_MAX)
+		block_size = PV_SPARSE_BLOCK_MAX;
+
+	debug("%s: %ld", "sparse output block size", (long) block_size);
+	state->transfer.sparse_block_size = block_size;
+
+	return block_size;
+}
+
+
+/*
+ * Write state->transfer.to_write bytes of data from the transfer buffer to
+ * the output in sparse mode, looking at it one output block at a time,
+ * aligned to the output position: runs of blocks that are entirely null
+ * are skipped over with lseek(), and only the runs in between are written.
+ *
+ * If lseek() fails, state->transfer.output_not_seekable is set, and the
+ * rest is written normally.
+ *
+ * Returns the number of bytes written or skipped, or -1 on error with
+ * errno set, like pv__transfer_write_repeated().
+ */
+static ssize_t pv__transfer_write_sparse(pvstate_t state)
+{
+	char *data;
+	size_t block_size, length, done;
+	off_t offset;
+
+	data = state->transfer.transfer_buffer + state->transfer.write_position;
+	length = (size_t) (state->transfer.to_write);
+	block_size = pv__transfer_sparse_block_size(state);
+
+	/*@+longintegral@ */
+	/* splint has trouble with off_t / __off_t, in the lseek() calls. */
+	offset = (off_t) lseek(state->control.output_fd, 0, SEEK_CUR);
+	if (offset < 0) {
+		debug("%s: %s", "output lseek() failed", strerror(errno));
+		state->transfer.output_not_seekable = true;
+		offset = 0;
+	}
+
+	done = 0;
+	while (done < length) {
+		size_t run, next;
+		bool null_run;
+		ssize_t nwritten;
+
+		/* The first block of the run ends at a block boundary. */
+		run = block_size - (size_t) (offset % (off_t) block_size);
+		if (run > length - done)
+			run = length - done;
+		null_run = pv_is_zero(data + done, run);
+
+		/* Extend the run over the following blocks of the same kind. */
+		while (done + run < length) {
+			next = length - done - run;
+			if (next > block_size)
+				next = block_size;
+			if (pv_is_zero(data + done + run, next) != null_run)
+				break;
+			run += next;
+		}
+
+		if (null_run && !state->transfer.output_not_seekable) {
+			if ((off_t) - 1 != lseek(state->control.output_fd, (off_t) run, SEEK_CUR)) {
+				debug("%s: %ld", "skipped null writes", (long) run);
+				done += run;
+				offset += (off_t) run;
+				continue;
+			}
+			debug("%s: %s", "output lseek() failed", strerror(errno));
+			state->transfer.output_not_seekable = true;
+		}
+
+		nwritten =
+		    pv__transfer_write_repeated(state->control.output_fd, data + done, run,
+						state->control.sync_after_write);
+		if (nwritten < 0) {
+			/* Report what was done so far; the error will recur. */
+			if (done > 0)
+				break;
+			return -1;
+		}
+
+		done += (size_t) nwritten;
+		offset += (off_t) nwritten;
+
+		/* Stop after a partial write, as the output is busy. */
+		if ((size_t) nwritten < run)
+			break;
+	}
+	/*@-longintegral@ */
+
+	return (ssize_t) done;
+}
+
+
+/*
+ * Return true if a write to the output could be held up waiting for
+ * whatever is reading from it - a pipe, socket, or terminal - so that the
+ * write needs a timer to interrupt it.  Writes to regular files and block
+ * devices never wait for a reader, so they are done without the timer,
+ * saving two setitimer() calls per write.
+ */
+static bool pv__transfer_output_may_block(pvstate_t state)
+{
+	struct stat sb;
+
+	if (state->transfer.output_block_checked)
+		return state->transfer.output_may_block;
+
+	state->transfer.output_block_checked = true;
+	state->transfer.output_may_block = true;
+
+	memset(&sb, 0, sizeof(sb));
+	if ((0 == fstat(state->control.output_fd, &sb)) && (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode)))
+		state->transfer.output_may_block = false;
+
+	debug("%s: %s", "output write timer", state->transfer.output_may_block ? "needed" : "not needed");
+
+	return state->transfer.output_may_block;
+}
+
+
+/*
+ * Return the size that transfers to and from "fd" must be a multiple of,
+ * and be aligned to, because it is a regular file or block device with
+ * O_DIRECT set - or 0 if there is no such restriction.
+ */
+static size_t pv__transfer_direct_block_of(int fd)
+{
+#ifdef O_DIRECT
+	struct stat sb;
+	int flags;
+	long alignment;
+
+	flags = fcntl(fd, F_GETFL);
+	if ((flags < 0) || (0 == (flags & O_DIRECT)))
+		return 0;
+
+	memset(&sb, 0, sizeof(sb));
+	if ((0 != fstat(fd, &sb)) || !(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode)))
+		return 0;
+
+	/* The same alignment as pv__allocate_aligned_buffer() uses. */
+#if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
+	alignment = sysconf(_SC_PAGESIZE);
+#else				/* ! defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE) */
+	alignment = 8192;
+#endif				/* defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE) */
+#if defined(HAVE_FPATHCONF) && defined(_PC_REC_XFER_ALIGN)
+	if (fpathconf(fd, _PC_REC_XFER_ALIGN) > alignment)
+		alignment = fpathconf(fd, _PC_REC_XFER_ALIGN);
+#endif				/* defined(HAVE_FPATHCONF) && defined(_PC_REC_XFER_ALIGN) */
+	if (alignment < 512)
+		alignment = 512;
+
+	debug("%s %d: %s: %ld", "fd", fd, "O_DIRECT block size", alignment);
+
+	return (size_t) alignment;
+#else				/* ! O_DIRECT */
+	return 0;
+#endif				/* O_DIRECT */
+}
+
+
+/*
+ * Return pv__transfer_direct_block_of() for the output, working it out
+ * again only when the output changes.
+ */
+static size_t pv__transfer_direct_block(pvstate_t state)
+{
+	if (state->control.output_fd == state->transfer.direct_checked_fd)
+		return state->transfer.direct_block;
+
+	/* A buffered descriptor for the previous output is no use now. */
+	if (state->transfer.direct_tail_fd >= 0)
+		(void) close(state->transfer.direct_tail_fd);
+	state->transfer.direct_tail_fd = -1;
+	state->transfer.direct_tail_failed = false;
+
+	state->transfer.direct_checked_fd = state->control.output_fd;
+	state->transfer.direct_block = pv__transfer_direct_block_of(state->control.output_fd);
+
+	return state->transfer.direct_block;
+}
+
+
+/*
+ * Return the offset in the output that the next write will go to, which is
+ * the end of the file if it was opened in append mode, or -1 on error.
+ */
+static off_t pv__transfer_output_offset(pvstate_t state)
+{
+	struct stat sb;
+	int flags;
+
+	flags = fcntl(state->control.output_fd, F_GETFL);
+	if ((flags >= 0) && (0 != (flags & O_APPEND))) {
+		memset(&sb, 0, sizeof(sb));
+		if (0 != fstat(state->control.output_fd, &sb))
+			return -1;
+		return sb.st_size;
+	}
+
+	return lseek(state->control.output_fd, 0, SEEK_CUR);
+}
+
+
+/*
+ * If the output is using O_DIRECT, reduce state->transfer.to_write to a
+ * whole number of blocks, since anything else would fail with "Invalid
+ * argument" (EINVAL).
+ *
+ * Returns true if the write should instead go through the page cache, with
+ * pv__transfer_write_buffered().  This is the case if the output position
+ * is not on a block boundary - to_write is then reduced to reach the next
+ * one, if the data in the buffer is in line with it - or if less than a
+ * block can be written and no more is coming: at the end of the input,
+ * when the buffer is full, or when "allowed" is holding the write back.
+ * Otherwise, if less than a block is waiting, to_write is set to 0 so that
+ * more is read first.
+ */
+static bool pv__transfer_direct_trim(pvstate_t state, bool eof_in)
+{
+	size_t block, misalign, buffer_misalign;
+	off_t offset;
+
+	if ((state->transfer.to_write <= 0) || state->control.discard_input || state->control.sparse_output)
+		return false;
+
+	block = pv__transfer_direct_block(state);
+	if (0 == block)
+		return false;
+
+	offset = pv__transfer_output_offset(state);
+	if (offset < 0)
+		return false;
+
+	misalign = (size_t) (offset % (off_t) block);
+	buffer_misalign = (size_t) (state->transfer.transfer_buffer + state->transfer.write_position) % block;
+
+	/* Buffered writes can't bring the two into line with each other. */
+	if (misalign != buffer_misalign)
+		return true;
+
+	if (misalign > 0) {
+		if ((size_t) (state->transfer.to_write) > block - misalign)
+			state->transfer.to_write = (ssize_t) (block - misalign);
+		return true;
+	}
+
+	if ((size_t) (state->transfer.to_write) >= block) {
+		state->transfer.to_write -= (ssize_t) ((size_t) (state->transfer.to_write) % block);
+		return false;
+	}
+
+	if (eof_in || (state->transfer.read_position >= state->transfer.buffer_size)
+	    || ((size_t) (state->transfer.to_write) < state->transfer.read_position - state->transfer.write_position))
+		return true;
+
+	state->transfer.to_write = 0;
+	return false;
+}
+
+
+/*
+ * Write state->transfer.to_write bytes from the write position in the
+ * transfer buffer to the O_DIRECT output through the page cache, at the
+ * output's current position, and return the number of bytes written, or
+ * -1 on error, like pv__transfer_write_repeated().
+ *
+ * A second descriptor for the output, without O_DIRECT, is opened through
+ * /proc/self/fd the first time; if that isn't possible, O_DIRECT is
+ * cleared on the output just for this write.
+ */
+static ssize_t pv__transfer_write_buffered(pvstate_t state)
+{
+	char *data;
+	size_t count;
+	ssize_t nwritten;
+	int fd, flags;
+
+	fd = state->control.output_fd;
+	data = state->transfer.transfer_buffer + state->transfer.write_position;
+	count = (size_t) (state->transfer.to_write);
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return -1;
+
+	if ((state->transfer.direct_tail_fd < 0) && (!state->transfer.direct_tail_failed)) {
+		char path[64];		 /* flawfinder: ignore */
+		/* flawfinder rationale: bounded by snprintf() below. */
+		memset(path, 0, sizeof(path));
+		(void) snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+		state->transfer.direct_tail_fd = open(path, O_WRONLY | (flags & O_APPEND));	/* flawfinder: ignore */
+		/*
+		 * flawfinder rationale: this reopens our own output, which
+		 * we already have open for writing.
+		 */
+		if (state->transfer.direct_tail_fd < 0) {
+			debug("%s: %s: %s", path, "buffered reopen failed", strerror(errno));
+			state->transfer.direct_tail_failed = true;
+		} else {
+			debug("%s %d: %s: %d", "fd", fd, "buffered descriptor for O_DIRECT output",
+			      state->transfer.direct_tail_fd);
+		}
+	}
+
+	if ((state->transfer.direct_tail_fd >= 0) && (0 != (flags & O_APPEND))) {
+		return pv__transfer_write_repeated(state->transfer.direct_tail_fd, data, count,
+						   state->control.sync_after_write);
+	} else if (state->transfer.direct_tail_fd >= 0) {
+		off_t offset = lseek(fd, 0, SEEK_CUR);
+		if ((offset < 0) || (lseek(state->transfer.direct_tail_fd, offset, SEEK_SET) < 0))
+			return -1;
+		nwritten =
+		    pv__transfer_write_repeated(state->transfer.direct_tail_fd, data, count,
+						state->control.sync_after_write);
+		if ((nwritten > 0) && (lseek(fd, offset + (off_t) nwritten, SEEK_SET) < 0))
+			return -1;
+		return nwritten;
+	}
+#ifdef O_DIRECT
+	if (0 != fcntl(fd, F_SETFL, flags & ~O_DIRECT))
+		return -1;
+	nwritten = pv__transfer_write_repeated(fd, data, count, state->control.sync_after_write);
+	if (0 != fcntl(fd, F_SETFL, flags)) {
+		debug("%s %d: %s: %s", "fd", fd, "fcntl", strerror(errno));
+	}
+#else				/* ! O_DIRECT */
+	nwritten = pv__transfer_write_repeated(fd, data, count, state->control.sync_after_write);
+#endif				/* O_DIRECT */
+
+	return nwritten;
+}
+
+
 /*
  * Write state->transfer.to_write bytes of data from the transfer buffer to the output.
  * Returns zero if there was a transient error and we need to return 0 from
@@ -650,14 +1706,13 @@ static int pv__transfer_read(pvstate_t state, int fd, bool *eof_in, bool *eof_ou
  * state->status.exit_status.
  *
  * If state->control.discard_input is true, does not actually write anything.
+ * If "buffered" is true, the data is written with
+ * pv__transfer_write_buffered().
  */
-static int pv__transfer_write(pvstate_t state, bool *eof_in, bool *eof_out, long *lineswritten)
+static int pv__transfer_write(pvstate_t state, bool *eof_in, bool *eof_out, bool buffered, long *lineswritten)
 {
 	ssize_t nwritten;
 	int write_errno;
-	bool all_nulls;
-	off_t output_offset;
-	size_t write_check_position, write_end_position;
 
 	if (NULL == state->transfer.transfer_buffer) {
 		pv_error("%s", _("no transfer buffer allocated"));
@@ -673,289 +1728,536 @@ static int pv__transfer_write(pvstate_t state, bool *eof_in, bool *eof_out, long
 	if (state->control.discard_input) {
 		nwritten = state->transfer.to_write;
 	} else if (state->transfer.to_write > 0) {
+		struct timespec write_start;
+		bool use_timer;
+#if HAVE_SETITIMER
+		struct itimerval new_timer;
+#endif
 
-		/*
-		 * In sparse output mode, check whether all of the bytes to
-		 * be written are null, and if so, try to seek the output
-		 * instead of writing the null bytes.
-		 */
-		if (state->control.sparse_output && !state->transfer.output_not_seekable) {
-			write_check_position = state->transfer.write_position;
-			write_end_position = write_check_position + (size_t) (state->transfer.to_write);
-			all_nulls = true;
-			while (all_nulls && write_check_position < write_end_position) {
-				if ('\0' == state->transfer.transfer_buffer[write_check_position]) {
-					write_check_position++;
-				} else {
-					all_nulls = false;
-				}
-			}
-			if (all_nulls) {
-
-				/*
-				 * Use lseek() to move forward in the file,
-				 * and then ftruncate() it to its new size.
-				 *
-				 * If any step fails, mark the output not
-				 * seekable so we stop trying.
-				 */
-
-				/*@+longintegral@ */
-				/*
-				 * splint has trouble with off_t / __off_t, in the lseek() call.
-				 */
-				output_offset =
-				    lseek(state->control.output_fd, (off_t) (state->transfer.to_write), SEEK_CUR);
-				if (output_offset == (off_t) - 1) {
-					debug("%s: %s", "output lseek() failed", strerror(errno));
-					state->transfer.output_not_seekable = true;
-				} else {
-					/* Seek successful - skip write. */
-					debug("%s (%ld) -> %s: %ld", "skipped null writes",
-					      (long) (state->transfer.to_write), "new position", (long) output_offset);
-					nwritten = state->transfer.to_write;
-					goto pv__transfer_write_completed;
-				}
-				/*@-longintegral@ */
-			}
-		}
+		pv_elapsedtime_zero(&write_start);
 
 		/*
 		 * Set an interval timer or an alarm to interrupt the write
 		 * with a signal if the write takes too long, so we can
 		 * continue producing progress information.
+		 *
+		 * Inside another program (libpv), nothing is there to
+		 * catch the signal, so the timer is never used.
 		 */
+		use_timer = (!state->control.embedded) && pv__transfer_output_may_block(state);
+		if (use_timer) {
 #if HAVE_SETITIMER
-		struct itimerval new_timer;
-
-		/*@-unrecog@ */
-		/* splint doesn't know setitimer or ITIMER_REAL */
-		memset(&new_timer, 0, sizeof(new_timer));
-		new_timer.it_value.tv_sec = (time_t) (state->control.interval);
-		new_timer.it_value.tv_usec = (suseconds_t) (((long) (state->control.interval * 1000000.0)) % 1000000);
+			/*@-unrecog@ */
+			/* splint doesn't know setitimer or ITIMER_REAL */
+			memset(&new_timer, 0, sizeof(new_timer));
+			new_timer.it_value.tv_sec = (time_t) (state->control.interval);
+			new_timer.it_value.tv_usec =
+			    (suseconds_t) (((long) (state->control.interval * 1000000.0)) % 1000000);
 
-		/*
-		 * We have to set the interval so that the timer continues
-		 * to repeat while writes are attempted, especially as it's
-		 * possible that the initial timer run will expire
-		 * immediately if the period is less than 1 second.
-		 */
-
-		new_timer.it_interval.tv_sec = new_timer.it_value.tv_sec;
-		new_timer.it_interval.tv_usec = new_timer.it_value.tv_usec;
+			/*
+			 * We have to set the interval so that the timer
+			 * continues to repeat while writes are attempted,
+			 * especially as it's possible that the initial
+			 * timer run will expire immediately if the period
+			 * is less than 1 second.
+			 */
 
-		debug("%s: [%lds,%ldus]", "setting interval timer", (long) (new_timer.it_value.tv_sec),
-		      (long) (new_timer.it_value.tv_usec));
+			new_timer.it_interval.tv_sec = new_timer.it_value.tv_sec;
+			new_timer.it_interval.tv_usec = new_timer.it_value.tv_usec;
 
-		if (0 != setitimer(ITIMER_REAL, &new_timer, NULL)) {
-			pv_error("%s: %s", _("failed to set interval timer"), strerror(errno));
-		}
+			debug("%s: [%lds,%ldus]", "setting interval timer", (long) (new_timer.it_value.tv_sec),
+			      (long) (new_timer.it_value.tv_usec));
 
+			if (0 != setitimer(ITIMER_REAL, &new_timer, NULL)) {
+				pv_error("%s: %s", _("failed to set interval timer"), strerror(errno));
+			}
 #else				/* ! HAVE_SETITIMER */
-		(void) alarm(1);
-		debug("%s", "setting alarm");
+			(void) alarm(1);
+			debug("%s", "setting alarm");
 #endif				/* HAVE_SETITIMER */
+		}
 		debug("%s: %ld %s", "beginning write attempt", (long) (state->transfer.to_write), "bytes");
-		nwritten = pv__transfer_write_repeated(state->control.output_fd,
-						       state->transfer.transfer_buffer +
-						       state->transfer.write_position,
-						       (size_t) (state->transfer.to_write),
-						       state->control.sync_after_write);
+		if (state->transfer.instrumented)
+			pv_elapsedtime_read(&write_start);
+		if (buffered) {
+			nwritten = pv__transfer_write_buffered(state);
+		} else if (state->control.sparse_output && !state->transfer.output_not_seekable) {
+			nwritten = pv__transfer_write_sparse(state);
+		} else if (pv_zerocopy_usable(state, state->control.output_fd, (size_t) (state->transfer.to_write))) {
+			nwritten = pv_zerocopy_send(state,
+						    state->transfer.transfer_buffer + state->transfer.write_position,
+						    (size_t) (state->transfer.to_write));
+		} else {
+			nwritten = pv__transfer_write_repeated(state->control.output_fd,
+							       state->transfer.transfer_buffer +
+							       state->transfer.write_position,
+							       (size_t) (state->transfer.to_write),
+							       state->control.sync_after_write);
+		}
+		if (state->transfer.instrumented) {
+			struct timespec write_end, write_elapsed;
+			pv_elapsedtime_read(&write_end);
+			pv_elapsedtime_subtract(&write_elapsed, &write_end, &write_start);
+			/* Time spent in write() is time waiting for the output. */
+			pv_bottleneck_note_wait(state, false, true, pv_elapsedtime_seconds(&write_elapsed));
+			pv_bottleneck_note_write(state, nwritten);
+		}
 		if (nwritten < 0) {
 			write_errno = (int) errno;
 			debug("%s: %ld: %s", "bytes written", (long) nwritten, strerror(errno));
 		} else {
 			debug("%s: %ld", "bytes written", (long) nwritten);
 		}
+		if (use_timer) {
 #if HAVE_SETITIMER
-		memset(&new_timer, 0, sizeof(new_timer));
-		new_timer.it_interval.tv_sec = 0;
-		new_timer.it_interval.tv_usec = 0;
-		new_timer.it_value.tv_sec = 0;
-		new_timer.it_value.tv_usec = 0;
-		if (0 != setitimer(ITIMER_REAL, &new_timer, NULL)) {
-			pv_error("%s: %s", _("failed to clear interval timer"), strerror(errno));
-		}
-
-		/*@+unrecog@ */
+			memset(&new_timer, 0, sizeof(new_timer));
+			new_timer.it_interval.tv_sec = 0;
+			new_timer.it_interval.tv_usec = 0;
+			new_timer.it_value.tv_sec = 0;
+			new_timer.it_value.tv_usec = 0;
+			if (0 != setitimer(ITIMER_REAL, &new_timer, NULL)) {
+				pv_error("%s: %s", _("failed to clear interval timer"), strerror(errno));
+			}
+			/*@+unrecog@ */
 #else				/* ! HAVE_SETITIMER */
-		debug("%s", "cancelling alarm");
-		(void) alarm(0);
+			debug("%s", "cancelling alarm");
+			(void) alarm(0);
 #endif				/* HAVE_SETITIMER */
+		}
 	}
 
-      pv__transfer_write_completed:
-	/* If lseek() worked for sparse output, it jumps down here. */
+	return pv__transfer_write_result(state, nwritten, write_errno, eof_in, eof_out, lineswritten);
+}
 
-	if (nwritten > 0) {
-		bool tracking_lines = false;
 
-		if ((state->control.linemode) && (lineswritten != NULL))
-			tracking_lines = true;
-		else if (state->display.showing_previous_line)
-			tracking_lines = true;
+/*
+ * Append up to "length" bytes from "data" to the line being received for
+ * the previous-line display ("%L"), truncating the line if it would not fit
+ * in the buffer.
+ */
+static void pv__transfer_append_next_line(pvstate_t state, const char *data, size_t length)
+{
+	size_t space;
 
-		/*
-		 * Write returned >0 - data successfully written.
-		 */
-		if (tracking_lines) {
-			char separator;
-			char *ptr;
-			long lines = 0;
+	if (state->display.next_line_len >= PV_SIZEOF_PREVLINE_BUFFER - 1)
+		return;
 
-			/*
-			 * Tracking lines - either line mode, or we're
-			 * showing the last line in the display, or both.
-			 * So we need to look through what we've just
-			 * written to either count how many lines there
-			 * were, or get the content of the most recent
-			 * complete line, or both.
-			 */
+	space = PV_SIZEOF_PREVLINE_BUFFER - 1 - state->display.next_line_len;
+	if (length > space)
+		length = space;
+	if (0 == length)
+		return;
 
-			/* Allocate buffer to remember line positions. */
-			if (NULL == state->transfer.line_positions && NULL != lineswritten) {
-				state->transfer.line_positions_capacity = MAX_LINE_POSITIONS;
-				/*@-mustfreeonly@ */
-				state->transfer.line_positions =
-				    calloc((size_t) (state->transfer.line_positions_capacity), sizeof(off_t));
-				if (NULL == state->transfer.line_positions) {
-					pv_error("%s: %s", _("line position buffer allocation failed"),
-						 strerror(errno));
-				}
-				/*@+mustfreeonly@ */
-				/* splint doesn't see we only call calloc() when line_positions is NULL. */
-			}
+	memcpy(state->display.next_line + state->display.next_line_len, data, length);	/* flawfinder: ignore */
+	state->display.next_line_len += length;
+	/*
+	 * flawfinder - the length is bounded above so that it fits in the
+	 * remaining space in the buffer.
+	 */
+}
 
-			if (state->control.null_terminated_lines) {
-				separator = '\0';
-			} else {
-				separator = '\n';
-			}
 
-			ptr = (char *) (state->transfer.transfer_buffer + state->transfer.write_position - 1);
-			for (ptr++;
-			     ptr - (char *) state->transfer.transfer_buffer - state->transfer.write_position <
-			     (size_t) nwritten; ptr++, state->transfer.last_output_position++) {
-				if (*ptr != separator) {
-					/*
-					 * If we're displaying the previous
-					 * line ("%L"), add to our line
-					 * buffer.
-					 */
-					if (state->display.showing_previous_line
-					    && state->display.next_line_len < PV_SIZEOF_PREVLINE_BUFFER - 1) {
-						state->display.next_line[state->display.next_line_len] = *ptr;
-						state->display.next_line_len++;
-					}
-					continue;
-				}
+/*
+ * Update the previous-line display buffers ("%L") with the "length" bytes
+ * of "data" that have just been written.
+ *
+ * Only the last complete line in the data needs to be copied to the
+ * previous-line buffer, and only the partial line after it needs to be
+ * kept for next time, so the separators are located with pv_memrchr()
+ * instead of copying out every line in turn.
+ */
+static void pv__transfer_previous_line(pvstate_t state, const char *data, size_t length, char separator)
+{
+	const char *last_separator;
+	const char *line_start;
+
+	last_separator = pv_memrchr(data, (int) separator, length);
+	if (NULL == last_separator) {
+		/* No line was completed - the whole block is a partial line. */
+		pv__transfer_append_next_line(state, data, length);
+		return;
+	}
 
-				/* Separator found - increment line count. */
-				++lines;
+	/*
+	 * If there's an earlier separator in this block, the last complete
+	 * line starts just after it, and the line we had been receiving was
+	 * completed and superseded within this block.
+	 */
+	line_start = data;
+	if (last_separator > data) {
+		const char *previous_separator;
+		previous_separator = pv_memrchr(data, (int) separator, (size_t) (last_separator - data));
+		if (NULL != previous_separator) {
+			line_start = previous_separator + 1;
+			state->display.next_line_len = 0;
+		}
+	}
 
-				/*
-				 * If we're displaying the previous line
-				 * ("%L"), update the previous-line buffer
-				 * with the line we just completed, and
-				 * start a new one.
-				 */
-				if (state->display.showing_previous_line) {
-					memset(state->display.previous_line, 0, PV_SIZEOF_PREVLINE_BUFFER);
-					if (state->display.next_line_len > PV_SIZEOF_PREVLINE_BUFFER - 1)
-						state->display.next_line_len = PV_SIZEOF_PREVLINE_BUFFER - 1;
-					if (state->display.next_line_len > 0) {
-						memcpy(state->display.previous_line, state->display.next_line,	/* flawfinder: ignore */
-						       state->display.next_line_len);
-						debug("%s: [%s]", "updated previous_line",
-						      state->display.previous_line);
-					}
-					state->display.next_line_len = 0;
-					/*
-					 * flawfinder - next_line_len is
-					 * guaranteed to be less than the
-					 * size of the previous_line buffer
-					 * since we check it just before
-					 * memcpy(), and we ensure that the
-					 * last byte in the buffer is \0.
-					 */
-				}
+	pv__transfer_append_next_line(state, line_start, (size_t) (last_separator - line_start));
 
-				if (NULL == state->transfer.line_positions)
-					continue;
+	memset(state->display.previous_line, 0, PV_SIZEOF_PREVLINE_BUFFER);
+	if (state->display.next_line_len > PV_SIZEOF_PREVLINE_BUFFER - 1)
+		state->display.next_line_len = PV_SIZEOF_PREVLINE_BUFFER - 1;
+	if (state->display.next_line_len > 0) {
+		memcpy(state->display.previous_line, state->display.next_line,	/* flawfinder: ignore */
+		       state->display.next_line_len);
+		debug("%s: [%s]", "updated previous_line", state->display.previous_line);
+	}
+	state->display.next_line_len = 0;
+	/*
+	 * flawfinder - next_line_len is guaranteed to be less than the size
+	 * of the previous_line buffer since we check it just before
+	 * memcpy(), and we ensure that the last byte in the buffer is \0.
+	 */
 
-				/* Store the position of the separator. */
-				state->transfer.line_positions[state->transfer.line_positions_head] =
-				    state->transfer.last_output_position;
-				state->transfer.line_positions_head++;
+	/* Start receiving the next line with whatever follows. */
+	pv__transfer_append_next_line(state, last_separator + 1, (size_t) (data + length - last_separator - 1));
+}
 
-				/* Circular buffer - wrap around. */
-				if (state->transfer.line_positions_head >= state->transfer.line_positions_capacity) {
-					state->transfer.line_positions_head = 0;
-				}
 
-				/* Increment count of line positions, if below capacity. */
-				if (state->transfer.line_positions_length < state->transfer.line_positions_capacity) {
-					state->transfer.line_positions_length++;
-				}
-			}
+/*
+ * Return the distance back from "end" to the line position at logical
+ * index "idx" of the circular buffer, where 0 is the oldest.
+ *
+ * Only the low 32 bits of each position are stored; since every position
+ * kept is within line_positions_window bytes of the end of the output,
+ * which is far less than 4GiB, the difference of the low 32 bits is the
+ * true distance.
+ */
+static uint32_t pv__transfer_line_distance(pvstate_t state, off_t end, size_t idx)
+{
+	size_t capacity, array_index;
 
-			if (NULL != lineswritten)
-				*lineswritten += lines;
-		}
+	capacity = state->transfer.line_positions_capacity;
+	array_index = state->transfer.line_positions_head + capacity - state->transfer.line_positions_length + idx;
+	while (array_index >= capacity)
+		array_index -= capacity;
 
-		state->transfer.write_position += nwritten;
-		state->transfer.written += nwritten;
+	/*@-nullderef@ *//* only called when line_positions is set */
+	return (uint32_t) ((uint32_t) end - state->transfer.line_positions[array_index]);
+	/*@+nullderef@ */
+}
 
-		/*
-		 * If we're monitoring the output, update our copy of the
-		 * last few bytes we've written.
-		 */
-		if (state->display.showing_last_written && (nwritten > 0)) {
-			size_t new_portion_size, old_portion_size;
 
-			new_portion_size = (size_t) nwritten;
-			if (new_portion_size > state->display.lastwritten_bytes)
-				new_portion_size = state->display.lastwritten_bytes;
+/*
+ * Make room for at least "needed" line positions, by doubling the size of
+ * the circular buffer, unwrapping it so that the oldest position is first.
+ * Returns false if no more memory could be had.
+ */
+static bool pv__transfer_line_positions_grow(pvstate_t state, size_t needed)
+{
+	uint32_t *new_positions;
+	size_t new_capacity, idx, length;
+
+	new_capacity = state->transfer.line_positions_capacity;
+	while (new_capacity < needed)
+		new_capacity *= 2;
+	if (new_capacity > state->transfer.line_positions_window)
+		new_capacity = state->transfer.line_positions_window;
+	if (new_capacity <= state->transfer.line_positions_capacity)
+		return false;
+
+	new_positions = malloc(new_capacity * sizeof(*new_positions));
+	if (NULL == new_positions)
+		return false;
+
+	length = state->transfer.line_positions_length;
+	for (idx = 0; idx < length; idx++) {
+		size_t array_index = state->transfer.line_positions_head + state->transfer.line_positions_capacity
+		    - length + idx;
+		while (array_index >= state->transfer.line_positions_capacity)
+			array_index -= state->transfer.line_positions_capacity;
+		/*@-nullderef@ *//* only called when line_positions is set */
+		new_positions[idx] = state->transfer.line_positions[array_index];
+		/*@+nullderef@ */
+	}
 
-			old_portion_size = state->display.lastwritten_bytes - new_portion_size;
+	debug("%s: %ld -> %ld", "line position buffer grown", (long) (state->transfer.line_positions_capacity),
+	      (long) new_capacity);
 
-			/*
-			 * Make room for the new portion.
-			 */
-			if (old_portion_size > 0) {
-				memmove(state->display.lastwritten_buffer,
-					state->display.lastwritten_buffer + new_portion_size, old_portion_size);
-			}
+	free(state->transfer.line_positions);
+	state->transfer.line_positions = new_positions;
+	state->transfer.line_positions_capacity = new_capacity;
+	state->transfer.line_positions_head = length;
 
-			/*
-			 * Copy the new data in.
-			 */
-			memcpy(state->display.lastwritten_buffer +	/* flawfinder: ignore */
-			       old_portion_size,
-			       state->transfer.transfer_buffer + state->transfer.write_position - new_portion_size,
-			       new_portion_size);
-			/*
-			 * flawfinder rationale: calculations above ensure
-			 * that old_portion_size + new_portion_size is
-			 * always <= lastwritten_bytes, and
-			 * lastwritten_bytes is guaranteed by
-			 * pv__format_init() to be no more than
-			 * PV_SIZEOF_LASTWRITTEN_BUFFER, which is the size
-			 * of lastwritten_buffer, so the memcpy() will
-			 * always fit into the buffer.
-			 */
-		}
+	return true;
+}
 
-		/*
-		 * If we've written all the data in the buffer, reset the
-		 * read pointer to the start, and if the input file is at
-		 * EOF, set eof_out as well to indicate that we've written
-		 * everything for this input file.
-		 */
-		if (state->transfer.write_position >= state->transfer.read_position) {
-			state->transfer.write_position = 0;
-			state->transfer.read_position = 0;
-			if (*eof_in)
+
+/*
+ * Record the output positions of the "lines" separators found in the
+ * "length" bytes of "data" that have just been written, in the circular
+ * line position buffer.
+ *
+ * Only the separators that could still be sitting in the output pipe are
+ * needed; that is, those in the last line_positions_window bytes written.
+ * So positions that have fallen out of that window are dropped first,
+ * only the new separators inside it are recorded, working backwards from
+ * the end of the data, and the buffer is grown only if the positions in
+ * the window don't fit - it never needs more room than the window has
+ * bytes.
+ */
+static void pv__transfer_line_positions(pvstate_t state, const char *data, size_t length, char separator,
+					size_t lines)
+{
+	size_t window, capacity, to_store, stored, array_index;
+	size_t remaining, scan_from;
+	off_t new_end;
+
+	window = state->transfer.line_positions_window;
+	if ((NULL == state->transfer.line_positions) || (0 == window))
+		return;
+
+	new_end = state->transfer.last_output_position + (off_t) length;
+
+	/* Drop positions that are now too far back to matter. */
+	if (length >= window) {
+		state->transfer.line_positions_length = 0;
+		scan_from = length - window;
+		to_store = pv_memcount(data + scan_from, (int) separator, window);
+	} else {
+		while ((state->transfer.line_positions_length > 0)
+		       && (pv__transfer_line_distance(state, new_end, 0) >= (uint32_t) window))
+			state->transfer.line_positions_length--;
+		scan_from = 0;
+		to_store = lines;
+	}
+
+	if (state->transfer.line_positions_length + to_store > state->transfer.line_positions_capacity)
+		(void) pv__transfer_line_positions_grow(state, state->transfer.line_positions_length + to_store);
+
+	capacity = state->transfer.line_positions_capacity;
+	if (to_store > capacity)
+		to_store = capacity;
+
+	/*
+	 * The last separator goes just before the new head position, the
+	 * one before that goes just before it, and so on.
+	 */
+	array_index = (state->transfer.line_positions_head + to_store) % capacity;
+	remaining = length;
+
+	for (stored = 0; stored < to_store; stored++) {
+		const char *found;
+
+		found = pv_memrchr(data + scan_from, (int) separator, remaining - scan_from);
+		if (NULL == found)
+			break;
+		remaining = (size_t) (found - data);
+
+		array_index = (0 == array_index) ? capacity - 1 : array_index - 1;
+		state->transfer.line_positions[array_index] =
+		    (uint32_t) (state->transfer.last_output_position + (off_t) remaining);
+	}
+
+	state->transfer.line_positions_head = (state->transfer.line_positions_head + stored) % capacity;
+	state->transfer.line_positions_length += stored;
+	if (state->transfer.line_positions_length > capacity)
+		state->transfer.line_positions_length = capacity;
+}
+
+
+/*
+ * Return the number of line separators among the last "not_consumed"
+ * bytes written, using the line position buffer; they are in order, so
+ * the oldest one that is still unconsumed is found by binary search.
+ *
+ * If the output pipe turns out to hold more than the positions cover, the
+ * window is widened for the positions recorded from now on.
+ */
+size_t pv_transfer_lines_not_consumed(pvstate_t state, size_t not_consumed)
+{
+	size_t low, high;
+	off_t end;
+
+	if ((NULL == state->transfer.line_positions) || (0 == state->transfer.line_positions_window))
+		return 0;
+
+	if ((not_consumed > state->transfer.line_positions_window) && (not_consumed < (size_t) 0x40000000)) {
+		size_t new_window = state->transfer.line_positions_window;
+		while (new_window <= not_consumed)
+			new_window *= 2;
+		debug("%s: %ld -> %ld", "line position window widened", (long) (state->transfer.line_positions_window),
+		      (long) new_window);
+		state->transfer.line_positions_window = new_window;
+	}
+
+	end = state->transfer.last_output_position;
+
+	/* Find the oldest position less than "not_consumed" bytes back. */
+	low = 0;
+	high = state->transfer.line_positions_length;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if ((size_t) pv__transfer_line_distance(state, end, middle) < not_consumed) {
+			high = middle;
+		} else {
+			low = middle + 1;
+		}
+	}
+
+	return state->transfer.line_positions_length - low;
+}
+
+
+/*
+ * Look through "length" bytes of "data" that have just been written to the
+ * output, to count the lines in them if in line mode (adding the count to
+ * *lineswritten), and to keep track of the previous line and the last few
+ * bytes written if they are being displayed.
+ */
+static void pv__transfer_track_output(pvstate_t state, const char *data, size_t length, /*@null@ */ long *lineswritten)
+{
+	bool tracking_lines = false;
+
+	if (0 == length)
+		return;
+
+	pv_hash_feed(state, data, length);
+
+	if ((state->control.linemode) && (lineswritten != NULL))
+		tracking_lines = true;
+	else if (state->display.showing_previous_line)
+		tracking_lines = true;
+
+	if (tracking_lines) {
+		char separator;
+		long lines = 0;
+
+		/*
+		 * Tracking lines - either line mode, or we're showing the
+		 * last line in the display, or both.  So we need to look
+		 * through what we've just written to either count how many
+		 * lines there were, or get the content of the most recent
+		 * complete line, or both.
+		 */
+
+		/*
+		 * Allocate buffer to remember line positions, if writing
+		 * to a pipe; it grows as needed.
+		 */
+		if ((NULL == state->transfer.line_positions) && (NULL != lineswritten)
+		    && (state->transfer.line_positions_window > 0)) {
+			state->transfer.line_positions_capacity = PV_LINE_POSITIONS_MIN;
+			if (state->transfer.line_positions_capacity > state->transfer.line_positions_window)
+				state->transfer.line_positions_capacity = state->transfer.line_positions_window;
+			state->transfer.line_positions_length = 0;
+			state->transfer.line_positions_head = 0;
+			/*@-mustfreeonly@ */
+			state->transfer.line_positions =
+			    calloc(state->transfer.line_positions_capacity, sizeof(uint32_t));
+			if (NULL == state->transfer.line_positions) {
+				pv_error("%s: %s", _("line position buffer allocation failed"), strerror(errno));
+			}
+			/*@+mustfreeonly@ */
+			/* splint doesn't see we only call calloc() when line_positions is NULL. */
+		}
+
+		if (state->control.null_terminated_lines) {
+			separator = '\0';
+		} else {
+			separator = '\n';
+		}
+
+		/* Count the separators in bulk rather than byte by byte. */
+		lines = (long) pv_memcount(data, (int) separator, length);
+
+		if (state->display.showing_previous_line)
+			pv__transfer_previous_line(state, data, length, separator);
+
+		if ((lines > 0) && (NULL != state->transfer.line_positions))
+			pv__transfer_line_positions(state, data, length, separator, (size_t) lines);
+
+		state->transfer.last_output_position += (off_t) length;
+
+		if (NULL != lineswritten)
+			*lineswritten += lines;
+	}
+
+	/*
+	 * If we're monitoring the output, update our copy of the last few
+	 * bytes we've written.
+	 */
+	if (state->display.showing_last_written) {
+		size_t new_portion_size, old_portion_size;
+
+		new_portion_size = length;
+		if (new_portion_size > state->display.lastwritten_bytes)
+			new_portion_size = state->display.lastwritten_bytes;
+
+		old_portion_size = state->display.lastwritten_bytes - new_portion_size;
+
+		/*
+		 * Make room for the new portion.
+		 */
+		if (old_portion_size > 0) {
+			memmove(state->display.lastwritten_buffer,
+				state->display.lastwritten_buffer + new_portion_size, old_portion_size);
+		}
+
+		/*
+		 * Copy the new data in.
+		 */
+		memcpy(state->display.lastwritten_buffer +	/* flawfinder: ignore */
+		       old_portion_size, data + length - new_portion_size, new_portion_size);
+		/*
+		 * flawfinder rationale: calculations above ensure that
+		 * old_portion_size + new_portion_size is always <=
+		 * lastwritten_bytes, and lastwritten_bytes is guaranteed by
+		 * pv__format_init() to be no more than
+		 * PV_SIZEOF_LASTWRITTEN_BUFFER, which is the size of
+		 * lastwritten_buffer, so the memcpy() will always fit into
+		 * the buffer.
+		 */
+	}
+}
+
+
+/*
+ * Account for the result of writing "nwritten" bytes from the transfer
+ * buffer's write position to the output, where "write_errno" is the errno
+ * value if nwritten is negative.  This is the second half of
+ * pv__transfer_write(), shared with the io_uring engine, and returns the
+ * same values.
+ *
+ * If state->transfer.buffer_pinned is true, the buffer positions are not
+ * reset to the start when everything has been written, because there are
+ * reads still in flight into the buffer.
+ */
+static int pv__transfer_write_result(pvstate_t state, ssize_t nwritten, int write_errno, bool *eof_in, bool *eof_out,
+				     long *lineswritten)
+{
+	if (nwritten > 0) {
+		/*
+		 * Write returned >0 - data successfully written.
+		 */
+		pv__transfer_track_output(state, state->transfer.transfer_buffer + state->transfer.write_position,
+					  (size_t) nwritten, lineswritten);
+		pv_fanout_queue(state, state->transfer.transfer_buffer + state->transfer.write_position,
+				(size_t) nwritten);
+
+		state->transfer.write_position += nwritten;
+		state->transfer.written += nwritten;
+
+		/*
+		 * If we've written all the data in the buffer, reset the
+		 * read pointer to the start, and if the input file is at
+		 * EOF, set eof_out as well to indicate that we've written
+		 * everything for this input file.
+		 *
+		 * The kernel is still reading from the buffer while
+		 * zero-copy sends are in flight, so then the pointers are
+		 * left where they are, for pv__transfer_zerocopy_reap() to
+		 * reset once the sends have completed.  A buffer borrowed
+		 * from the libpv caller is never reused.
+		 */
+		if ((state->transfer.write_position >= state->transfer.read_position)
+		    && (!state->transfer.buffer_pinned)) {
+			if ((!pv_zerocopy_pending(&(state->transfer))) && (!state->transfer.buffer_borrowed)) {
+				state->transfer.write_position = 0;
+				state->transfer.read_position = 0;
+			}
+			if (*eof_in)
 				*eof_out = true;
 		}
 
@@ -1012,14 +2314,22 @@ static int pv__transfer_write(pvstate_t state, bool *eof_in, bool *eof_out, long
  * available.  With O_DIRECT, this means that transfers could fail with an
  * "Invalid argument" error (EINVAL).
  *
+ * With --huge-pages, --lock-memory, or --numa-node, the buffer comes from
+ * pv_buffer_alloc() instead.  Either way, how it was allocated is stored
+ * in "*mem", for pv_buffer_free().
+ *
  * Returns NULL on complete allocation failure.
  */
 /*@null@*/
 /*@only@*/
-static char *pv__allocate_aligned_buffer(int outfd, int infd, size_t target_size)
+static char *pv__allocate_aligned_buffer(pvstate_t state, int outfd, int infd, size_t target_size,
+					 struct pvbuffermem_s *mem)
 {
 	void *newptr;
 
+	memset(mem, 0, sizeof(*mem));
+	mem->node = -1;
+
 #if defined(HAVE_FPATHCONF) && defined(HAVE_POSIX_MEMALIGN) && defined(_PC_REC_XFER_ALIGN)
 	long input_alignment, output_alignment, min_alignment;
 	long required_alignment;
@@ -1047,6 +2357,10 @@ static char *pv__allocate_aligned_buffer(int outfd, int infd, size_t target_size
 		required_alignment = min_alignment;
 	}
 
+	if (state->control.huge_pages || state->control.lock_memory || (state->control.numa_node >= 0))
+		return pv_buffer_alloc(target_size, (size_t) required_alignment, state->control.huge_pages,
+				       state->control.lock_memory, state->control.numa_node, mem);
+
 	newptr = NULL;
 
 	/*@-unrecog@ */
@@ -1056,6 +2370,10 @@ static char *pv__allocate_aligned_buffer(int outfd, int infd, size_t target_size
 	}
 	/*@+unrecog@ */
 #else				/* ! defined(HAVE_FPATHCONF) && defined(HAVE_POSIX_MEMALIGN) && defined(_PC_REC_XFER_ALIGN) */
+	if (state->control.huge_pages || state->control.lock_memory || (state->control.numa_node >= 0))
+		return pv_buffer_alloc(target_size, 0, state->control.huge_pages, state->control.lock_memory,
+				       state->control.numa_node, mem);
+
 	newptr = malloc(target_size);
 #endif				/* defined(HAVE_FPATHCONF) && defined(HAVE_POSIX_MEMALIGN) && defined(_PC_REC_XFER_ALIGN) */
 
@@ -1068,8 +2386,660 @@ static char *pv__allocate_aligned_buffer(int outfd, int infd, size_t target_size
 
 
 /*
- * Transfer some data from "fd" to standard output, timing out after 9/100
- * of a second.  If state->control.rate_limit is >0, and/or "allowed" is >0, only up
+ * In line mode, reduce state->transfer.to_write so that we only write up to
+ * and including the last newline, so that we're writing output
+ * line-by-line.
+ */
+static void pv__transfer_trim_to_line(pvstate_t state)
+{
+	char *start;
+	char *end;
+
+	if ((state->transfer.to_write <= 0) || (!state->control.linemode) || (state->control.null_terminated_lines))
+		return;
+
+	start = (char *) (state->transfer.transfer_buffer + state->transfer.write_position);
+	end = pv_memrchr(start, (int) '\n', (size_t) (state->transfer.to_write));
+
+	if (NULL != end) {
+		state->transfer.to_write = (ssize_t) ((end - start) + 1);
+	}
+}
+
+
+/*
+ * Rotate the written bytes out of the buffer so that it can be filled up
+ * completely by the next read.
+ *
+ * With O_DIRECT, the unwritten bytes are moved to just short of a block
+ * boundary instead of to the start, so that the next read from "fd" is
+ * still aligned - or, if only the output is using O_DIRECT, so that the
+ * next write is in line with the output position.
+ */
+static void pv__transfer_compact_buffer(pvstate_t state, int fd)
+{
+#ifdef MAXIMISE_BUFFER_FILL
+	size_t remaining, shift, block;
+
+	if (state->transfer.buffer_pinned || state->transfer.buffer_borrowed || pv_zerocopy_pending(&(state->transfer)))
+		return;
+	if (0 == state->transfer.write_position)
+		return;
+	if (state->transfer.write_position >= state->transfer.read_position) {
+		state->transfer.write_position = 0;
+		state->transfer.read_position = 0;
+		return;
+	}
+
+	remaining = state->transfer.read_position - state->transfer.write_position;
+	shift = 0;
+
+	if (fd != state->transfer.direct_input_fd) {
+		state->transfer.direct_input_fd = fd;
+		state->transfer.direct_input_block = pv__transfer_direct_block_of(fd);
+	}
+	block = state->transfer.direct_input_block;
+	if (block > 0) {
+		shift = (block - (remaining % block)) % block;
+	} else {
+		block = pv__transfer_direct_block(state);
+		if (block > 0) {
+			off_t offset = pv__transfer_output_offset(state);
+			if (offset > 0)
+				shift = (size_t) (offset % (off_t) block);
+		}
+	}
+	if (shift + remaining > state->transfer.buffer_size)
+		shift = 0;
+
+	if (state->transfer.write_position == shift)
+		return;
+
+	memmove(state->transfer.transfer_buffer + shift,
+		state->transfer.transfer_buffer + state->transfer.write_position, remaining);
+	state->transfer.read_position = shift + remaining;
+	state->transfer.write_position = shift;
+#endif				/* MAXIMISE_BUFFER_FILL */
+}
+
+
+/*
+ * Return how long, in microseconds, pv_transfer() may wait for input or
+ * output: as long as the main loop says nothing else is due, or 9/100 of
+ * a second if it has not said, and no longer than the --metrics interval,
+ * so that the records are written on time even when nothing is moving.
+ */
+long pv_transfer_wait_usec(pvstate_t state)
+{
+	long wait_usec;
+
+	wait_usec = 90000;
+	if (state->transfer.wait_usec > 0)
+		wait_usec = state->transfer.wait_usec;
+	if ((state->metrics.fd >= 0) && (state->control.metrics_interval * 1000000.0 < (double) wait_usec))
+		wait_usec = (long) (state->control.metrics_interval * 1000000.0);
+
+	return wait_usec;
+}
+
+
+/*
+ * Collect the notifications for zero-copy sends that have completed, and
+ * once none are left in flight, rewind the buffer if everything in it has
+ * been written, as pv__transfer_write_result() would have done.
+ *
+ * If the buffer is full and everything in it has been sent, nothing else
+ * can happen until the kernel has finished with it, so wait for that, for
+ * as long as the main loop allows.
+ */
+static void pv__transfer_zerocopy_reap(pvstate_t state)
+{
+	long wait_usec = 0;
+	bool all_written;
+
+	all_written = (state->transfer.write_position >= state->transfer.read_position);
+
+	if (all_written && (state->transfer.read_position >= state->transfer.buffer_size))
+		wait_usec = pv_transfer_wait_usec(state);
+
+	pv_zerocopy_reap(&(state->transfer), wait_usec);
+
+	if (all_written && (!state->transfer.buffer_pinned) && (!state->transfer.buffer_borrowed)
+	    && (!pv_zerocopy_pending(&(state->transfer)))) {
+		state->transfer.write_position = 0;
+		state->transfer.read_position = 0;
+	}
+}
+
+
+#ifdef HAVE_THREADS
+/*
+ * Return true if the threaded pipeline should handle this call to
+ * pv_transfer().
+ *
+ * The writer thread only counts lines, so anything that needs to look at
+ * the data as it is written - showing the last line or last bytes written,
+ * sparse output, rate limiting by lines, --tee outputs, --hash - stays on
+ * the normal path, as do skipping read errors and --merge, and O_DIRECT,
+ * whose writes have to be kept in line with the output's block size.
+ */
+static bool pv__transfer_threads_usable(pvstate_t state)
+{
+	if ((!state->control.threaded) || (state->transfer.pipeline_failed))
+		return false;
+	if (state->display.showing_previous_line || state->display.showing_last_written)
+		return false;
+	if (state->control.sparse_output || (state->control.skip_errors > 0))
+		return false;
+	if (state->control.linemode && (state->control.rate_limit > 0))
+		return false;
+	if ((state->fanout.count > 0) || (state->merge.count > 0))
+		return false;
+	if (0 != state->control.hash_algorithms)
+		return false;
+	if (state->control.direct_io)
+		return false;
+	return true;
+}
+
+
+/*
+ * Return true if the parallel chunked copy should handle this call to
+ * pv_transfer(), which is worked out once for each input.
+ *
+ * Both ends have to be regular files or block devices, other than the
+ * same file, and the output can't be in append mode, since each chunk is
+ * written at its own offset.  The data is never in the transfer buffer,
+ * so anything that needs to look at it in order - line mode, showing the
+ * last line or last bytes written, --tee outputs, --hash - or to act on
+ * read errors, stays on the normal path, as do --merge, O_DIRECT,
+ * discarding the input, and store-and-forward.
+ */
+static bool pv__transfer_parallel_usable(pvstate_t state, int fd)
+{
+	struct stat sb_in, sb_out;
+	int flags;
+
+	if ((0 == state->control.parallel) || (state->transfer.parallel_failed))
+		return false;
+	if (fd == state->transfer.parallel_fd)
+		return state->transfer.parallel_usable;
+
+	state->transfer.parallel_fd = fd;
+	state->transfer.parallel_usable = false;
+
+	if (state->control.linemode || state->display.showing_previous_line || state->display.showing_last_written)
+		return false;
+	if ((state->control.skip_errors > 0) || (NULL != state->rescue.map))
+		return false;
+	if ((state->fanout.count > 0) || (state->merge.count > 0))
+		return false;
+	if (0 != state->control.hash_algorithms)
+		return false;
+	if (state->control.direct_io || state->control.discard_input || (NULL != state->spool.engine))
+		return false;
+	if (state->transfer.read_position != state->transfer.write_position)
+		return false;
+
+	memset(&sb_in, 0, sizeof(sb_in));
+	memset(&sb_out, 0, sizeof(sb_out));
+	flags = fcntl(state->control.output_fd, F_GETFL);
+	if ((flags < 0) || (0 != (flags & O_APPEND)))
+		return false;
+	if ((0 != fstat(fd, &sb_in)) || (0 != fstat(state->control.output_fd, &sb_out)))
+		return false;
+	if (!(S_ISREG(sb_in.st_mode) || S_ISBLK(sb_in.st_mode)))
+		return false;
+	if (!(S_ISREG(sb_out.st_mode) || S_ISBLK(sb_out.st_mode)))
+		return false;
+	if ((sb_in.st_dev == sb_out.st_dev) && (sb_in.st_ino == sb_out.st_ino))
+		return false;
+
+	debug("%s %d: %s", "fd", fd, "using parallel copy");
+	state->transfer.parallel_usable = true;
+	return true;
+}
+#endif				/* HAVE_THREADS */
+
+
+#ifdef HAVE_IO_URING
+
+#define PV_URING_TAG_WRITE	64UL
+#define PV_URING_TAG_READ	128UL
+
+/*
+ * Return true if the io_uring engine should handle this call to
+ * pv_transfer(), starting it up first if necessary.  It is used when asked
+ * for with --io-uring or --io-depth, and with --direct-io, since O_DIRECT
+ * transfers gain the most from having several operations in flight.
+ *
+ * Sparse output, syncing after every write, discarding the input, and
+ * --tee outputs all need to act on each write as it happens, and --merge
+ * reads from several inputs, so they stay on the normal path.  Once the
+ * engine has failed, the normal path is used as soon as there is nothing
+ * left in flight.
+ */
+static bool pv__transfer_uring_usable(pvstate_t state)
+{
+	if ((state->transfer.uring_reads_queued > 0) || (state->transfer.uring_writes_queued > 0))
+		return true;
+	if (state->transfer.uring_failed)
+		return false;
+	if ((!state->control.io_uring) && (0 == state->control.io_depth) && (!state->control.direct_io))
+		return false;
+	if (state->control.sparse_output || state->control.sync_after_write || state->control.discard_input)
+		return false;
+	if ((state->fanout.count > 0) || (state->merge.count > 0) || (NULL != state->rescue.map))
+		return false;
+
+	if (NULL == state->transfer.uring) {
+		state->transfer.uring = pv_uring_alloc(PV_URING_QUEUE_DEPTH);
+		if (NULL == state->transfer.uring) {
+			debug("%s: %s", "io_uring unavailable - using read/write", strerror(errno));
+			state->transfer.uring_failed = true;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * Return the number of reads, or writes, to keep in flight at once.
+ */
+static unsigned int pv__transfer_uring_depth(pvstate_t state)
+{
+	if (0 == state->control.io_depth)
+		return PV_URING_DEFAULT_DEPTH;
+	if (state->control.io_depth > PV_URING_MAX_DEPTH)
+		return PV_URING_MAX_DEPTH;
+	return state->control.io_depth;
+}
+
+
+/*
+ * Queue reads to fill the free part of the transfer buffer.  For seekable
+ * inputs the space is split into up to --io-depth reads at explicit
+ * offsets, which the kernel can service in parallel; otherwise a single
+ * read at the current position is used, since the order of the data could
+ * not be guaranteed.
+ */
+static void pv__transfer_uring_queue_reads(pvstate_t state, int fd)
+{
+	size_t bytes_can_read, chunk_size, queued_bytes, limit;
+	unsigned int depth, slot;
+
+	depth = state->transfer.uring_read_seekable ? pv__transfer_uring_depth(state) : 1;
+
+	/* Deeper queues can read more than MAX_READ_AT_ONCE in one go. */
+	limit = depth * PV_URING_SLOT_SIZE;
+	if (limit < MAX_READ_AT_ONCE)
+		limit = MAX_READ_AT_ONCE;
+
+	bytes_can_read = pv__transfer_read_limit(state);
+	if (bytes_can_read > limit)
+		bytes_can_read = limit;
+	if (0 == bytes_can_read)
+		return;
+
+	/* Keep each read a whole number of pages, for O_DIRECT. */
+	chunk_size = (bytes_can_read + depth - 1) / depth;
+	chunk_size = (chunk_size + 4095) & ~((size_t) 4095);
+
+	queued_bytes = 0;
+	for (slot = 0; slot < depth && queued_bytes < bytes_can_read; slot++) {
+		size_t length = chunk_size;
+		off_t offset = -1;
+
+		if (length > bytes_can_read - queued_bytes)
+			length = bytes_can_read - queued_bytes;
+		if (state->transfer.uring_read_seekable)
+			offset = state->transfer.uring_read_offset + (off_t) queued_bytes;
+
+		if (!pv_uring_queue_rw
+		    (state->transfer.uring, false, fd,
+		     state->transfer.transfer_buffer + state->transfer.read_position + queued_bytes, length, offset,
+		     PV_URING_TAG_READ + slot))
+			break;
+
+		state->transfer.uring_read_length[slot] = length;
+		state->transfer.uring_read_done[slot] = false;
+		state->transfer.uring_reads_queued = slot + 1;
+		queued_bytes += length;
+	}
+
+	state->transfer.uring_reads_committed = 0;
+	state->transfer.uring_read_stopped = false;
+	state->transfer.uring_read_eof = false;
+}
+
+
+/*
+ * Commit completed reads to the transfer buffer, in the order they were
+ * queued.  Anything after a short read is discarded, since it would leave
+ * a gap in the buffer; it will be read again next time.
+ *
+ * Once every queued read is done, the input file position is brought up to
+ * date if explicit offsets were used, and end of file or a read error is
+ * dealt with - an error hands over to the normal path, which retries the
+ * read and reports or skips the error as usual.
+ */
+static void pv__transfer_uring_commit_reads(pvstate_t state, int fd, bool *eof_in, bool *eof_out)
+{
+	bool read_failed = false;
+
+	while ((state->transfer.uring_reads_committed < state->transfer.uring_reads_queued)
+	       && (state->transfer.uring_read_done[state->transfer.uring_reads_committed])) {
+		unsigned int slot = state->transfer.uring_reads_committed;
+		long result = state->transfer.uring_read_result[slot];
+
+		state->transfer.uring_reads_committed++;
+
+		if (state->transfer.uring_read_stopped)
+			continue;
+
+		if (result > 0) {
+			state->transfer.read_errors_in_a_row = 0;
+			state->transfer.read_position += (size_t) result;
+			state->transfer.total_bytes_read += (off_t) result;
+			state->transfer.uring_read_offset += (off_t) result;
+			if ((size_t) result < state->transfer.uring_read_length[slot])
+				state->transfer.uring_read_stopped = true;
+		} else if (0 == result) {
+			state->transfer.uring_read_stopped = true;
+			state->transfer.uring_read_eof = true;
+		} else {
+			state->transfer.uring_read_stopped = true;
+			if ((-EINTR != result) && (-EAGAIN != result)) {
+				debug("%s %d: %s: %s", "fd", fd, "io_uring read failed - using read/write",
+				      strerror((int) (-result)));
+				read_failed = true;
+			}
+		}
+	}
+
+	if (state->transfer.uring_reads_committed < state->transfer.uring_reads_queued)
+		return;
+
+	state->transfer.uring_reads_queued = 0;
+	state->transfer.uring_reads_committed = 0;
+
+	if (state->transfer.uring_read_seekable) {
+		if (lseek(fd, state->transfer.uring_read_offset, SEEK_SET) < 0) {
+			debug("%s %d: %s: %s", "fd", fd, "lseek", strerror(errno));
+		}
+	}
+
+	if (read_failed)
+		state->transfer.uring_failed = true;
+
+	/*
+	 * At the end of the input, forget the input file, since the next
+	 * one may be given the same file descriptor.
+	 */
+	if (state->transfer.uring_read_eof) {
+		state->transfer.uring_read_fd = -1;
+		*eof_in = true;
+		if ((state->transfer.write_position >= state->transfer.read_position)
+		    && (0 == state->transfer.uring_writes_queued))
+			*eof_out = true;
+	}
+}
+
+
+
+/*
+ * Queue writes of state->transfer.to_write bytes from the write position.
+ * For a regular file or block device output they are split into up to
+ * --io-depth writes at explicit offsets, each a whole number of pages (or
+ * of O_DIRECT blocks), so that the kernel can service them in parallel;
+ * otherwise a single write at the current position is used.
+ */
+static void pv__transfer_uring_queue_writes(pvstate_t state)
+{
+	size_t to_write, chunk_size, unit, queued_bytes;
+	unsigned int depth, slot;
+	int fd;
+
+	fd = state->control.output_fd;
+
+	/*
+	 * Work out whether the output can take writes at explicit offsets
+	 * when it changes.
+	 */
+	if (fd != state->transfer.uring_write_fd) {
+		struct stat sb;
+		int flags;
+
+		state->transfer.uring_write_fd = fd;
+		state->transfer.uring_write_seekable = false;
+		flags = fcntl(fd, F_GETFL);
+		memset(&sb, 0, sizeof(sb));
+		if ((flags >= 0) && (0 == (flags & O_APPEND)) && (0 == fstat(fd, &sb))
+		    && (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode)))
+			state->transfer.uring_write_seekable = true;
+		debug("%s %d: %s: %s", "fd", fd, "io_uring output",
+		      state->transfer.uring_write_seekable ? "seekable" : "stream");
+	}
+
+	state->transfer.uring_write_offset = -1;
+	if (state->transfer.uring_write_seekable)
+		state->transfer.uring_write_offset = lseek(fd, 0, SEEK_CUR);
+
+	depth = 1;
+	if (state->transfer.uring_write_offset >= 0)
+		depth = pv__transfer_uring_depth(state);
+
+	unit = pv__transfer_direct_block(state);
+	if (unit < 4096)
+		unit = 4096;
+
+	to_write = (size_t) (state->transfer.to_write);
+	chunk_size = (to_write + depth - 1) / depth;
+	chunk_size = ((chunk_size + unit - 1) / unit) * unit;
+
+	queued_bytes = 0;
+	for (slot = 0; slot < depth && queued_bytes < to_write; slot++) {
+		size_t length = chunk_size;
+		off_t offset = -1;
+
+		if (length > to_write - queued_bytes)
+			length = to_write - queued_bytes;
+		if (state->transfer.uring_write_offset >= 0)
+			offset = state->transfer.uring_write_offset + (off_t) queued_bytes;
+
+		if (!pv_uring_queue_rw
+		    (state->transfer.uring, true, fd,
+		     state->transfer.transfer_buffer + state->transfer.write_position + queued_bytes, length, offset,
+		     PV_URING_TAG_WRITE + slot))
+			break;
+
+		state->transfer.uring_write_length[slot] = length;
+		state->transfer.uring_write_done[slot] = false;
+		state->transfer.uring_writes_queued = slot + 1;
+		queued_bytes += length;
+	}
+
+	state->transfer.uring_writes_committed = 0;
+	state->transfer.uring_write_stopped = false;
+}
+
+
+/*
+ * Pass completed writes on to pv__transfer_write_result(), in the order
+ * they were queued, keeping the buffer pinned while any are still in
+ * flight.  Anything after a short or failed write is discarded, and will
+ * be written again next time; with explicit offsets, the output file
+ * position is brought up to date once every queued write is done.
+ */
+static void pv__transfer_uring_commit_writes(pvstate_t state, bool *eof_in, bool *eof_out, long *lineswritten)
+{
+	if (0 == state->transfer.uring_writes_queued)
+		return;
+
+	while ((state->transfer.uring_writes_committed < state->transfer.uring_writes_queued)
+	       && (state->transfer.uring_write_done[state->transfer.uring_writes_committed])) {
+		unsigned int slot = state->transfer.uring_writes_committed;
+		long result = state->transfer.uring_write_result[slot];
+
+		state->transfer.uring_writes_committed++;
+
+		if (state->transfer.uring_write_stopped)
+			continue;
+
+		debug("%s: %ld/%ld", "io_uring write completed", result,
+		      (long) (state->transfer.uring_write_length[slot]));
+
+		if ((result <= 0) || ((size_t) result < state->transfer.uring_write_length[slot]))
+			state->transfer.uring_write_stopped = true;
+		if ((result > 0) && (state->transfer.uring_write_offset >= 0))
+			state->transfer.uring_write_offset += (off_t) result;
+
+		state->transfer.buffer_pinned = (state->transfer.uring_reads_queued > 0)
+		    || (state->transfer.uring_writes_committed < state->transfer.uring_writes_queued);
+
+		(void) pv__transfer_write_result(state, (ssize_t) (result < 0 ? -1 : result),
+						 (int) (result < 0 ? -result : 0), eof_in, eof_out, lineswritten);
+	}
+
+	if (state->transfer.uring_writes_committed < state->transfer.uring_writes_queued)
+		return;
+
+	state->transfer.uring_writes_queued = 0;
+	state->transfer.uring_writes_committed = 0;
+
+	if (state->transfer.uring_write_offset >= 0) {
+		if (lseek(state->control.output_fd, state->transfer.uring_write_offset, SEEK_SET) < 0) {
+			debug("%s %d: %s: %s", "fd", state->control.output_fd, "lseek", strerror(errno));
+		}
+	}
+}
+
+
+/*
+ * Transfer data using io_uring: keep reads queued into the free part of
+ * the transfer buffer and writes queued from the unwritten part, and wait
+ * as long as pv_transfer_wait_usec() allows for any of them to complete,
+ * in a single system call.  This replaces the select(), read(), write(), and interval timer
+ * calls of the normal path, and returns the same values as pv_transfer().
+ *
+ * Operations still in flight when this returns are picked up on the next
+ * call; until then, state->transfer.buffer_pinned stops the buffer being
+ * moved, resized, or rewound underneath them.
+ *
+ * With O_DIRECT, the writes are kept to whole blocks, and the odd bytes
+ * at the end are written through the page cache while nothing else is
+ * being written - see pv__transfer_direct_trim().
+ */
+static ssize_t pv__transfer_uring(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed,
+				  long *lineswritten)
+{
+	unsigned long tag;
+	long result;
+
+	/*
+	 * Start fresh read bookkeeping when the input file changes.
+	 */
+	if ((fd != state->transfer.uring_read_fd) && (0 == state->transfer.uring_reads_queued)) {
+		struct stat sb;
+
+		state->transfer.uring_read_fd = fd;
+		state->transfer.uring_read_offset = lseek(fd, 0, SEEK_CUR);
+		state->transfer.uring_read_seekable = false;
+		if ((state->transfer.uring_read_offset >= 0) && (0 == fstat(fd, &sb)) && (S_ISREG(sb.st_mode)))
+			state->transfer.uring_read_seekable = true;
+		debug("%s %d: %s: %s", "fd", fd, "io_uring input",
+		      state->transfer.uring_read_seekable ? "seekable" : "stream");
+	}
+
+	state->transfer.written = 0;
+
+	if ((!state->transfer.uring_failed) && (!(*eof_in)) && (0 == state->transfer.uring_reads_queued)
+	    && (state->transfer.read_position < state->transfer.buffer_size)) {
+		pv__transfer_uring_queue_reads(state, fd);
+	}
+
+	if ((!state->transfer.uring_failed) && (0 == state->transfer.uring_writes_queued) && (!(*eof_out))
+	    && (state->transfer.read_position > state->transfer.write_position) && (NULL != lineswritten)) {
+		size_t limit;
+
+		/* Deeper queues can write more than MAX_WRITE_AT_ONCE in one go. */
+		limit = pv__transfer_uring_depth(state) * PV_URING_SLOT_SIZE;
+		if (limit < MAX_WRITE_AT_ONCE)
+			limit = MAX_WRITE_AT_ONCE;
+
+		state->transfer.to_write = (ssize_t) (state->transfer.read_position - state->transfer.write_position);
+		if ((state->control.rate_limit > 0) || (allowed > 0)) {
+			if ((off_t) (state->transfer.to_write) > allowed) {
+				state->transfer.to_write = (ssize_t) allowed;
+			}
+		}
+		if (state->transfer.to_write > (ssize_t) limit)
+			state->transfer.to_write = (ssize_t) limit;
+		pv__transfer_trim_to_line(state);
+		if (pv__transfer_direct_trim(state, *eof_in)) {
+			ssize_t nwritten = pv__transfer_write_buffered(state);
+			debug("%s: %ld/%ld", "buffered write", (long) nwritten, (long) (state->transfer.to_write));
+			state->transfer.buffer_pinned = (state->transfer.uring_reads_queued > 0);
+			(void) pv__transfer_write_result(state, nwritten, nwritten < 0 ? (int) errno : 0, eof_in,
+							 eof_out, lineswritten);
+		} else if (state->transfer.to_write > 0) {
+			pv__transfer_uring_queue_writes(state);
+		}
+	}
+
+	state->transfer.buffer_pinned = (state->transfer.uring_reads_queued > 0)
+	    || (state->transfer.uring_writes_queued > 0);
+
+	if (!state->transfer.buffer_pinned) {
+		/*
+		 * Nothing we can do yet, such as when rate limited - unless
+		 * a buffered write was done.
+		 */
+		if (0 == state->transfer.written)
+			(void) is_data_ready(-1, NULL, -1, NULL, pv_transfer_wait_usec(state));
+		pv__transfer_compact_buffer(state, fd);
+		return state->transfer.written;
+	}
+
+	if (pv_uring_submit_and_wait(state->transfer.uring, pv_transfer_wait_usec(state)) < 0) {
+		/*@-compdef@ */
+		pv_error("%s: %s: %s", pv_current_file_name(state), _("io_uring call failed"), strerror(errno));
+		/*@+compdef@ */
+		/* splint - see previous pv_current_file_name() calls. */
+		state->status.exit_status |= PV_ERROREXIT_TRANSFER;
+		return -1;
+	}
+
+	while (pv_uring_next_completion(state->transfer.uring, &tag, &result)) {
+		if ((tag >= PV_URING_TAG_WRITE) && (tag < PV_URING_TAG_WRITE + PV_URING_MAX_DEPTH)) {
+			state->transfer.uring_write_result[tag - PV_URING_TAG_WRITE] = result;
+			state->transfer.uring_write_done[tag - PV_URING_TAG_WRITE] = true;
+		} else if ((tag >= PV_URING_TAG_READ) && (tag < PV_URING_TAG_READ + PV_URING_MAX_DEPTH)) {
+			state->transfer.uring_read_result[tag - PV_URING_TAG_READ] = result;
+			state->transfer.uring_read_done[tag - PV_URING_TAG_READ] = true;
+		}
+	}
+
+	pv__transfer_uring_commit_writes(state, eof_in, eof_out, lineswritten);
+
+	pv__transfer_uring_commit_reads(state, fd, eof_in, eof_out);
+
+	state->transfer.buffer_pinned = (state->transfer.uring_reads_queued > 0)
+	    || (state->transfer.uring_writes_queued > 0);
+
+	pv__transfer_compact_buffer(state, fd);
+
+	return state->transfer.written;
+}
+
+#endif				/* HAVE_IO_URING */
+
+
+/*
+ * Transfer some data from "fd" to standard output, timing out after
+ * pv_transfer_wait_usec().  If state->control.rate_limit is >0, and/or "allowed" is >0, only up
  * to "allowed" bytes can be written.  The variables that "eof_in" and
  * "eof_out" point to are used to flag that we've finished reading and
  * writing respectively.
@@ -1080,8 +3050,9 @@ static char *pv__allocate_aligned_buffer(int outfd, int infd, size_t target_size
  */
 ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t allowed, long *lineswritten)
 {
-	bool ready_to_read, ready_to_write;
+	bool ready_to_read, ready_to_write, buffered;
 	int check_read_fd, check_write_fd;
+	long wait_usec;
 	int n;
 
 	if (NULL == state)
@@ -1111,6 +3082,7 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 			}
 		}
 		state->control.direct_io_changed = false;
+		state->transfer.direct_checked_fd = -1;
 	}
 #endif				/* O_DIRECT */
 
@@ -1130,7 +3102,8 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 	 */
 	if (NULL == state->transfer.transfer_buffer) {
 		state->transfer.transfer_buffer =
-		    pv__allocate_aligned_buffer(state->control.output_fd, fd, state->control.target_buffer_size + 32);
+		    pv__allocate_aligned_buffer(state, state->control.output_fd, fd,
+						state->control.target_buffer_size + 32, &(state->transfer.buffer_mem));
 		if (NULL == state->transfer.transfer_buffer) {
 			pv_error("%s: %s", _("buffer allocation failed"), strerror(errno));
 			state->status.exit_status |= PV_ERROREXIT_MEMORY;
@@ -1139,17 +3112,33 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 		state->transfer.buffer_size = state->control.target_buffer_size;
 	}
 
+	if (pv_zerocopy_pending(&(state->transfer)))
+		pv__transfer_zerocopy_reap(state);
+
+	/* With --auto-buffer, this may change the target buffer size. */
+	pv_autotune_update(state, fd);
+
 	/*
 	 * Reallocate the buffer if the buffer size has changed
 	 * mid-transfer.  We have to do this by allocating a new buffer,
 	 * copying to it, and freeing the old one (potentially leaking
 	 * memory) because the buffer may need to be aligned for O_DIRECT,
 	 * and we can't realloc() an aligned buffer.
+	 *
+	 * The buffer is only made smaller (by --auto-buffer) while it is
+	 * empty, and is left alone while the kernel is still sending from
+	 * it, or if it belongs to the libpv caller.
 	 */
-	if (state->transfer.buffer_size < state->control.target_buffer_size) {
+	if ((!state->transfer.buffer_pinned) && (!state->transfer.buffer_borrowed)
+	    && (!pv_zerocopy_pending(&(state->transfer)))
+	    && ((state->transfer.buffer_size < state->control.target_buffer_size)
+		|| ((state->transfer.buffer_size > state->control.target_buffer_size)
+		    && (0 == state->transfer.read_position)))) {
+		struct pvbuffermem_s newmem;
 		char *newptr;
 		newptr =
-		    pv__allocate_aligned_buffer(state->control.output_fd, fd, state->control.target_buffer_size + 32);
+		    pv__allocate_aligned_buffer(state, state->control.output_fd, fd,
+						state->control.target_buffer_size + 32, &newmem);
 		if (NULL == newptr) {
 			/*
 			 * Reset target if realloc failed so we don't keep
@@ -1163,16 +3152,19 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 			 * Copy the old buffer contents into the new buffer,
 			 * and free the old one.
 			 */
-			if (state->transfer.buffer_size > 0) {
-				memcpy(newptr, state->transfer.transfer_buffer, state->transfer.buffer_size);	/* flawfinder: ignore */
+			if (state->transfer.read_position > 0) {
+				memcpy(newptr, state->transfer.transfer_buffer, state->transfer.read_position);	/* flawfinder: ignore */
 			}
 			/*
-			 * flawfinder rationale: number of bytes copied is
-			 * definitely always smaller than the new buffer
+			 * flawfinder rationale: only the data in the buffer
+			 * is copied, and the buffer is only made smaller
+			 * when it holds no data, so the number of bytes
+			 * copied is always smaller than the new buffer
 			 * size.
 			 */
-			free(state->transfer.transfer_buffer);
+			pv_buffer_free(state->transfer.transfer_buffer, &(state->transfer.buffer_mem));
 			state->transfer.transfer_buffer = newptr;
+			state->transfer.buffer_mem = newmem;
 			state->transfer.buffer_size = state->control.target_buffer_size;
 		}
 	}
@@ -1180,10 +3172,39 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 	if ((state->control.linemode) && (lineswritten != NULL))
 		*lineswritten = 0;
 
+	/*
+	 * Give the --tee outputs what they are waiting for first, and hold
+	 * off while any of them has too much still to take, or anything at
+	 * all once the transfer is complete.
+	 */
+	if ((state->fanout.count > 0) && pv_fanout_hold(state, (*eof_in) && (*eof_out), 90000)) {
+		debug("%s %d: %s", "fd", fd, "early return 0 - waiting for --tee outputs");
+		return 0;
+	}
+
+	/*
+	 * Pass on what has reached the store-and-forward file, and once it
+	 * holds everything, hold off until it has all been passed on.
+	 */
+	if ((NULL != state->spool.engine) && pv_spool_hold(state, (*eof_in) && (*eof_out), 90000)) {
+		debug("%s %d: %s", "fd", fd, "early return 0 - waiting for forwarding from the spool");
+		return 0;
+	}
+
 	if ((*eof_in) && (*eof_out)) {
 		debug("%s %d: %s", "fd", fd, "early return 0 - EOF in and out");
 		return 0;
 	}
+#ifdef HAVE_THREADS
+	if (pv__transfer_parallel_usable(state, fd))
+		return pv_parallel_transfer(state, fd, eof_in, eof_out, allowed);
+	if (pv__transfer_threads_usable(state))
+		return pv_pipeline_transfer(state, fd, eof_in, eof_out, allowed, lineswritten);
+#endif				/* HAVE_THREADS */
+#ifdef HAVE_IO_URING
+	if (pv__transfer_uring_usable(state))
+		return pv__transfer_uring(state, fd, eof_in, eof_out, allowed, lineswritten);
+#endif				/* HAVE_IO_URING */
 
 	check_read_fd = -1;
 	check_write_fd = -1;
@@ -1217,9 +3238,68 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 		check_write_fd = state->control.output_fd;
 	}
 
+#ifdef HAVE_SPLICE
+	/*
+	 * With nothing in the buffer, the data would be copied within the
+	 * kernel, which writes it as well; so if the rate limit allows
+	 * nothing to be written yet, there is nothing to do until it does,
+	 * and the input being ready is no reason to stop waiting.
+	 */
+	if ((check_read_fd >= 0) && (state->control.rate_limit > 0) && (allowed <= 0)
+	    && (!state->control.no_splice) && (state->transfer.read_position == state->transfer.write_position)
+	    && (0 == state->fanout.count) && (0 == state->merge.count)) {
+		check_read_fd = -1;
+	}
+#endif				/* HAVE_SPLICE */
+
+	/*
+	 * Measure the time spent waiting with --stats, or once the display
+	 * is found to show it, as well as for --auto-buffer.
+	 */
+	if ((!state->transfer.instrumented)
+	    && (state->control.show_stats || state->display.showing_bottleneck
+		|| state->extra_display.showing_bottleneck)) {
+		state->transfer.instrumented = true;
+		state->transfer.instrumented_since = state->transfer.elapsed_seconds;
+	}
+
+	wait_usec = pv_transfer_wait_usec(state);
+
 	ready_to_read = false;
 	ready_to_write = false;
-	n = is_data_ready(check_read_fd, &ready_to_read, check_write_fd, &ready_to_write, 90000);
+	if (state->control.auto_buffer || state->transfer.instrumented) {
+		struct timespec wait_start, wait_end, wait_elapsed;
+
+		pv_elapsedtime_read(&wait_start);
+		n = pv__transfer_wait(state, check_read_fd, &ready_to_read, check_write_fd, &ready_to_write, wait_usec);
+		pv_elapsedtime_read(&wait_end);
+		pv_elapsedtime_subtract(&wait_elapsed, &wait_end, &wait_start);
+
+		/*
+		 * Only count the time as waiting if something we were
+		 * waiting for didn't become ready.  For --auto-buffer, a
+		 * full buffer counts as waiting for the output; but it
+		 * doesn't for the bottleneck measurements, since the
+		 * buffer is only full without the output being waited for
+		 * when the rate limit is holding the writes back.
+		 */
+		if ((!ready_to_read) || (!ready_to_write)) {
+			bool waiting_for_input, waiting_for_output;
+			long double waited;
+
+			waiting_for_input = (check_read_fd >= 0) && (!ready_to_read);
+			waiting_for_output = (check_write_fd >= 0) && (!ready_to_write);
+			waited = pv_elapsedtime_seconds(&wait_elapsed);
+
+			if (state->control.auto_buffer)
+				pv_autotune_note_wait(state, waiting_for_input,
+						      waiting_for_output || ((check_read_fd < 0) && (!(*eof_in))),
+						      waited);
+			pv_bottleneck_note_wait(state, waiting_for_input, waiting_for_output, waited);
+		}
+	} else {
+		n = pv__transfer_wait(state, check_read_fd, &ready_to_read, check_write_fd, &ready_to_write, wait_usec);
+	}
 
 	if (n < 0) {
 		/*
@@ -1252,7 +3332,29 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 	 * NB this can update state->transfer.written because of splice().
 	 */
 	if (ready_to_read) {
-		if (pv__transfer_read(state, fd, eof_in, eof_out, allowed) == 0) {
+		struct timespec read_start;
+		int read_result;
+
+		pv_elapsedtime_zero(&read_start);
+		if (state->transfer.instrumented)
+			pv_elapsedtime_read(&read_start);
+
+		read_result = pv__transfer_read(state, fd, eof_in, eof_out, allowed, lineswritten);
+
+#ifdef HAVE_SPLICE
+		/*
+		 * The input was ready, so if splice() took a while, it was
+		 * the output that it was waiting for.
+		 */
+		if (state->transfer.instrumented && state->transfer.splice_used) {
+			struct timespec read_end, read_elapsed;
+			pv_elapsedtime_read(&read_end);
+			pv_elapsedtime_subtract(&read_elapsed, &read_end, &read_start);
+			pv_bottleneck_note_wait(state, false, true, pv_elapsedtime_seconds(&read_elapsed));
+		}
+#endif				/* HAVE_SPLICE */
+
+		if (0 == read_result) {
 			debug("%s %d: %s (%s=%s, %s=%s, %s=%lu)", "fd", fd,
 			      "early return 0 - pv__transfer_read returned 0", "eof_in", eof_in ? "true" : "false",
 			      "eof_out", eof_out ? "true" : "false", "allowed", (unsigned long) allowed);
@@ -1260,21 +3362,8 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 		}
 	}
 
-	/*
-	 * In line mode, only write up to and including the last newline,
-	 * so that we're writing output line-by-line.
-	 */
-	if ((state->transfer.to_write > 0) && (state->control.linemode) && !(state->control.null_terminated_lines)) {
-		char *start;
-		char *end;
-
-		start = (char *) (state->transfer.transfer_buffer + state->transfer.write_position);
-		end = pv_memrchr(start, (int) '\n', (size_t) (state->transfer.to_write));
-
-		if (NULL != end) {
-			state->transfer.to_write = (ssize_t) ((end - start) + 1);
-		}
-	}
+	pv__transfer_trim_to_line(state);
+	buffered = pv__transfer_direct_trim(state, *eof_in);
 
 	/*
 	 * If there is data to write, and the output is ready to receive it,
@@ -1288,32 +3377,14 @@ ssize_t pv_transfer(pvstate_t state, int fd, bool *eof_in, bool *eof_out, off_t
 	    && (state->transfer.read_position > state->transfer.write_position)
 	    && (state->transfer.to_write > 0)
 	    && (NULL != lineswritten)) {
-		if (pv__transfer_write(state, eof_in, eof_out, lineswritten) == 0) {
+		if (pv__transfer_write(state, eof_in, eof_out, buffered, lineswritten) == 0) {
 			debug("%s %d: %s (%s=%s, %s=%s, %s=%lu)", "fd", fd,
 			      "early return 0 - pv__transfer_write returned 0", "eof_in", eof_in ? "true" : "false",
 			      "eof_out", eof_out ? "true" : "false", "lineswritten", (unsigned long) lineswritten);
 			return 0;
 		}
 	}
-#ifdef MAXIMISE_BUFFER_FILL
-	/*
-	 * Rotate the written bytes out of the buffer so that it can be
-	 * filled up completely by the next read.
-	 */
-	if (state->transfer.write_position > 0) {
-		if (state->transfer.write_position < state->transfer.read_position) {
-			memmove(state->transfer.transfer_buffer,
-				state->transfer.transfer_buffer +
-				state->transfer.write_position,
-				state->transfer.read_position - state->transfer.write_position);
-			state->transfer.read_position -= state->transfer.write_position;
-			state->transfer.write_position = 0;
-		} else {
-			state->transfer.write_position = 0;
-			state->transfer.read_position = 0;
-		}
-	}
-#endif				/* MAXIMISE_BUFFER_FILL */
+	pv__transfer_compact_buffer(state, fd);
 
 	if (0 == state->transfer.written) {
 		debug("%s %d: %s", "fd", fd, "end-of-function return 0 - transfer.written is zero");
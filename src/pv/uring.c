@@ -0,0 +1,290 @@
+/*
+ * Minimal io_uring submission and completion handling for the transfer
+ * engine, using the raw system calls so that no extra library is needed.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#ifdef HAVE_IO_URING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * An io_uring instance, with pointers into the shared submission and
+ * completion queue rings.
+ */
+struct pvuring_s {
+	int ring_fd;			 /* file descriptor of the ring */
+	unsigned int sq_entries;	 /* number of submission queue entries */
+	unsigned int to_submit;		 /* entries queued but not submitted */
+	/*@null@*/ void *sq_ring;	 /* mapped submission queue ring */
+	size_t sq_ring_size;		 /* size of the mapping */
+	/*@null@*/ void *cq_ring;	 /* mapped completion queue ring */
+	size_t cq_ring_size;		 /* size of the mapping, 0 if shared */
+	/*@null@*/ struct io_uring_sqe *sqes;	/* mapped submission entries */
+	size_t sqes_size;		 /* size of the mapping */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+
+/*
+ * Unmap and close everything in the given ring, and free it.
+ */
+void pv_uring_free( /*@only@ */ pvuring_t ring)
+{
+	if (NULL == ring)
+		return;
+	if (NULL != ring->sqes)
+		(void) munmap(ring->sqes, ring->sqes_size);
+	if ((NULL != ring->cq_ring) && (ring->cq_ring_size > 0))
+		(void) munmap(ring->cq_ring, ring->cq_ring_size);
+	if (NULL != ring->sq_ring)
+		(void) munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->ring_fd >= 0)
+		(void) close(ring->ring_fd);
+	free(ring);
+}
+
+
+/*
+ * Set up a new io_uring with room for at least "entries" submissions.
+ *
+ * Returns NULL, with errno set, if io_uring is not available, or if the
+ * kernel is too old to support the features we rely on (reads and writes
+ * at the current file position, and a timeout passed directly to
+ * io_uring_enter()).
+ */
+/*@null@ */
+/*@only@ */
+pvuring_t pv_uring_alloc(unsigned int entries)
+{
+	struct io_uring_params params;
+	pvuring_t ring;
+	long ring_fd;
+	char *sq_ptr;
+	char *cq_ptr;
+
+	ring = calloc(1, sizeof(*ring));
+	if (NULL == ring)
+		return NULL;
+
+	memset(&params, 0, sizeof(params));
+	ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring_fd < 0) {
+		debug("%s: %s", "io_uring_setup", strerror(errno));
+		free(ring);
+		return NULL;
+	}
+	ring->ring_fd = (int) ring_fd;
+
+	if ((0 == (params.features & IORING_FEAT_EXT_ARG))
+	    || (0 == (params.features & IORING_FEAT_RW_CUR_POS))) {
+		debug("%s: 0x%x", "io_uring features too limited", params.features);
+		pv_uring_free(ring);
+		errno = ENOSYS;
+		return NULL;
+	}
+
+	ring->sq_entries = params.sq_entries;
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	/*
+	 * With IORING_FEAT_SINGLE_MMAP, both rings live in one mapping;
+	 * cq_ring_size is zeroed so that pv_uring_free() won't unmap it
+	 * twice.
+	 */
+	if (0 != (params.features & IORING_FEAT_SINGLE_MMAP)) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = 0;
+	}
+
+	ring->sq_ring =
+	    mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+		 IORING_OFF_SQ_RING);
+	if (MAP_FAILED == ring->sq_ring) {
+		ring->sq_ring = NULL;
+		pv_uring_free(ring);
+		return NULL;
+	}
+
+	if (0 == ring->cq_ring_size) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring =
+		    mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+			 IORING_OFF_CQ_RING);
+		if (MAP_FAILED == ring->cq_ring) {
+			ring->cq_ring = NULL;
+			pv_uring_free(ring);
+			return NULL;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes =
+	    mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+		 IORING_OFF_SQES);
+	if (MAP_FAILED == ring->sqes) {
+		ring->sqes = NULL;
+		pv_uring_free(ring);
+		return NULL;
+	}
+
+	sq_ptr = (char *) (ring->sq_ring);
+	cq_ptr = (char *) (ring->cq_ring);
+
+	ring->sq_head = (unsigned int *) (sq_ptr + params.sq_off.head);
+	ring->sq_tail = (unsigned int *) (sq_ptr + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *) (sq_ptr + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *) (sq_ptr + params.sq_off.array);
+	ring->cq_head = (unsigned int *) (cq_ptr + params.cq_off.head);
+	ring->cq_tail = (unsigned int *) (cq_ptr + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *) (cq_ptr + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq_ptr + params.cq_off.cqes);
+
+	debug("%s: fd=%d, sq_entries=%u, cq_entries=%u, features=0x%x", "io_uring ready", ring->ring_fd,
+	      params.sq_entries, params.cq_entries, params.features);
+
+	return ring;
+}
+
+
+/*
+ * Queue a read (or, if "is_write" is true, a write) of "count" bytes
+ * between "buf" and "fd", tagged with "tag" so the completion can be
+ * identified.  If "offset" is negative, the file's current position is
+ * used and advanced, as with read() and write().
+ *
+ * Nothing is sent to the kernel until pv_uring_submit_and_wait().
+ *
+ * Returns false if the submission queue is full.
+ */
+bool pv_uring_queue_rw(pvuring_t ring, bool is_write, int fd, void *buf, size_t count, off_t offset,
+		       unsigned long tag)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail, head, index;
+
+	if (NULL == ring)
+		return false;
+
+	tail = *(ring->sq_tail);
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head >= ring->sq_entries)
+		return false;
+
+	index = tail & *(ring->sq_mask);
+	sqe = &(ring->sqes[index]);
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (__u8) (is_write ? IORING_OP_WRITE : IORING_OP_READ);
+	sqe->fd = fd;
+	sqe->addr = (__u64) (unsigned long) buf;
+	sqe->len = (__u32) count;
+	sqe->off = offset < 0 ? (__u64) - 1 : (__u64) offset;
+	sqe->user_data = (__u64) tag;
+
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+
+	return true;
+}
+
+
+/*
+ * Submit everything queued by pv_uring_queue_rw(), and wait up to
+ * "timeout_usec" microseconds for at least one completion.
+ *
+ * Returns 0 on success or timeout, or -1 on error with errno set.  An
+ * interruption by a signal counts as a timeout.
+ */
+int pv_uring_submit_and_wait(pvuring_t ring, long timeout_usec)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec timeout;
+	long result;
+
+	if (NULL == ring)
+		return -1;
+
+	memset(&timeout, 0, sizeof(timeout));
+	timeout.tv_sec = (__kernel_time64_t) (timeout_usec / 1000000);
+	timeout.tv_nsec = (long long) ((timeout_usec % 1000000) * 1000);
+
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (__u64) (unsigned long) (&timeout);
+
+	result =
+	    syscall(__NR_io_uring_enter, ring->ring_fd, ring->to_submit, 1,
+		    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (result >= 0) {
+		if ((unsigned int) result >= ring->to_submit) {
+			ring->to_submit = 0;
+		} else {
+			ring->to_submit -= (unsigned int) result;
+		}
+		return 0;
+	}
+
+	if ((ETIME == errno) || (EINTR == errno) || (EBUSY == errno) || (EAGAIN == errno))
+		return 0;
+
+	debug("%s: %s", "io_uring_enter", strerror(errno));
+	return -1;
+}
+
+
+/*
+ * Retrieve the next completion from the ring, if there is one, putting its
+ * tag into *tag and its result (bytes transferred, or a negated errno)
+ * into *result.
+ *
+ * Returns false if there are no more completions waiting.
+ */
+bool pv_uring_next_completion(pvuring_t ring, unsigned long *tag, long *result)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+
+	if (NULL == ring)
+		return false;
+
+	head = *(ring->cq_head);
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return false;
+
+	cqe = &(ring->cqes[head & *(ring->cq_mask)]);
+	*tag = (unsigned long) (cqe->user_data);
+	*result = (long) (cqe->res);
+
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+#endif				/* HAVE_IO_URING */
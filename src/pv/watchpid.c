@@ -30,21 +30,27 @@
 #include <libproc.h>
 #include <sys/proc_info.h>
 #endif
+#ifdef PV_WATCHFD_PIDFD
+#include <poll.h>
+#include <sys/syscall.h>
+#endif
 
 /*@-type@*/
 /* splint has trouble with off_t and mode_t. */
 
 /*
  * Set info->size to the size of the file info->file_fdpath points to,
- * assuming that info->sb_fd has been populated by stat(), or to 0 if the
- * file size could not be determined or the file was opened in write mode;
- * returns false if the file was not a block device or regular file.
+ * given "sb_fd" from stat() on it, or to 0 if the file size could not be
+ * determined or the file was opened in write mode; returns false if the
+ * file was not a block device or regular file.
  */
-static bool filesize(pvwatchfd_t info)
+static bool filesize(pvwatchfd_t info, const struct stat *sb_fd)
 {
 	if (NULL == info)
 		return false;
-	if (S_ISBLK(info->sb_fd.st_mode)) {
+	if (NULL == info->file_fdpath)
+		return false;
+	if (S_ISBLK(sb_fd->st_mode)) {
 		int fd;
 
 		/*
@@ -73,9 +79,9 @@ static bool filesize(pvwatchfd_t info)
 		} else {
 			info->size = 0;
 		}
-	} else if (S_ISREG(info->sb_fd.st_mode)) {
-		if ((info->sb_fd_link.st_mode & S_IWUSR) == 0) {
-			info->size = info->sb_fd.st_size;
+	} else if (S_ISREG(sb_fd->st_mode)) {
+		if ((info->fd_link_mode & S_IWUSR) == 0) {
+			info->size = sb_fd->st_size;
 		}
 	} else {
 		return false;
@@ -90,6 +96,7 @@ static bool filesize(pvwatchfd_t info)
 int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 {
 	struct vnode_fdinfowithpath vnodeInfo = { };
+	struct stat sb_fd;
 
 	if (NULL == state)
 		return -1;
@@ -111,19 +118,27 @@ int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 		return 3;
 	}
 
-	strlcpy(info->file_fdpath, vnodeInfo.pvip.vip_path, PV_SIZEOF_FILE_FDPATH);
+	if (NULL != info->file_fdpath)
+		free(info->file_fdpath);
+	info->file_fdpath = pv_strdup(vnodeInfo.pvip.vip_path);
+	if (NULL == info->file_fdpath)
+		return 2;
 
 	info->size = 0;
 
-	if (!(0 == stat(info->file_fdpath, &(info->sb_fd)))) {
+	memset(&sb_fd, 0, sizeof(sb_fd));
+	if (!(0 == stat(info->file_fdpath, &sb_fd))) {
 		if (!automatic)
 			pv_error("%s %u: %s %d: %s: %s",
 				 _("pid"),
 				 info->watch_pid, _("fd"), info->watch_fd, info->file_fdpath, strerror(errno));
 		return 3;
 	}
+	info->fd_dev = sb_fd.st_dev;
+	info->fd_ino = sb_fd.st_ino;
+	info->fd_link_mode = 0;
 
-	if (!filesize(info)) {
+	if (!filesize(info, &sb_fd)) {
 		if (!automatic)
 			pv_error("%s %u: %s %d: %s: %s",
 				 _("pid"),
@@ -137,6 +152,220 @@ int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 
 #else
 
+/*
+ * The fields of interest from a /proc/PID/fdinfo/FD file.
+ */
+struct pv__fdinfo_fields {
+	long long pos;
+	unsigned long long ino;
+	unsigned long mnt_id;
+	unsigned int accmode;
+	bool has_pos;
+	bool has_ino;
+};
+
+
+/*
+ * Number of fdinfo files currently held open, across all watched fds, and
+ * the most that may be held open at once, or 0 if that is not known yet.
+ */
+static unsigned int pv__fdinfo_held = 0;
+static unsigned int pv__fdinfo_hold_limit = 0;
+
+
+/*
+ * Return true if another fdinfo file may be held open, working out the
+ * limit from the descriptor limit the first time.
+ */
+static bool pv__fdinfo_may_hold(void)
+{
+	if (0 == pv__fdinfo_hold_limit) {
+		long open_max = -1;
+#if defined(HAVE_SYSCONF) && defined(_SC_OPEN_MAX)
+		open_max = sysconf(_SC_OPEN_MAX);
+#endif
+		if (open_max < 1)
+			open_max = 256;
+		if (open_max > 1048576)
+			open_max = 1048576;
+		pv__fdinfo_hold_limit = (unsigned int) (open_max / PV_WATCHFD_FDINFO_SHARE);
+		if (pv__fdinfo_hold_limit < 1)
+			pv__fdinfo_hold_limit = 1;
+		debug("%s: %u", "fdinfo files to hold open at most", pv__fdinfo_hold_limit);
+	}
+	return pv__fdinfo_held < pv__fdinfo_hold_limit ? true : false;
+}
+
+
+/*
+ * Close the fdinfo file held open for the given watchfd, if there is one.
+ */
+static void pv__watchfd_close_fdinfo(pvwatchfd_t info)
+{
+	if (!info->fdinfo_open)
+		return;
+	(void) close(info->fdinfo_fd);
+	info->fdinfo_fd = -1;
+	info->fdinfo_open = false;
+	if (pv__fdinfo_held > 0)
+		pv__fdinfo_held--;
+}
+
+
+/*
+ * Parse an unsigned number in the given base from the start of "text",
+ * stopping at the first character that isn't a digit.
+ */
+static unsigned long long pv__fdinfo_number(const char *text, unsigned int base)
+{
+	unsigned long long value;
+
+	value = 0;
+	while ('\0' != *text) {
+		unsigned int digit;
+		if ((*text < '0') || (*text > '9'))
+			break;
+		digit = (unsigned int) (*text - '0');
+		if (digit >= base)
+			break;
+		value = (value * base) + digit;
+		text++;
+	}
+
+	return value;
+}
+
+
+/*
+ * Return true if the last failure was from running out of descriptors,
+ * rather than from the fdinfo file having gone away.
+ */
+static bool pv__fdinfo_out_of_fds(int error)
+{
+	return ((EMFILE == error) || (ENFILE == error)) ? true : false;
+}
+
+
+/*
+ * Read the fdinfo of the given watchfd into "fields", opening the fdinfo
+ * file first if it isn't already being held open.  For a displayable fd,
+ * whose position is read at every update, the file stays open so that each
+ * subsequent read costs one pread(), since the kernel generates the
+ * contents afresh whenever it is read from the start - unless too many are
+ * already open.  Otherwise it is closed again after this read, so that
+ * fds that are only checked for changes, such as pipes and sockets, don't
+ * use up descriptors.
+ *
+ * Returns false if the fdinfo could not be read, which is what happens
+ * once the watched process has closed the fd, or has exited, or if we have
+ * run out of descriptors, which pv__fdinfo_out_of_fds(errno) tells apart.
+ */
+static bool pv__watchfd_read_fdinfo(pvwatchfd_t info, struct pv__fdinfo_fields *fields)
+{
+	char content[PV_SIZEOF_FDINFO_CONTENT];	/* flawfinder: ignore - bounded, terminated below */
+	ssize_t got;
+	char *line;
+	int fd;
+	bool hold;
+
+	memset(fields, 0, sizeof(*fields));
+
+	if (info->fdinfo_open) {
+		fd = info->fdinfo_fd;
+		hold = true;
+	} else {
+		char file_fdinfo[PV_SIZEOF_FILE_FD];	/* flawfinder: ignore - bounded with pv_snprintf() */
+		memset(file_fdinfo, 0, sizeof(file_fdinfo));
+		(void) pv_snprintf(file_fdinfo, sizeof(file_fdinfo), "/proc/%u/fdinfo/%d", info->watch_pid,
+				   info->watch_fd);
+		fd = open(file_fdinfo, O_RDONLY | O_CLOEXEC);	/* flawfinder: ignore */
+		/* flawfinder: trusted location (/proc). */
+		if (fd < 0) {
+			int open_error = errno;
+			if (pv__fdinfo_out_of_fds(open_error) && (pv__fdinfo_held > 0)
+			    && (pv__fdinfo_held < pv__fdinfo_hold_limit)) {
+				/* Hold no more fdinfo files open than we can already. */
+				debug("%s: %u", "out of descriptors - fdinfo files to hold open reduced to",
+				      pv__fdinfo_held);
+				pv__fdinfo_hold_limit = pv__fdinfo_held;
+			}
+			errno = open_error;
+			return false;
+		}
+		hold = info->displayable ? pv__fdinfo_may_hold() : false;
+		if (hold) {
+			info->fdinfo_fd = fd;
+			info->fdinfo_open = true;
+			pv__fdinfo_held++;
+		}
+	}
+
+	got = pread(fd, content, sizeof(content) - 1, 0);	/* flawfinder: ignore */
+	if (!hold)
+		(void) close(fd);
+	if (got <= 0) {
+		pv__watchfd_close_fdinfo(info);
+		errno = 0;
+		return false;
+	}
+	content[got] = '\0';
+
+	/*
+	 * Each line is "key:", whitespace, and a number.  Only the first few
+	 * lines are of interest; anything after them, such as the event
+	 * details of an epoll descriptor, may be cut off by the buffer size,
+	 * which doesn't matter.
+	 */
+	line = content;
+	while ('\0' != *line) {
+		char *value;
+		char *next;
+
+		next = strchr(line, '\n');
+		if (NULL != next)
+			*next = '\0';
+
+		value = strchr(line, ':');
+		if (NULL != value) {
+			*value = '\0';
+			value++;
+			while ((' ' == *value) || ('\t' == *value))
+				value++;
+			if (0 == strcmp(line, "pos")) {
+				fields->pos = (long long) pv__fdinfo_number(value, 10);
+				fields->has_pos = true;
+			} else if (0 == strcmp(line, "flags")) {
+				fields->accmode = (unsigned int) (pv__fdinfo_number(value, 8) & O_ACCMODE);
+			} else if (0 == strcmp(line, "mnt_id")) {
+				fields->mnt_id = (unsigned long) pv__fdinfo_number(value, 10);
+			} else if (0 == strcmp(line, "ino")) {
+				fields->ino = pv__fdinfo_number(value, 10);
+				fields->has_ino = true;
+			}
+		}
+
+		if (NULL == next)
+			break;
+		line = next + 1;
+	}
+
+	return true;
+}
+
+
+/*
+ * Record the fdinfo fields that later reads are compared against.
+ */
+static void pv__watchfd_record_fdinfo(pvwatchfd_t info, const struct pv__fdinfo_fields *fields)
+{
+	info->fdinfo_ino = fields->ino;
+	info->fdinfo_mnt_id = fields->mnt_id;
+	info->fdinfo_accmode = fields->accmode;
+	info->fdinfo_has_ino = fields->has_ino;
+	info->fdinfo_recorded = true;
+}
+
+
 /*
  * Fill in the given information structure with the file paths and stat
  * details of the given file descriptor within the given process (given
@@ -156,6 +385,10 @@ int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
  */
 int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 {
+	char file_fd[PV_SIZEOF_FILE_FD];	/* flawfinder: ignore - bounded with pv_snprintf() */
+	char file_fdpath[PV_SIZEOF_FILE_FDPATH];	/* flawfinder: ignore - see readlink() below */
+	struct stat sb_fd, sb_fd_link;
+
 	if (NULL == state)
 		return -1;
 	if (NULL == info)
@@ -166,12 +399,12 @@ int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 			pv_error("%s %u: %s", _("pid"), info->watch_pid, strerror(errno));
 		return 1;
 	}
-	(void) pv_snprintf(info->file_fdinfo, PV_SIZEOF_FILE_FDINFO,
-			   "/proc/%u/fdinfo/%d", info->watch_pid, info->watch_fd);
-	(void) pv_snprintf(info->file_fd, PV_SIZEOF_FILE_FD, "/proc/%u/fd/%d", info->watch_pid, info->watch_fd);
 
-	memset(info->file_fdpath, 0, PV_SIZEOF_FILE_FDPATH);
-	if (readlink(info->file_fd, info->file_fdpath, PV_SIZEOF_FILE_FDPATH - 1) < 0) {	/* flawfinder: ignore */
+	memset(file_fd, 0, sizeof(file_fd));
+	(void) pv_snprintf(file_fd, sizeof(file_fd), "/proc/%u/fd/%d", info->watch_pid, info->watch_fd);
+
+	memset(file_fdpath, 0, sizeof(file_fdpath));
+	if (readlink(file_fd, file_fdpath, sizeof(file_fdpath) - 1) < 0) {	/* flawfinder: ignore */
 		/*
 		 * flawfinder: memset() has put \0 at the end already, and
 		 * we tell readlink() to use 1 byte less than the buffer
@@ -186,18 +419,46 @@ int pv_watchfd_info(pvstate_t state, pvwatchfd_t info, bool automatic)
 		return 2;
 	}
 
-	if (!((0 == stat(info->file_fd, &(info->sb_fd)))
-	      && (0 == lstat(info->file_fd, &(info->sb_fd_link))))) {
+	/* Keep the path at its real length. */
+	if (NULL != info->file_fdpath)
+		free(info->file_fdpath);
+	info->file_fdpath = pv_strdup(file_fdpath);
+	if (NULL == info->file_fdpath)
+		return 2;
+
+	memset(&sb_fd, 0, sizeof(sb_fd));
+	memset(&sb_fd_link, 0, sizeof(sb_fd_link));
+	if (!((0 == stat(file_fd, &sb_fd))
+	      && (0 == lstat(file_fd, &sb_fd_link)))) {
 		if (!automatic)
 			pv_error("%s %u: %s %d: %s: %s",
 				 _("pid"),
 				 info->watch_pid, _("fd"), info->watch_fd, info->file_fdpath, strerror(errno));
 		return 3;
 	}
+	info->fd_dev = sb_fd.st_dev;
+	info->fd_ino = sb_fd.st_ino;
+	info->fd_link_mode = sb_fd_link.st_mode;
+
+	/*
+	 * Record what the fdinfo says about the fd now, so that later reads
+	 * of its position can tell whether the fd has been re-used for a
+	 * different file.  If it can't be read now, the first later read
+	 * that works is recorded instead - see pv__watchfd_fields_changed().
+	 */
+	pv__watchfd_close_fdinfo(info);
+	info->fdinfo_recorded = false;
+	{
+		struct pv__fdinfo_fields fields;
+		if (pv__watchfd_read_fdinfo(info, &fields))
+			pv__watchfd_record_fdinfo(info, &fields);
+	}
+	pv_elapsedtime_read(&(info->next_stat_check));
+	pv_elapsedtime_add_nsec(&(info->next_stat_check), 1000000000LL * PV_WATCHFD_STAT_INTERVAL);
 
 	info->size = 0;
 
-	if (!filesize(info)) {
+	if (!filesize(info, &sb_fd)) {
 		if (!automatic)
 			pv_error("%s %u: %s %d: %s: %s",
 				 _("pid"),
@@ -217,24 +478,25 @@ bool pv_watchfd_changed(pvwatchfd_t info)
 }
 #else
 /*
- * Return true if the given file descriptor has changed in some way since
- * we started looking at it (i.e. changed destination or permissions).
+ * Return true if stat() and lstat() on the fd's /proc symlink show that it
+ * has changed destination or permissions, or if they fail.
  */
-bool pv_watchfd_changed(pvwatchfd_t info)
+static bool pv__watchfd_stat_changed(pvwatchfd_t info)
 {
+	char file_fd[PV_SIZEOF_FILE_FD];	/* flawfinder: ignore - bounded with pv_snprintf() */
 	struct stat sb_fd, sb_fd_link;
 
-	if (NULL == info)
-		return false;
+	memset(file_fd, 0, sizeof(file_fd));
+	(void) pv_snprintf(file_fd, sizeof(file_fd), "/proc/%u/fd/%d", info->watch_pid, info->watch_fd);
 
 	memset(&sb_fd, 0, sizeof(sb_fd));
 	memset(&sb_fd_link, 0, sizeof(sb_fd_link));
 
-	if ((0 == stat(info->file_fd, &sb_fd))
-	    && (0 == lstat(info->file_fd, &sb_fd_link))) {
-		if ((sb_fd.st_dev != info->sb_fd.st_dev)
-		    || (sb_fd.st_ino != info->sb_fd.st_ino)
-		    || (sb_fd_link.st_mode != info->sb_fd_link.st_mode)
+	if ((0 == stat(file_fd, &sb_fd))
+	    && (0 == lstat(file_fd, &sb_fd_link))) {
+		if ((sb_fd.st_dev != info->fd_dev)
+		    || (sb_fd.st_ino != info->fd_ino)
+		    || (sb_fd_link.st_mode != info->fd_link_mode)
 		    ) {
 			return true;
 		}
@@ -244,6 +506,68 @@ bool pv_watchfd_changed(pvwatchfd_t info)
 
 	return false;
 }
+
+
+/*
+ * Return true if the fdinfo just read into "fields" shows that the fd has
+ * changed since we started looking at it, or if it is time for the less
+ * frequent stat() check and that shows a change.
+ *
+ * When the fdinfo includes the inode (Linux 5.14 onwards), comparing it,
+ * the mount ID, and the access mode catches the fd being closed and
+ * re-used for another file, so the stat() check is only done every
+ * PV_WATCHFD_STAT_INTERVAL seconds; otherwise it is done every time.
+ */
+static bool pv__watchfd_fields_changed(pvwatchfd_t info, const struct pv__fdinfo_fields *fields)
+{
+	struct timespec now;
+
+	/* Nothing to compare with yet - record these, and rely on stat(). */
+	if (!info->fdinfo_recorded) {
+		pv__watchfd_record_fdinfo(info, fields);
+		return pv__watchfd_stat_changed(info);
+	}
+
+	if ((fields->accmode != info->fdinfo_accmode) || (fields->mnt_id != info->fdinfo_mnt_id))
+		return true;
+	if (fields->has_ino != info->fdinfo_has_ino)
+		return true;
+	if (fields->has_ino && (fields->ino != info->fdinfo_ino))
+		return true;
+
+	if (fields->has_ino) {
+		memset(&now, 0, sizeof(now));
+		pv_elapsedtime_read(&now);
+		if (pv_elapsedtime_compare(&now, &(info->next_stat_check)) < 0)
+			return false;
+		pv_elapsedtime_copy(&(info->next_stat_check), &now);
+		pv_elapsedtime_add_nsec(&(info->next_stat_check), 1000000000LL * PV_WATCHFD_STAT_INTERVAL);
+	}
+
+	return pv__watchfd_stat_changed(info);
+}
+
+
+/*
+ * Return true if the given file descriptor has changed in some way since
+ * we started looking at it (i.e. changed destination or permissions).
+ */
+bool pv_watchfd_changed(pvwatchfd_t info)
+{
+	struct pv__fdinfo_fields fields;
+
+	if (NULL == info)
+		return false;
+
+	if (!pv__watchfd_read_fdinfo(info, &fields)) {
+		/* Out of descriptors - stat() doesn't need one. */
+		if (pv__fdinfo_out_of_fds(errno))
+			return pv__watchfd_stat_changed(info);
+		return true;
+	}
+
+	return pv__watchfd_fields_changed(info, &fields);
+}
 #endif
 
 
@@ -267,25 +591,29 @@ off_t pv_watchfd_position(pvwatchfd_t info)
 
 	position = (off_t) vnodeInfo.pfi.fi_offset;
 #else
-	long long pos_long;
-	FILE *fptr;
+	struct pv__fdinfo_fields fields;
 
 	if (NULL == info)
 		return -1;
 
-	if (pv_watchfd_changed(info))
+	if (!pv__watchfd_read_fdinfo(info, &fields)) {
+		/*
+		 * Out of descriptors - the fd hasn't been seen to close, so
+		 * unless stat() shows it has changed, keep the position it
+		 * was last seen at until there is a descriptor to read with.
+		 */
+		if (pv__fdinfo_out_of_fds(errno) && !pv__watchfd_stat_changed(info))
+			return info->position;
 		return -1;
+	}
 
-	fptr = fopen(info->file_fdinfo, "r");	/* flawfinder: ignore */
-	/* flawfinder: trusted location (/proc). */
-	if (NULL == fptr)
+	if (pv__watchfd_fields_changed(info, &fields))
 		return -1;
-	pos_long = -1;
-	position = -1;
-	if (1 == fscanf(fptr, "pos: %lld", &pos_long)) {
-		position = (off_t) pos_long;
-	}
-	(void) fclose(fptr);
+
+	if (!fields.has_pos)
+		return -1;
+
+	position = (off_t) fields.pos;
 #endif
 
 	/*
@@ -334,39 +662,44 @@ static int pidfds(pvstate_t state, unsigned int pid, struct proc_fdinfo **fds, i
  */
 
 /*
- * Extend the info array by one, returning false on error.
+ * Extend the info array, returning false on error.  The array grows by
+ * half as much again each time, so that a process with thousands of fds
+ * doesn't cause thousands of reallocations; the new entries are all
+ * marked as unused.
  */
 static bool extend_info_array(int *array_length_ptr, pvwatchfd_t *info_array_ptr)
 {
 	int array_length = 0;
+	int new_length;
 	struct pvwatchfd_s *info_array = NULL;
 	struct pvwatchfd_s *new_info_array;
+	int idx;
 
 	array_length = *array_length_ptr;
 	info_array = *info_array_ptr;
 
-	array_length++;
+	new_length = array_length + (array_length / 2);
+	if (new_length < array_length + 8)
+		new_length = array_length + 8;
 
 	if (NULL == info_array) {
-		new_info_array = malloc(array_length * sizeof(*info_array));
-		if (NULL != new_info_array)
-			memset(new_info_array, 0, array_length * sizeof(*info_array));
+		new_info_array = malloc(new_length * sizeof(*info_array));
 	} else {
-		new_info_array = realloc(info_array, array_length * sizeof(*info_array));
-		if (NULL != new_info_array)
-			memset(&(new_info_array[array_length - 1]), 0, sizeof(*info_array));
+		new_info_array = realloc(info_array, new_length * sizeof(*info_array));
 	}
 
 	if (NULL == new_info_array) {
 		return false;
 	}
 
-	new_info_array[array_length - 1].unused = true;
+	memset(&(new_info_array[array_length]), 0, (new_length - array_length) * sizeof(*info_array));
+	for (idx = array_length; idx < new_length; idx++)
+		new_info_array[idx].unused = true;
 
-	debug("%s", "extended info array");
+	debug("%s: %d -> %d", "extended info array", array_length, new_length);
 
 	*info_array_ptr = new_info_array;
-	*array_length_ptr = array_length;
+	*array_length_ptr = new_length;
 	return true;
 }
 
@@ -380,12 +713,12 @@ static bool extend_info_array(int *array_length_ptr, pvwatchfd_t *info_array_ptr
  */
 void pv_reset_watchfd(pvwatchfd_t info)
 {
-	if (NULL == info)
+	if ((NULL == info) || (NULL == info->shown))
 		return;
-	pv_reset_calc(&(info->calc));
-	pv_reset_transfer(&(info->transfer));
-	pv_reset_flags(&(info->flags));
-	pv_reset_display(&(info->display));
+	pv_reset_calc(&(info->shown->calc));
+	pv_reset_transfer(&(info->shown->transfer));
+	pv_reset_flags(&(info->shown->flags));
+	pv_reset_display(&(info->shown->display));
 }
 
 
@@ -396,9 +729,20 @@ void pv_freecontents_watchfd(pvwatchfd_t info)
 {
 	if (NULL == info)
 		return;
-	pv_freecontents_calc(&(info->calc));
-	pv_freecontents_transfer(&(info->transfer));
-	pv_freecontents_display(&(info->display));
+	if (NULL != info->shown) {
+		pv_freecontents_calc(&(info->shown->calc));
+		pv_freecontents_transfer(&(info->shown->transfer));
+		pv_freecontents_display(&(info->shown->display));
+		free(info->shown);
+		info->shown = NULL;
+	}
+	if (NULL != info->file_fdpath) {
+		free(info->file_fdpath);
+		info->file_fdpath = NULL;
+	}
+#ifndef __APPLE__
+	pv__watchfd_close_fdinfo(info);
+#endif
 }
 
 
@@ -535,9 +879,9 @@ int pv_watchpid_scanfds(pvstate_t state, pid_t watch_pid, int watch_fd, int *arr
 		if (use_idx < 0) {
 			if (!extend_info_array(array_length_ptr, info_array_ptr))
 				return 2;
+			use_idx = array_length;
 			array_length = *array_length_ptr;
 			info_array = *info_array_ptr;
-			use_idx = array_length - 1;
 		}
 
 		/* At this point, the array should exist. */
@@ -551,21 +895,17 @@ int pv_watchpid_scanfds(pvstate_t state, pid_t watch_pid, int watch_fd, int *arr
 		/*
 		 * Initialise the details of this new entry.
 		 */
+		pv_freecontents_watchfd(&(info_array[use_idx]));
 		memset(&(info_array[use_idx]), 0, sizeof(info_array[use_idx]));
 
-		pv_reset_watchfd(&(info_array[use_idx]));
 		info_array[use_idx].watch_pid = watch_pid;
 		info_array[use_idx].watch_fd = fd;
+#ifndef __APPLE__
+		info_array[use_idx].fdinfo_fd = -1;
+#endif
 		info_array[use_idx].closed = false;
 		info_array[use_idx].unused = false;
-		info_array[use_idx].displayable = true;
-
-		/*
-		 * Set the average rate window so that a new history buffer
-		 * is allocated for this state.
-		 */
-		(void) pv_update_calc_average_rate_window(&(info_array[use_idx].calc),
-							  state->control.average_rate_window);
+		info_array[use_idx].displayable = false;
 
 #ifdef __APPLE__
 		if (fd_infos[i].proc_fdtype != PROX_FDTYPE_VNODE) {
@@ -587,19 +927,35 @@ int pv_watchpid_scanfds(pvstate_t state, pid_t watch_pid, int watch_fd, int *arr
 		}
 
 		/*
-		 * Not displayable - mark it as such so the main loop
-		 * doesn't show it.
+		 * Not displayable - leave it marked as such so the main
+		 * loop doesn't show it; it is only checked for changes, so
+		 * it needs no display state.
 		 */
 		if (rc != 0) {
 			debug("%s %d: %s", "fd", fd, "marking as not displayable");
-			info_array[use_idx].displayable = false;
+			continue;
 		}
 
+		info_array[use_idx].shown = calloc(1, sizeof(*(info_array[use_idx].shown)));
+		if (NULL == info_array[use_idx].shown) {
+			pv_error("%s: %s", _("watchfd display allocation failed"), strerror(errno));
+			continue;
+		}
+		info_array[use_idx].displayable = true;
+		pv_reset_watchfd(&(info_array[use_idx]));
+
+		/*
+		 * Set the average rate window so that a new history buffer
+		 * is allocated for this state.
+		 */
+		(void) pv_update_calc_average_rate_window(&(info_array[use_idx].shown->calc),
+							  state->control.average_rate_window);
+
 		/* Set the info display_name appropriately. */
 		pv_watchpid_setname(state, &(info_array[use_idx]));
 
 		/* Force the display to be re-parsed. */
-		info_array[use_idx].flags.reparse_display = 1;
+		info_array[use_idx].shown->flags.reparse_display = 1;
 
 		pv_elapsedtime_read(&(info_array[use_idx].start_time));
 
@@ -608,11 +964,11 @@ int pv_watchpid_scanfds(pvstate_t state, pid_t watch_pid, int watch_fd, int *arr
 		 * display), if known, so that ETA and so on are calculated
 		 * correctly.
 		 */
-		info_array[use_idx].display.initial_offset = 0;
+		info_array[use_idx].shown->display.initial_offset = 0;
 		info_array[use_idx].position = 0;
 		position_now = pv_watchfd_position(&(info_array[use_idx]));
 		if (position_now >= 0) {
-			info_array[use_idx].display.initial_offset = position_now;
+			info_array[use_idx].shown->display.initial_offset = position_now;
 			info_array[use_idx].position = position_now;
 		}
 	}
@@ -651,13 +1007,15 @@ void pv_watchpid_setname(pvstate_t state, pvwatchfd_t info)
 	size_t path_length, cwd_length;
 	int max_display_length;
 	char *file_fdpath;
+	char *display_name;
 
-	if (NULL == info)
+	if ((NULL == info) || (NULL == info->shown) || (NULL == info->file_fdpath))
 		return;
 
 	file_fdpath = info->file_fdpath;
+	display_name = info->shown->display_name;
 
-	memset(info->display_name, 0, PV_SIZEOF_DISPLAY_NAME);
+	memset(display_name, 0, PV_SIZEOF_DISPLAY_NAME);
 
 	path_length = strlen(info->file_fdpath);	/* flawfinder: ignore */
 	cwd_length = strlen(state->status.cwd);	/* flawfinder: ignore */
@@ -674,11 +1032,11 @@ void pv_watchpid_setname(pvstate_t state, pvwatchfd_t info)
 		max_display_length -= 9;
 	if (max_display_length >= (int) path_length) {
 		if (state->watchfd.multiple_pids) {
-			(void) pv_snprintf(info->display_name,
+			(void) pv_snprintf(display_name,
 					   PV_SIZEOF_DISPLAY_NAME, "%8d:%4d:%.498s", (int) (info->watch_pid),
 					   info->watch_fd, file_fdpath);
 		} else {
-			(void) pv_snprintf(info->display_name,
+			(void) pv_snprintf(display_name,
 					   PV_SIZEOF_DISPLAY_NAME, "%4d:%.498s", info->watch_fd, file_fdpath);
 		}
 	} else {
@@ -688,13 +1046,13 @@ void pv_watchpid_setname(pvstate_t state, pvwatchfd_t info)
 		suffix_length = max_display_length - prefix_length - 3;
 
 		if (state->watchfd.multiple_pids) {
-			(void) pv_snprintf(info->display_name,
+			(void) pv_snprintf(display_name,
 					   PV_SIZEOF_DISPLAY_NAME,
 					   "%8d:%4d:%.*s...%.*s",
 					   (int) (info->watch_pid), info->watch_fd, prefix_length,
 					   file_fdpath, suffix_length, file_fdpath + path_length - suffix_length);
 		} else {
-			(void) pv_snprintf(info->display_name,
+			(void) pv_snprintf(display_name,
 					   PV_SIZEOF_DISPLAY_NAME,
 					   "%4d:%.*s...%.*s",
 					   info->watch_fd, prefix_length,
@@ -702,5 +1060,115 @@ void pv_watchpid_setname(pvstate_t state, pvwatchfd_t info)
 		}
 	}
 
-	debug("%s: %d: [%s]", "set name for fd", info->watch_fd, info->display_name);
+	debug("%s: %d: [%s]", "set name for fd", info->watch_fd, display_name);
+}
+
+
+/*
+ * Start tracking the process of the given whole-PID watched item, so that
+ * pv_watchpid_exited() can tell whether it has exited without looking in
+ * /proc, if pidfd_open() is available.
+ */
+void pv_watchpid_track(struct pvwatcheditem_s *item)
+{
+	item->pidfd_open = false;
+	item->pidfd = -1;
+	item->fd_count = 0;
+	item->rescan = true;
+#ifdef PV_WATCHFD_PIDFD
+	{
+		long rc;
+		rc = syscall(SYS_pidfd_open, item->pid, 0);
+		if (rc >= 0) {
+			item->pidfd = (int) rc;
+			item->pidfd_open = true;
+			(void) fcntl(item->pidfd, F_SETFD, FD_CLOEXEC);
+		} else {
+			debug("%s %d: %s: %s", "pid", (int) (item->pid), "pidfd_open failed", strerror(errno));
+		}
+	}
+#endif
+}
+
+
+/*
+ * Return true if the process of the given watched item is known to have
+ * exited, which is only possible to tell here if it has a pidfd - without
+ * one, the caller finds out when pv_watchpid_scanfds() fails.
+ */
+bool pv_watchpid_exited(struct pvwatcheditem_s *item)
+{
+#ifdef PV_WATCHFD_PIDFD
+	struct pollfd pfd;
+
+	if (!item->pidfd_open)
+		return false;
+
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = item->pidfd;
+	pfd.events = POLLIN;
+
+	/* A pidfd becomes readable when its process exits. */
+	if ((poll(&pfd, 1, 0) > 0) && (0 != (pfd.revents & (POLLIN | POLLHUP | POLLERR)))) {
+		debug("%s %d: %s", "pid", (int) (item->pid), "pidfd shows process has exited");
+		return true;
+	}
+#endif
+	return false;
+}
+
+
+/*
+ * Return true if the fds of the process of the given whole-PID watched
+ * item need to be rescanned with pv_watchpid_scanfds(), at time "now".
+ *
+ * On Linux 6.2 onwards, stat() on /proc/PID/fd reports the number of open
+ * fds as the size, so a scan is only needed when that changes, when one of
+ * the watched fds has closed (set by the caller in item->rescan, to catch
+ * an fd being closed and another being opened), or every
+ * PV_WATCHPID_RESCAN_INTERVAL seconds, in case of a change that leaves the
+ * count the same.  Without a count, every call returns true.
+ */
+bool pv_watchpid_rescan_due(struct pvwatcheditem_s *item, const struct timespec *now)
+{
+	off_t fd_count;
+
+	fd_count = 0;
+
+#ifndef __APPLE__
+	{
+		char fd_dir[512];	 /* flawfinder: ignore - zeroed, bounded with pv_snprintf(). */
+		struct stat sb;
+
+		memset(fd_dir, 0, sizeof(fd_dir));
+		memset(&sb, 0, sizeof(sb));
+		(void) pv_snprintf(fd_dir, sizeof(fd_dir), "/proc/%u/fd", item->pid);
+		if (0 == stat(fd_dir, &sb))
+			fd_count = sb.st_size;
+	}
+
+	if ((fd_count > 0) && (fd_count == item->fd_count) && (!item->rescan)
+	    && (pv_elapsedtime_compare(now, &(item->next_scan)) < 0))
+		return false;
+#endif
+
+	item->fd_count = fd_count;
+	item->rescan = false;
+	pv_elapsedtime_copy(&(item->next_scan), now);
+	pv_elapsedtime_add_nsec(&(item->next_scan), 1000000000LL * PV_WATCHPID_RESCAN_INTERVAL);
+
+	return true;
+}
+
+
+/*
+ * Release anything opened by pv_watchpid_track().
+ */
+void pv_watchpid_untrack(struct pvwatcheditem_s *item)
+{
+	if (!item->pidfd_open)
+		return;
+	(void) close(item->pidfd);
+	item->pidfd = -1;
+	item->pidfd_open = false;
 }
@@ -0,0 +1,199 @@
+/*
+ * Test program for libpv, run by tests/Library_-_libpv.test; it uses only
+ * the public interface in <libpv.h>.
+ *
+ * Usage: libpv-test MODE INPUTFILE OUTPUTFILE [RATE]
+ *
+ *   fd      copy INPUTFILE to OUTPUTFILE with libpv_transfer_fd()
+ *   buffer  read INPUTFILE into memory, and write it to OUTPUTFILE with
+ *           libpv_transfer_buffer()
+ *   reuse   do both of the above with the same handle, so that OUTPUTFILE
+ *           holds two copies of INPUTFILE
+ *   stop    like "fd", but call libpv_stop() from the first progress
+ *           update
+ *
+ * RATE, if given, is the rate limit in bytes per second.  The last
+ * progress update of each transfer is written to standard output as
+ * "status=N transferred=N size=N percentage=N updates=N finals=N".
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "libpv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+struct test_progress_s {
+	struct libpv_progress_s last;	/* most recent progress update */
+	unsigned long updates;		/* number of updates received */
+	unsigned long finals;		/* number of those that were final */
+	bool stop;			/* call libpv_stop() at the first update */
+	libpv_t handle;
+};
+
+
+/*
+ * Record a progress update.
+ */
+static void test_progress(const struct libpv_progress_s *progress, void *userdata)
+{
+	struct test_progress_s *record = (struct test_progress_s *) userdata;
+
+	record->last = *progress;
+	record->updates++;
+	if (progress->final)
+		record->finals++;
+	if (record->stop)
+		libpv_stop(record->handle);
+}
+
+
+/*
+ * Read all of "filename" into a newly allocated buffer, storing its length
+ * in "*length"; returns NULL on error.
+ */
+static char *test_read_file(const char *filename, size_t *length)
+{
+	struct stat sb;
+	char *buffer;
+	size_t got;
+	int fd;
+
+	fd = open(filename, O_RDONLY);	/* flawfinder: ignore */
+	if (fd < 0)
+		return NULL;
+	if ((0 != fstat(fd, &sb)) || (sb.st_size < 0)) {
+		(void) close(fd);
+		return NULL;
+	}
+
+	buffer = malloc((size_t) (sb.st_size) + 1);
+	if (NULL == buffer) {
+		(void) close(fd);
+		return NULL;
+	}
+
+	got = 0;
+	while (got < (size_t) (sb.st_size)) {
+		ssize_t nread = read(fd, buffer + got, (size_t) (sb.st_size) - got);	/* flawfinder: ignore */
+		if (nread <= 0)
+			break;
+		got += (size_t) nread;
+	}
+	(void) close(fd);
+
+	*length = got;
+	return buffer;
+}
+
+
+/*
+ * Run one transfer and report on it, returning its status.
+ */
+static int test_transfer(libpv_t handle, struct test_progress_s *record, const char *mode, const char *input,
+			 int output_fd)
+{
+	int status;
+
+	record->updates = 0;
+	record->finals = 0;
+	memset(&(record->last), 0, sizeof(record->last));
+
+	if (0 == strcmp(mode, "buffer")) {
+		char *buffer;
+		size_t length = 0;
+
+		buffer = test_read_file(input, &length);
+		if (NULL == buffer) {
+			fprintf(stderr, "%s: %s\n", input, strerror(errno));
+			return 99;
+		}
+		status = libpv_transfer_buffer(handle, buffer, length, output_fd);
+		free(buffer);
+	} else {
+		int input_fd;
+
+		input_fd = open(input, O_RDONLY);	/* flawfinder: ignore */
+		if (input_fd < 0) {
+			fprintf(stderr, "%s: %s\n", input, strerror(errno));
+			return 99;
+		}
+		status = libpv_transfer_fd(handle, input_fd, output_fd);
+		/* The descriptor must still be ours to close. */
+		if (0 != close(input_fd)) {
+			fprintf(stderr, "%s: %s\n", "input descriptor closed by libpv", strerror(errno));
+			status |= 128;
+		}
+	}
+
+	printf("status=%d transferred=%lld size=%lld percentage=%.0f updates=%lu finals=%lu\n", status,
+	       record->last.transferred, record->last.size, record->last.percentage, record->updates,
+	       record->finals);
+
+	return status;
+}
+
+
+int main(int argc, char **argv)
+{
+	struct test_progress_s record;
+	libpv_t handle;
+	int output_fd, status;
+
+	if (argc < 4) {
+		fprintf(stderr, "Usage: %s fd|buffer|reuse|stop INPUTFILE OUTPUTFILE [RATE]\n", argv[0]);
+		return 99;
+	}
+
+	/* As the library documentation says, a closed output must not kill us. */
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	output_fd = open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0600);	/* flawfinder: ignore */
+	if (output_fd < 0) {
+		fprintf(stderr, "%s: %s\n", argv[3], strerror(errno));
+		return 99;
+	}
+
+	handle = libpv_new("libpv-test");
+	if (NULL == handle) {
+		fprintf(stderr, "%s\n", "libpv_new failed");
+		return 99;
+	}
+
+	memset(&record, 0, sizeof(record));
+	record.handle = handle;
+	record.stop = (0 == strcmp(argv[1], "stop"));
+
+	libpv_set_interval(handle, 0.1);
+	libpv_set_progress(handle, test_progress, &record);
+	if (argc > 4)
+		libpv_set_rate_limit(handle, atoll(argv[4]));
+
+	if (0 == strcmp(argv[1], "reuse")) {
+		status = test_transfer(handle, &record, "fd", argv[2], output_fd);
+		status |= test_transfer(handle, &record, "buffer", argv[2], output_fd);
+	} else {
+		status = test_transfer(handle, &record, argv[1], argv[2], output_fd);
+	}
+
+	libpv_free(handle);
+
+	if (0 != close(output_fd)) {
+		fprintf(stderr, "%s: %s\n", "output descriptor closed by libpv", strerror(errno));
+		status |= 128;
+	}
+
+	return 0 == status ? 0 : 1;
+}
@@ -0,0 +1,530 @@
+/*
+ * Microbenchmarks of the functions that run on every display update or
+ * every block transferred, for "make check-perf".
+ *
+ * Each benchmark is timed as the best of several runs, and its time per
+ * operation is divided by that of a fixed calibration loop, so that the
+ * resulting score is roughly comparable between hosts.  The scores are
+ * compared against the baselines in a file of "NAME SCORE" lines, and the
+ * exit status is 1 if any is more than the tolerance above its baseline.
+ *
+ * Usage: microbench [-b BASELINEFILE] [-t PERCENT] [-w] [NAME...]
+ *
+ *   -b FILE     the baseline file to compare with, or with -w, to write
+ *   -t PERCENT  how far above its baseline a score may be (default 100)
+ *   -w          write the scores to the baseline file instead of comparing
+ *   NAME...     only run these benchmarks
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+#include "pv.h"
+#include "pv-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+#define BENCH_RUNS		15		/* runs per benchmark, best is kept */
+#define BENCH_ATTEMPTS		3		/* scores taken before a regression counts */
+#define BENCH_RUN_SECONDS	0.01		/* minimum duration of each run */
+#define BENCH_DATA_SIZE		(size_t) 1048576 /* bytes scanned per data operation */
+#define BENCH_MAX_BASELINES	64		/* most baseline file entries read */
+
+
+/*
+ * Everything the benchmarks work on, set up once by bench_setup().
+ */
+struct bench_context_s {
+	/*@only@*/ pvstate_t state;
+	/*@only@*/ char *text;			/* lines of text, for the line scanner */
+	/*@only@*/ char *zeroes;		/* zeroed block, for the sparse check */
+	struct pvwatchfd_s watchfd;		/* one of our own descriptors */
+	/*@null@*/ FILE *watch_file;		/* the file that descriptor is open on */
+	long double amount;
+	unsigned long counter;
+	volatile unsigned long sink;		/* results, so nothing is optimised out */
+};
+
+typedef void (*bench_function_t)(struct bench_context_s *, unsigned long);
+
+struct bench_s {
+	const char *name;
+	const char *description;
+	bench_function_t function;
+};
+
+
+/*
+ * The calibration loop: a fixed amount of dependent integer arithmetic.
+ */
+static void bench_calibrate(struct bench_context_s *ctx, unsigned long iterations)
+{
+	unsigned long value = ctx->sink | 1;
+	unsigned long idx, step;
+
+	for (idx = 0; idx < iterations; idx++) {
+		for (step = 0; step < 1000; step++) {
+			value ^= value << 13;
+			value ^= value >> 7;
+			value ^= value << 17;
+		}
+	}
+	ctx->sink = value;
+}
+
+
+/*
+ * pv_format() with the default format string, as for each display update.
+ *
+ * The transfer goes round the same 1000 updates of a 10GiB transfer at
+ * 100MiB/s, so that the work done per call doesn't depend on how many
+ * iterations are run.
+ */
+static void bench_format_default(struct bench_context_s *ctx, unsigned long iterations)
+{
+	pvstate_t state = ctx->state;
+	unsigned long idx;
+
+	for (idx = 0; idx < iterations; idx++) {
+		unsigned long update = (ctx->counter++) % 1000;
+		state->transfer.elapsed_seconds = 0.1 * (long double) update;
+		state->transfer.transferred = (off_t) (10485760 * update);
+		state->calc.transfer_rate = 104857600.0L + (long double) (update * 1000);
+		state->calc.average_rate = 104857600.0L;
+		state->calc.percentage = 100.0 * (double) update / 1000.0;
+		(void) pv_format(&(state->status), &(state->control), &(state->transfer), &(state->calc),
+				 state->control.format_string, &(state->display), false, false);
+		ctx->sink += (unsigned long) (state->display.display_string_bytes);
+	}
+}
+
+
+/*
+ * pv_describe_amount(), as used by the byte, rate, and average rate
+ * formatters, with amounts spanning the SI prefixes.
+ */
+static void bench_describe_amount(struct bench_context_s *ctx, unsigned long iterations)
+{
+	char buffer[64];		 /* flawfinder: ignore - only written by pv_describe_amount() */
+	unsigned long idx;
+
+	for (idx = 0; idx < iterations; idx++) {
+		ctx->amount = ctx->amount * 1.37L + 1.0L;
+		if (ctx->amount > 1.0e15L)
+			ctx->amount = 1.0L;
+		pv_describe_amount(buffer, sizeof(buffer), "%s", ctx->amount, "", "/s", PV_TRANSFERCOUNT_BYTES);
+		ctx->sink += (unsigned long) (buffer[0]);
+	}
+}
+
+
+/*
+ * pv_calculate_transfer_rate(), as for each display update.
+ */
+static void bench_calculate_rate(struct bench_context_s *ctx, unsigned long iterations)
+{
+	pvstate_t state = ctx->state;
+	unsigned long idx;
+
+	for (idx = 0; idx < iterations; idx++) {
+		state->transfer.transferred += (off_t) (1048576 + (idx & 65535));
+		state->transfer.elapsed_seconds += 0.1;
+		pv_calculate_transfer_rate(&(state->calc), &(state->transfer), &(state->control), &(state->display),
+					   false);
+		ctx->sink += (unsigned long) (state->calc.transfer_rate);
+	}
+}
+
+
+/*
+ * The line scanner used when writing in line mode: counting the
+ * separators in each block, and finding the last ones, over 1MiB of
+ * 80-byte lines per operation.
+ */
+static void bench_line_scan(struct bench_context_s *ctx, unsigned long iterations)
+{
+	unsigned long idx;
+
+	for (idx = 0; idx < iterations; idx++) {
+		const char *last;
+		ctx->sink += (unsigned long) pv_memcount(ctx->text, (int) '\n', BENCH_DATA_SIZE);
+		last = pv_memrchr(ctx->text, (int) '\n', BENCH_DATA_SIZE);
+		if (NULL != last)
+			ctx->sink += (unsigned long) (last - ctx->text);
+	}
+}
+
+
+/*
+ * The sparse output zero check, over 1MiB of zeroes per operation.
+ */
+static void bench_sparse_zero(struct bench_context_s *ctx, unsigned long iterations)
+{
+	unsigned long idx;
+
+	for (idx = 0; idx < iterations; idx++) {
+		if (pv_is_zero(ctx->zeroes, BENCH_DATA_SIZE))
+			ctx->sink++;
+	}
+}
+
+
+/*
+ * pv_watchfd_position() of one of our own descriptors, as done for each
+ * watched descriptor on each update with --watchfd.
+ */
+static void bench_watchfd_position(struct bench_context_s *ctx, unsigned long iterations)
+{
+	unsigned long idx;
+
+	for (idx = 0; idx < iterations; idx++) {
+		ctx->sink += (unsigned long) pv_watchfd_position(&(ctx->watchfd));
+	}
+}
+
+
+static struct bench_s benchmarks[] = {
+	{ "calibrate", "calibration loop", bench_calibrate },
+	{ "format_default", "pv_format() with the default format", bench_format_default },
+	{ "describe_amount", "pv_describe_amount()", bench_describe_amount },
+	{ "calculate_rate", "pv_calculate_transfer_rate()", bench_calculate_rate },
+	{ "line_scan", "line mode separator scan, per MiB", bench_line_scan },
+	{ "sparse_zero", "sparse output zero check, per MiB", bench_sparse_zero },
+	{ "watchfd_position", "pv_watchfd_position()", bench_watchfd_position },
+	{ NULL, NULL, NULL }
+};
+
+
+/*
+ * Set up everything the benchmarks need, returning false on error.
+ */
+static bool bench_setup(struct bench_context_s *ctx)
+{
+	pvformatoptions_s format_options;
+	size_t offset;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->amount = 1.0L;
+
+	ctx->state = pv_state_alloc();
+	if (NULL == ctx->state)
+		return false;
+
+	/* The default display, as if run with no display options. */
+	memset(&format_options, 0, sizeof(format_options));
+	format_options.progress = true;
+	format_options.timer = true;
+	format_options.eta = true;
+	format_options.rate = true;
+	format_options.bytes = true;
+	pv_state_set_format_options(ctx->state, format_options);
+	pv_state_width_set(ctx->state, 80, true);
+	pv_state_size_set(ctx->state, (off_t) 10737418240LL);
+	pv_state_interval_set(ctx->state, 1);
+	pv_state_average_rate_window_set(ctx->state, 30);
+
+	/* Parse the format once, as the first display update would. */
+	(void) pv_format(&(ctx->state->status), &(ctx->state->control), &(ctx->state->transfer),
+			 &(ctx->state->calc), ctx->state->control.format_string, &(ctx->state->display), true, false);
+
+	ctx->text = malloc(BENCH_DATA_SIZE);
+	ctx->zeroes = calloc(1, BENCH_DATA_SIZE);
+	if ((NULL == ctx->text) || (NULL == ctx->zeroes))
+		return false;
+	for (offset = 0; offset < BENCH_DATA_SIZE; offset++)
+		ctx->text[offset] = (79 == offset % 80) ? '\n' : (char) ('a' + offset % 26);
+
+	/*
+	 * Watch a temporary file of our own, as a displayed fd, so that
+	 * its fdinfo file is held open as it would be for the display.
+	 */
+	ctx->watch_file = tmpfile();
+	if (NULL == ctx->watch_file)
+		return false;
+	memset(&(ctx->watchfd), 0, sizeof(ctx->watchfd));
+	ctx->watchfd.watch_pid = getpid();
+	ctx->watchfd.watch_fd = fileno(ctx->watch_file);
+#ifndef __APPLE__
+	ctx->watchfd.fdinfo_fd = -1;
+#endif
+	ctx->watchfd.displayable = true;
+	if (0 != pv_watchfd_info(ctx->state, &(ctx->watchfd), false))
+		return false;
+
+	return true;
+}
+
+
+/*
+ * Free what bench_setup() allocated.
+ */
+static void bench_teardown(struct bench_context_s *ctx)
+{
+	pv_freecontents_watchfd(&(ctx->watchfd));
+	if (NULL != ctx->watch_file)
+		(void) fclose(ctx->watch_file);
+	if (NULL != ctx->text)
+		free(ctx->text);
+	if (NULL != ctx->zeroes)
+		free(ctx->zeroes);
+	if (NULL != ctx->state)
+		pv_state_free(ctx->state);
+}
+
+
+/*
+ * Return the time taken by "iterations" iterations of "function".
+ */
+static long double bench_time(struct bench_context_s *ctx, bench_function_t function, unsigned long iterations)
+{
+	struct timespec start_time, end_time, taken;
+
+	pv_elapsedtime_read(&start_time);
+	function(ctx, iterations);
+	pv_elapsedtime_read(&end_time);
+	pv_elapsedtime_subtract(&taken, &end_time, &start_time);
+
+	return pv_elapsedtime_seconds(&taken);
+}
+
+
+/*
+ * Return the best time per operation of "function", in nanoseconds, from
+ * BENCH_RUNS runs which each take at least BENCH_RUN_SECONDS.
+ */
+static long double bench_run(struct bench_context_s *ctx, bench_function_t function)
+{
+	unsigned long iterations;
+	long double best, taken;
+	int run;
+
+	/* Find how many iterations take long enough to time. */
+	iterations = 1;
+	while (iterations < 1000000000UL) {
+		taken = bench_time(ctx, function, iterations);
+		if (taken >= BENCH_RUN_SECONDS)
+			break;
+		iterations *= (taken < BENCH_RUN_SECONDS / 10.0) ? 10 : 2;
+	}
+
+	best = -1;
+	for (run = 0; run < BENCH_RUNS; run++) {
+		taken = bench_time(ctx, function, iterations);
+		if ((best < 0) || (taken < best))
+			best = taken;
+	}
+
+	return 1000000000.0L * best / (long double) iterations;
+}
+
+
+/*
+ * Return the score of "function": its time per operation divided by that
+ * of the calibration loop, which is timed either side of it and the faster
+ * kept, so that the score reflects the speed the host was running at while
+ * the benchmark ran.  The times are also put in "*nanoseconds" and
+ * "*calibration_ns".
+ */
+static double bench_score(struct bench_context_s *ctx, bench_function_t function, long double *nanoseconds,
+			  long double *calibration_ns)
+{
+	long double after_ns;
+
+	*calibration_ns = bench_run(ctx, bench_calibrate);
+	*nanoseconds = bench_run(ctx, function);
+	after_ns = bench_run(ctx, bench_calibrate);
+	if (after_ns < *calibration_ns)
+		*calibration_ns = after_ns;
+	if (*calibration_ns <= 0)
+		*calibration_ns = 1;
+
+	return (double) (*nanoseconds / *calibration_ns);
+}
+
+
+/*
+ * Look up benchmark "name" in the "count" baselines read, returning its
+ * score, or -1 if there isn't one.
+ */
+static double bench_baseline(const char *name, char names[][64], const double *scores, int count)
+{
+	int idx;
+	for (idx = 0; idx < count; idx++) {
+		if (0 == strcmp(names[idx], name))
+			return scores[idx];
+	}
+	return -1;
+}
+
+
+int main(int argc, char **argv)
+{
+	struct bench_context_s ctx;
+	char baseline_names[BENCH_MAX_BASELINES][64];	/* flawfinder: ignore - bounded by sscanf() */
+	double baseline_scores[BENCH_MAX_BASELINES];
+	int baseline_count, bench_idx, argidx, regressions;
+	const char *baseline_file;
+	long double best_calibration_ns;
+	double tolerance;
+	bool write_baseline;
+	FILE *fptr;
+
+	baseline_file = NULL;
+	tolerance = 100;
+	write_baseline = false;
+
+	for (argidx = 1; argidx < argc; argidx++) {
+		if ((0 == strcmp(argv[argidx], "-b")) && (argidx + 1 < argc)) {
+			baseline_file = argv[++argidx];
+		} else if ((0 == strcmp(argv[argidx], "-t")) && (argidx + 1 < argc)) {
+			tolerance = atof(argv[++argidx]);
+		} else if (0 == strcmp(argv[argidx], "-w")) {
+			write_baseline = true;
+		} else if ('-' == argv[argidx][0]) {
+			fprintf(stderr, "%s: %s: %s\n", argv[0], argv[argidx], "unknown option");
+			return 2;
+		} else {
+			break;
+		}
+	}
+
+	if (write_baseline && (NULL == baseline_file)) {
+		fprintf(stderr, "%s: %s\n", argv[0], "-w needs -b FILE");
+		return 2;
+	}
+
+	/* Read the baselines, unless they are to be written. */
+	baseline_count = 0;
+	if ((NULL != baseline_file) && !write_baseline) {
+		char line[256];		 /* flawfinder: ignore - bounded by fgets() */
+		fptr = fopen(baseline_file, "r");	/* flawfinder: ignore - file given by the caller */
+		if (NULL == fptr) {
+			fprintf(stderr, "%s: %s: %s\n", argv[0], baseline_file, strerror(errno));
+			return 2;
+		}
+		while ((baseline_count < BENCH_MAX_BASELINES) && (NULL != fgets(line, (int) (sizeof(line)), fptr))) {
+			if ('#' == line[0])
+				continue;
+			if (2 == sscanf(line, "%63s %lf", baseline_names[baseline_count],
+					&(baseline_scores[baseline_count])))
+				baseline_count++;
+		}
+		(void) fclose(fptr);
+	}
+
+	if (!bench_setup(&ctx)) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], "setup failed", strerror(errno));
+		bench_teardown(&ctx);
+		return 2;
+	}
+
+	best_calibration_ns = -1;
+
+	fptr = NULL;
+	if (write_baseline) {
+		fptr = fopen(baseline_file, "w");	/* flawfinder: ignore - file given by the caller */
+		if (NULL == fptr) {
+			fprintf(stderr, "%s: %s: %s\n", argv[0], baseline_file, strerror(errno));
+			bench_teardown(&ctx);
+			return 2;
+		}
+		fprintf(fptr, "%s\n%s\n%s\n", "# Baselines for \"make check-perf\" (see tests/microbench.c): the time",
+			"# per operation of each benchmark, divided by that of the calibration",
+			"# loop.  Regenerate with \"make check-perf-baseline\".");
+	}
+
+	printf("%-18s %14s %10s %10s  %s\n", "benchmark", "ns/op", "score", "baseline", "result");
+
+	regressions = 0;
+	for (bench_idx = 1; NULL != benchmarks[bench_idx].name; bench_idx++) {
+		long double nanoseconds;
+		double score, baseline;
+		int attempt;
+		const char *result;
+
+		if (argidx < argc) {
+			int nameidx;
+			bool wanted = false;
+			for (nameidx = argidx; nameidx < argc; nameidx++) {
+				if (0 == strcmp(argv[nameidx], benchmarks[bench_idx].name))
+					wanted = true;
+			}
+			if (!wanted)
+				continue;
+		}
+
+		/*
+		 * A score can be thrown out by other activity on the host, so
+		 * take the best of BENCH_ATTEMPTS when writing baselines, and
+		 * only count a regression if it is seen that many times over.
+		 */
+		baseline = -1;
+		if (NULL == fptr)
+			baseline = bench_baseline(benchmarks[bench_idx].name, baseline_names, baseline_scores,
+						  baseline_count);
+		score = -1;
+		nanoseconds = 0;
+		for (attempt = 0; attempt < BENCH_ATTEMPTS; attempt++) {
+			long double attempt_ns, calibration_ns;
+			double attempt_score;
+
+			attempt_score = bench_score(&ctx, benchmarks[bench_idx].function, &attempt_ns, &calibration_ns);
+			if ((best_calibration_ns < 0) || (calibration_ns < best_calibration_ns))
+				best_calibration_ns = calibration_ns;
+			if ((score < 0) || (attempt_score < score)) {
+				score = attempt_score;
+				nanoseconds = attempt_ns;
+			}
+			if ((NULL == fptr) && ((baseline < 0) || (score <= baseline * (1.0 + tolerance / 100.0))))
+				break;
+		}
+
+		if (NULL != fptr) {
+			fprintf(fptr, "%s\t%.4f\n", benchmarks[bench_idx].name, score);
+			result = "written";
+			baseline = score;
+		} else {
+			if (baseline < 0) {
+				result = "no baseline";
+			} else if (score > baseline * (1.0 + tolerance / 100.0)) {
+				result = "REGRESSION";
+				regressions++;
+			} else {
+				result = "ok";
+			}
+		}
+
+		if (baseline < 0) {
+			printf("%-18s %14.1Lf %10.4f %10s  %s (%s)\n", benchmarks[bench_idx].name, nanoseconds,
+			       score, "-", result, benchmarks[bench_idx].description);
+		} else {
+			printf("%-18s %14.1Lf %10.4f %10.4f  %s (%s)\n", benchmarks[bench_idx].name, nanoseconds,
+			       score, baseline, result, benchmarks[bench_idx].description);
+		}
+	}
+
+	if (best_calibration_ns > 0)
+		printf("%-18s %14.1Lf\n", benchmarks[0].name, best_calibration_ns);
+
+	if (NULL != fptr)
+		(void) fclose(fptr);
+
+	bench_teardown(&ctx);
+
+	if (regressions > 0) {
+		printf("%d %s %.0f%%\n", regressions, "benchmarks were slower than their baseline by more than",
+		       tolerance);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Read error injection, loaded with LD_PRELOAD by
+ * tests/Transfer_-_--error-map_read_errors.test.
+ *
+ * Reads of the file named by PV_TEST_READFAIL_FILE fail with EIO wherever
+ * they would touch the bytes from offset PV_TEST_READFAIL_START up to, but
+ * not including, PV_TEST_READFAIL_END.  A read that starts before that
+ * area stops short at its start, as it would on a damaged disk.
+ *
+ * copy_file_range() from that file always fails with EXDEV, so that the
+ * data is read with read() instead.
+ *
+ * Copyright 2026 Andrew Wood
+ *
+ * License GPLv3+: GNU GPL version 3 or later; see `docs/COPYING'.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+/*
+ * Return true if "fd" is the file whose reads are to fail.
+ */
+static bool readfail_target(int fd)
+{
+	static bool checked = false;
+	static struct stat target;
+	struct stat sb;
+	const char *filename;
+
+	if (!checked) {
+		checked = true;
+		filename = getenv("PV_TEST_READFAIL_FILE");	/* flawfinder: ignore */
+		/* flawfinder - only used to find the file to fail reads on. */
+		if ((NULL == filename) || (0 != stat(filename, &target)))
+			target.st_ino = 0;
+	}
+
+	if (0 == target.st_ino)
+		return false;
+	if (0 != fstat(fd, &sb))
+		return false;
+
+	return (sb.st_dev == target.st_dev) && (sb.st_ino == target.st_ino);
+}
+
+
+/*
+ * Return the value of the offset in environment variable "name", or -1 if
+ * it is not set.
+ */
+static off_t readfail_offset(const char *name)
+{
+	const char *value;
+
+	value = getenv(name);			    /* flawfinder: ignore */
+	/* flawfinder - only parsed as a number. */
+	if (NULL == value)
+		return -1;
+
+	return (off_t) strtoll(value, NULL, 10);
+}
+
+
+ssize_t read(int fd, void *buf, size_t count)	/* flawfinder: ignore */
+{
+	static ssize_t (*real_read)(int, void *, size_t) = NULL;
+
+	if (NULL == real_read) {
+		*(void **) (&real_read) = dlsym(RTLD_NEXT, "read");
+		if (NULL == real_read) {
+			errno = ENOSYS;
+			return -1;
+		}
+	}
+
+	if ((count > 0) && readfail_target(fd)) {
+		off_t offset, bad_start, bad_end;
+
+		offset = lseek(fd, 0, SEEK_CUR);
+		bad_start = readfail_offset("PV_TEST_READFAIL_START");
+		bad_end = readfail_offset("PV_TEST_READFAIL_END");
+
+		if ((offset >= 0) && (bad_start >= 0) && (bad_end > bad_start)) {
+			if ((offset >= bad_start) && (offset < bad_end)) {
+				errno = EIO;
+				return -1;
+			}
+			if ((offset < bad_start) && ((off_t) count > bad_start - offset))
+				count = (size_t) (bad_start - offset);
+		}
+	}
+
+	return real_read(fd, buf, count);	/* flawfinder: ignore */
+}
+
+
+#ifdef HAVE_COPY_FILE_RANGE
+ssize_t copy_file_range(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)
+{
+	static ssize_t (*real_copy_file_range)(int, loff_t *, int, loff_t *, size_t, unsigned int) = NULL;
+
+	if (readfail_target(fd_in)) {
+		errno = EXDEV;
+		return -1;
+	}
+
+	if (NULL == real_copy_file_range) {
+		*(void **) (&real_copy_file_range) = dlsym(RTLD_NEXT, "copy_file_range");
+		if (NULL == real_copy_file_range) {
+			errno = ENOSYS;
+			return -1;
+		}
+	}
+
+	return real_copy_file_range(fd_in, off_in, fd_out, off_out, len, flags);
+}
+#endif				/* HAVE_COPY_FILE_RANGE */